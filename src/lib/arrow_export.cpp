@@ -0,0 +1,538 @@
+/**
+ *	@file arrow_export.cpp
+ * 	@brief decoded reports exported as Apache Arrow IPC streams
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	bool on_report(tsip &gps, void *ctx) {
+ * 		return ((arrow_writer *)ctx)->append(gps);
+ * 	}
+ *
+ * 	arrow_writer out;
+ * 	out.open("secondary.arrows", REPORT_SUPER, REPORT_SUPER_SECONDARY_TIME);
+ * 	reactor.add(gps, on_report, &out);
+ * 	...
+ * 	out.close();
+ * @endcode
+ *
+ * The stream is the Arrow IPC streaming format (columnar format 1.0,
+ * metadata version V5): each message is the continuation marker
+ * 0xFFFFFFFF, the length of its flatbuffer metadata, the metadata
+ * padded to 8 bytes, then the body of the message.
+ *
+ */
+
+#include "arrow_export.h"
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// column types besides the FIELD_ types of report_stream.h
+#define FIELD_U64			6		// generation
+#define FIELD_TIMESTAMP		7		// received, ns since the epoch
+
+// Arrow flatbuffer enumerations, see Schema.fbs and Message.fbs
+#define ARROW_METADATA_V5		4
+#define ARROW_HEADER_SCHEMA		1
+#define ARROW_HEADER_BATCH		3
+#define ARROW_TYPE_INT			2
+#define ARROW_TYPE_FLOAT		3
+#define ARROW_TYPE_TIMESTAMP	10
+#define ARROW_FLOAT_SINGLE		1
+#define ARROW_FLOAT_DOUBLE		2
+#define ARROW_UNIT_NANOSECOND	3
+
+#define ARROW_CONTINUATION		0xFFFFFFFF
+
+static const UINT8 zeros[ARROW_ALIGNMENT] = {0};
+
+/*
+*   Flatbuffers written front to back: a table is preceded by its
+*   vtable, and the objects it refers to are written after it, so
+*   every offset points forward as the format requires.  Offsets are
+*   written as 0 and patched once their object is written.
+*/
+
+// field of a flatbuffer table
+struct fb_field_t {
+	int id;					// in the schema of the table
+	int size;				// bytes, 1, 2, 4 or 8
+	unsigned long long value;	// scalar, 0 for an offset
+	size_t *at;				// receives the position of the field, for offsets
+};
+
+static void fb_put(std::vector<UINT8> &b, unsigned long long value, int size) {
+	UINT8 bytes[8];
+	memcpy(bytes, &value, sizeof(bytes));	// little endian host
+	b.insert(b.end(), bytes, bytes + size);
+}
+
+static void fb_align(std::vector<UINT8> &b, size_t align, size_t ahead) {
+	while ((b.size() + ahead) % align != 0) {
+		b.push_back(0);
+	}
+}
+
+/** fb patch
+*
+*   Point the offset at position at to the object at target.
+*
+*   @param std::vector<UINT8>&  flatbuffer
+*   @param size_t               position of the offset
+*   @param size_t               position of the object
+*/
+static void fb_patch(std::vector<UINT8> &b, size_t at, size_t target) {
+	UINT32 offset = target - at;
+	memcpy(&b[at], &offset, sizeof(offset));
+}
+
+/** fb table
+*
+*   Write a vtable and its table, the fields in decreasing size so all
+*   are aligned once the table fields start 8 byte aligned.
+*
+*   @param std::vector<UINT8>&  flatbuffer
+*   @param fb_field_t*          fields
+*   @param int                  count of fields
+*   @return size_t              position of the table
+*/
+static size_t fb_table(std::vector<UINT8> &b, fb_field_t *fields, int count) {
+	UINT16 slot[16] = {0};
+	int slots = 0;
+	int size = 4;			// soffset to the vtable
+
+	for (int width=8; width>=1; width/=2) {
+		for (int i=0; i<count; i++) {
+			if (fields[i].size == width) {
+				slot[fields[i].id] = size;
+				size += width;
+			}
+		}
+	}
+	for (int i=0; i<count; i++) {
+		if (fields[i].id + 1 > slots) {
+			slots = fields[i].id + 1;
+		}
+	}
+	int vtable_size = 4 + 2 * slots;
+
+	fb_align(b, 8, vtable_size + 4);
+	size_t vtable = b.size();
+	fb_put(b, vtable_size, 2);
+	fb_put(b, size, 2);
+	for (int i=0; i<slots; i++) {
+		fb_put(b, slot[i], 2);
+	}
+	size_t table = b.size();
+	fb_put(b, table - vtable, 4);
+	for (int width=8; width>=1; width/=2) {
+		for (int i=0; i<count; i++) {
+			if (fields[i].size == width) {
+				if (fields[i].at != NULL) {
+					*fields[i].at = b.size();
+				}
+				fb_put(b, fields[i].value, width);
+			}
+		}
+	}
+	return table;
+}
+
+/** fb vector
+*
+*   Write the length of a vector, aligned for its elements, which the
+*   caller writes next.
+*
+*   @param std::vector<UINT8>&  flatbuffer
+*   @param size_t               count of elements
+*   @param size_t               alignment of the elements
+*   @return size_t              position of the vector
+*/
+static size_t fb_vector(std::vector<UINT8> &b, size_t count, size_t align) {
+	fb_align(b, align < 4 ? 4 : align, 4);
+	size_t vector = b.size();
+	fb_put(b, count, 4);
+	return vector;
+}
+
+static size_t fb_string(std::vector<UINT8> &b, const std::string &text) {
+	size_t string = fb_vector(b, text.size(), 1);
+	b.insert(b.end(), text.begin(), text.end());
+	b.push_back(0);
+	return string;
+}
+
+/** fb message
+*
+*   Start the flatbuffer of a Message after the 8 bytes of its prefix.
+*
+*   @param std::vector<UINT8>&  cleared, receives the prefix and the Message
+*   @param int                  ARROW_HEADER_ type
+*   @param size_t               bytes of the body
+*   @return size_t              position of the header offset, to patch
+*/
+static size_t fb_message(std::vector<UINT8> &b, int type, size_t body_length) {
+	size_t header = 0;
+	size_t root = 8;
+
+	b.clear();
+	fb_put(b, ARROW_CONTINUATION, 4);
+	fb_put(b, 0, 4);				// metadata length, set by write_message
+	fb_put(b, 0, 4);				// root offset
+	fb_field_t message[] = {
+		{0, 2, ARROW_METADATA_V5, NULL},	// version
+		{1, 1, (unsigned long long)type, NULL},	// header_type
+		{2, 4, 0, &header},			// header
+		{3, 8, body_length, NULL},	// bodyLength
+	};
+	fb_patch(b, root, fb_table(b, message, 4));
+	return header;
+}
+
+/** column width
+*
+*   @param int  FIELD_ type
+*   @return int bytes per row
+*/
+static int column_width(int type) {
+	switch (type) {
+		case FIELD_U8:			return 1;
+		case FIELD_U16:			return 2;
+		case FIELD_S16:			return 2;
+		case FIELD_U32:			return 4;
+		case FIELD_F32:			return 4;
+		default:				return 8;
+	}
+}
+
+/** fb column
+*
+*   Write the Field of a column, with its type table.
+*
+*   @param std::vector<UINT8>&  flatbuffer
+*   @param std::string&         name
+*   @param int                  FIELD_ type
+*   @return size_t              position of the Field
+*/
+static size_t fb_column(std::vector<UINT8> &b, const std::string &name, int type) {
+	size_t name_at = 0, type_at = 0, children_at = 0, timezone_at = 0;
+	int type_type;
+
+	switch (type) {
+		case FIELD_F32:
+		case FIELD_F64:			type_type = ARROW_TYPE_FLOAT;		break;
+		case FIELD_TIMESTAMP:	type_type = ARROW_TYPE_TIMESTAMP;	break;
+		default:				type_type = ARROW_TYPE_INT;			break;
+	}
+	fb_field_t field[] = {
+		{0, 4, 0, &name_at},		// name
+		{1, 1, 0, NULL},			// nullable
+		{2, 1, (unsigned long long)type_type, NULL},
+		{3, 4, 0, &type_at},		// type
+		{5, 4, 0, &children_at},	// children, empty but required
+	};
+	size_t table = fb_table(b, field, 5);
+	fb_patch(b, name_at, fb_string(b, name));
+	fb_patch(b, children_at, fb_vector(b, 0, 4));
+
+	if (type_type == ARROW_TYPE_FLOAT) {
+		fb_field_t precision[] = {
+			{0, 2, (unsigned long long)(type == FIELD_F32 ? ARROW_FLOAT_SINGLE : ARROW_FLOAT_DOUBLE), NULL},
+		};
+		fb_patch(b, type_at, fb_table(b, precision, 1));
+	} else if (type_type == ARROW_TYPE_TIMESTAMP) {
+		fb_field_t timestamp[] = {
+			{0, 2, ARROW_UNIT_NANOSECOND, NULL},	// unit
+			{1, 4, 0, &timezone_at},				// timezone
+		};
+		fb_patch(b, type_at, fb_table(b, timestamp, 2));
+		fb_patch(b, timezone_at, fb_string(b, "UTC"));
+	} else {
+		fb_field_t integer[] = {
+			{0, 4, (unsigned long long)column_width(type) * 8, NULL},	// bitWidth
+			{1, 1, type == FIELD_S16, NULL},						// is_signed
+		};
+		fb_patch(b, type_at, fb_table(b, integer, 2));
+	}
+	return table;
+}
+
+/** arrow writer
+*
+*   @param size_t  rows of a record batch, buffers are allocated by open
+*   @param int     seconds, by the report stamps, between the first row
+*                  of a batch and the row that writes it, 0 - full batches only
+*/
+arrow_writer::arrow_writer(size_t batch_rows, int flush_seconds) {
+	m_fd = -1;
+	m_layout = NULL;
+	m_bit = 0;
+	m_batch_rows = batch_rows > 0 ? batch_rows : 1;
+	m_rows = 0;
+	m_flush_ns = flush_seconds > 0 ? flush_seconds * 1000000000ULL : 0;
+	m_oldest = 0;
+	m_failed = false;
+	m_written = 0;
+	m_batches = 0;
+}
+
+arrow_writer::~arrow_writer() {
+	if (m_fd >= 0) {
+		close();
+	}
+}
+
+/** open
+*
+*   Create the stream of a report, allocate the column buffers and
+*   write the schema.
+*
+*   @param std::string&  path, created or truncated
+*   @param int           report code
+*   @param int           report subcode, of a super packet
+*   @return bool         false - no layout for the report, or the file failed
+*/
+bool arrow_writer::open(const std::string &path, int code, int subcode) {
+	if (m_fd >= 0) {
+		close();
+	}
+	m_layout = report_stream::get_layout(code, subcode);
+	if (m_layout == NULL) {
+		fprintf(stderr, "arrow_writer: no layout for report %02X-%02X\n", code, subcode);
+		return false;
+	}
+	m_bit = tsip::report_bit(code, subcode);
+
+	m_columns.clear();
+	m_columns.push_back({"generation", FIELD_U64, 8, -1, {}});
+	m_columns.push_back({"received", FIELD_TIMESTAMP, 8, -1, {}});
+	for (int i=0; i<m_layout->count; i++) {
+		const stream_field_t &field = m_layout->fields[i];
+		// the NDJSON key without its quotes and colon
+		m_columns.push_back({std::string(field.key + 1, field.key_length - 3), field.type,
+				column_width(field.type), field.offset, {}});
+	}
+	for (size_t i=0; i<m_columns.size(); i++) {
+		m_columns[i].data.resize(m_batch_rows * m_columns[i].width);
+	}
+	m_rows = 0;
+	m_failed = false;
+	m_written = 0;
+	m_batches = 0;
+
+	m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (m_fd < 0) {
+		perror(path.c_str());
+		return false;
+	}
+
+	// Message { Schema { fields: [Field] } }
+	size_t fields_at = 0;
+	size_t header_at = fb_message(m_metadata, ARROW_HEADER_SCHEMA, 0);
+	fb_field_t schema[] = {
+		{0, 2, 0, NULL},			// endianness, little
+		{1, 4, 0, &fields_at},		// fields
+	};
+	fb_patch(m_metadata, header_at, fb_table(m_metadata, schema, 2));
+	size_t vector = fb_vector(m_metadata, m_columns.size(), 4);
+	fb_patch(m_metadata, fields_at, vector);
+	for (size_t i=0; i<m_columns.size(); i++) {
+		fb_put(m_metadata, 0, 4);
+	}
+	for (size_t i=0; i<m_columns.size(); i++) {
+		size_t element = vector + 4 + 4 * i;
+		fb_patch(m_metadata, element, fb_column(m_metadata, m_columns[i].name, m_columns[i].type));
+	}
+	return write_message(0);
+}
+
+/** append
+*
+*   Copy the report just decoded into the next row of the columns,
+*   when it is the report of the stream, and write the batch once full
+*   or once its first row is flush_seconds older than this one.
+*
+*   @param tsip&  decoder, from the report handler
+*   @return bool  false - the stream failed
+*/
+bool arrow_writer::append(tsip &gps) {
+	if (m_fd < 0 || m_failed) {
+		return false;
+	}
+	if (tsip::report_bit(gps.m_report.report.code, gps.m_report.extended.subcode) != m_bit) {
+		return true;
+	}
+	const struct _report_stamp *stamp = gps.get_stamp(m_bit);
+	if (stamp == NULL || stamp->generation != gps.get_generation()) {
+		return true;			// not stored as its type
+	}
+	const UINT8 *report = (const UINT8 *)m_layout->report(gps);
+	unsigned long long received = stamp->received.tv_sec * 1000000000ULL + stamp->received.tv_nsec;
+
+	for (size_t i=0; i<m_columns.size(); i++) {
+		column_t &column = m_columns[i];
+		UINT8 *row = &column.data[m_rows * column.width];
+		if (column.type == FIELD_U64) {
+			memcpy(row, &stamp->generation, 8);
+		} else if (column.type == FIELD_TIMESTAMP) {
+			memcpy(row, &received, 8);
+		} else {
+			memcpy(row, report + column.offset, column.width);
+		}
+	}
+	if (m_rows == 0) {
+		m_oldest = received;
+	}
+	if (++m_rows == m_batch_rows || (m_flush_ns > 0 && received - m_oldest >= m_flush_ns)) {
+		return flush();
+	}
+	return true;
+}
+
+/** flush
+*
+*   Write the rows appended since the last batch as a record batch.
+*
+*   @return bool  false - the write failed
+*/
+bool arrow_writer::flush() {
+	if (m_fd < 0 || m_failed) {
+		return false;
+	}
+	if (m_rows == 0) {
+		return true;
+	}
+
+	// Message { RecordBatch { length, nodes: [FieldNode], buffers: [Buffer] } }
+	size_t body = 0;
+	for (size_t i=0; i<m_columns.size(); i++) {
+		size_t length = m_rows * m_columns[i].width;
+		body += (length + ARROW_ALIGNMENT - 1) / ARROW_ALIGNMENT * ARROW_ALIGNMENT;
+	}
+	size_t nodes_at = 0, buffers_at = 0;
+	size_t header_at = fb_message(m_metadata, ARROW_HEADER_BATCH, body);
+	fb_field_t batch[] = {
+		{0, 8, m_rows, NULL},		// length
+		{1, 4, 0, &nodes_at},		// nodes
+		{2, 4, 0, &buffers_at},		// buffers
+	};
+	fb_patch(m_metadata, header_at, fb_table(m_metadata, batch, 3));
+	fb_patch(m_metadata, nodes_at, fb_vector(m_metadata, m_columns.size(), 8));
+	for (size_t i=0; i<m_columns.size(); i++) {
+		fb_put(m_metadata, m_rows, 8);	// length
+		fb_put(m_metadata, 0, 8);		// null_count
+	}
+	fb_patch(m_metadata, buffers_at, fb_vector(m_metadata, 2 * m_columns.size(), 8));
+	size_t offset = 0;
+	for (size_t i=0; i<m_columns.size(); i++) {
+		size_t length = m_rows * m_columns[i].width;
+		fb_put(m_metadata, offset, 8);	// validity, none without nulls
+		fb_put(m_metadata, 0, 8);
+		fb_put(m_metadata, offset, 8);	// values
+		fb_put(m_metadata, length, 8);
+		offset += (length + ARROW_ALIGNMENT - 1) / ARROW_ALIGNMENT * ARROW_ALIGNMENT;
+	}
+	if (!write_message(body)) {
+		return false;
+	}
+	m_written += m_rows;
+	m_batches++;
+	m_rows = 0;
+	return true;
+}
+
+/** close
+*
+*   Write the last batch and the end of stream marker.
+*
+*   @return bool  false - a write failed
+*/
+bool arrow_writer::close() {
+	if (m_fd < 0) {
+		return false;
+	}
+	bool ok = flush();
+	if (ok) {
+		m_metadata.clear();
+		fb_put(m_metadata, ARROW_CONTINUATION, 4);
+		fb_put(m_metadata, 0, 4);
+		m_columns.clear();		// no body
+		ok = write_message(0);
+	}
+	if (::close(m_fd) < 0) {
+		perror("arrow_writer");
+		ok = false;
+	}
+	m_fd = -1;
+	m_columns.clear();
+	return ok;
+}
+
+unsigned long long arrow_writer::get_rows() {
+	return m_written;
+}
+
+unsigned long long arrow_writer::get_batches() {
+	return m_batches;
+}
+
+/** write message
+*
+*   Pad the metadata in m_metadata, set its length in the prefix, and
+*   write it with the body of m_rows rows of the columns.
+*
+*   @param size_t  bytes of the body, 0 - none
+*   @return bool   false - the write failed
+*/
+bool arrow_writer::write_message(size_t body) {
+	if (m_metadata.size() > 8) {
+		fb_align(m_metadata, ARROW_ALIGNMENT, 0);
+		UINT32 length = m_metadata.size() - 8;
+		memcpy(&m_metadata[4], &length, sizeof(length));
+	}
+
+	std::vector<struct iovec> &iov = m_iov;
+	iov.clear();
+	iov.push_back({&m_metadata[0], m_metadata.size()});
+	for (size_t i=0; body > 0 && i<m_columns.size(); i++) {
+		size_t length = m_rows * m_columns[i].width;
+		size_t padding = (ARROW_ALIGNMENT - length % ARROW_ALIGNMENT) % ARROW_ALIGNMENT;
+		iov.push_back({&m_columns[i].data[0], length});
+		if (padding > 0) {
+			iov.push_back({(void *)zeros, padding});
+		}
+	}
+
+	// writev may stop short, e.g. on a full pipe
+	size_t first = 0;
+	while (first < iov.size()) {
+		int count = iov.size() - first < IOV_MAX ? iov.size() - first : IOV_MAX;
+		ssize_t n = ::writev(m_fd, &iov[first], count);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("arrow_writer");
+			m_failed = true;
+			return false;
+		}
+		while (first < iov.size() && (size_t)n >= iov[first].iov_len) {
+			n -= iov[first].iov_len;
+			first++;
+		}
+		if (n > 0) {
+			iov[first].iov_base = (UINT8 *)iov[first].iov_base + n;
+			iov[first].iov_len -= n;
+		}
+	}
+	return true;
+}
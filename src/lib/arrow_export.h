@@ -0,0 +1,90 @@
+/*
+  arrow_export.h - decoded reports exported as Apache Arrow IPC streams.
+
+  An arrow_writer writes one report type, 8F-AB say, as an Arrow IPC
+  stream: the schema, then record batches of ARROW_BATCH_ROWS rows,
+  then the end of stream marker.  A batch is also written once its
+  oldest row is ARROW_FLUSH_SECONDS old, so a report sent once a
+  second reaches the file within minutes rather than after a day.
+  Dataframe tools read the file without parsing it, pyarrow with
+  pa.ipc.open_stream(), and may map it in memory:
+
+    arrow_writer primary;
+    primary.open("primary.arrows", REPORT_SUPER, REPORT_SUPER_PRIMARY_TIME);
+    ...                                     // from the report handler
+    primary.append(gps);                    // other reports are skipped
+    ...
+    primary.close();
+
+  The columns are generation (uint64) and received (timestamp, ns,
+  UTC) from the report stamp, then the fields of the report in the
+  layout of report_stream.h, with the same names and types.  Each
+  column is a buffer allocated once for a whole batch; append() copies
+  the fields of the report structure straight into them, no row object
+  is made.  A batch is written with one writev, its buffers as they
+  are.
+
+  The Arrow metadata is flatbuffers, written here by a minimal encoder
+  for the few tables needed (Message, Schema, Field, Int,
+  FloatingPoint, Timestamp, RecordBatch), so neither the Arrow nor the
+  flatbuffers library is needed.  Columns have no nulls and are little
+  endian, as the host must be.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _arrow_export_h
+#define _arrow_export_h
+
+#include <tsip.h>
+#include <report_stream.h>
+#include <sys/uio.h>
+#include <vector>
+
+#define ARROW_BATCH_ROWS		65536	// rows per record batch
+#define ARROW_FLUSH_SECONDS		60		// age of the oldest row that writes the batch
+#define ARROW_ALIGNMENT			8		// of messages and buffers in the stream
+
+class arrow_writer {
+	public:
+		arrow_writer(size_t batch_rows=ARROW_BATCH_ROWS, int flush_seconds=ARROW_FLUSH_SECONDS);
+		~arrow_writer(void);
+		// create path and write the schema of the report, see get_layout
+		bool open(const std::string &path, int code, int subcode);
+		bool append(tsip &gps);			// false - a batch could not be written
+		bool flush(void);				// write the rows appended as a batch
+		bool close(void);				// flush and end the stream
+		unsigned long long get_rows(void);	// written
+		unsigned long long get_batches(void);
+
+	private:
+		struct column_t {
+			std::string name;
+			int type;					// FIELD_ type, FIELD_TIMESTAMP, FIELD_U64
+			int width;					// bytes per row
+			int offset;					// of the field in the report, -1 - stamp
+			std::vector<UINT8> data;	// batch_rows * width
+		};
+
+		int m_fd;
+		const stream_layout_t *m_layout;
+		int m_bit;						// of the report, see tsip::report_bit
+		size_t m_batch_rows;
+		size_t m_rows;					// in the current batch
+		unsigned long long m_flush_ns;	// age of the oldest row that writes the batch, 0 - none
+		unsigned long long m_oldest;	// received of the first row of the batch, ns
+		std::vector<column_t> m_columns;
+		std::vector<UINT8> m_metadata;	// prefix and flatbuffers of the message written
+		std::vector<struct iovec> m_iov;
+		bool m_failed;
+		unsigned long long m_written;
+		unsigned long long m_batches;
+
+		bool write_message(size_t body);	// m_metadata, then the columns when body > 0
+};
+
+#endif
@@ -0,0 +1,265 @@
+/*
+ * arrow_test.cpp
+ *
+ * Test of the Arrow IPC stream export, run by ctest.  8F-AB packets
+ * are decoded and appended to an arrow_writer of 1000 row batches that
+ * flushes after one second: five rows, a pause, one more row writes a
+ * batch of six, two more are written by close.  The file is then read
+ * back by a minimal flatbuffers reader: the Schema message with its
+ * field names, the two RecordBatch messages with their row counts and
+ * the seconds_of_week column, and the end of stream marker.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "tsip.h"
+#include "arrow_export.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#define TEST_BATCH_ROWS		1000
+#define TEST_FLUSH_SECONDS	1
+#define TEST_FIRST_SECOND	100000
+
+// Arrow flatbuffer enumerations, see Message.fbs
+#define ARROW_HEADER_SCHEMA		1
+#define ARROW_HEADER_BATCH		3
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL line %d: %s\n", __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+// big endian fields of a TSIP packet body
+static void put_be(std::vector<UINT8> &body, const void *value, int size) {
+	for (int i=size-1; i>=0; i--) {
+		body.push_back(((const UINT8 *)value)[i]);
+	}
+}
+
+/** feed primary
+*
+*   Decode an 8F-AB, framed and with its DLE bytes stuffed.
+*
+*   @return void
+*/
+static void feed_primary(tsip &gps, UINT32 seconds_of_week) {
+	std::vector<UINT8> b = {REPORT_SUPER, REPORT_SUPER_PRIMARY_TIME};
+	std::vector<UINT8> frame;
+	UINT16 week = 2300;
+	SINT16 offset = 18;
+	UINT16 year = 2026;
+
+	put_be(b, &seconds_of_week, 4);
+	put_be(b, &week, 2);
+	put_be(b, &offset, 2);
+	b.insert(b.end(), {3, 40, 30, 12, 19, 10});
+	put_be(b, &year, 2);
+
+	frame.push_back(0x10);
+	for (size_t i=0; i<b.size(); i++) {
+		frame.push_back(b[i]);
+		if (b[i] == 0x10) {
+			frame.push_back(0x10);
+		}
+	}
+	frame.push_back(0x10);
+	frame.push_back(0x03);
+	gps.encode(&frame[0], frame.size(), NULL, NULL);
+}
+
+/*
+*   Flatbuffers read back: a table starts with the signed offset back to
+*   its vtable, which holds the offset of each field in the table, 0 for
+*   a field not written.  Offsets to objects are unsigned and forward.
+*/
+
+static unsigned long long get_le(const std::vector<UINT8> &b, size_t at, int size) {
+	unsigned long long value = 0;
+
+	if (at + size <= b.size()) {
+		memcpy(&value, &b[at], size);		// little endian host
+	}
+	return value;
+}
+
+/** fb field
+*
+*   @param std::vector<UINT8>&  flatbuffer
+*   @param size_t               position of the table
+*   @param int                  field id
+*   @return size_t              position of the field, 0 - not written
+*/
+static size_t fb_field(const std::vector<UINT8> &b, size_t table, int id) {
+	size_t vtable = table - (SINT32)get_le(b, table, 4);
+	size_t vtable_size = get_le(b, vtable, 2);
+
+	if (4 + 2 * (size_t)id >= vtable_size) {
+		return 0;
+	}
+	size_t offset = get_le(b, vtable + 4 + 2 * id, 2);
+	return offset == 0 ? 0 : table + offset;
+}
+
+// the object an offset field points to
+static size_t fb_deref(const std::vector<UINT8> &b, size_t at) {
+	return at + get_le(b, at, 4);
+}
+
+static std::string fb_string(const std::vector<UINT8> &b, size_t at) {
+	size_t string = fb_deref(b, at);
+	size_t length = get_le(b, string, 4);
+
+	if (string + 4 + length > b.size()) {
+		return "";
+	}
+	return std::string((const char *)&b[string + 4], length);
+}
+
+// a message of the stream, its flatbuffer and its body
+struct message_t {
+	std::vector<UINT8> metadata;
+	std::vector<UINT8> body;
+	int type;						// ARROW_HEADER_, 0 - end of stream
+	size_t header;					// position of the header table
+};
+
+/** read message
+*
+*   @param FILE*      stream
+*   @param message_t& message read
+*   @return bool      false - truncated or not a message
+*/
+static bool read_message(FILE *fp, message_t &m) {
+	UINT32 prefix[2];
+
+	m.type = 0;
+	if (fread(prefix, sizeof(prefix), 1, fp) != 1 || prefix[0] != 0xFFFFFFFF) {
+		return false;
+	}
+	if (prefix[1] == 0) {
+		return true;
+	}
+	m.metadata.resize(prefix[1]);
+	if (fread(&m.metadata[0], 1, prefix[1], fp) != prefix[1]) {
+		return false;
+	}
+	size_t message = get_le(m.metadata, 0, 4);
+	size_t type_at = fb_field(m.metadata, message, 1);
+	size_t header_at = fb_field(m.metadata, message, 2);
+	size_t body_at = fb_field(m.metadata, message, 3);
+	if (type_at == 0 || header_at == 0) {
+		return false;
+	}
+	m.type = get_le(m.metadata, type_at, 1);
+	m.header = fb_deref(m.metadata, header_at);
+	m.body.resize(body_at ? get_le(m.metadata, body_at, 8) : 0);
+	return m.body.empty() || fread(&m.body[0], 1, m.body.size(), fp) == m.body.size();
+}
+
+/** check batch
+*
+*   A RecordBatch of rows rows, the seconds_of_week column counting up
+*   from first.
+*
+*   @return void
+*/
+static void check_batch(const message_t &m, int column, size_t rows, UINT32 first) {
+	const std::vector<UINT8> &b = m.metadata;
+
+	CHECK(m.type == ARROW_HEADER_BATCH);
+	if (m.type != ARROW_HEADER_BATCH || column < 0) {
+		return;
+	}
+	size_t length_at = fb_field(b, m.header, 0);
+	CHECK(length_at != 0 && get_le(b, length_at, 8) == rows);
+	size_t buffers = fb_deref(b, fb_field(b, m.header, 2));
+	// Buffer { offset, length }, validity then values of each column
+	size_t values = buffers + 4 + 16 * (2 * column + 1);
+	size_t offset = get_le(b, values, 8);
+	size_t length = get_le(b, values + 8, 8);
+	CHECK(length == rows * 4 && offset + length <= m.body.size());
+	if (length != rows * 4 || offset + length > m.body.size()) {
+		return;
+	}
+	for (size_t i=0; i<rows; i++) {
+		CHECK(get_le(m.body, offset + 4 * i, 4) == first + i);
+	}
+}
+
+int main() {
+	char path[64];
+	arrow_writer writer(TEST_BATCH_ROWS, TEST_FLUSH_SECONDS);
+	tsip gps("", false);
+	UINT32 second = TEST_FIRST_SECOND;
+
+	gps.set_verbose(false);
+	snprintf(path, sizeof(path), "/tmp/arrow_test.%d.arrows", (int)getpid());
+	if (!writer.open(path, REPORT_SUPER, REPORT_SUPER_PRIMARY_TIME)) {
+		printf("FAIL open %s\n", path);
+		return 1;
+	}
+	for (int i=0; i<5; i++) {
+		feed_primary(gps, second++);
+		CHECK(writer.append(gps));
+	}
+	CHECK(writer.get_batches() == 0);
+	usleep(TEST_FLUSH_SECONDS * 1000000 + 100000);
+	feed_primary(gps, second++);
+	CHECK(writer.append(gps));
+	CHECK(writer.get_batches() == 1 && writer.get_rows() == 6);
+	for (int i=0; i<2; i++) {
+		feed_primary(gps, second++);
+		CHECK(writer.append(gps));
+	}
+	CHECK(writer.close());
+	CHECK(writer.get_batches() == 2 && writer.get_rows() == 8);
+
+	FILE *fp = fopen(path, "r");
+	CHECK(fp != NULL);
+	if (fp != NULL) {
+		message_t m;
+		int column = -1;
+
+		CHECK(read_message(fp, m) && m.type == ARROW_HEADER_SCHEMA);
+		if (m.type == ARROW_HEADER_SCHEMA) {
+			size_t fields = fb_deref(m.metadata, fb_field(m.metadata, m.header, 1));
+			size_t count = get_le(m.metadata, fields, 4);
+			std::vector<std::string> names;
+			for (size_t i=0; i<count; i++) {
+				size_t field = fb_deref(m.metadata, fields + 4 + 4 * i);
+				names.push_back(fb_string(m.metadata, fb_field(m.metadata, field, 0)));
+				if (names.back() == "seconds_of_week") {
+					column = i;
+				}
+			}
+			CHECK(count > 3 && names[0] == "generation" && names[1] == "received");
+			CHECK(column == 2);
+		}
+		CHECK(read_message(fp, m));
+		check_batch(m, column, 6, TEST_FIRST_SECOND);
+		CHECK(read_message(fp, m));
+		check_batch(m, column, 2, TEST_FIRST_SECOND + 6);
+		CHECK(read_message(fp, m) && m.type == 0);
+		CHECK(fgetc(fp) == EOF);
+		fclose(fp);
+	}
+	unlink(path);
+	printf("arrow export: %d failures\n", failures);
+	return failures == 0 ? 0 : 1;
+}
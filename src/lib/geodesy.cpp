@@ -0,0 +1,338 @@
+/**
+ *	@file geodesy.cpp
+ * 	@brief WGS-84 ECEF / LLA / ENU conversions, single and batched
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  The batch conversions pick a kernel once, on first use: AVX2 when
+ *  the library was built with it and the cpu supports it, else SSE2,
+ *  else scalar.  The environment variable GPS_GEODESY_KERNEL=scalar or
+ *  sse2 forces a narrower kernel.
+ *
+ * Usage:
+ * @code
+ * 	lla_t ref = {lat, lon, alt};
+ * 	geodesy frame(ref);
+ *
+ * 	geodesy::lla_to_ecef(lat, lon, alt, x, y, z, n);
+ * 	frame.ecef_to_enu(x, y, z, e, nn, u, n);
+ * @endcode
+ *
+ */
+
+#include "geodesy.h"
+#include "geodesy_kernels.h"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(GPS_HAVE_AVX2)
+void geodesy_lla_to_ecef_avx2(const double *lat, const double *lon, const double *alt,
+		double *x, double *y, double *z, size_t n);
+void geodesy_ecef_to_lla_avx2(const double *x, const double *y, const double *z,
+		double *lat, double *lon, double *alt, size_t n);
+void geodesy_ecef_to_enu_avx2(const double *rot, const double *org,
+		const double *x, const double *y, const double *z,
+		double *e, double *n, double *u, size_t cnt);
+void geodesy_enu_to_ecef_avx2(const double *rot, const double *org,
+		const double *e, const double *n, const double *u,
+		double *x, double *y, double *z, size_t cnt);
+#endif
+
+enum geodesy_kernel_t {
+	KERNEL_SCALAR,
+	KERNEL_SSE2,
+	KERNEL_AVX2
+};
+
+/** select kernel
+*
+*   @return geodesy_kernel_t widest kernel usable on this cpu
+*/
+static geodesy_kernel_t select_kernel() {
+	const char *force = getenv("GPS_GEODESY_KERNEL");
+
+	if (force != NULL && strcmp(force, "scalar") == 0) {
+		return KERNEL_SCALAR;
+	}
+#if defined(GPS_HAVE_AVX2)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && (force == NULL || strcmp(force, "sse2") != 0)) {
+		return KERNEL_AVX2;
+	}
+#endif
+#if defined(__SSE2__)
+	return KERNEL_SSE2;
+#else
+	return KERNEL_SCALAR;
+#endif
+}
+
+/** get kernel
+*
+*   @return geodesy_kernel_t kernel used by the batch conversions
+*/
+static geodesy_kernel_t get_kernel_id() {
+	static const geodesy_kernel_t kernel = select_kernel();
+	return kernel;
+}
+
+/** Constructor.
+*
+*	Set up a local east/north/up frame at the origin.
+*
+* 	@param lla_t    origin
+*/
+geodesy::geodesy(const lla_t &origin) {
+	set_origin(origin);
+}
+
+/** Constructor.
+*
+*	Set up a local east/north/up frame at the origin.
+*
+* 	@param ecef_t   origin
+*/
+geodesy::geodesy(const ecef_t &origin) {
+	set_origin(ecef_to_lla(origin));
+}
+
+/** set origin
+*
+*   Compute the origin in both coordinate systems and the rotation from
+*   ECEF to ENU at the origin.
+*
+* 	@param lla_t    origin
+*   @return void
+*/
+void geodesy::set_origin(const lla_t &origin) {
+	double sl = sin(origin.latitude);
+	double cl = cos(origin.latitude);
+	double so = sin(origin.longitude);
+	double co = cos(origin.longitude);
+
+	m_origin = origin;
+	m_origin_ecef = lla_to_ecef(origin);
+
+	m_rot[0] = -so;		m_rot[1] = co;			m_rot[2] = 0;
+	m_rot[3] = -sl*co;	m_rot[4] = -sl*so;		m_rot[5] = cl;
+	m_rot[6] = cl*co;	m_rot[7] = cl*so;		m_rot[8] = sl;
+}
+
+/** get origin
+*
+*   @return lla_t origin of the local frame
+*/
+lla_t geodesy::get_origin() const {
+	return m_origin;
+}
+
+/** lla to ecef
+*
+* 	@param lla_t    position
+*   @return ecef_t  position
+*/
+ecef_t geodesy::lla_to_ecef(const lla_t &lla) {
+	ecef_t ecef;
+	double sl = sin(lla.latitude);
+	double cl = cos(lla.latitude);
+	double n = WGS84_A/sqrt(1 - WGS84_E2*sl*sl);
+
+	ecef.x = (n + lla.altitude)*cl*cos(lla.longitude);
+	ecef.y = (n + lla.altitude)*cl*sin(lla.longitude);
+	ecef.z = (n*(1 - WGS84_E2) + lla.altitude)*sl;
+	return ecef;
+}
+
+/** ecef to lla
+*
+*   Bowring's method with one refinement of the parametric latitude,
+*   accurate to a few micrometers from the surface to orbit.
+*
+* 	@param ecef_t   position
+*   @return lla_t   position
+*/
+lla_t geodesy::ecef_to_lla(const ecef_t &ecef) {
+	lla_t lla;
+	double p = sqrt(ecef.x*ecef.x + ecef.y*ecef.y);
+	double theta = atan2(ecef.z*WGS84_A, p*WGS84_B);
+	double num = 0;
+	double den = 0;
+
+	for (int i=0; i<2; i++) {
+		double st = sin(theta);
+		double ct = cos(theta);
+		num = ecef.z + WGS84_EP2*WGS84_B*st*st*st;
+		den = p - WGS84_E2*WGS84_A*ct*ct*ct;
+		theta = atan2(WGS84_B*num, WGS84_A*den);
+	}
+
+	lla.latitude = atan2(num, den);
+	lla.longitude = atan2(ecef.y, ecef.x);
+
+	double sl = sin(lla.latitude);
+	double cl = cos(lla.latitude);
+	lla.altitude = p*cl + ecef.z*sl - WGS84_A*sqrt(1 - WGS84_E2*sl*sl);
+	return lla;
+}
+
+/** ecef to enu
+*
+* 	@param ecef_t   position
+*   @return enu_t   position in the local frame
+*/
+enu_t geodesy::ecef_to_enu(const ecef_t &ecef) const {
+	enu_t enu;
+	double dx = ecef.x - m_origin_ecef.x;
+	double dy = ecef.y - m_origin_ecef.y;
+	double dz = ecef.z - m_origin_ecef.z;
+
+	enu.east  = m_rot[0]*dx + m_rot[1]*dy + m_rot[2]*dz;
+	enu.north = m_rot[3]*dx + m_rot[4]*dy + m_rot[5]*dz;
+	enu.up    = m_rot[6]*dx + m_rot[7]*dy + m_rot[8]*dz;
+	return enu;
+}
+
+/** enu to ecef
+*
+* 	@param enu_t    position in the local frame
+*   @return ecef_t  position
+*/
+ecef_t geodesy::enu_to_ecef(const enu_t &enu) const {
+	ecef_t ecef;
+
+	ecef.x = m_origin_ecef.x + m_rot[0]*enu.east + m_rot[3]*enu.north + m_rot[6]*enu.up;
+	ecef.y = m_origin_ecef.y + m_rot[1]*enu.east + m_rot[4]*enu.north + m_rot[7]*enu.up;
+	ecef.z = m_origin_ecef.z + m_rot[2]*enu.east + m_rot[5]*enu.north + m_rot[8]*enu.up;
+	return ecef;
+}
+
+/** lla to enu
+*
+* 	@param lla_t    position
+*   @return enu_t   position in the local frame
+*/
+enu_t geodesy::lla_to_enu(const lla_t &lla) const {
+	return ecef_to_enu(lla_to_ecef(lla));
+}
+
+/** batch lla to ecef
+*
+*   Input and output arrays hold n values each and may not overlap.
+*
+*   @return void
+*/
+void geodesy::lla_to_ecef(const double *lat, const double *lon, const double *alt,
+		double *x, double *y, double *z, size_t n) {
+	switch (get_kernel_id()) {
+#if defined(GPS_HAVE_AVX2)
+	case KERNEL_AVX2:
+		geodesy_lla_to_ecef_avx2(lat, lon, alt, x, y, z, n);
+		break;
+#endif
+#if defined(__SSE2__)
+	case KERNEL_SSE2:
+		lla_to_ecef_batch<vd2>(lat, lon, alt, x, y, z, n);
+		break;
+#endif
+	default:
+		lla_to_ecef_batch<vd1>(lat, lon, alt, x, y, z, n);
+		break;
+	}
+}
+
+/** batch ecef to lla
+*
+*   Input and output arrays hold n values each and may not overlap.
+*
+*   @return void
+*/
+void geodesy::ecef_to_lla(const double *x, const double *y, const double *z,
+		double *lat, double *lon, double *alt, size_t n) {
+	switch (get_kernel_id()) {
+#if defined(GPS_HAVE_AVX2)
+	case KERNEL_AVX2:
+		geodesy_ecef_to_lla_avx2(x, y, z, lat, lon, alt, n);
+		break;
+#endif
+#if defined(__SSE2__)
+	case KERNEL_SSE2:
+		ecef_to_lla_batch<vd2>(x, y, z, lat, lon, alt, n);
+		break;
+#endif
+	default:
+		ecef_to_lla_batch<vd1>(x, y, z, lat, lon, alt, n);
+		break;
+	}
+}
+
+/** batch ecef to enu
+*
+*   Input and output arrays hold cnt values each and may not overlap.
+*
+*   @return void
+*/
+void geodesy::ecef_to_enu(const double *x, const double *y, const double *z,
+		double *e, double *n, double *u, size_t cnt) const {
+	const double org[3] = {m_origin_ecef.x, m_origin_ecef.y, m_origin_ecef.z};
+
+	switch (get_kernel_id()) {
+#if defined(GPS_HAVE_AVX2)
+	case KERNEL_AVX2:
+		geodesy_ecef_to_enu_avx2(m_rot, org, x, y, z, e, n, u, cnt);
+		break;
+#endif
+#if defined(__SSE2__)
+	case KERNEL_SSE2:
+		ecef_to_enu_batch<vd2>(m_rot, org, x, y, z, e, n, u, cnt);
+		break;
+#endif
+	default:
+		ecef_to_enu_batch<vd1>(m_rot, org, x, y, z, e, n, u, cnt);
+		break;
+	}
+}
+
+/** batch enu to ecef
+*
+*   Input and output arrays hold cnt values each and may not overlap.
+*
+*   @return void
+*/
+void geodesy::enu_to_ecef(const double *e, const double *n, const double *u,
+		double *x, double *y, double *z, size_t cnt) const {
+	const double org[3] = {m_origin_ecef.x, m_origin_ecef.y, m_origin_ecef.z};
+
+	switch (get_kernel_id()) {
+#if defined(GPS_HAVE_AVX2)
+	case KERNEL_AVX2:
+		geodesy_enu_to_ecef_avx2(m_rot, org, e, n, u, x, y, z, cnt);
+		break;
+#endif
+#if defined(__SSE2__)
+	case KERNEL_SSE2:
+		enu_to_ecef_batch<vd2>(m_rot, org, e, n, u, x, y, z, cnt);
+		break;
+#endif
+	default:
+		enu_to_ecef_batch<vd1>(m_rot, org, e, n, u, x, y, z, cnt);
+		break;
+	}
+}
+
+/** get kernel
+*
+*   @return const char* name of the kernel used by the batch conversions
+*/
+const char *geodesy::get_kernel() {
+	switch (get_kernel_id()) {
+	case KERNEL_AVX2:
+		return "avx2";
+	case KERNEL_SSE2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
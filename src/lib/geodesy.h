@@ -0,0 +1,85 @@
+/*
+  geodesy.h - WGS-84 conversions between earth centered earth fixed
+            (ECEF), latitude/longitude/altitude (LLA) and local
+            east/north/up (ENU) coordinates.
+
+  Single positions are converted with the libm trig functions.  Batches
+  are converted in structure-of-arrays form by vector kernels: AVX2 when
+  the cpu has it, SSE2, or a scalar fallback.  The kernels use their own
+  polynomial sin/cos/atan and agree with the scalar conversions to a
+  few parts in 1e16.
+
+  Angles are radians, distances meters.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _geodesy_h
+#define _geodesy_h
+
+#include <cstddef>
+
+// WGS-84 ellipsoid
+const double WGS84_A   = 6378137.0;					// semi-major axis, meters
+const double WGS84_F   = 1.0/298.257223563;			// flattening
+const double WGS84_B   = WGS84_A*(1.0-WGS84_F);		// semi-minor axis, meters
+const double WGS84_E2  = WGS84_F*(2.0-WGS84_F);		// first eccentricity squared
+const double WGS84_EP2 = WGS84_E2/(1.0-WGS84_E2);		// second eccentricity squared
+
+struct lla_t {
+	double latitude;			// radians + north, - south
+	double longitude;			// radians + east, - west
+	double altitude;			// meters above the ellipsoid
+};
+
+struct ecef_t {
+	double x;					// meters
+	double y;					// meters
+	double z;					// meters
+};
+
+struct enu_t {
+	double east;				// meters
+	double north;				// meters
+	double up;					// meters
+};
+
+// conversions, an instance holds the origin of a local ENU frame
+class geodesy {
+	public:
+		geodesy(const lla_t &origin);
+		geodesy(const ecef_t &origin);
+
+		// single positions
+		static ecef_t lla_to_ecef(const lla_t &lla);
+		static lla_t ecef_to_lla(const ecef_t &ecef);
+		enu_t ecef_to_enu(const ecef_t &ecef) const;
+		ecef_t enu_to_ecef(const enu_t &enu) const;
+		enu_t lla_to_enu(const lla_t &lla) const;
+		lla_t get_origin(void) const;
+
+		// batches, structure of arrays
+		static void lla_to_ecef(const double *lat, const double *lon, const double *alt,
+				double *x, double *y, double *z, size_t n);
+		static void ecef_to_lla(const double *x, const double *y, const double *z,
+				double *lat, double *lon, double *alt, size_t n);
+		void ecef_to_enu(const double *x, const double *y, const double *z,
+				double *e, double *n, double *u, size_t cnt) const;
+		void enu_to_ecef(const double *e, const double *n, const double *u,
+				double *x, double *y, double *z, size_t cnt) const;
+
+		static const char *get_kernel(void);	// "avx2", "sse2" or "scalar"
+
+	private:
+		lla_t  m_origin;
+		ecef_t m_origin_ecef;
+		double m_rot[9];			// ECEF to ENU rotation, row major
+
+		void set_origin(const lla_t &origin);
+};
+
+#endif
@@ -0,0 +1,40 @@
+/**
+ *	@file geodesy_avx2.cpp
+ * 	@brief AVX2 instances of the batch conversion kernels
+ *
+ *  This file is compiled with -mavx2 and is only called after the cpu
+ *  has been checked for AVX2 support.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ */
+
+#include "geodesy_kernels.h"
+
+#if defined(__AVX2__)
+
+void geodesy_lla_to_ecef_avx2(const double *lat, const double *lon, const double *alt,
+		double *x, double *y, double *z, size_t n) {
+	lla_to_ecef_batch<vd4>(lat, lon, alt, x, y, z, n);
+}
+
+void geodesy_ecef_to_lla_avx2(const double *x, const double *y, const double *z,
+		double *lat, double *lon, double *alt, size_t n) {
+	ecef_to_lla_batch<vd4>(x, y, z, lat, lon, alt, n);
+}
+
+void geodesy_ecef_to_enu_avx2(const double *rot, const double *org,
+		const double *x, const double *y, const double *z,
+		double *e, double *n, double *u, size_t cnt) {
+	ecef_to_enu_batch<vd4>(rot, org, x, y, z, e, n, u, cnt);
+}
+
+void geodesy_enu_to_ecef_avx2(const double *rot, const double *org,
+		const double *e, const double *n, const double *u,
+		double *x, double *y, double *z, size_t cnt) {
+	enu_to_ecef_batch<vd4>(rot, org, e, n, u, x, y, z, cnt);
+}
+
+#endif
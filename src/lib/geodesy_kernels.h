@@ -0,0 +1,366 @@
+/*
+  geodesy_kernels.h - batch conversion kernels shared by geodesy.cpp
+            and geodesy_avx2.cpp.
+
+  The kernels are written once against a small vector type:
+
+    vd1  scalar double, the fallback and the tail of every batch
+    vd2  two doubles in an SSE2 register
+    vd4  four doubles in an AVX2 register (geodesy_avx2.cpp only)
+
+  Everything here has internal linkage, so the copies compiled with
+  -mavx2 can never be picked by the linker for the generic code.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _geodesy_kernels_h
+#define _geodesy_kernels_h
+
+#include "geodesy.h"
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/****************************
+ * vector types             *
+ ****************************/
+
+struct vd1 {
+	enum { width = 1 };
+	double v;
+
+	static vd1 set1(double x) { vd1 r; r.v = x; return r; }
+	static vd1 load(const double *p) { return set1(*p); }
+	void store(double *p) const { *p = v; }
+
+	static uint64_t bits(double x) { uint64_t b; memcpy(&b, &x, 8); return b; }
+	static double from_bits(uint64_t b) { double x; memcpy(&x, &b, 8); return x; }
+};
+inline vd1 operator+(vd1 a, vd1 b) { return vd1::set1(a.v + b.v); }
+inline vd1 operator-(vd1 a, vd1 b) { return vd1::set1(a.v - b.v); }
+inline vd1 operator*(vd1 a, vd1 b) { return vd1::set1(a.v * b.v); }
+inline vd1 operator/(vd1 a, vd1 b) { return vd1::set1(a.v / b.v); }
+inline vd1 vsqrt(vd1 a) { return vd1::set1(std::sqrt(a.v)); }
+inline vd1 vmax(vd1 a, vd1 b) { return vd1::set1(a.v > b.v ? a.v : b.v); }
+inline vd1 vmin(vd1 a, vd1 b) { return vd1::set1(a.v < b.v ? a.v : b.v); }
+inline vd1 vand(vd1 a, vd1 b) { return vd1::set1(vd1::from_bits(vd1::bits(a.v) & vd1::bits(b.v))); }
+inline vd1 vandnot(vd1 m, vd1 a) { return vd1::set1(vd1::from_bits(~vd1::bits(m.v) & vd1::bits(a.v))); }
+inline vd1 vor(vd1 a, vd1 b) { return vd1::set1(vd1::from_bits(vd1::bits(a.v) | vd1::bits(b.v))); }
+inline vd1 vxor(vd1 a, vd1 b) { return vd1::set1(vd1::from_bits(vd1::bits(a.v) ^ vd1::bits(b.v))); }
+inline vd1 vcmpgt(vd1 a, vd1 b) { return vd1::set1(vd1::from_bits(a.v > b.v ? ~(uint64_t)0 : 0)); }
+inline vd1 vcmplt(vd1 a, vd1 b) { return vcmpgt(b, a); }
+// all ones where bit 0 of the integer in the low mantissa is set
+inline vd1 vodd_mask(vd1 t) { return vd1::set1(vd1::from_bits(0 - (vd1::bits(t.v) & 1))); }
+// sign bit set where bit 1 of the integer in the low mantissa is set
+inline vd1 vbit1_sign(vd1 t) { return vd1::set1(vd1::from_bits((vd1::bits(t.v) << 62) & 0x8000000000000000ULL)); }
+inline vd1 vinc_bits(vd1 t) { return vd1::set1(vd1::from_bits(vd1::bits(t.v) + 1)); }
+
+#if defined(__SSE2__)
+struct vd2 {
+	enum { width = 2 };
+	__m128d v;
+
+	static vd2 make(__m128d x) { vd2 r; r.v = x; return r; }
+	static vd2 set1(double x) { return make(_mm_set1_pd(x)); }
+	static vd2 load(const double *p) { return make(_mm_loadu_pd(p)); }
+	void store(double *p) const { _mm_storeu_pd(p, v); }
+};
+inline vd2 operator+(vd2 a, vd2 b) { return vd2::make(_mm_add_pd(a.v, b.v)); }
+inline vd2 operator-(vd2 a, vd2 b) { return vd2::make(_mm_sub_pd(a.v, b.v)); }
+inline vd2 operator*(vd2 a, vd2 b) { return vd2::make(_mm_mul_pd(a.v, b.v)); }
+inline vd2 operator/(vd2 a, vd2 b) { return vd2::make(_mm_div_pd(a.v, b.v)); }
+inline vd2 vsqrt(vd2 a) { return vd2::make(_mm_sqrt_pd(a.v)); }
+inline vd2 vmax(vd2 a, vd2 b) { return vd2::make(_mm_max_pd(a.v, b.v)); }
+inline vd2 vmin(vd2 a, vd2 b) { return vd2::make(_mm_min_pd(a.v, b.v)); }
+inline vd2 vand(vd2 a, vd2 b) { return vd2::make(_mm_and_pd(a.v, b.v)); }
+inline vd2 vandnot(vd2 m, vd2 a) { return vd2::make(_mm_andnot_pd(m.v, a.v)); }
+inline vd2 vor(vd2 a, vd2 b) { return vd2::make(_mm_or_pd(a.v, b.v)); }
+inline vd2 vxor(vd2 a, vd2 b) { return vd2::make(_mm_xor_pd(a.v, b.v)); }
+inline vd2 vcmpgt(vd2 a, vd2 b) { return vd2::make(_mm_cmpgt_pd(a.v, b.v)); }
+inline vd2 vcmplt(vd2 a, vd2 b) { return vd2::make(_mm_cmplt_pd(a.v, b.v)); }
+inline vd2 vodd_mask(vd2 t) {
+	__m128i b = _mm_and_si128(_mm_castpd_si128(t.v), _mm_set1_epi64x(1));
+	return vd2::make(_mm_castsi128_pd(_mm_sub_epi64(_mm_setzero_si128(), b)));
+}
+inline vd2 vbit1_sign(vd2 t) {
+	__m128i b = _mm_slli_epi64(_mm_castpd_si128(t.v), 62);
+	return vd2::make(_mm_and_pd(_mm_castsi128_pd(b), _mm_set1_pd(-0.0)));
+}
+inline vd2 vinc_bits(vd2 t) {
+	return vd2::make(_mm_castsi128_pd(_mm_add_epi64(_mm_castpd_si128(t.v), _mm_set1_epi64x(1))));
+}
+#endif
+
+#if defined(__AVX2__)
+struct vd4 {
+	enum { width = 4 };
+	__m256d v;
+
+	static vd4 make(__m256d x) { vd4 r; r.v = x; return r; }
+	static vd4 set1(double x) { return make(_mm256_set1_pd(x)); }
+	static vd4 load(const double *p) { return make(_mm256_loadu_pd(p)); }
+	void store(double *p) const { _mm256_storeu_pd(p, v); }
+};
+inline vd4 operator+(vd4 a, vd4 b) { return vd4::make(_mm256_add_pd(a.v, b.v)); }
+inline vd4 operator-(vd4 a, vd4 b) { return vd4::make(_mm256_sub_pd(a.v, b.v)); }
+inline vd4 operator*(vd4 a, vd4 b) { return vd4::make(_mm256_mul_pd(a.v, b.v)); }
+inline vd4 operator/(vd4 a, vd4 b) { return vd4::make(_mm256_div_pd(a.v, b.v)); }
+inline vd4 vsqrt(vd4 a) { return vd4::make(_mm256_sqrt_pd(a.v)); }
+inline vd4 vmax(vd4 a, vd4 b) { return vd4::make(_mm256_max_pd(a.v, b.v)); }
+inline vd4 vmin(vd4 a, vd4 b) { return vd4::make(_mm256_min_pd(a.v, b.v)); }
+inline vd4 vand(vd4 a, vd4 b) { return vd4::make(_mm256_and_pd(a.v, b.v)); }
+inline vd4 vandnot(vd4 m, vd4 a) { return vd4::make(_mm256_andnot_pd(m.v, a.v)); }
+inline vd4 vor(vd4 a, vd4 b) { return vd4::make(_mm256_or_pd(a.v, b.v)); }
+inline vd4 vxor(vd4 a, vd4 b) { return vd4::make(_mm256_xor_pd(a.v, b.v)); }
+inline vd4 vcmpgt(vd4 a, vd4 b) { return vd4::make(_mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ)); }
+inline vd4 vcmplt(vd4 a, vd4 b) { return vd4::make(_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)); }
+inline vd4 vodd_mask(vd4 t) {
+	__m256i b = _mm256_and_si256(_mm256_castpd_si256(t.v), _mm256_set1_epi64x(1));
+	return vd4::make(_mm256_castsi256_pd(_mm256_sub_epi64(_mm256_setzero_si256(), b)));
+}
+inline vd4 vbit1_sign(vd4 t) {
+	__m256i b = _mm256_slli_epi64(_mm256_castpd_si256(t.v), 62);
+	return vd4::make(_mm256_and_pd(_mm256_castsi256_pd(b), _mm256_set1_pd(-0.0)));
+}
+inline vd4 vinc_bits(vd4 t) {
+	return vd4::make(_mm256_castsi256_pd(_mm256_add_epi64(_mm256_castpd_si256(t.v), _mm256_set1_epi64x(1))));
+}
+#endif
+
+/****************************
+ * elementary functions     *
+ ****************************/
+
+template <class V> inline V vselect(V mask, V a, V b) {
+	return vor(vand(mask, a), vandnot(mask, b));
+}
+
+template <class V> inline V vabs(V a) {
+	return vandnot(V::set1(-0.0), a);
+}
+
+// sin and cos for |x| up to a few thousand radians.  The argument is
+// reduced by pi/2 in three parts (Cody-Waite) and the fdlibm minimax
+// polynomials are evaluated on [-pi/4, pi/4].
+template <class V> inline void vsincos(V x, V &s, V &c) {
+	const V magic = V::set1(6755399441055744.0);		// 1.5 * 2^52
+
+	V t = x*V::set1(0.63661977236758134308) + magic;	// 2/pi
+	V q = t - magic;
+	V r = x - q*V::set1(1.57079632673412561417e+00);
+	r = r - q*V::set1(6.07710050630396597660e-11);
+	r = r - q*V::set1(2.02226624871116645580e-21);
+
+	V z = r*r;
+	V ps = V::set1(1.58969099521155010221e-10);
+	ps = ps*z + V::set1(-2.50507602534068634195e-08);
+	ps = ps*z + V::set1(2.75573137070700676789e-06);
+	ps = ps*z + V::set1(-1.98412698298579493134e-04);
+	ps = ps*z + V::set1(8.33333333332248946124e-03);
+	ps = ps*z + V::set1(-1.66666666666666324348e-01);
+	V sr = r + r*z*ps;
+
+	V pc = V::set1(-1.13596475577881948265e-11);
+	pc = pc*z + V::set1(2.08757232129817482790e-09);
+	pc = pc*z + V::set1(-2.75573143513906633035e-07);
+	pc = pc*z + V::set1(2.48015872894767294178e-05);
+	pc = pc*z + V::set1(-1.38888888888741095749e-03);
+	pc = pc*z + V::set1(4.16666666666666019037e-02);
+	V cr = V::set1(1.0) - V::set1(0.5)*z + z*z*pc;
+
+	// quadrant: odd quadrants swap sin and cos, bit 1 flips the sign
+	V swap = vodd_mask(t);
+	s = vxor(vselect(swap, cr, sr), vbit1_sign(t));
+	c = vxor(vselect(swap, sr, cr), vbit1_sign(vinc_bits(t)));
+}
+
+// atan for 0 <= x <= 1 (cephes atan, reduced around tan(pi/8))
+template <class V> inline V vatan01(V x) {
+	V big = vcmpgt(x, V::set1(0.66));
+	V xr = vselect(big, (x - V::set1(1.0))/(x + V::set1(1.0)), x);
+	V y0 = vand(big, V::set1(0.78539816339744830962));
+	V more = vand(big, V::set1(3.061616997868382943065e-17));
+
+	V z = xr*xr;
+	V p = V::set1(-8.750608600031904122785e-1);
+	p = p*z + V::set1(-1.615753718733365076637e1);
+	p = p*z + V::set1(-7.500855792314704667340e1);
+	p = p*z + V::set1(-1.228866684490136173410e2);
+	p = p*z + V::set1(-6.485021904942025371773e1);
+	V q = z + V::set1(2.485846490142306297962e1);
+	q = q*z + V::set1(1.650270098316988542046e2);
+	q = q*z + V::set1(4.328810604912902668951e2);
+	q = q*z + V::set1(4.853903996359136964868e2);
+	q = q*z + V::set1(1.945506571482613964425e2);
+
+	return y0 + (xr*(z*p/q) + more + xr);
+}
+
+// atan2 with the quadrant rules of libm (atan2(0, 0) returns 0)
+template <class V> inline V vatan2(V y, V x) {
+	V ax = vabs(x);
+	V ay = vabs(y);
+	V hi = vmax(ax, ay);
+	V lo = vmin(ax, ay);
+	V t = lo/vmax(hi, V::set1(1e-300));
+
+	V a = vatan01(t);
+	a = vselect(vcmpgt(ay, ax), V::set1(1.57079632679489661923) - a, a);
+	a = vselect(vcmplt(x, V::set1(0.0)), V::set1(3.14159265358979323846) - a, a);
+	return vor(a, vand(V::set1(-0.0), y));
+}
+
+/****************************
+ * conversion kernels       *
+ ****************************/
+
+template <class V> inline void lla_to_ecef_v(const double *lat, const double *lon, const double *alt,
+		double *x, double *y, double *z) {
+	V sl, cl, so, co;
+	V h = V::load(alt);
+
+	vsincos(V::load(lat), sl, cl);
+	vsincos(V::load(lon), so, co);
+
+	V n = V::set1(WGS84_A)/vsqrt(V::set1(1.0) - V::set1(WGS84_E2)*sl*sl);
+	V r = (n + h)*cl;
+	(r*co).store(x);
+	(r*so).store(y);
+	((n*V::set1(1.0 - WGS84_E2) + h)*sl).store(z);
+}
+
+// Bowring's method with one refinement of the parametric latitude.
+// Only sqrt and two atan2 per position, no sin/cos.
+template <class V> inline void ecef_to_lla_v(const double *px, const double *py, const double *pz,
+		double *lat, double *lon, double *alt) {
+	const V one = V::set1(1.0);
+	const V a = V::set1(WGS84_A);
+	const V b = V::set1(WGS84_B);
+	V x = V::load(px);
+	V y = V::load(py);
+	V z = V::load(pz);
+	V p = vsqrt(x*x + y*y);
+
+	// parametric latitude from the point itself
+	V u = z*a;
+	V w = p*b;
+	V r = vsqrt(u*u + w*w);
+	V st = u/r;
+	V ct = w/r;
+
+	V num, den, h;
+	for (int i=0; i<2; i++) {
+		num = z + V::set1(WGS84_EP2*WGS84_B)*st*st*st;
+		den = p - V::set1(WGS84_E2*WGS84_A)*ct*ct*ct;
+		if (i == 0) {
+			// parametric latitude from the first geodetic estimate
+			u = b*num;
+			w = a*den;
+			r = vsqrt(u*u + w*w);
+			st = u/r;
+			ct = w/r;
+		}
+	}
+	h = vsqrt(num*num + den*den);
+	V sphi = num/h;
+	V cphi = den/h;
+
+	vatan2(num, den).store(lat);
+	vatan2(y, x).store(lon);
+	(p*cphi + z*sphi - a*vsqrt(one - V::set1(WGS84_E2)*sphi*sphi)).store(alt);
+}
+
+template <class V> inline void ecef_to_enu_v(const double *rot, const double *org,
+		const double *px, const double *py, const double *pz,
+		double *e, double *n, double *u) {
+	V dx = V::load(px) - V::set1(org[0]);
+	V dy = V::load(py) - V::set1(org[1]);
+	V dz = V::load(pz) - V::set1(org[2]);
+
+	(V::set1(rot[0])*dx + V::set1(rot[1])*dy + V::set1(rot[2])*dz).store(e);
+	(V::set1(rot[3])*dx + V::set1(rot[4])*dy + V::set1(rot[5])*dz).store(n);
+	(V::set1(rot[6])*dx + V::set1(rot[7])*dy + V::set1(rot[8])*dz).store(u);
+}
+
+template <class V> inline void enu_to_ecef_v(const double *rot, const double *org,
+		const double *pe, const double *pn, const double *pu,
+		double *x, double *y, double *z) {
+	V e = V::load(pe);
+	V n = V::load(pn);
+	V u = V::load(pu);
+
+	(V::set1(org[0]) + V::set1(rot[0])*e + V::set1(rot[3])*n + V::set1(rot[6])*u).store(x);
+	(V::set1(org[1]) + V::set1(rot[1])*e + V::set1(rot[4])*n + V::set1(rot[7])*u).store(y);
+	(V::set1(org[2]) + V::set1(rot[2])*e + V::set1(rot[5])*n + V::set1(rot[8])*u).store(z);
+}
+
+/****************************
+ * batch drivers            *
+ ****************************/
+
+// each driver runs the kernel over the batch with V and finishes the
+// tail with vd1
+
+template <class V> void lla_to_ecef_batch(const double *lat, const double *lon, const double *alt,
+		double *x, double *y, double *z, size_t n) {
+	size_t i = 0;
+	for (; i + V::width <= n; i += V::width) {
+		lla_to_ecef_v<V>(lat+i, lon+i, alt+i, x+i, y+i, z+i);
+	}
+	for (; i < n; i++) {
+		lla_to_ecef_v<vd1>(lat+i, lon+i, alt+i, x+i, y+i, z+i);
+	}
+}
+
+template <class V> void ecef_to_lla_batch(const double *x, const double *y, const double *z,
+		double *lat, double *lon, double *alt, size_t n) {
+	size_t i = 0;
+	for (; i + V::width <= n; i += V::width) {
+		ecef_to_lla_v<V>(x+i, y+i, z+i, lat+i, lon+i, alt+i);
+	}
+	for (; i < n; i++) {
+		ecef_to_lla_v<vd1>(x+i, y+i, z+i, lat+i, lon+i, alt+i);
+	}
+}
+
+template <class V> void ecef_to_enu_batch(const double *rot, const double *org,
+		const double *x, const double *y, const double *z,
+		double *e, double *n, double *u, size_t cnt) {
+	size_t i = 0;
+	for (; i + V::width <= cnt; i += V::width) {
+		ecef_to_enu_v<V>(rot, org, x+i, y+i, z+i, e+i, n+i, u+i);
+	}
+	for (; i < cnt; i++) {
+		ecef_to_enu_v<vd1>(rot, org, x+i, y+i, z+i, e+i, n+i, u+i);
+	}
+}
+
+template <class V> void enu_to_ecef_batch(const double *rot, const double *org,
+		const double *e, const double *n, const double *u,
+		double *x, double *y, double *z, size_t cnt) {
+	size_t i = 0;
+	for (; i + V::width <= cnt; i += V::width) {
+		enu_to_ecef_v<V>(rot, org, e+i, n+i, u+i, x+i, y+i, z+i);
+	}
+	for (; i < cnt; i++) {
+		enu_to_ecef_v<vd1>(rot, org, e+i, n+i, u+i, x+i, y+i, z+i);
+	}
+}
+
+}
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * geodesy_test.cpp
+ *
+ * Test of the WGS-84 conversions, run by ctest once per batch kernel:
+ *
+ *   geodesy_test scalar|sse2|avx2
+ *
+ * The kernel is forced with GPS_GEODESY_KERNEL, an avx2 run on a cpu
+ * without it is skipped.  Reference points, computed from the closed
+ * form LLA to ECEF in 40 digit arithmetic, are checked through the
+ * single and the batch conversions in both directions, then random
+ * points from 1000 km below the surface to beyond the GPS orbits make
+ * the round trip ECEF to LLA to ECEF; the two Bowring iterations of
+ * ecef_to_lla are not meant for the deep interior.  Batches are of odd
+ * sizes so the tails of the vector kernels are covered.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "geodesy.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define TEST_SKIPPED		77		// SKIP_RETURN_CODE of the avx2 test
+#define TOLERANCE_M			1e-6	// meters
+#define TOLERANCE_RAD		1e-12	// radians, 6 micrometers on the ground
+
+static const double DEG = M_PI / 180;
+
+// latitude, longitude (degrees), altitude, x, y, z (meters)
+static const double reference[][6] = {
+	{0, 0, 0, 6378137.000000, 0.000000, 0.000000},
+	{0, 90, 0, 0.000000, 6378137.000000, 0.000000},
+	{90, 0, 0, 0.000000, 0.000000, 6356752.314245},
+	{45, 45, 1000, 3194919.145061, 3194919.145061, 4488055.515647},
+	{-33.8688, 151.2093, 58, -4646093.477288, 2553229.535817, -3534404.710910},
+	{51.4778, -0.0015, 45, 3980609.237098, -104.212106, 4966859.728504},
+	{37.4, -122.1, 30, -2695879.211672, -4297599.703177, 3852771.309555},
+	{-89.9, 10, 2800, 11004.516682, 1940.393201, -6359542.562845},
+	{10, -170, 20200000, -25777332.535968, -4545239.216785, 4607941.736607},
+};
+static const int reference_cnt = sizeof(reference) / sizeof(reference[0]);
+
+static int failures = 0;
+
+static void check(const char *what, int i, double got, double expected, double tolerance) {
+	if (!(fabs(got - expected) <= tolerance)) {
+		printf("FAIL %s %d: %.9f, expected %.9f\n", what, i, got, expected);
+		failures++;
+	}
+}
+
+/** check reference
+*
+*   The reference points through the single and batch conversions.
+*
+*   @return void
+*/
+static void check_reference() {
+	std::vector<double> lat(reference_cnt), lon(reference_cnt), alt(reference_cnt);
+	std::vector<double> x(reference_cnt), y(reference_cnt), z(reference_cnt);
+	std::vector<double> la(reference_cnt), lo(reference_cnt), al(reference_cnt);
+
+	for (int i=0; i<reference_cnt; i++) {
+		lat[i] = reference[i][0] * DEG;
+		lon[i] = reference[i][1] * DEG;
+		alt[i] = reference[i][2];
+		x[i] = reference[i][3];
+		y[i] = reference[i][4];
+		z[i] = reference[i][5];
+
+		lla_t lla = {lat[i], lon[i], alt[i]};
+		ecef_t ecef = geodesy::lla_to_ecef(lla);
+		check("lla_to_ecef x", i, ecef.x, x[i], TOLERANCE_M);
+		check("lla_to_ecef y", i, ecef.y, y[i], TOLERANCE_M);
+		check("lla_to_ecef z", i, ecef.z, z[i], TOLERANCE_M);
+		ecef = {x[i], y[i], z[i]};
+		lla = geodesy::ecef_to_lla(ecef);
+		check("ecef_to_lla latitude", i, lla.latitude, lat[i], TOLERANCE_RAD);
+		// none at the poles, the references are rounded to the micrometer
+		if (fabs(reference[i][0]) != 90) {
+			check("ecef_to_lla longitude", i, lla.longitude, lon[i], TOLERANCE_M / hypot(x[i], y[i]));
+		}
+		check("ecef_to_lla altitude", i, lla.altitude, alt[i], TOLERANCE_M);
+	}
+
+	std::vector<double> bx(reference_cnt), by(reference_cnt), bz(reference_cnt);
+	geodesy::lla_to_ecef(&lat[0], &lon[0], &alt[0], &bx[0], &by[0], &bz[0], reference_cnt);
+	geodesy::ecef_to_lla(&x[0], &y[0], &z[0], &la[0], &lo[0], &al[0], reference_cnt);
+	for (int i=0; i<reference_cnt; i++) {
+		check("batch lla_to_ecef x", i, bx[i], x[i], TOLERANCE_M);
+		check("batch lla_to_ecef y", i, by[i], y[i], TOLERANCE_M);
+		check("batch lla_to_ecef z", i, bz[i], z[i], TOLERANCE_M);
+		check("batch ecef_to_lla latitude", i, la[i], lat[i], TOLERANCE_RAD);
+		if (fabs(reference[i][0]) != 90) {
+			check("batch ecef_to_lla longitude", i, lo[i], lon[i], TOLERANCE_M / hypot(x[i], y[i]));
+		}
+		check("batch ecef_to_lla altitude", i, al[i], alt[i], TOLERANCE_M);
+	}
+}
+
+/** check round trip
+*
+*   Random ECEF points to LLA and back, by the batch kernel, compared
+*   with the start and with the single conversions.
+*
+*   @param size_t  points
+*   @return void
+*/
+static void check_round_trip(size_t n) {
+	std::mt19937_64 random(n);
+	std::uniform_real_distribution<double> unit(-1, 1);
+	std::uniform_real_distribution<double> radius(WGS84_B - 1000e3, 4 * WGS84_A);
+	std::vector<double> x(n), y(n), z(n), lat(n), lon(n), alt(n), bx(n), by(n), bz(n);
+
+	for (size_t i=0; i<n; i++) {
+		double v[3], norm;
+		do {
+			v[0] = unit(random);
+			v[1] = unit(random);
+			v[2] = unit(random);
+			norm = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		} while (norm < 0.1 || norm > 1);
+		double r = radius(random);
+		x[i] = v[0] / norm * r;
+		y[i] = v[1] / norm * r;
+		z[i] = v[2] / norm * r;
+	}
+	geodesy::ecef_to_lla(&x[0], &y[0], &z[0], &lat[0], &lon[0], &alt[0], n);
+	geodesy::lla_to_ecef(&lat[0], &lon[0], &alt[0], &bx[0], &by[0], &bz[0], n);
+	for (size_t i=0; i<n; i++) {
+		check("round trip x", i, bx[i], x[i], TOLERANCE_M);
+		check("round trip y", i, by[i], y[i], TOLERANCE_M);
+		check("round trip z", i, bz[i], z[i], TOLERANCE_M);
+		ecef_t ecef = {x[i], y[i], z[i]};
+		lla_t lla = geodesy::ecef_to_lla(ecef);
+		check("kernel latitude", i, lat[i], lla.latitude, TOLERANCE_RAD);
+		check("kernel longitude", i, lon[i], lla.longitude, TOLERANCE_RAD);
+		check("kernel altitude", i, alt[i], lla.altitude, TOLERANCE_M);
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s scalar|sse2|avx2\n", argv[0]);
+		return 2;
+	}
+	if (strcmp(argv[1], "avx2") == 0) {
+		unsetenv("GPS_GEODESY_KERNEL");
+	} else {
+		setenv("GPS_GEODESY_KERNEL", argv[1], 1);
+	}
+	if (strcmp(geodesy::get_kernel(), argv[1]) != 0) {
+		printf("kernel %s not available, %s used\n", argv[1], geodesy::get_kernel());
+		return TEST_SKIPPED;
+	}
+
+	check_reference();
+	check_round_trip(1);
+	check_round_trip(7);
+	check_round_trip(10001);
+	printf("%s: %d failures\n", geodesy::get_kernel(), failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,318 @@
+/**
+ *	@file gps_frame.cpp
+ * 	@brief protocol detection of a receiver port
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	int baud;
+ * 	gps_protocol protocol = probe_port("/dev/ttyUSB0", baud);
+ *
+ * 	if (protocol != PROTOCOL_UNKNOWN) {
+ * 		printf("%s at %d baud\n", protocol_name(protocol), baud);
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "gps_frame.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+
+#define DETECT_BUFFER	512		// bytes read at once while listening
+
+/** Constructor.
+*/
+protocol_detector::protocol_detector() : m_tsip("", false) {
+	m_tsip.set_verbose(false);
+	reset();
+}
+
+/** reset
+*
+*   Forget the bytes fed so far, e.g. after a change of rate.
+*
+*   @return void
+*/
+void protocol_detector::reset() {
+	m_tsip.init_rpt();
+	m_nmea.reset();
+	m_tsip_frames = 0;
+	m_nmea_frames = 0;
+}
+
+/** count frame
+*
+*   Handler of both decoders, counts the TSIP reports of a known type
+*   and the NMEA sentences with a good checksum.
+*
+*   @return bool true - keep decoding
+*/
+bool protocol_detector::count_frame(frame_decoder &decoder, void *ctx) {
+	protocol_detector *d = (protocol_detector *)ctx;
+
+	if (decoder.get_protocol() == PROTOCOL_NMEA) {
+		d->m_nmea_frames++;
+	} else if (!d->m_tsip.m_updated.report.unknown) {
+		d->m_tsip_frames++;
+	}
+	return true;
+}
+
+/** feed
+*
+*   @param UINT8*  bytes read from the port
+*   @param int     number of bytes
+*   @return void
+*/
+void protocol_detector::feed(const UINT8 *data, int len) {
+	m_tsip.decode(data, len, count_frame, this);
+	m_nmea.decode(data, len, count_frame, this);
+}
+
+/** get protocol
+*
+*   @return gps_protocol  protocol with DETECT_MIN_FRAMES good frames and
+*                         more than the other, PROTOCOL_UNKNOWN - none yet
+*/
+gps_protocol protocol_detector::get_protocol() {
+	if (m_tsip_frames >= DETECT_MIN_FRAMES && m_tsip_frames > m_nmea_frames) {
+		return PROTOCOL_TSIP;
+	}
+	if (m_nmea_frames >= DETECT_MIN_FRAMES && m_nmea_frames > m_tsip_frames) {
+		return PROTOCOL_NMEA;
+	}
+	return PROTOCOL_UNKNOWN;
+}
+
+/** get frames
+*
+*   @param gps_protocol  protocol
+*   @return int          good frames of the protocol so far
+*/
+int protocol_detector::get_frames(gps_protocol protocol) {
+	switch (protocol) {
+		case PROTOCOL_TSIP:		return m_tsip_frames;
+		case PROTOCOL_NMEA:		return m_nmea_frames;
+		default:				return 0;
+	}
+}
+
+/** detect protocol
+*
+*   @param UINT8*  bytes received from a port
+*   @param int     number of bytes
+*   @return gps_protocol  PROTOCOL_UNKNOWN - not enough good frames
+*/
+gps_protocol detect_protocol(const UINT8 *data, int len) {
+	protocol_detector detector;
+
+	detector.feed(data, len);
+	return detector.get_protocol();
+}
+
+/** protocol name
+*
+*   @param gps_protocol  protocol
+*   @return const char*  "tsip", "nmea" or "unknown"
+*/
+const char *protocol_name(gps_protocol protocol) {
+	switch (protocol) {
+		case PROTOCOL_TSIP:		return "tsip";
+		case PROTOCOL_NMEA:		return "nmea";
+		default:				return "unknown";
+	}
+}
+
+/** listen port
+*
+*   Feed what the port sends for up to window_ms to the detector,
+*   return as soon as it has found the protocol.
+*
+*   @return gps_protocol  PROTOCOL_UNKNOWN - nothing found
+*/
+static gps_protocol listen_port(int fd, int window_ms, protocol_detector &detector) {
+	UINT8 buffer[DETECT_BUFFER];
+	struct timespec now;
+	struct pollfd p;
+
+	p.fd = fd;
+	p.events = POLLIN;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long deadline = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + window_ms;
+
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long left = deadline - (now.tv_sec * 1000LL + now.tv_nsec / 1000000);
+		if (left <= 0) {
+			return PROTOCOL_UNKNOWN;
+		}
+		int n = poll(&p, 1, (int)left);
+		if (n < 0 && errno != EINTR) {
+			return PROTOCOL_UNKNOWN;
+		}
+		if (n <= 0) {
+			continue;
+		}
+		ssize_t len = read(fd, buffer, sizeof(buffer));
+		if (len <= 0) {
+			if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+				continue;
+			}
+			return PROTOCOL_UNKNOWN;
+		}
+		detector.feed(buffer, len);
+		if (detector.get_protocol() != PROTOCOL_UNKNOWN) {
+			return detector.get_protocol();
+		}
+	}
+}
+
+/** probe port
+*
+*   Listen to the port at each candidate rate, the TSIP and the NMEA
+*   default rates first.
+*
+*   @param string  port name
+*   @param int&    returned rate the protocol was found at
+*   @param int     listening time per rate, milliseconds
+*   @return gps_protocol  PROTOCOL_UNKNOWN - nothing found
+*/
+gps_protocol probe_port(const std::string &port, int &baud, int window_ms) {
+	static const int candidates[] = {9600, NMEA_DEFAULT_BAUD, 38400, 19200, 57600, 115200};
+	gps_protocol protocol = PROTOCOL_UNKNOWN;
+	protocol_detector detector;
+
+	int fd = open(port.c_str(), O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		perror(port.c_str());
+		return PROTOCOL_UNKNOWN;
+	}
+	for (size_t i=0; i<sizeof(candidates)/sizeof(candidates[0]); i++) {
+		if (!setup_serial_port(fd, candidates[i])) {
+			break;
+		}
+		detector.reset();
+		protocol = listen_port(fd, window_ms, detector);
+		if (protocol != PROTOCOL_UNKNOWN) {
+			baud = candidates[i];
+			break;
+		}
+	}
+	close(fd);
+	return protocol;
+}
+
+/** open decoder
+*
+*   Probe the port and open the decoder of the protocol found, at the
+*   rate found.
+*
+*   @param string  port name
+*   @param int     listening time per rate, milliseconds
+*   @return frame_decoder*  tsip or nmea, NULL - nothing found or not opened
+*/
+frame_decoder *open_decoder(const std::string &port, int window_ms) {
+	int baud = 0;
+
+	switch (probe_port(port, baud, window_ms)) {
+		case PROTOCOL_TSIP: {
+			tsip *gps = new tsip(port, false);
+			if (!gps->port_status || !gps->set_baud(baud)) {
+				delete gps;
+				return NULL;
+			}
+			return gps;
+		}
+		case PROTOCOL_NMEA: {
+			nmea *gps = new nmea(port, baud);
+			if (!gps->port_status) {
+				delete gps;
+				return NULL;
+			}
+			return gps;
+		}
+		default:
+			printf("%s: no TSIP or NMEA receiver found\n", port.c_str());
+			return NULL;
+	}
+}
+
+/** serial speed
+*
+*   @param int  bits per second
+*   @return speed_t termios speed, B0 when not supported
+*/
+speed_t serial_speed(int baud) {
+	switch (baud) {
+		case 300:		return B300;
+		case 600:		return B600;
+		case 1200:		return B1200;
+		case 2400:		return B2400;
+		case 4800:		return B4800;
+		case 9600:		return B9600;
+		case 19200:		return B19200;
+		case 38400:		return B38400;
+		case 57600:		return B57600;
+		case 115200:	return B115200;
+		default:		return B0;
+	}
+}
+
+/** set up serial port
+*
+*   8N1, raw input and output, blocking reads of at least one byte.
+*   The input waiting is flushed.
+*
+*   @param int  file descriptor of the port
+*   @param int  bits per second
+*   @return bool false - the rate is not supported or not set
+*/
+bool setup_serial_port(int fd, int baud) {
+    struct termios newtio;
+    speed_t speed = serial_speed(baud);
+
+    if (speed == B0) {
+        return false;
+    }
+    memset(&newtio, 0, sizeof(newtio)); /* clear struct for new port settings */
+
+    /*
+        CS8     : 8n1 (8bit,no parity,1 stopbit)
+        CLOCAL  : local connection, no modem contol
+        CREAD   : enable receiving characters
+     */
+    newtio.c_cflag = CS8 | CLOCAL | CREAD;
+    cfsetispeed(&newtio, speed);
+    cfsetospeed(&newtio, speed);
+
+    /*
+        IGNPAR  : ignore bytes with parity errors
+        otherwise make device raw (no other input processing)
+     */
+    newtio.c_iflag = IGNPAR;
+
+    /*
+        Raw output.
+     */
+    newtio.c_oflag = 0;
+
+    newtio.c_cc[VTIME]    = 0;     /* inter-character timer unused */
+    newtio.c_cc[VMIN]     = 1;     /* blocking read until 1 character arrives */
+
+    /*
+        disable all echo functionality, and don't send signals to calling program
+     */
+    newtio.c_lflag = 0;
+
+    /*
+        now clean the modem line and activate the settings for the port
+     */
+    tcflush(fd, TCIFLUSH);
+    return tcsetattr(fd, TCSANOW, &newtio) == 0;
+}
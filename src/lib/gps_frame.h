@@ -0,0 +1,75 @@
+/*
+  gps_frame.h - protocol detection of a receiver port.
+
+  A port carries TSIP packets (class tsip) or NMEA 0183 sentences
+  (class nmea), both decoded behind the frame_decoder interface of
+  tsip.h.  open_decoder() listens to a port at each candidate rate
+  and returns the decoder of what it heard, at that rate, so a
+  collector handles a mixed fleet with one code path:
+
+    bool on_frame(frame_decoder &decoder, void *ctx) {
+        if (decoder.get_protocol() == PROTOCOL_TSIP) ...
+        return true;
+    }
+
+    tsip_reactor reactor;
+    for (i...) {
+        frame_decoder *gps = open_decoder(ports[i]);
+        if (gps != NULL) reactor.add(*gps, on_frame, gps);
+    }
+    reactor.run();
+
+  Detection only listens, nothing is sent: a Thunderbolt broadcasts
+  8F-AB and 8F-AC every second, an NMEA receiver its sentences.  The
+  bytes are run through both decoders and the protocol with
+  DETECT_MIN_FRAMES good frames, and more than the other, is taken: a
+  TSIP report of a known type and length, or an NMEA sentence with a
+  good checksum.  Noise at a wrong rate gives neither.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _gps_frame_h
+#define _gps_frame_h
+
+#include <tsip.h>
+#include <nmea.h>
+
+#define DETECT_WINDOW_MS		2500	// listening time per rate, two broadcasts
+#define DETECT_MIN_FRAMES		2		// good frames that identify a protocol
+
+// counts the good frames of each protocol in a byte stream
+class protocol_detector {
+	public:
+		protocol_detector(void);
+		void feed(const UINT8 *data, int len);
+		gps_protocol get_protocol(void);	// PROTOCOL_UNKNOWN - not yet
+		int get_frames(gps_protocol protocol);
+		void reset(void);
+
+	private:
+		tsip m_tsip;
+		nmea m_nmea;
+		int m_tsip_frames;
+		int m_nmea_frames;
+
+		static bool count_frame(frame_decoder &decoder, void *ctx);
+};
+
+gps_protocol detect_protocol(const UINT8 *data, int len);
+const char *protocol_name(gps_protocol protocol);
+
+// listen to the port at each candidate rate, baud is the rate found
+gps_protocol probe_port(const std::string &port, int &baud, int window_ms=DETECT_WINDOW_MS);
+// decoder of the protocol found on the port, NULL - none, delete when done
+frame_decoder *open_decoder(const std::string &port, int window_ms=DETECT_WINDOW_MS);
+
+// serial port set up shared by the decoders, 8N1 raw
+speed_t serial_speed(int baud);		// B0 - not supported
+bool setup_serial_port(int fd, int baud);
+
+#endif
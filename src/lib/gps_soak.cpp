@@ -0,0 +1,857 @@
+/*
+ * gps_soak.cpp
+ *
+ * Soak test of the TSIP packet decoder.  A stream of timing packets
+ * with known contents is passed through fault_source under each fault
+ * profile and decoded; the run reports the packets recovered, the
+ * damaged packets the decoder accepted as good ones and the decode
+ * throughput.  With --gps-port the bytes of a receiver are damaged
+ * instead, only the decoder counts are known then.
+ *
+ * With --alloc-check every heap allocation is counted once the first
+ * reports are decoded, on the decode, report handler and snapshot
+ * (tsip::get_reply) path, and the run fails if there is one.
+ *
+ * With --raw-file 0x5A raw measurements for 12 satellites are added to
+ * every second of the stream and written to the file through
+ * raw_measurement_ring and its writer thread, while the timing reports
+ * are checked as before.  The file is read back and every record
+ * decoded must be in it.
+ *
+ * With --shm every report decoded is published into a shared memory
+ * ring under that name, and a reader thread follows it through its
+ * own read only mapping, as another process would.  Every packet it
+ * reads intact must be consistent; the ones it falls behind on are
+ * counted as lost, the decoder is never held up.
+ *
+ * With --mcast the 8F-AC decoded are published as the snapshots of
+ * MCAST_RECEIVERS receivers in turn, a datagram per round, to that
+ * address, 127.0.0.1 keeps it on loopback.  A subscriber thread checks
+ * every record it receives against the packet sent; datagrams the
+ * socket buffer could not hold are counted as lost.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <tsip.h>
+#include <tsip_source.h>
+#include <tsip_history.h>
+#include <tsip_raw.h>
+#include <tsip_shm.h>
+#include <tsip_multicast.h>
+#include <boost/program_options.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace po = boost::program_options;
+
+namespace {
+  const size_t ERROR_IN_COMMAND_LINE = 3;
+  const size_t SUCCESS = 0;
+  const size_t FAILURE = 1;
+  const size_t EXIT_HELP = 2;
+  const int DEFAULT_PACKETS = 100000;   // 8F-AB/8F-AC pairs per profile
+  const int READ_SIZE = 4096;
+  const UINT16 FIRST_WEEK = 2200;
+  const long WEEK_SECONDS = 604800;
+  const unsigned long ALLOC_WARMUP_REPORTS = 1000;  // decoded before allocations count
+  const int RAW_PER_SECOND = 12;        // 0x5A per second with --raw-file
+  const int MCAST_RECEIVERS = 8;        // receivers emulated with --mcast
+  const int MCAST_QUIET_MS = 200;       // nothing received for this long ends the subscriber
+
+  struct profile_entry {
+	const char *name;
+	fault_source::profile_t profile;    // bit_flip, drop, dup_dle, truncate, burst_max
+  };
+
+  const profile_entry profiles[] = {
+	{ "clean",      { 0,    0,    0,    0,    0 } },
+	{ "burst",      { 0,    0,    0,    0,    64 } },
+	{ "bit-flip",   { 1e-4, 0,    0,    0,    0 } },
+	{ "drop",       { 0,    1e-4, 0,    0,    0 } },
+	{ "dup-dle",    { 0,    0,    1e-2, 0,    0 } },
+	{ "truncate",   { 0,    0,    0,    1e-4, 0 } },
+	{ "noisy-usb",  { 1e-4, 1e-4, 1e-3, 1e-4, 64 } },
+	{ "bad-cable",  { 1e-3, 1e-3, 1e-2, 1e-3, 16 } },
+  };
+  const int profile_cnt = sizeof(profiles) / sizeof(profiles[0]);
+}
+using namespace std;
+
+// heap allocations, counted while alloc_counting is set
+static atomic<bool> alloc_counting(false);
+static atomic<unsigned long> alloc_count(0);
+
+#ifdef __GLIBC__
+// operator new allocates with malloc, so counting malloc covers both
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) {
+	if (alloc_counting.load(memory_order_relaxed)) {
+		alloc_count++;
+	}
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+	if (alloc_counting.load(memory_order_relaxed)) {
+		alloc_count++;
+	}
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	if (alloc_counting.load(memory_order_relaxed)) {
+		alloc_count++;
+	}
+	return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+	if (alloc_counting.load(memory_order_relaxed)) {
+		alloc_count++;
+	}
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+	return memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+	*ptr = memalign(alignment, size);
+	return (*ptr != NULL) ? 0 : ENOMEM;
+}
+
+void free(void *ptr) {
+	__libc_free(ptr);
+}
+}
+#else
+void *operator new(size_t size) {
+	if (alloc_counting.load(memory_order_relaxed)) {
+		alloc_count++;
+	}
+	void *p = malloc(size);
+	if (p == NULL) {
+		throw bad_alloc();
+	}
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+	free(ptr);
+}
+#endif
+
+struct soak_options {
+	int packets;
+	unsigned long seed;
+	vector<string> profiles;        // empty - all
+	bool custom;                    // rates given on the command line
+	fault_source::profile_t rates;
+	string port;                    // live receiver, empty - generated stream
+	int seconds;
+	bool alloc_check;               // fail on heap allocations after warm-up
+	string raw_file;                // 0x5A records written here, empty - no 0x5A
+	string shm;                     // reports published under this name, empty - none
+	string mcast;                   // snapshots sent to this address, empty - none
+	int mcast_port;
+};
+
+// reader thread of the shared memory ring
+struct shm_check_t {
+	shm_packet_reader reader;
+	atomic<bool> done;              // the decoder has finished publishing
+	unsigned long long bad;         // read intact but not consistent
+};
+
+// subscriber thread of the multicast snapshots
+struct mcast_check_t {
+	mcast_subscriber subscriber;
+	int packets;
+	atomic<bool> done;              // the last datagram is sent
+	unsigned long long good;        // records with the contents sent
+	unsigned long long bad;
+};
+
+// decode results of one run
+struct soak_result {
+	int packets;
+	vector<char> seen;              // per packet sent, bit 0 8F-AB, bit 1 8F-AC
+	unsigned long recovered;        // packets decoded with the contents sent
+	unsigned long false_frames;     // timing packets decoded with other contents
+	unsigned long other;            // any other report
+	double decode_sec;
+	tsip_reply *snapshot;           // taken of every report, NULL - none
+	unsigned long raw;              // 0x5A decoded
+	mcast_publisher *mcast;         // snapshots sent, NULL - none
+};
+
+/** add packet
+*
+*   Append a packet with DLE stuffing and its DLE ETX.
+*/
+static void add_packet(vector<UINT8> &stream, const vector<UINT8> &packet) {
+	stream.push_back(DLE);
+	for (size_t i=0; i<packet.size(); i++) {
+		stream.push_back(packet[i]);
+		if (packet[i] == DLE) {
+			stream.push_back(DLE);
+		}
+	}
+	stream.push_back(DLE);
+	stream.push_back(ETX);
+}
+
+static void put_b2(vector<UINT8> &p, UINT16 v) {
+	p.push_back(v >> 8);
+	p.push_back(v & 0xff);
+}
+
+static void put_b4(vector<UINT8> &p, UINT32 v) {
+	p.push_back(v >> 24);
+	p.push_back((v >> 16) & 0xff);
+	p.push_back((v >> 8) & 0xff);
+	p.push_back(v & 0xff);
+}
+
+static void put_single(vector<UINT8> &p, SINGLE v) {
+	UINT32 x;
+	memcpy(&x, &v, sizeof(x));
+	put_b4(p, x);
+}
+
+static void put_double(vector<UINT8> &p, DOUBLE v) {
+	unsigned long long x;
+	memcpy(&x, &v, sizeof(x));
+	put_b4(p, x >> 32);
+	put_b4(p, x & 0xffffffff);
+}
+
+// contents of packet i, chosen so most fields differ between packets
+static UINT32 packet_dac(int i)          { return 0x80000000u ^ (i * 2654435761u); }
+static SINGLE packet_temperature(int i)  { return 30.0f + (i % 1000) * 0.01f; }
+static SINGLE packet_pps_offset(int i)   { return (i % 200) - 100.0f; }
+static DOUBLE packet_latitude(int i)     { return 0.7 + i * 1e-9; }
+static DOUBLE raw_time(int i, int k)     { return i + k * 0.001; }
+static SINGLE raw_doppler(int i, int k)  { return (i % 5000) - 2500.0f + k; }
+
+/** build stream
+*
+*   An 8F-AB and an 8F-AC per second, as the receiver broadcasts them,
+*   and an 0x47 every tenth second.  With raw set an 0x5A per satellite
+*   follows each second.
+*
+*   @return void
+*/
+static void build_stream(int packets, bool raw, vector<UINT8> &stream) {
+	vector<UINT8> p;
+
+	for (int i=0; i<packets; i++) {
+		p.clear();
+		p.push_back(REPORT_SUPER);
+		p.push_back(REPORT_SUPER_PRIMARY_TIME);
+		put_b4(p, i % WEEK_SECONDS);
+		put_b2(p, FIRST_WEEK + i / WEEK_SECONDS);
+		put_b2(p, 18);
+		p.push_back(0x03);
+		p.push_back(i % 60);
+		p.push_back((i / 60) % 60);
+		p.push_back((i / 3600) % 24);
+		p.push_back(1 + (i / 86400) % 28);
+		p.push_back(1);
+		put_b2(p, 2026);
+		add_packet(stream, p);
+
+		p.clear();
+		p.push_back(REPORT_SUPER);
+		p.push_back(REPORT_SUPER_SECONDARY_TIME);
+		p.push_back(RECEIVE_MODE_OVERDETERMINDE_CLOCK);
+		p.push_back(DISCIPLINING_MODE_NORMAL);
+		p.push_back(100);
+		put_b4(p, i);							// holdover_duration, the packet number
+		put_b2(p, 0);
+		put_b2(p, 0);
+		p.push_back(GPS_DECODING_STATUS_DOING_FIXES);
+		p.push_back(DISCIPLINING_ACTIVITY_PHASE_LOCKING);
+		p.push_back(0);
+		p.push_back(0);
+		put_single(p, packet_pps_offset(i));
+		put_single(p, 0.001f);
+		put_b4(p, packet_dac(i));
+		put_single(p, 0.25f);
+		put_single(p, packet_temperature(i));
+		put_double(p, packet_latitude(i));
+		put_double(p, -1.8);
+		put_double(p, 1600.0);
+		for (int k=0; k<8; k++) {
+			p.push_back(0);
+		}
+		add_packet(stream, p);
+
+		if (i % 10 == 0) {
+			// 0x47 signal levels, variable length, not checked
+			p.clear();
+			p.push_back(0x47);
+			p.push_back(4);
+			for (int k=0; k<4; k++) {
+				p.push_back(k * 7 + 1);
+				put_single(p, 40.0f + k);
+			}
+			add_packet(stream, p);
+		}
+
+		for (int k=0; raw && k<RAW_PER_SECOND; k++) {
+			p.clear();
+			p.push_back(REPORT_RAW_MEASUREMENT);
+			p.push_back(k + 1);
+			put_single(p, 10.0f);
+			put_single(p, 45.0f - k);
+			put_single(p, 1000.0f + k);
+			put_single(p, raw_doppler(i, k));
+			put_double(p, raw_time(i, k));
+			add_packet(stream, p);
+		}
+	}
+}
+
+/** check raw file
+*
+*   Read the records written back and count the ones carrying the
+*   contents sent.
+*
+*   @return unsigned long  good records, the others are counted in bad
+*/
+static unsigned long check_raw_file(const string &path, unsigned long &bad) {
+	FILE *f = fopen(path.c_str(), "rb");
+	raw_record_t rec;
+	unsigned long good = 0;
+
+	bad = 0;
+	if (f == NULL) {
+		perror(path.c_str());
+		return 0;
+	}
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		int k = rec.prn - 1;
+		long i = (long)rec.time_of_measurement;
+		if (k >= 0 && k < RAW_PER_SECOND && i >= 0
+				&& rec.time_of_measurement == raw_time(i, k)
+				&& rec.doppler == raw_doppler(i, k)
+				&& rec.signal_level == 45.0f - k && rec.code_phase == 1000.0f + k) {
+			good++;
+		} else {
+			bad++;
+		}
+	}
+	fclose(f);
+	return good;
+}
+
+/** read shm
+*
+*   Follow the ring until the decoder is done and everything published
+*   is read or lost.  A packet is consistent when its bit is the one of
+*   its code, its generation follows the previous one and a primary
+*   timing structure holds the seconds of week of the packet bytes.
+*
+*   @return void
+*/
+static void read_shm(shm_check_t *c) {
+	unsigned long long generation = 0;
+	union tsip::_update_report unknown;
+
+	unknown.value = 0;
+	unknown.report.unknown = 1;
+
+	for (;;) {
+		const shm_packet_t *p = c->reader.peek();
+		if (p == NULL) {
+			if (c->done) {
+				if (c->reader.peek() == NULL) {
+					break;
+				}
+				continue;
+			}
+			this_thread::yield();
+			continue;
+		}
+		// a packet of the code alone or not stored as its type is unknown
+		bool ok = p->length >= 1 && p->length <= SHM_PACKET_MAX
+				&& (p->bit == unknown.value
+					|| (p->length >= 2 && p->bit == tsip::report_bit(p->raw[0], p->raw[1])))
+				&& (p->stamp.generation == 0 || p->stamp.generation > generation);
+		unsigned long long g = p->stamp.generation != 0 ? p->stamp.generation : generation;
+		if (ok && p->decoded && p->bit == tsip::report_bit(REPORT_SUPER, REPORT_SUPER_PRIMARY_TIME)) {
+			UINT32 tow = ((UINT32)p->raw[2] << 24) | (p->raw[3] << 16) | (p->raw[4] << 8) | p->raw[5];
+			ok = p->report.primary_time.seconds_of_week == tow;
+		}
+		if (c->reader.consume()) {
+			generation = g;
+			if (!ok) {
+				c->bad++;
+			}
+		}
+	}
+}
+
+/** read mcast
+*
+*   Receive until the publisher is done and nothing more comes.  A
+*   record is good when it is the receiver of its 8F-AC, see
+*   check_report, and holds the contents of that packet.
+*
+*   @return void
+*/
+static void read_mcast(mcast_check_t *c) {
+	const mcast_timing_t *records;
+
+	for (;;) {
+		int n = c->subscriber.receive(records, MCAST_QUIET_MS);
+		if (n < 0 || (n == 0 && c->done)) {
+			break;
+		}
+		for (int k=0; k<n; k++) {
+			const mcast_timing_t &t = records[k];
+			long i = t.holdover_duration;
+			if (i < c->packets && (long)t.receiver == i % MCAST_RECEIVERS
+					&& (t.valid & MCAST_SECONDARY_VALID)
+					&& t.dac_value == packet_dac(i) && t.pps_offset == packet_pps_offset(i)
+					&& t.latitude == packet_latitude(i)) {
+				c->good++;
+			} else {
+				c->bad++;
+			}
+		}
+	}
+}
+
+/** check report
+*
+*   Decoder callback, compare each timing report with the packet sent.
+*
+*   @return bool true - continue decoding
+*/
+static bool check_report(tsip &gps, void *ctx) {
+	soak_result *r = (soak_result *)ctx;
+
+	if (r->snapshot != NULL) {
+		gps.get_reply(*r->snapshot);
+	}
+	if (gps.m_updated.report.primary_time) {
+		const _primary_time &t = gps.m_primary_time;
+		long i = (long)(t.report.week_number - FIRST_WEEK) * WEEK_SECONDS
+				+ t.report.seconds_of_week;
+		bool ok = i >= 0 && i < r->packets && !(r->seen[i] & 1)
+				&& t.report.utc_offset == 18 && t.report.flags.value == 0x03
+				&& t.report.seconds == i % 60 && t.report.minutes == (i / 60) % 60
+				&& t.report.hours == (i / 3600) % 24 && t.report.year == 2026;
+		if (ok) {
+			r->seen[i] |= 1;
+			r->recovered++;
+		} else {
+			r->false_frames++;
+		}
+	} else if (gps.m_updated.report.secondary_time) {
+		const _secondary_time &t = gps.m_secondary_time;
+		long i = t.report.holdover_duration;
+		bool ok = i >= 0 && i < r->packets && !(r->seen[i] & 2)
+				&& t.report.receiver_mode == RECEIVE_MODE_OVERDETERMINDE_CLOCK
+				&& t.report.self_survey_progress == 100
+				&& t.report.critical_alarms.value == 0 && t.report.minor_alarms.value == 0
+				&& t.report.dac_value == packet_dac(i)
+				&& t.report.temperature == packet_temperature(i)
+				&& t.report.pps_offset == packet_pps_offset(i)
+				&& t.report.latitude == packet_latitude(i)
+				&& t.report.longitude == -1.8 && t.report.altitude == 1600.0;
+		if (ok) {
+			r->seen[i] |= 2;
+			r->recovered++;
+			if (r->mcast != NULL) {
+				r->mcast->update(i % MCAST_RECEIVERS, gps);
+				if (i % MCAST_RECEIVERS == MCAST_RECEIVERS - 1) {
+					r->mcast->flush();
+				}
+			}
+		} else {
+			r->false_frames++;
+		}
+	} else if (gps.m_updated.report.raw_measurement) {
+		r->raw++;
+	} else {
+		r->other++;
+	}
+	return true;
+}
+
+/** run profile
+*
+*   Decode the stream damaged by one profile.  Only the time spent in
+*   the decoder is counted for the throughput.  With opt.alloc_check
+*   the reports are also kept in histories and copied to a snapshot,
+*   and the allocations after the warm-up are counted.  With
+*   opt.raw_file the 0x5A records go through the writer thread to the
+*   file, the ring holds the whole run since the stream is decoded far
+*   faster than any link carries it.  With opt.shm the reports are
+*   published and read back by a thread, see read_shm, with opt.mcast
+*   the timing snapshots are sent to a thread, see read_mcast.
+*
+*   @return bool  false - heap allocations after the warm-up, or a
+*                 check of the 0x5A file, the shared memory or the
+*                 snapshots failed
+*/
+static bool run_profile(const soak_options &opt, const char *name,
+		const fault_source::profile_t &profile, const vector<UINT8> &stream) {
+	memory_source clean(&stream[0], stream.size());
+	fault_source noisy(clean, profile, opt.seed);
+	tsip gps("", false);
+	soak_result r;
+	tsip_reply snapshot;
+	UINT8 buffer[READ_SIZE];
+	unsigned long bytes = 0;
+	int n;
+	unsigned long raw_sent = opt.raw_file.empty() ? 0 : (unsigned long)opt.packets * RAW_PER_SECOND;
+	raw_measurement_ring ring(max((unsigned long)RAW_RING_DEFAULT_CAPACITY, raw_sent));
+	raw_measurement_writer writer(ring);
+	shm_packet_writer publisher;
+	shm_check_t shm;
+	thread shm_thread;
+	mcast_publisher mcast;
+	mcast_check_t subscriber;
+	thread mcast_thread;
+
+	gps.set_verbose(false);
+	r.packets = opt.packets;
+	r.seen.assign(opt.packets, 0);
+	r.recovered = 0;
+	r.false_frames = 0;
+	r.other = 0;
+	r.decode_sec = 0;
+	r.snapshot = NULL;
+	r.raw = 0;
+	r.mcast = NULL;
+	if (!opt.raw_file.empty()) {
+		unlink(opt.raw_file.c_str());
+		if (!writer.open(opt.raw_file) || !writer.start()) {
+			return false;
+		}
+		gps.stream_raw(&ring);
+	}
+	if (!opt.shm.empty()) {
+		if (!publisher.create(opt.shm) || !shm.reader.open(opt.shm)) {
+			return false;
+		}
+		shm.done = false;
+		shm.bad = 0;
+		gps.publish(&publisher);
+		shm_thread = thread(read_shm, &shm);
+	}
+	if (!opt.mcast.empty()) {
+		if (!subscriber.subscriber.open(opt.mcast, opt.mcast_port)
+				|| !mcast.open(opt.mcast, opt.mcast_port)) {
+			return false;
+		}
+		subscriber.packets = opt.packets;
+		subscriber.done = false;
+		subscriber.good = 0;
+		subscriber.bad = 0;
+		r.mcast = &mcast;
+		mcast_thread = thread(read_mcast, &subscriber);
+	}
+	if (opt.alloc_check) {
+		r.snapshot = &snapshot;
+		gps.keep_history(REPORT_SUPER, REPORT_SUPER_PRIMARY_TIME);
+		gps.keep_history(REPORT_SUPER, REPORT_SUPER_SECONDARY_TIME);
+	}
+	alloc_count = 0;
+
+	while ((n = noisy.read(buffer, sizeof(buffer))) > 0) {
+		if (opt.alloc_check && r.recovered + r.false_frames + r.other >= ALLOC_WARMUP_REPORTS) {
+			alloc_counting = true;
+		}
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		gps.encode(buffer, n, check_report, &r);
+		r.decode_sec += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		bytes += n;
+	}
+	alloc_counting = false;
+	gps.publish(NULL);
+	if (shm_thread.joinable()) {
+		shm.done = true;
+		shm_thread.join();
+	}
+	if (mcast_thread.joinable()) {
+		mcast.flush();
+		subscriber.done = true;
+		mcast_thread.join();
+	}
+	gps.stream_raw(NULL);
+	writer.stop();
+	writer.close();
+
+	fault_source::stats_t faults;
+	tsip_frame_stats frames;
+	noisy.get_stats(faults);
+	gps.get_frame_stats(frames);
+
+	unsigned long sent = 2UL * opt.packets;
+	unsigned long injected = faults.bit_flips + faults.drops + faults.dup_dles + faults.truncations;
+	printf("%-10s %8lu %9lu %9lu %7.3f%% %6lu %7lu %6lu %6lu %9lu %9lu %8.1f\n",
+			name, injected, sent, r.recovered,
+			100.0 * (sent - r.recovered) / sent, r.false_frames,
+			frames.short_frames, frames.long_frames, frames.oversize,
+			frames.misframed, frames.skipped,
+			r.decode_sec > 0 ? bytes / r.decode_sec / 1e6 : 0.0);
+	if (opt.alloc_check && alloc_count > 0) {
+		printf("%-10s %lu heap allocations after warm-up\n", name, alloc_count.load());
+		return false;
+	}
+	if (!opt.raw_file.empty()) {
+		raw_measurement_writer::stats_t ws;
+		unsigned long bad;
+		unsigned long good = check_raw_file(opt.raw_file, bad);
+
+		writer.get_stats(ws);
+		printf("%-10s 0x5A sent %lu decoded %lu written %llu in %llu writes, dropped %llu, read back %lu good %lu bad\n",
+				name, raw_sent, r.raw, ws.records, ws.writes, ring.get_dropped(), good, bad);
+		// a damaged 0x5A of the right length is decoded and written too
+		if (ring.get_dropped() > 0 || ws.records != r.raw || (injected == 0 && good != raw_sent)) {
+			return false;
+		}
+	}
+	if (!opt.shm.empty()) {
+		unsigned long long published = publisher.get_published();
+
+		printf("%-10s shm published %llu read %llu lost %llu inconsistent %llu\n",
+				name, published, shm.reader.get_read(), shm.reader.get_lost(), shm.bad);
+		publisher.close();
+		if (shm.bad > 0 || shm.reader.get_read() + shm.reader.get_lost() != published) {
+			return false;
+		}
+	}
+	if (!opt.mcast.empty()) {
+		mcast_subscriber::stats_t ms;
+
+		subscriber.subscriber.get_stats(ms);
+		printf("%-10s mcast records %llu in %llu datagrams, %llu not sent, received %llu good %llu bad, %llu datagrams lost\n",
+				name, mcast.get_records(), mcast.get_datagrams(), mcast.get_errors(),
+				subscriber.good, subscriber.bad, ms.lost);
+		// the trailing datagrams lost are not seen as a gap
+		if (subscriber.bad > 0 || ms.rejected > 0 || ms.datagrams + ms.lost > mcast.get_datagrams()
+				|| (mcast.get_datagrams() > 0 && ms.datagrams == 0)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// reports decoded from a live receiver
+static bool count_report(tsip &, void *ctx) {
+	(*(unsigned long *)ctx)++;
+	return true;
+}
+
+/** run port
+*
+*   Damage the bytes of a receiver for opt.seconds.
+*
+*   @return int  SUCCESS or FAILURE
+*/
+static int run_port(const soak_options &opt, const fault_source::profile_t &profile) {
+	tsip gps(opt.port, false);
+	UINT8 buffer[READ_SIZE];
+	unsigned long reports = 0;
+	int n;
+
+	if (!gps.port_status) {
+		cerr << "ERROR: cannot open " << opt.port << endl;
+		return FAILURE;
+	}
+	gps.set_verbose(false);
+	fd_source port(gps.get_port_fd());
+	fault_source noisy(port, profile, opt.seed);
+	time_t end = time(NULL) + opt.seconds;
+
+	while (time(NULL) < end && (n = noisy.read(buffer, sizeof(buffer))) > 0) {
+		gps.encode(buffer, n, count_report, &reports);
+	}
+
+	fault_source::stats_t faults;
+	tsip_frame_stats frames;
+	noisy.get_stats(faults);
+	gps.get_frame_stats(frames);
+	printf("bytes %lu  bit flips %lu  drops %lu  dup DLEs %lu  truncations %lu\n",
+			faults.bytes, faults.bit_flips, faults.drops, faults.dup_dles, faults.truncations);
+	printf("reports %lu  frames %lu  short %lu  long %lu  oversize %lu  misframed %lu  skipped %lu\n",
+			reports, frames.frames, frames.short_frames, frames.long_frames,
+			frames.oversize, frames.misframed, frames.skipped);
+	return SUCCESS;
+}
+
+int proc_args(int argc, char **argv, soak_options &opt) {
+	po::variables_map vm;
+
+	po::options_description desc("Allowed options");
+	desc.add_options()
+		("help,h", "display help text")
+		("packets,n", po::value<int>(), "8F-AB/8F-AC pairs per profile, default is 100000")
+		("seed,s", po::value<unsigned long>(), "fault generator seed, default is 1")
+		("profile,p", po::value<vector<string> >()->composing(), "fault profile, may be repeated, default is all")
+		("bit-flip", po::value<double>(), "custom profile, bit flips per byte")
+		("drop", po::value<double>(), "custom profile, dropped bytes per byte")
+		("dup-dle", po::value<double>(), "custom profile, duplicated DLEs per DLE")
+		("truncate", po::value<double>(), "custom profile, truncated packets per byte")
+		("burst", po::value<int>(), "custom profile, largest read in bytes, 0 - full reads")
+		("gps-port,g", po::value<string>(), "damage the bytes of this receiver instead")
+		("seconds,t", po::value<int>(), "seconds to read the receiver, default is 60")
+		("alloc-check,a", "fail if the decode path allocates after warm-up")
+		("raw-file,r", po::value<string>(), "add 0x5A packets and stream them to this file")
+		("shm,m", po::value<string>(), "publish the reports in shared memory under this name")
+		("mcast,M", po::value<string>(), "send timing snapshots to this address, e.g. 127.0.0.1 or a group")
+		("mcast-port", po::value<int>(), "UDP port of --mcast, default is 4583")
+	;
+
+	try {
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			cout << "gps_soak measures the TSIP decoder under line faults" << endl << endl;
+			cout << "profiles:";
+			for (int i=0; i<profile_cnt; i++) {
+				cout << " " << profiles[i].name;
+			}
+			cout << endl << endl << desc << "\n";
+			return EXIT_HELP;
+		}
+
+		po::notify(vm);
+
+	} catch(po::error& e) {
+		cerr << "ERROR: " << e.what() << std::endl << endl;
+		cerr << desc << endl;
+		return ERROR_IN_COMMAND_LINE;
+	}
+
+	opt.packets = vm.count("packets") ? vm["packets"].as<int>() : DEFAULT_PACKETS;
+	if (opt.packets < 1) {
+		cerr << "ERROR: packets must be at least 1" << endl;
+		return ERROR_IN_COMMAND_LINE;
+	}
+	opt.seed = vm.count("seed") ? vm["seed"].as<unsigned long>() : 1;
+	if (vm.count("profile")) {
+		opt.profiles = vm["profile"].as<vector<string> >();
+	}
+
+	memset(&opt.rates, 0, sizeof(opt.rates));
+	opt.custom = false;
+	if (vm.count("bit-flip")) {
+		opt.rates.bit_flip = vm["bit-flip"].as<double>();
+		opt.custom = true;
+	}
+	if (vm.count("drop")) {
+		opt.rates.drop = vm["drop"].as<double>();
+		opt.custom = true;
+	}
+	if (vm.count("dup-dle")) {
+		opt.rates.dup_dle = vm["dup-dle"].as<double>();
+		opt.custom = true;
+	}
+	if (vm.count("truncate")) {
+		opt.rates.truncate = vm["truncate"].as<double>();
+		opt.custom = true;
+	}
+	if (vm.count("burst")) {
+		opt.rates.burst_max = vm["burst"].as<int>();
+		opt.custom = true;
+	}
+
+	opt.port = vm.count("gps-port") ? vm["gps-port"].as<string>() : "";
+	opt.seconds = vm.count("seconds") ? vm["seconds"].as<int>() : 60;
+	opt.alloc_check = vm.count("alloc-check") > 0;
+	opt.raw_file = vm.count("raw-file") ? vm["raw-file"].as<string>() : "";
+	opt.shm = vm.count("shm") ? vm["shm"].as<string>() : "";
+	opt.mcast = vm.count("mcast") ? vm["mcast"].as<string>() : "";
+	opt.mcast_port = vm.count("mcast-port") ? vm["mcast-port"].as<int>() : MCAST_DEFAULT_PORT;
+	return SUCCESS;
+}
+
+int main(int argc, char **argv) {
+	soak_options opt;
+	vector<const profile_entry *> selected;
+	profile_entry custom;
+
+	int rc = proc_args(argc, argv, opt);
+	if (rc != (int)SUCCESS) {
+		return (rc == (int)EXIT_HELP) ? (int)SUCCESS : rc;
+	}
+
+	if (opt.custom) {
+		custom.name = "custom";
+		custom.profile = opt.rates;
+		selected.push_back(&custom);
+	}
+	for (size_t k=0; k<opt.profiles.size(); k++) {
+		int i;
+		for (i=0; i<profile_cnt && opt.profiles[k] != profiles[i].name; i++) {
+		}
+		if (i == profile_cnt) {
+			cerr << "ERROR: unknown profile " << opt.profiles[k] << endl;
+			return ERROR_IN_COMMAND_LINE;
+		}
+		selected.push_back(&profiles[i]);
+	}
+	if (selected.empty()) {
+		for (int i=0; i<profile_cnt; i++) {
+			selected.push_back(&profiles[i]);
+		}
+	}
+
+	if (!opt.port.empty()) {
+		return run_port(opt, selected[0]->profile);
+	}
+
+	vector<UINT8> stream;
+	build_stream(opt.packets, !opt.raw_file.empty(), stream);
+	printf("%d packet pairs, %lu bytes, seed %lu\n\n", opt.packets,
+			(unsigned long)stream.size(), opt.seed);
+	printf("%-10s %8s %9s %9s %8s %6s %7s %6s %6s %9s %9s %8s\n",
+			"profile", "faults", "sent", "recovered", "lost", "false",
+			"short", "long", "over", "misframed", "skipped", "MB/s");
+	rc = SUCCESS;
+	for (size_t i=0; i<selected.size(); i++) {
+		if (!run_profile(opt, selected[i]->name, selected[i]->profile, stream)) {
+			rc = FAILURE;
+		}
+	}
+	if (opt.alloc_check && rc == (int)SUCCESS) {
+		printf("\nno heap allocations after warm-up\n");
+	}
+	return rc;
+}
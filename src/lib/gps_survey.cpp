@@ -1,170 +1,708 @@
-/*
- * gps_survey.cpp
- *
- * Access the gps unit and force a self-survey to acquire the new
- * position of the station.
- *
- *  Created on: Oct 24, 2016
- *      Author: cswaim
- *
- * Copyright 2016 Vandevender Enterprises.
- *
- * This is free software; you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation; either version 3, or (at your option)
- * any later version.
- *
- * This software is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this software; see the file COPYING.  If not, write to
- * the Free Software Foundation, Inc., 51 Franklin Street,
- * Boston, MA 02110-1301, USA.
- */
-#include <gps_survey.h>
-
-namespace {
-  const size_t ERROR_IN_COMMAND_LINE = 3;
-  const size_t SUCCESS = 0;
-  const size_t FAILURE = 1;
-  const size_t ERROR_UNHANDLED_EXCEPTION = 4;
-  const size_t EXIT_HELP = 2;
-}
-using namespace std;
-
-int proc_args(int argc,char**  argv) {
-	// Declare the supported options.
-	po::options_description desc("Allowed options");
-	desc.add_options()
-		("help,h", "display help text")
-		("wait-sec,w", po::value<int>(), "sleep delay seconds, default is 100")
-		("survey-cnt,s", po::value<int>(), "survey sample cnt to fix position, default is 100")
-		("gps-port,g", po::value<string>(), "gps port, default is /dev/ttyUSB0")
-	;
-
-	//po::variables_map vm;
-	try {
-		po::store(po::parse_command_line(argc, argv, desc), vm);
-
-		if (vm.count("help")) {
-			cout << "gps_survey will reset the gps location" << endl << endl;
-			cout << desc << "\n";
-			return EXIT_HELP;
-		}
-
-		po::notify(vm);  //throws on error, do after help
-
-	} catch(po::error& e) {
-		cerr << "ERROR: " << e.what() << std::endl << endl;
-		cerr << desc << endl;
-		return ERROR_IN_COMMAND_LINE;
-	}
-
-	cout << endl;
-	//set run parms
-	if (vm.count("wait-sec")) {
-		wait_sec = vm["wait-sec"].as<int>();
-	} else {
-		wait_sec = 100;
-	}
-	cout << "wait_sec set: " << wait_sec << endl;
-
-	if (vm.count("survey-cnt")) {
-		survey_cnt = vm["survey-cnt"].as<int>();
-	} else {
-		survey_cnt = 100;
-	}
-	cout << "survey_cnt set: " << survey_cnt << endl;
-
-
-	if (vm.count("gps-port")) {
-		gps_port = vm["gps-port"].as<string>();
-	} else {
-		gps_port = "/dev/ttyUSB0";
-	}
-	cout << "gps_port set: " << gps_port << endl;
-
-
-	return 0;
-}
-
-void test_prt(int argc,char **argv) {
-	cout << endl << "----from test_prt--------" << endl;
-	cout << "number parms: " << argc << " -- parms: " << argv << endl;
-		for (int i =0; i < argc; i++) {
-			cout << argv[i] << endl;
-		}
-	if (vm.count("wait-sec")) {
-		cout << "wait-sec: " << vm["wait-sec"].as<int>() << endl;
-	} else {
-		cout << "variable wait-sec not found" << endl;
-		//cout << vm;
-	}
-	cout << endl;
-	cout << boost::format("  gps-port: %s") % gps_port << endl;
-	cout << boost::format("survey-cnt: %i") % survey_cnt << endl;
-	cout << boost::format("  wait-sec: %i") % wait_sec << endl;
-	
-	cout << endl << "-------------------------" << endl << endl;
-}
-
-int main(int argc,char **argv) {
-	rc = 0;
-	
-	try {
-		int rtn = proc_args(argc,argv);
-		if (rtn > EXIT_SUCCESS) {
-			if (rtn != EXIT_HELP) {
-				cout << " ***(" << rtn << ") error encountered in parms***" << endl << endl;
-			}
-			throw ERROR_IN_COMMAND_LINE;
-		}
-		
-		//test_prt(argc,argv);
-
-		//instantiate gps class
-		cout << boost::format("gps is on port: %s") % gps_port<< endl;
-		tsip gps(gps_port);
-		
-		if (!gps.port_status) {
-			cout << "Unable to open port - terminating run" << endl;
-			throw 99;
-		}
-		
-		bool rc;
-		//set the survey count
-		cout << "setting survey_count to " << survey_cnt << endl;
-		rc = gps.set_survey_params(survey_cnt);
-		
-		//start self survey
-		cout << "starting self survey for " << survey_cnt << " position readings" << endl;
-		rc = gps.start_self_survey();
-		
-		//wait for survey to finish
-		if (wait_sec > 0) {
-			cout << "waiting for " << wait_sec << " seconds." << endl;
-			sleep(wait_sec);
-			cout << "OK...done!" << endl;
-		}
-		
-		rc = 0;
-	} 
-	catch(exception& e) {
-		cerr << "Unhandled Exception reached the top of main: "
-		     << e.what() << ", application will now exit" << endl;
-		rc = ERROR_UNHANDLED_EXCEPTION;
-		return ERROR_UNHANDLED_EXCEPTION;
-	} 
-	catch (int n) {
-		rc = n;
-	}
-	catch(...) {
-	}
-	
-	return rc;
-}
-
-
+/*
+ * gps_survey.cpp
+ *
+ * Access the gps unit and force a self-survey to acquire the new
+ * position of the station.
+ *
+ *  Created on: Oct 24, 2016
+ *      Author: cswaim
+ *
+ * Copyright 2016 Vandevender Enterprises.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <gps_survey.h>
+#include <algorithm>
+#include <chrono>
+#include <glob.h>
+#include <thread>
+
+namespace {
+  const size_t ERROR_IN_COMMAND_LINE = 3;
+  const size_t SUCCESS = 0;
+  const size_t FAILURE = 1;
+  const size_t ERROR_UNHANDLED_EXCEPTION = 4;
+  const size_t EXIT_HELP = 2;
+  const int ERROR_PORT = 99;
+  const int ERROR_NO_REPLY = 98;
+  const int NO_REPLY_MAX = 5;           // position requests unanswered in a row
+  const int RESTORE_CHECK_SEC = 60;     // seconds of fixes to check the antenna
+  const double RESTORE_TOLERANCE = 2.0; // meters, single precision rounding of 0x32
+  const int DEFAULT_JOBS = 8;           // receivers surveyed at the same time
+
+  const char *state_names[] = {
+	"queued", "opening", "restoring", "surveying", "waiting", "done", "failed"
+  };
+}
+using namespace std;
+
+int proc_args(int argc,char**  argv, survey_options &opt) {
+	po::variables_map vm;
+
+	// Declare the supported options.
+	po::options_description desc("Allowed options");
+	desc.add_options()
+		("help,h", "display help text")
+		("wait-sec,w", po::value<int>(), "sleep delay seconds, default is 100")
+		("survey-cnt,s", po::value<int>(), "survey sample cnt to fix position, default is 100")
+		("gps-port,g", po::value<vector<string> >()->composing(), "gps port, default is /dev/ttyUSB0; may be repeated, a comma separated list or a glob (\"/dev/ttyUSB*\")")
+		("jobs,j", po::value<int>(), "receivers surveyed at the same time, default is 8")
+		("accuracy,a", po::value<double>(), "stop the survey when the position is known to this many meters (95%), default is 0 - wait for survey-cnt")
+		("store,p", po::value<string>(), "surveyed position store, default is " POSITION_STORE_DEFAULT)
+		("move-limit,m", po::value<double>(), "meters the antenna may move and keep the stored position, default is 10")
+		("no-restore,n", "always survey, do not load the stored position")
+	;
+
+	try {
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help")) {
+			cout << "gps_survey will reset the gps location" << endl << endl;
+			cout << desc << "\n";
+			return EXIT_HELP;
+		}
+
+		po::notify(vm);  //throws on error, do after help
+
+	} catch(po::error& e) {
+		cerr << "ERROR: " << e.what() << std::endl << endl;
+		cerr << desc << endl;
+		return ERROR_IN_COMMAND_LINE;
+	}
+
+	cout << endl;
+	//set run parms
+	if (vm.count("wait-sec")) {
+		opt.wait_sec = vm["wait-sec"].as<int>();
+	} else {
+		opt.wait_sec = 100;
+	}
+	cout << "wait_sec set: " << opt.wait_sec << endl;
+
+	if (vm.count("survey-cnt")) {
+		opt.survey_cnt = vm["survey-cnt"].as<int>();
+	} else {
+		opt.survey_cnt = 100;
+	}
+	cout << "survey_cnt set: " << opt.survey_cnt << endl;
+
+
+	if (vm.count("gps-port")) {
+		opt.ports = expand_ports(vm["gps-port"].as<vector<string> >());
+		if (opt.ports.empty()) {
+			cerr << "ERROR: no gps port found" << endl;
+			return ERROR_IN_COMMAND_LINE;
+		}
+	} else {
+		opt.ports.push_back("/dev/ttyUSB0");
+	}
+	for (size_t i = 0; i < opt.ports.size(); i++) {
+		cout << "gps_port set: " << opt.ports[i] << endl;
+	}
+
+	if (vm.count("jobs")) {
+		opt.jobs = vm["jobs"].as<int>();
+		if (opt.jobs < 1) {
+			cerr << "ERROR: jobs must be at least 1" << endl;
+			return ERROR_IN_COMMAND_LINE;
+		}
+	} else {
+		opt.jobs = DEFAULT_JOBS;
+	}
+	if (opt.ports.size() > 1) {
+		cout << "jobs set: " << opt.jobs << endl;
+	}
+
+	if (vm.count("accuracy")) {
+		opt.target_accuracy = vm["accuracy"].as<double>();
+	} else {
+		opt.target_accuracy = 0;
+	}
+	cout << "accuracy set: " << opt.target_accuracy << endl;
+
+	if (vm.count("store")) {
+		opt.store_path = vm["store"].as<string>();
+	} else {
+		opt.store_path = POSITION_STORE_DEFAULT;
+	}
+	cout << "store set: " << opt.store_path << endl;
+
+	if (vm.count("move-limit")) {
+		opt.move_limit = vm["move-limit"].as<double>();
+	} else {
+		opt.move_limit = 10;
+	}
+	cout << "move_limit set: " << opt.move_limit << endl;
+
+	opt.restore = (vm.count("no-restore") == 0);
+
+
+	return 0;
+}
+
+void test_prt(int argc,char **argv, const survey_options &opt) {
+	cout << endl << "----from test_prt--------" << endl;
+	cout << "number parms: " << argc << " -- parms: " << argv << endl;
+		for (int i =0; i < argc; i++) {
+			cout << argv[i] << endl;
+		}
+	cout << endl;
+	for (size_t i = 0; i < opt.ports.size(); i++) {
+		cout << boost::format("  gps-port: %s") % opt.ports[i] << endl;
+	}
+	cout << boost::format("survey-cnt: %i") % opt.survey_cnt << endl;
+	cout << boost::format("  wait-sec: %i") % opt.wait_sec << endl;
+	
+	cout << endl << "-------------------------" << endl << endl;
+}
+
+/** expand ports
+*
+*   Split each --gps-port value at the commas and expand the globs.
+*   A name without wildcards is kept even when it does not exist, so
+*   the survey reports it as not opened.  Duplicates are dropped.
+*
+*   @param vector<string> option values
+*   @return vector<string> ports in order
+*/
+vector<string> expand_ports(const vector<string> &args) {
+	vector<string> ports;
+
+	for (size_t i = 0; i < args.size(); i++) {
+		stringstream list(args[i]);
+		string item;
+
+		while (getline(list, item, ',')) {
+			if (item.empty()) {
+				continue;
+			}
+			vector<string> names;
+			if (item.find_first_of("*?[") == string::npos) {
+				names.push_back(item);
+			} else {
+				glob_t g;
+				memset(&g, 0, sizeof(g));
+				if (glob(item.c_str(), 0, NULL, &g) == 0) {
+					for (size_t k = 0; k < g.gl_pathc; k++) {
+						names.push_back(g.gl_pathv[k]);
+					}
+				} else {
+					cerr << "no port matches " << item << endl;
+				}
+				globfree(&g);
+			}
+			for (size_t k = 0; k < names.size(); k++) {
+				if (find(ports.begin(), ports.end(), names[k]) == ports.end()) {
+					ports.push_back(names[k]);
+				}
+			}
+		}
+	}
+	return ports;
+}
+
+/** set job state
+*
+*   @return void
+*/
+static void set_state(survey_job &job, survey_shared &shared, survey_job::state_t state) {
+	{
+		lock_guard<mutex> guard(job.lock);
+		job.state = state;
+	}
+	shared.changes++;
+}
+
+/** read position
+*
+*   Request the 8F-AC, waited for with a timeout.
+*
+*   @param tsip& gps
+*   @return bool true - the receiver replied, false - timeout or closed port
+*/
+static bool read_position(tsip &gps) {
+	unsigned long long since = gps.get_generation();
+
+	gps.get_xyz();
+	return gps.m_secondary_time.stamp.generation > since;
+}
+
+/** host survey
+*
+*   Average the receiver positions on the host while the receiver survey
+*   runs.  As soon as the position is known to the target accuracy it is
+*   loaded as the accurate position, which ends the receiver survey, and
+*   saved to eeprom.  The wait is limited to wait_sec seconds.
+*
+*   @param tsip& gps
+*   @param survey_options& run parameters
+*   @param survey_job& progress of this receiver
+*   @param estimate_t& returned position
+*   @return int 0 - position stored, 1 - target not reached,
+*               ERROR_NO_REPLY - the receiver stopped replying
+*/
+int host_survey(tsip &gps, const survey_options &opt, survey_job &job,
+		survey_estimator::estimate_t &pos) {
+	ostream &out = *job.out;
+	survey_estimator est;
+	time_t start = time(NULL);
+	int progress = 0;
+	int missed = 0;
+
+	out << "averaging positions for up to " << opt.wait_sec << " seconds." << endl;
+	gps.set_verbose(false);
+
+	while (time(NULL) - start < opt.wait_sec) {
+		if (!read_position(gps)) {
+			if (++missed >= NO_REPLY_MAX) {
+				out << "receiver does not reply" << endl;
+				return ERROR_NO_REPLY;
+			}
+			sleep(1);
+			continue;
+		}
+		missed = 0;
+		if (gps.m_secondary_time.valid) {
+			progress = gps.m_secondary_time.report.self_survey_progress;
+		}
+		if (est.add_report(gps)) {
+			pos = est.get_estimate();
+			{
+				lock_guard<mutex> guard(job.lock);
+				job.samples = pos.samples;
+				job.h95 = pos.horizontal_radius;
+				job.progress = progress;
+			}
+			if (pos.samples % 10 == 0) {
+				out << boost::format("%5i samples  h95 %8.3f m  v95 %8.3f m  n_eff %6.1f  survey %3i%%")
+					% pos.samples % pos.horizontal_radius % pos.vertical_radius
+					% pos.effective_samples % progress << endl;
+			}
+			if (est.is_converged(opt.target_accuracy)) {
+				break;
+			}
+		}
+		sleep(1);
+	}
+
+	if (!est.is_converged(opt.target_accuracy)) {
+		out << "target accuracy not reached, receiver survey continues" << endl;
+		return 1;
+	}
+
+	pos = est.get_estimate();
+	out << boost::format("position lat %.9f  lon %.9f  alt %.3f  (%i samples, h95 %.3f m, v95 %.3f m)")
+		% (pos.latitude*gps._rad) % (pos.longitude*gps._rad) % pos.altitude
+		% pos.samples % pos.horizontal_radius % pos.vertical_radius << endl;
+	out << boost::format("  median lat %.9f  lon %.9f  alt %.3f")
+		% (pos.median_latitude*gps._rad) % (pos.median_longitude*gps._rad) % pos.median_altitude << endl;
+
+	if (!gps.set_accurate_position(pos.latitude, pos.longitude, pos.altitude)) {
+		out << "unable to send accurate position" << endl;
+		return 1;
+	}
+	gps.save_to_eeprom(7);
+	out << "accurate position stored, survey stopped" << endl;
+	return 0;
+}
+
+/** restore position
+*
+*   Load the stored position of this receiver back into the gps.  The
+*   current fixes are averaged for RESTORE_CHECK_SEC seconds first, and
+*   the stored position is only used when the antenna is within
+*   move_limit meters (plus the uncertainty of the check) of it.  The
+*   position is then saved to eeprom and the gps is checked to be using
+*   it.
+*
+*   @param tsip& gps
+*   @param survey_options& run parameters
+*   @param survey_shared& position store
+*   @param survey_job& receiver, serial number set
+*   @return int 0 - position restored, 1 - survey needed,
+*               ERROR_NO_REPLY - the receiver stopped replying
+*/
+int restore_position(tsip &gps, const survey_options &opt, survey_shared &shared,
+		survey_job &job) {
+	ostream &out = *job.out;
+	position_store::entry_t stored;
+	position_store::entry_t current;
+	survey_estimator est(10);
+	survey_estimator::estimate_t pos;
+	bool found = false;
+	int missed = 0;
+
+	if (!job.serial.empty()) {
+		lock_guard<mutex> guard(shared.store_lock);
+		found = shared.store.find(job.serial, stored);
+	}
+	if (!found) {
+		out << "no stored position for receiver " << job.serial << endl;
+		return 1;
+	}
+	out << boost::format("stored position for %s: lat %.9f  lon %.9f  alt %.3f  (h95 %.3f m)")
+		% job.serial % (stored.latitude*gps._rad) % (stored.longitude*gps._rad)
+		% stored.altitude % stored.horizontal_radius << endl;
+
+	out << "checking antenna position for " << RESTORE_CHECK_SEC << " seconds." << endl;
+	gps.set_verbose(false);
+	time_t start = time(NULL);
+	while (time(NULL) - start < RESTORE_CHECK_SEC) {
+		if (!read_position(gps)) {
+			if (++missed >= NO_REPLY_MAX) {
+				out << "receiver does not reply" << endl;
+				return ERROR_NO_REPLY;
+			}
+			sleep(1);
+			continue;
+		}
+		missed = 0;
+		if (est.add_report(gps)) {
+			lock_guard<mutex> guard(job.lock);
+			job.samples = est.get_samples();
+		}
+		sleep(1);
+	}
+	if (est.get_samples() < 10) {
+		out << "receiver has no position fix, unable to check antenna" << endl;
+		return 1;
+	}
+
+	pos = est.get_estimate();
+	current.latitude = pos.latitude;
+	current.longitude = pos.longitude;
+	current.altitude = pos.altitude;
+	double hd = position_store::horizontal_distance(stored, current);
+	double vd = position_store::vertical_distance(stored, current);
+	out << boost::format("antenna is %.2f m (h) %.2f m (v) from the stored position") % hd % vd << endl;
+	if (hd > opt.move_limit + pos.horizontal_radius || vd > opt.move_limit + pos.vertical_radius) {
+		out << "antenna has moved, stored position not used" << endl;
+		return 1;
+	}
+
+	if (!gps.set_accurate_position(stored.latitude, stored.longitude, stored.altitude)) {
+		out << "unable to send accurate position" << endl;
+		return 1;
+	}
+	gps.save_to_eeprom(7);
+
+	if (!gps.verify_accurate_position(stored.latitude, stored.longitude, stored.altitude, RESTORE_TOLERANCE)) {
+		out << "receiver did not accept the stored position" << endl;
+		return 1;
+	}
+	return 0;
+}
+
+/** survey port
+*
+*   The whole workflow for one receiver: restore the stored position
+*   when the antenna has not moved, otherwise start the self survey and
+*   wait for it, on the host when a target accuracy is given.  Runs on a
+*   worker thread in fleet mode, everything it touches is in job, opt
+*   (read only) or shared.
+*
+*   @param survey_job& receiver
+*   @param survey_options& run parameters
+*   @param survey_shared& position store
+*   @return int 0 - done, ERROR_PORT - unable to open the port,
+*               ERROR_NO_REPLY - the receiver does not reply
+*/
+int survey_port(survey_job &job, const survey_options &opt, survey_shared &shared) {
+	ostream &out = *job.out;
+	string result;
+
+	set_state(job, shared, survey_job::OPENING);
+	out << boost::format("gps is on port: %s") % job.port << endl;
+	tsip gps("", false);
+	gps.set_verbose(job.out == &cout);
+	if (!gps.open_gps_port(job.port) || !gps.port_status) {
+		out << "Unable to open port - terminating run" << endl;
+		{
+			lock_guard<mutex> guard(job.lock);
+			job.result = "port not opened";
+		}
+		return ERROR_PORT;
+	}
+
+	//reload the stored position when the antenna has not moved
+	string serial = gps.get_serial_number();
+	{
+		lock_guard<mutex> guard(job.lock);
+		job.serial = serial;
+	}
+	// a receiver without 8E-41 still answers the position request
+	if (serial.empty() && !read_position(gps)) {
+		out << "receiver does not reply - terminating run" << endl;
+		lock_guard<mutex> guard(job.lock);
+		job.result = "no reply";
+		return ERROR_NO_REPLY;
+	}
+	if (opt.restore) {
+		set_state(job, shared, survey_job::RESTORING);
+		int rc = restore_position(gps, opt, shared, job);
+		if (rc == 0) {
+			out << "stored position restored, survey skipped" << endl;
+			lock_guard<mutex> guard(job.lock);
+			job.result = "restored";
+			return 0;
+		}
+		if (rc == ERROR_NO_REPLY) {
+			lock_guard<mutex> guard(job.lock);
+			job.result = "no reply";
+			return ERROR_NO_REPLY;
+		}
+	}
+
+	//set the survey count
+	set_state(job, shared, survey_job::SURVEYING);
+	out << "setting survey_count to " << opt.survey_cnt << endl;
+	gps.set_survey_params(opt.survey_cnt);
+
+	//start self survey
+	out << "starting self survey for " << opt.survey_cnt << " position readings" << endl;
+	gps.start_self_survey();
+
+	//wait for survey to finish
+	if (opt.target_accuracy > 0) {
+		survey_estimator::estimate_t pos;
+		int rc = host_survey(gps, opt, job, pos);
+		if (rc == ERROR_NO_REPLY) {
+			lock_guard<mutex> guard(job.lock);
+			job.result = "no reply";
+			return ERROR_NO_REPLY;
+		}
+		if (rc == 0) {
+			result = "surveyed";
+			if (!serial.empty()) {
+				position_store::entry_t entry;
+				entry.serial = serial;
+				entry.latitude = pos.latitude;
+				entry.longitude = pos.longitude;
+				entry.altitude = pos.altitude;
+				entry.horizontal_radius = pos.horizontal_radius;
+				entry.vertical_radius = pos.vertical_radius;
+				entry.samples = pos.samples;
+				entry.surveyed = time(NULL);
+				lock_guard<mutex> guard(shared.store_lock);
+				if (shared.store.update(entry) && shared.store.save()) {
+					out << "surveyed position saved to " << opt.store_path << endl;
+				}
+			}
+		} else {
+			result = "not converged";
+		}
+	} else {
+		result = "survey started";
+		if (opt.wait_sec > 0) {
+			set_state(job, shared, survey_job::WAITING);
+			out << "waiting for " << opt.wait_sec << " seconds." << endl;
+			sleep(opt.wait_sec);
+			out << "OK...done!" << endl;
+		}
+	}
+
+	lock_guard<mutex> guard(job.lock);
+	job.result = result;
+	return 0;
+}
+
+/** print table
+*
+*   One line per receiver.  On a terminal the previous table is
+*   overwritten.
+*
+*   @param vector<survey_job> jobs
+*   @param bool  overwrite the table printed before
+*   @return void
+*/
+static void print_table(vector<survey_job> &jobs, bool overwrite) {
+	time_t now = time(NULL);
+	const char *clear = overwrite ? "\033[K" : "";
+
+	if (overwrite) {
+		cout << "\033[" << (jobs.size() + 1) << "A";
+	}
+	cout << boost::format("%-20s %-14s %-10s %6s %8s %9s %8s  %-16s")
+		% "port" % "serial" % "state" % "survey" % "samples" % "h95 m" % "elapsed" % "result"
+		<< clear << endl;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		survey_job &job = jobs[i];
+		lock_guard<mutex> guard(job.lock);
+		long elapsed = 0;
+		if (job.state != survey_job::QUEUED) {
+			elapsed = ((job.finished ? job.finished : now) - job.started);
+		}
+		cout << boost::format("%-20s %-14s %-10s %5i%% %8i %9.3f %5i:%02i  %-16s")
+			% job.port % job.serial % state_names[job.state] % job.progress
+			% job.samples % job.h95 % (elapsed / 60) % (elapsed % 60) % job.result
+			<< clear << endl;
+	}
+	cout.flush();
+}
+
+/** run fleet
+*
+*   Survey all the ports with opt.jobs worker threads.  The main thread
+*   prints the progress table, redrawn in place on a terminal and
+*   printed on every change otherwise, then the log of each receiver
+*   that did not finish cleanly and a summary of the results.
+*
+*   @param vector<survey_job> jobs, one per port
+*   @param survey_options& run parameters
+*   @param survey_shared& position store
+*   @return int SUCCESS - every survey returned 0, FAILURE otherwise
+*/
+int run_fleet(vector<survey_job> &jobs, const survey_options &opt, survey_shared &shared) {
+	atomic<size_t> next(0);
+	atomic<size_t> finished(0);
+	vector<thread> workers;
+	bool tty = isatty(STDOUT_FILENO);
+
+	size_t n = min(jobs.size(), (size_t)opt.jobs);
+	for (size_t w = 0; w < n; w++) {
+		workers.push_back(thread([&]() {
+			size_t i;
+			while ((i = next++) < jobs.size()) {
+				survey_job &job = jobs[i];
+				int rc;
+				{
+					lock_guard<mutex> guard(job.lock);
+					job.started = time(NULL);
+				}
+				try {
+					rc = survey_port(job, opt, shared);
+				} catch (exception &e) {
+					*job.out << "exception: " << e.what() << endl;
+					lock_guard<mutex> guard(job.lock);
+					job.result = "exception";
+					rc = ERROR_UNHANDLED_EXCEPTION;
+				}
+				{
+					lock_guard<mutex> guard(job.lock);
+					job.rc = rc;
+					job.finished = time(NULL);
+				}
+				set_state(job, shared, rc == 0 ? survey_job::DONE : survey_job::FAILED);
+				finished++;
+			}
+		}));
+	}
+
+	cout << endl;
+	unsigned seen = shared.changes;
+	time_t drawn = time(NULL);
+	print_table(jobs, false);
+	while (finished < jobs.size()) {
+		this_thread::sleep_for(chrono::milliseconds(200));
+		unsigned changes = shared.changes;
+		// a terminal also gets the elapsed times ticking
+		if (changes != seen || (tty && time(NULL) != drawn)) {
+			seen = changes;
+			drawn = time(NULL);
+			print_table(jobs, tty);
+		}
+	}
+	for (size_t w = 0; w < workers.size(); w++) {
+		workers[w].join();
+	}
+	print_table(jobs, tty);
+
+	// logs of the receivers that need a look
+	for (size_t i = 0; i < jobs.size(); i++) {
+		survey_job &job = jobs[i];
+		if (job.rc != 0 || job.result == "not converged") {
+			cout << endl << "---- " << job.port << " ----" << endl << job.log.str();
+		}
+	}
+
+	vector<string> results;
+	vector<int> counts;
+	int failed = 0;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		size_t k = find(results.begin(), results.end(), jobs[i].result) - results.begin();
+		if (k == results.size()) {
+			results.push_back(jobs[i].result);
+			counts.push_back(0);
+		}
+		counts[k]++;
+		failed += (jobs[i].rc != 0);
+	}
+	cout << endl << "summary: " << jobs.size() << " receivers";
+	for (size_t k = 0; k < results.size(); k++) {
+		cout << ", " << counts[k] << " " << results[k];
+	}
+	cout << endl;
+	if (failed) {
+		cout << failed << " receivers failed" << endl;
+	}
+	return failed ? FAILURE : SUCCESS;
+}
+
+int main(int argc,char **argv) {
+	survey_options opt;
+	int rc = 0;
+	
+	try {
+		int rtn = proc_args(argc,argv,opt);
+		if (rtn > EXIT_SUCCESS) {
+			if (rtn != EXIT_HELP) {
+				cout << " ***(" << rtn << ") error encountered in parms***" << endl << endl;
+			}
+			throw ERROR_IN_COMMAND_LINE;
+		}
+		
+		//test_prt(argc,argv,opt);
+
+		survey_shared shared(opt.store_path);
+		if (!shared.store.load()) {
+			cout << "unable to read position store " << opt.store_path << endl;
+		}
+
+		// survey_job holds a mutex, the vector is sized once and never moved
+		vector<survey_job> jobs(opt.ports.size());
+		for (size_t i = 0; i < jobs.size(); i++) {
+			survey_job &job = jobs[i];
+			job.port = opt.ports[i];
+			job.out = (opt.ports.size() == 1) ? &cout : &job.log;
+			job.state = survey_job::QUEUED;
+			job.progress = 0;
+			job.samples = 0;
+			job.h95 = 0;
+			job.started = 0;
+			job.finished = 0;
+			job.rc = 0;
+		}
+
+		if (jobs.size() == 1) {
+			rc = survey_port(jobs[0], opt, shared);
+		} else {
+			rc = run_fleet(jobs, opt, shared);
+		}
+	} 
+	catch(exception& e) {
+		cerr << "Unhandled Exception reached the top of main: "
+		     << e.what() << ", application will now exit" << endl;
+		rc = ERROR_UNHANDLED_EXCEPTION;
+		return ERROR_UNHANDLED_EXCEPTION;
+	} 
+	catch (int n) {
+		rc = n;
+	}
+	catch(...) {
+	}
+	
+	return rc;
+}
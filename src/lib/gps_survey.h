@@ -1,30 +1,77 @@
-/*
- * gps_survey.h
- *
- *  Created on: Oct 24, 2016
- *      Author: cswaim
- */
-
-#ifndef GPS_SURVEY_H_
-#define GPS_SURVEY_H_
-
-#include <boost/program_options.hpp>
-#include <boost/format.hpp>
-#include <string>
-#include <iostream>
-
-#include <tsip.h>
-
-
-namespace po = boost::program_options;
-
-po::variables_map vm;
-int wait_sec;
-int survey_cnt;
-tsip gps;
-std::string gps_port;     // "/dev/ttyUSB0"
-int rc;                   // program return code 
-
-int proc_args(int argc,char** argv, po::variables_map &vm);
-
-#endif /* GPS_SURVEY_H_ */
+/*
+ * gps_survey.h
+ *
+ *  Created on: Oct 24, 2016
+ *      Author: cswaim
+ */
+
+#ifndef GPS_SURVEY_H_
+#define GPS_SURVEY_H_
+
+#include <boost/program_options.hpp>
+#include <boost/format.hpp>
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+#include <tsip.h>
+#include <survey_estimator.h>
+#include <position_store.h>
+
+
+namespace po = boost::program_options;
+
+// run parameters, read only once the surveys start
+struct survey_options {
+	int wait_sec;
+	int survey_cnt;
+	double target_accuracy;   // meters, 0 - wait for the receiver survey
+	double move_limit;        // meters the antenna may move and keep its position
+	bool restore;             // load the stored position instead of surveying
+	std::string store_path;   // surveyed position store
+	std::vector<std::string> ports;  // "/dev/ttyUSB0", ...
+	int jobs;                 // receivers surveyed at the same time
+};
+
+// one receiver, updated by its worker and read by the progress table
+struct survey_job {
+	enum state_t { QUEUED, OPENING, RESTORING, SURVEYING, WAITING, DONE, FAILED };
+
+	std::string port;
+	std::ostream *out;        // messages of this survey, std::cout for a single port
+	std::ostringstream log;   // out when several ports are surveyed
+
+	std::mutex lock;          // guards the fields below
+	state_t state;
+	std::string serial;
+	std::string result;       // "surveyed", "restored" ...
+	int progress;             // receiver self survey, percent
+	long samples;             // positions averaged on the host
+	double h95;               // meters
+	time_t started;
+	time_t finished;
+	int rc;                   // return code of the survey
+};
+
+// state shared by all the surveys
+struct survey_shared {
+	position_store store;
+	std::mutex store_lock;
+	std::atomic<unsigned> changes;   // bumped on every job update
+
+	survey_shared(const std::string &path) : store(path), changes(0) {}
+};
+
+int proc_args(int argc, char** argv, survey_options &opt);
+std::vector<std::string> expand_ports(const std::vector<std::string> &args);
+int survey_port(survey_job &job, const survey_options &opt, survey_shared &shared);
+int host_survey(tsip &gps, const survey_options &opt, survey_job &job,
+		survey_estimator::estimate_t &pos);
+int restore_position(tsip &gps, const survey_options &opt, survey_shared &shared,
+		survey_job &job);
+int run_fleet(std::vector<survey_job> &jobs, const survey_options &opt, survey_shared &shared);
+
+#endif /* GPS_SURVEY_H_ */
@@ -1,7 +1,17 @@
 #include <tsip.h>
+#include <tsip_reactor.h>
+#include <report_stream.h>
+#include <arrow_export.h>
+#include <timing_spectrum.h>
+#include <tsip_log.h>
+#include <csignal>
+#include <cstring>
 #include <iostream>
 //#include "get_gps_time.h"
 void print_report();
+int stream_reports(stream_format format);
+int export_reports(const std::string &prefix);
+int print_spectrum(int segment);
 std::string port = "/dev/ttyUSB0";
 //std::string port = "/dev/ttyS5";
 tsip::xyz_t xyz;
@@ -10,7 +20,21 @@ tsip gps;
 
 int main(int argc,char **argv)
 {
-	//check for port
+	//check for port, then --ndjson or --binary to stream the reports
+	if (argc > 2 && (strcmp(argv[2], "--ndjson") == 0 || strcmp(argv[2], "--binary") == 0)) {
+		port = argv[1];
+		return stream_reports(strcmp(argv[2], "--ndjson") == 0 ? STREAM_NDJSON : STREAM_BINARY);
+	}
+	//or --arrow PREFIX to export the timing reports
+	if (argc > 3 && strcmp(argv[2], "--arrow") == 0) {
+		port = argv[1];
+		return export_reports(argv[3]);
+	}
+	//or --spectrum [SEGMENT] to follow the spectra of the 8F-AC offsets
+	if (argc > 2 && strcmp(argv[2], "--spectrum") == 0) {
+		port = argv[1];
+		return print_spectrum(argc > 3 ? atoi(argv[3]) : SPECTRUM_SEGMENT);
+	}
 	if (argc > 1) {
 		std::cout << "  argc: " << argc << std::endl;
 		std::cout << "argv 0: " << argv[0] << std::endl;
@@ -39,6 +63,7 @@ int main(int argc,char **argv)
 	}
 	std::cout << "get utc time"<<std::endl;
 	gps_time = gps.get_gps_time_utc();
+	log_flush();			// the decoder messages before the report
     if (gps_time) {
         printf("\nYear: %d, Month: %d, Day: %d, Hour: %d, Minutes: %d, Seconds: %d\n", year, month, day, hour, minute, second);
         printf("seconds: %d\n", gps_time);
@@ -154,3 +179,156 @@ void print_report() {
 		printf("           Year: %i %x\n",gps.m_primary_time.report.year,gps.m_primary_time.report.year);
 	}
 }
+
+// reactor of stream_reports, stopped by SIGINT or SIGTERM
+static tsip_reactor *stream_reactor = NULL;
+static volatile sig_atomic_t stream_stopped = 0;
+
+static void stop_stream(int) {
+	stream_stopped = 1;
+	if (stream_reactor != NULL) {
+		stream_reactor->stop();
+	}
+}
+
+static bool write_report(tsip &gps, void *ctx) {
+	return ((report_stream *)ctx)->write(gps);
+}
+
+/** stream reports
+*
+*   Stay attached to the port and write a record per report decoded
+*   to standard output, one write per batch of reports read, until
+*   interrupted or the output is closed.
+*
+*   @param stream_format  NDJSON or binary, see report_stream.h
+*   @return int           exit status
+*/
+int stream_reports(stream_format format) {
+	report_stream out(STDOUT_FILENO, format);
+	tsip_reactor reactor;
+
+	signal(SIGPIPE, SIG_IGN);
+	gps.set_verbose(false);
+	gps.set_gps_port(port);
+	if (!gps.open_gps_port()) {
+		fprintf(stderr, "%s: open failed\n", port.c_str());
+		return 1;
+	}
+	out.set_source(port, 0);
+	if (!reactor.add(gps, write_report, &out)) {
+		return 1;
+	}
+	stream_reactor = &reactor;
+	signal(SIGINT, stop_stream);
+	signal(SIGTERM, stop_stream);
+	while (!stream_stopped && reactor.size() > 0) {
+		if (reactor.poll(-1) < 0 || !out.flush()) {
+			break;
+		}
+	}
+	stream_reactor = NULL;
+	return out.flush() ? 0 : 1;
+}
+
+static bool export_report(tsip &gps, void *ctx) {
+	arrow_writer *out = (arrow_writer *)ctx;
+	return out[0].append(gps) && out[1].append(gps);
+}
+
+/** export reports
+*
+*   Stay attached to the port and export the primary and secondary
+*   timing reports to PREFIX-primary_time.arrows and
+*   PREFIX-secondary_time.arrows, Arrow IPC streams, until interrupted.
+*
+*   @param std::string&  prefix of the files
+*   @return int          exit status
+*/
+int export_reports(const std::string &prefix) {
+	arrow_writer out[2];
+	tsip_reactor reactor;
+	const int subcodes[2] = {REPORT_SUPER_PRIMARY_TIME, REPORT_SUPER_SECONDARY_TIME};
+
+	gps.set_verbose(false);
+	for (int i=0; i<2; i++) {
+		const stream_layout_t *layout = report_stream::get_layout(REPORT_SUPER, subcodes[i]);
+		if (!out[i].open(prefix + "-" + layout->name + ".arrows", REPORT_SUPER, subcodes[i])) {
+			return 1;
+		}
+	}
+	gps.set_gps_port(port);
+	if (!gps.open_gps_port()) {
+		fprintf(stderr, "%s: open failed\n", port.c_str());
+		return 1;
+	}
+	if (!reactor.add(gps, export_report, out)) {
+		return 1;
+	}
+	stream_reactor = &reactor;
+	signal(SIGINT, stop_stream);
+	signal(SIGTERM, stop_stream);
+	while (!stream_stopped && reactor.size() > 0) {
+		if (reactor.poll(-1) < 0) {
+			break;
+		}
+	}
+	stream_reactor = NULL;
+	bool ok = out[0].close() & out[1].close();
+	fprintf(stderr, "%llu primary, %llu secondary timing reports exported\n",
+			out[0].get_rows(), out[1].get_rows());
+	return ok ? 0 : 1;
+}
+
+static bool add_spectrum(tsip &gps, void *ctx) {
+	timing_spectrum *spectrum = (timing_spectrum *)ctx;
+	long segments = spectrum->pps_offset().get_segments();
+
+	if (spectrum->add_report(gps) && spectrum->pps_offset().get_segments() > segments) {
+		const welch_psd *psd[2] = {&spectrum->pps_offset(), &spectrum->tenMHz_offset()};
+		const char *name[2] = {"pps_offset", "tenMHz_offset"};
+		for (int i=0; i<2; i++) {
+			// above the first bins, where the drift left by removing the mean shows
+			int k = psd[i]->peak(psd[i]->frequency(2));
+			printf("%-14s segments %ld  peak %.6f Hz (%.1f s)  %g /Hz\n", name[i],
+					psd[i]->get_segments(), psd[i]->frequency(k), 1 / psd[i]->frequency(k),
+					psd[i]->density(k));
+		}
+		fflush(stdout);
+	}
+	return true;
+}
+
+/** print spectrum
+*
+*   Stay attached to the port and print the highest peak of the
+*   spectra of pps_offset and tenMHz_offset each time a segment of
+*   8F-AC reports completes, half a segment of seconds apart.
+*
+*   @param int  seconds per segment, rounded up to a power of 2
+*   @return int exit status
+*/
+int print_spectrum(int segment) {
+	timing_spectrum spectrum(segment);
+	tsip_reactor reactor;
+
+	gps.set_verbose(false);
+	gps.set_gps_port(port);
+	if (!gps.open_gps_port()) {
+		fprintf(stderr, "%s: open failed\n", port.c_str());
+		return 1;
+	}
+	if (!reactor.add(gps, add_spectrum, &spectrum)) {
+		return 1;
+	}
+	stream_reactor = &reactor;
+	signal(SIGINT, stop_stream);
+	signal(SIGTERM, stop_stream);
+	while (!stream_stopped && reactor.size() > 0) {
+		if (reactor.poll(-1) < 0) {
+			break;
+		}
+	}
+	stream_reactor = NULL;
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * multicast_test.cpp
+ *
+ * Loopback test of the timing snapshot multicast, run by ctest.  A
+ * publisher sends the 8F-AB and 8F-AC decoded from known packets as
+ * the snapshots of MCAST_BATCH_MAX + 7 receivers to 127.0.0.1, and
+ * the subscriber must receive each record as sent, in two datagrams.
+ * Datagrams written by hand then check that a gap in the sequence of
+ * a sender is counted as lost and that a datagram with a wrong magic
+ * is rejected.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "tsip.h"
+#include "tsip_multicast.h"
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#define TEST_ADDRESS		"127.0.0.1"
+#define TEST_RECEIVERS		(MCAST_BATCH_MAX + 7)
+#define TEST_SENDER			7
+#define TEST_WAIT_MS		1000
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL line %d: %s\n", __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+// big endian fields of a TSIP packet body
+static void put_be(std::vector<UINT8> &body, const void *value, int size) {
+	for (int i=size-1; i>=0; i--) {
+		body.push_back(((const UINT8 *)value)[i]);
+	}
+}
+
+/** feed
+*
+*   Decode a packet body, framed and with its DLE bytes stuffed.
+*
+*   @return void
+*/
+static void feed(tsip &gps, const std::vector<UINT8> &body) {
+	std::vector<UINT8> frame;
+
+	frame.push_back(0x10);
+	for (size_t i=0; i<body.size(); i++) {
+		frame.push_back(body[i]);
+		if (body[i] == 0x10) {
+			frame.push_back(0x10);
+		}
+	}
+	frame.push_back(0x10);
+	frame.push_back(0x03);
+	gps.encode(&frame[0], frame.size(), NULL, NULL);
+}
+
+static void feed_primary(tsip &gps, UINT32 seconds_of_week) {
+	std::vector<UINT8> b = {REPORT_SUPER, REPORT_SUPER_PRIMARY_TIME};
+	UINT16 week = 2300;
+	SINT16 offset = 18;
+	UINT16 year = 2026;
+
+	put_be(b, &seconds_of_week, 4);
+	put_be(b, &week, 2);
+	put_be(b, &offset, 2);
+	b.insert(b.end(), {3, 40, 30, 12, 19, 10});
+	put_be(b, &year, 2);
+	feed(gps, b);
+}
+
+static void feed_secondary(tsip &gps, float pps_offset, double latitude) {
+	std::vector<UINT8> b = {REPORT_SUPER, REPORT_SUPER_SECONDARY_TIME, 7, 0, 100};
+	UINT32 holdover = 0;
+	UINT32 dac = 0x8000;
+	float tenMHz = -0.25f, voltage = 1.2f, temperature = 40.5f;
+	double longitude = -1.8, altitude = 1600;
+
+	put_be(b, &holdover, 4);
+	b.insert(b.end(), 8, 0);			// alarms, decoding status, activity, spares
+	put_be(b, &pps_offset, 4);
+	put_be(b, &tenMHz, 4);
+	put_be(b, &dac, 4);
+	put_be(b, &voltage, 4);
+	put_be(b, &temperature, 4);
+	put_be(b, &latitude, 8);
+	put_be(b, &longitude, 8);
+	put_be(b, &altitude, 8);
+	b.insert(b.end(), 8, 0);
+	feed(gps, b);
+}
+
+/** check publisher
+*
+*   The records of TEST_RECEIVERS receivers, as sent.
+*
+*   @return void
+*/
+static void check_publisher(mcast_subscriber &subscriber, int port) {
+	mcast_publisher publisher;
+	tsip gps("", false);
+	const mcast_timing_t *records;
+
+	gps.set_verbose(false);
+	CHECK(publisher.open(TEST_ADDRESS, port, TEST_ADDRESS, 1, TEST_SENDER));
+	feed_primary(gps, 100000);
+	for (UINT32 i=0; i<TEST_RECEIVERS; i++) {
+		feed_secondary(gps, 0.5f * i, 0.01 * i);
+		CHECK(publisher.update(i, gps));
+	}
+	CHECK(publisher.flush());
+	CHECK(publisher.get_datagrams() == 2);
+	CHECK(publisher.get_records() == TEST_RECEIVERS);
+
+	UINT32 received = 0;
+	int n;
+	while (received < TEST_RECEIVERS && (n = subscriber.receive(records, TEST_WAIT_MS)) > 0) {
+		CHECK(subscriber.get_header()->sender == TEST_SENDER);
+		for (int k=0; k<n; k++, received++) {
+			const mcast_timing_t &r = records[k];
+			CHECK(r.receiver == received);
+			CHECK(r.valid == (MCAST_PRIMARY_VALID | MCAST_SECONDARY_VALID));
+			CHECK(r.seconds_of_week == 100000 && r.week_number == 2300 && r.year == 2026);
+			CHECK(r.pps_offset == 0.5f * received);
+			CHECK(r.tenMHz_offset == -0.25f);
+			CHECK(r.dac_value == 0x8000);
+			CHECK(r.latitude == 0.01 * received);
+			CHECK(r.altitude == 1600);
+		}
+	}
+	CHECK(received == TEST_RECEIVERS);
+}
+
+/** send datagram
+*
+*   A header written by hand, with one zeroed record.
+*
+*   @return void
+*/
+static void send_datagram(int fd, int port, UINT32 magic, UINT32 sequence) {
+	union {
+		mcast_header_t header;
+		UINT8 bytes[sizeof(mcast_header_t) + sizeof(mcast_timing_t)];
+	} datagram;
+	struct sockaddr_in to;
+
+	memset(&datagram, 0, sizeof(datagram));
+	datagram.header.magic = magic;
+	datagram.header.version = MCAST_VERSION;
+	datagram.header.record_size = sizeof(mcast_timing_t);
+	datagram.header.sender = TEST_SENDER + 1;
+	datagram.header.sequence = sequence;
+	datagram.header.count = 1;
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(port);
+	inet_pton(AF_INET, TEST_ADDRESS, &to.sin_addr);
+	CHECK(sendto(fd, datagram.bytes, sizeof(datagram.bytes), 0,
+			(const struct sockaddr *)&to, sizeof(to)) == (ssize_t)sizeof(datagram.bytes));
+}
+
+/** check lost and rejected
+*
+*   Sequence 0, then 3: two lost.  A wrong magic: rejected, not
+*   received.
+*
+*   @return void
+*/
+static void check_lost_rejected(mcast_subscriber &subscriber, int port) {
+	const mcast_timing_t *records;
+	mcast_subscriber::stats_t before, after;
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	CHECK(fd >= 0);
+	subscriber.get_stats(before);
+	send_datagram(fd, port, MCAST_MAGIC, 0);
+	send_datagram(fd, port, MCAST_MAGIC, 3);
+	send_datagram(fd, port, ~MCAST_MAGIC, 4);
+	CHECK(subscriber.receive(records, TEST_WAIT_MS) == 1);
+	CHECK(subscriber.receive(records, TEST_WAIT_MS) == 1);
+	CHECK(subscriber.get_header()->sequence == 3);
+	CHECK(subscriber.receive(records, 200) == 0);
+	subscriber.get_stats(after);
+	CHECK(after.datagrams - before.datagrams == 2);
+	CHECK(after.lost - before.lost == 2);
+	CHECK(after.rejected - before.rejected == 1);
+	close(fd);
+}
+
+int main() {
+	mcast_subscriber subscriber;
+	mcast_subscriber::stats_t stats;
+	int port = 20000 + getpid() % 20000;		// ctest may run tests side by side
+
+	if (!subscriber.open(TEST_ADDRESS, port, TEST_ADDRESS)) {
+		printf("FAIL subscriber open on port %d\n", port);
+		return 1;
+	}
+	check_publisher(subscriber, port);
+	subscriber.get_stats(stats);
+	CHECK(stats.datagrams == 2 && stats.records == TEST_RECEIVERS);
+	CHECK(stats.lost == 0 && stats.rejected == 0);
+	check_lost_rejected(subscriber, port);
+	printf("multicast loopback: %d failures\n", failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,602 @@
+/**
+ *	@file nmea.cpp
+ * 	@brief NMEA 0183 sentence decoder
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	nmea gps("/dev/ttyUSB1", 4800);
+ * 	UINT8 buffer[512];
+ * 	ssize_t n;
+ *
+ * 	while ((n = read(gps.get_port_fd(), buffer, sizeof(buffer))) > 0) {
+ * 		gps.decode(buffer, n, on_sentence, NULL);
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "nmea.h"
+#include "gps_frame.h"
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/** Constructor.
+*
+*	The port is opened when given.
+*
+* 	@param string   port name  "/dev/ttyS1"
+* 	@param int      bits per second
+*/
+nmea::nmea(const std::string &port, int baud) {
+	port_status = false;
+	m_fd = -1;
+	m_baud = baud;
+	m_generation = 0;
+	memset(m_sentence, 0, sizeof(m_sentence));
+	m_fields = 0;
+	reset();
+	reset_frame_stats();
+	clear_sentences();
+
+	if (port != "") {
+		open_gps_port(port);
+	}
+}
+
+/** Destructor.
+*
+*	Close the port.
+*/
+nmea::~nmea() {
+	close_gps_port();
+}
+
+/** open gps port
+*
+*   Open the port read only at m_baud, 8N1.
+*
+*   @param string   port name, "" - the one given before
+*   @return bool    true - success
+*/
+bool nmea::open_gps_port(const std::string &port) {
+	if (port != "") {
+		gps_port = port;
+	}
+	if (gps_port == "") {
+		printf("Port must be provided in call or in the constructor\n");
+		return false;
+	}
+	close_gps_port();
+	m_fd = open(gps_port.c_str(), O_RDONLY | O_NOCTTY | O_CLOEXEC);
+	if (m_fd < 0) {
+		perror(gps_port.c_str());
+		port_status = false;
+		return false;
+	}
+	setup_serial_port(m_fd, m_baud);
+	reset();
+	port_status = true;
+	return true;
+}
+
+/** close gps port
+*
+*   @return void
+*/
+void nmea::close_gps_port() {
+	if (m_fd >= 0) {
+		close(m_fd);
+		m_fd = -1;
+	}
+	port_status = false;
+}
+
+/** get gps port
+*
+*   @return string  port name
+*/
+const std::string &nmea::get_gps_port() {
+	return gps_port;
+}
+
+/** get port file descriptor
+*
+*   @return int  file descriptor of the open gps port, -1 if not open
+*/
+int nmea::get_port_fd() {
+	return m_fd;
+}
+
+/** set baud
+*
+*   Change the host side rate.  The input is flushed and the decoder
+*   restarts.
+*
+*   @param int  bits per second
+*   @return bool false - not supported or the port is not open
+*/
+bool nmea::set_baud(int baud) {
+	if (m_fd < 0 || serial_speed(baud) == B0) {
+		return false;
+	}
+	if (!setup_serial_port(m_fd, baud)) {
+		return false;
+	}
+	reset();
+	m_baud = baud;
+	return true;
+}
+
+/** get baud
+*
+*   @return int host side rate, bits per second
+*/
+int nmea::get_baud() {
+	return m_baud;
+}
+
+/** get protocol
+*
+*   @return gps_protocol  PROTOCOL_NMEA
+*/
+gps_protocol nmea::get_protocol() {
+	return PROTOCOL_NMEA;
+}
+
+/** reset
+*
+*   Drop a sentence partly decoded, the next one starts at a '$'.
+*
+*   @return void
+*/
+void nmea::reset() {
+	m_state = START;
+	m_length = 0;
+	m_updated.value = 0;
+}
+
+/** clear sentences
+*
+*   Mark every sentence as never received.
+*
+*   @return void
+*/
+void nmea::clear_sentences() {
+	m_generation = 0;
+	m_rmc.valid = false;
+	m_gga.valid = false;
+	m_gsa.valid = false;
+	m_zda.valid = false;
+	memset(&m_rmc.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_gga.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_gsa.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_zda.stamp, 0, sizeof(struct _report_stamp));
+}
+
+/** stamp sentence
+*
+*   @param _report_stamp&  stamp of the sentence just decoded
+*   @return void
+*/
+void nmea::stamp(struct _report_stamp &stamp) {
+	stamp.generation = ++m_generation;
+	clock_gettime(CLOCK_REALTIME, &stamp.received);
+}
+
+/** get generation
+*
+*   @return unsigned long long  sentences decoded so far
+*/
+unsigned long long nmea::get_generation() {
+	return m_generation;
+}
+
+/** get frame stats
+*
+*   @param nmea_frame_stats&  returned counts since the last reset
+*   @return void
+*/
+void nmea::get_frame_stats(nmea_frame_stats &stats) {
+	stats = m_stats;
+}
+
+/** reset frame stats
+*
+*   @return void
+*/
+void nmea::reset_frame_stats() {
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+/** decode
+*
+*   Decode a block of bytes read from the port, calling the handler
+*   for each sentence that passes its checksum.  The bytes of a
+*   sentence are copied once, into m_sentence.  A '$' inside a
+*   sentence starts a new one, the line feed of the first was lost.
+*
+*   @param UINT8*         bytes read from the gps
+*   @param int            number of bytes
+*   @param frame_handler  called per sentence, may be NULL
+*   @param void*          passed to the handler
+*   @return int  bytes consumed, less than len if the handler stopped
+*/
+int nmea::decode(const UINT8 *data, int len, frame_handler handler, void *ctx) {
+	const UINT8 *p = data;
+	const UINT8 *end = data + len;
+
+	while (p < end) {
+		if (m_state == START) {
+			const UINT8 *dollar = (const UINT8 *)memchr(p, '$', end - p);
+			if (dollar == NULL) {
+				m_stats.skipped += end - p;
+				return len;
+			}
+			m_stats.skipped += dollar - p;
+			p = dollar + 1;
+			m_length = 0;
+			m_state = SENTENCE;
+			continue;
+		}
+
+		const UINT8 *lf = (const UINT8 *)memchr(p, '\n', end - p);
+		const UINT8 *stop = (lf != NULL) ? lf : end;
+		const UINT8 *dollar = (const UINT8 *)memchr(p, '$', stop - p);
+		if (dollar != NULL) {
+			m_stats.restarted++;
+			m_stats.skipped += m_length + (dollar - p) + 1;
+			p = dollar + 1;
+			m_length = 0;
+			continue;
+		}
+
+		int n = stop - p;
+		if (m_length + n > NMEA_MAX_SENTENCE) {
+			m_stats.oversize++;
+			m_stats.skipped += m_length + n + 1;
+			m_state = START;
+			p = (lf != NULL) ? lf + 1 : end;
+			continue;
+		}
+		memcpy(m_sentence + m_length, p, n);
+		m_length += n;
+		if (lf == NULL) {
+			return len;
+		}
+
+		p = lf + 1;
+		m_state = START;
+		if (end_sentence() && handler != NULL && !handler(*this, ctx)) {
+			return p - data;
+		}
+	}
+	return len;
+}
+
+/** hex digit
+*
+*   @return int  value, -1 - not a hex digit
+*/
+static int hex_digit(char c) {
+	if (c >= '0' && c <= '9')	return c - '0';
+	if (c >= 'A' && c <= 'F')	return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f')	return c - 'a' + 10;
+	return -1;
+}
+
+/** end sentence
+*
+*   Check the checksum of the sentence in m_sentence, split its fields
+*   and update the sentence decoded.
+*
+*   @return bool  true - sentence decoded, m_updated has its bit
+*/
+bool nmea::end_sentence() {
+	int n = m_length;
+
+	m_stats.sentences++;
+	m_updated.value = 0;
+	if (n > 0 && m_sentence[n-1] == '\r') {
+		n--;
+	}
+	if (n < 3 || m_sentence[n-3] != '*') {
+		m_stats.no_checksum++;
+		return false;
+	}
+	int hi = hex_digit(m_sentence[n-2]);
+	int lo = hex_digit(m_sentence[n-1]);
+	n -= 3;
+	if (hi < 0 || lo < 0 || checksum((const UINT8 *)m_sentence, n) != ((hi << 4) | lo)) {
+		m_stats.bad_checksum++;
+		return false;
+	}
+
+	m_fields = split_fields(m_sentence, n, m_field, NMEA_MAX_FIELDS);
+	update_sentence();
+	return true;
+}
+
+/** checksum
+*
+*   XOR of the bytes, 16 at a time.
+*
+*   @param UINT8*  bytes between '$' and '*'
+*   @param int     number of bytes
+*   @return UINT8  checksum
+*/
+UINT8 nmea::checksum(const UINT8 *data, int len) {
+	UINT8 sum = 0;
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128i acc = _mm_setzero_si128();
+
+	for (; i + 16 <= len; i += 16) {
+		acc = _mm_xor_si128(acc, _mm_loadu_si128((const __m128i *)(data + i)));
+	}
+	// fold the 16 lanes into the low byte
+	acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 8));
+	acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 4));
+	acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 2));
+	acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 1));
+	sum = (UINT8)_mm_cvtsi128_si32(acc);
+#endif
+	for (; i < len; i++) {
+		sum ^= data[i];
+	}
+	return sum;
+}
+
+/** split fields
+*
+*   Find the commas 16 bytes at a time and end each field with a NUL
+*   in place.  Fields past max_fields stay joined in the last one.
+*
+*   @param char*    sentence without '$' and '*hh', one byte more is written
+*   @param int      number of bytes
+*   @param UINT16*  returned start of each field
+*   @param int      size of start
+*   @return int     fields, at least 1
+*/
+int nmea::split_fields(char *data, int len, UINT16 *start, int max_fields) {
+	int fields = 1;
+	int i = 0;
+
+	start[0] = 0;
+#if defined(__SSE2__)
+	const __m128i comma = _mm_set1_epi8(',');
+
+	for (; i + 16 <= len && fields < max_fields; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, comma));
+
+		while (mask != 0 && fields < max_fields) {
+			int k = i + __builtin_ctz(mask);
+			data[k] = '\0';
+			start[fields++] = k + 1;
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for (; i < len && fields < max_fields; i++) {
+		if (data[i] == ',') {
+			data[i] = '\0';
+			start[fields++] = i + 1;
+		}
+	}
+	data[len] = '\0';
+	return fields;
+}
+
+/** get field count
+*
+*   @return int  fields of the sentence in the handler, the address is field 0
+*/
+int nmea::get_field_count() {
+	return m_fields;
+}
+
+/** get field
+*
+*   Field 0 is the address, "GPRMC".  Only valid in the handler.
+*
+*   @param int  field
+*   @return const char*  NUL terminated, "" - empty or beyond the last
+*/
+const char *nmea::get_field(int field) {
+	if (field < 0 || field >= m_fields) {
+		return "";
+	}
+	return m_sentence + m_field[field];
+}
+
+/** number
+*
+*   @param int  field
+*   @return double  value, NAN - empty
+*/
+double nmea::number(int field) {
+	const char *s = get_field(field);
+
+	if (*s == '\0') {
+		return NAN;
+	}
+	return strtod(s, NULL);
+}
+
+/** coordinate
+*
+*   Latitude ddmm.mmmm or longitude dddmm.mmmm, the field after it is
+*   the hemisphere.
+*
+*   @param int  field of the value
+*   @return double  decimal degrees, south and west negative, NAN - empty
+*/
+double nmea::coordinate(int field) {
+	double v = number(field);
+	char hemisphere = *get_field(field + 1);
+
+	if (std::isnan(v)) {
+		return NAN;
+	}
+	double degrees = floor(v / 100);
+	degrees += (v - degrees * 100) / 60;
+	return (hemisphere == 'S' || hemisphere == 'W') ? -degrees : degrees;
+}
+
+/** time of day
+*
+*   @param double  hhmmss.ss
+*   @return double seconds of the day, NAN - empty
+*/
+static double time_of_day(double hhmmss) {
+	if (std::isnan(hhmmss)) {
+		return NAN;
+	}
+	double hours = floor(hhmmss / 10000);
+	double minutes = floor(fmod(hhmmss, 10000) / 100);
+	return hours * 3600 + minutes * 60 + fmod(hhmmss, 100);
+}
+
+/** date
+*
+*   RMC date ddmmyy, the century is taken as 1980..2079.
+*
+*   @param int      field
+*   @param UINT8&   returned day, 0 - empty
+*   @param UINT8&   returned month
+*   @param UINT16&  returned year
+*   @return void
+*/
+void nmea::date(int field, UINT8 &day, UINT8 &month, UINT16 &year) {
+	const char *s = get_field(field);
+	int v = atoi(s);
+
+	if (*s == '\0') {
+		day = 0;
+		month = 0;
+		year = 0;
+		return;
+	}
+	day = v / 10000;
+	month = (v / 100) % 100;
+	year = v % 100;
+	year += (year < 80) ? 2000 : 1900;
+}
+
+/** update sentence
+*
+*   Decode the fields of RMC, GGA, GSA and ZDA, from any talker.  The
+*   others are left for get_field.
+*
+*   @return void
+*/
+void nmea::update_sentence() {
+	const char *address = get_field(0);
+	const char *type = address + 2;
+
+	if (address[0] == 'P' || strlen(address) != 5) {
+		// proprietary sentence
+		m_updated.sentence.unknown = 1;
+		return;
+	}
+
+	if (memcmp(type, "RMC", 3) == 0) {
+		struct _nmea_rmc::_rmc &r = m_rmc.report;
+		r.utc_time = time_of_day(number(1));
+		r.status = *get_field(2);
+		r.latitude = coordinate(3);
+		r.longitude = coordinate(5);
+		r.speed = number(7);
+		r.course = number(8);
+		date(9, r.day, r.month, r.year);
+		r.variation = number(10);
+		if (*get_field(11) == 'W') {
+			r.variation = -r.variation;
+		}
+		r.mode = *get_field(12);
+		m_rmc.valid = true;
+		stamp(m_rmc.stamp);
+		m_updated.sentence.rmc = 1;
+
+	} else if (memcmp(type, "GGA", 3) == 0) {
+		struct _nmea_gga::_gga &r = m_gga.report;
+		r.utc_time = time_of_day(number(1));
+		r.latitude = coordinate(2);
+		r.longitude = coordinate(4);
+		r.quality = atoi(get_field(6));
+		r.satellites = atoi(get_field(7));
+		r.hdop = number(8);
+		r.altitude = number(9);
+		r.geoid_separation = number(11);
+		m_gga.valid = true;
+		stamp(m_gga.stamp);
+		m_updated.sentence.gga = 1;
+
+	} else if (memcmp(type, "GSA", 3) == 0) {
+		struct _nmea_gsa::_gsa &r = m_gsa.report;
+		r.selection = *get_field(1);
+		r.fix = atoi(get_field(2));
+		for (int i=0; i<NMEA_MAX_GSA_PRNS; i++) {
+			r.prn[i] = atoi(get_field(3 + i));
+		}
+		r.pdop = number(15);
+		r.hdop = number(16);
+		r.vdop = number(17);
+		m_gsa.valid = true;
+		stamp(m_gsa.stamp);
+		m_updated.sentence.gsa = 1;
+
+	} else if (memcmp(type, "ZDA", 3) == 0) {
+		struct _nmea_zda::_zda &r = m_zda.report;
+		r.utc_time = time_of_day(number(1));
+		r.day = atoi(get_field(2));
+		r.month = atoi(get_field(3));
+		r.year = atoi(get_field(4));
+		r.zone_hours = atoi(get_field(5));
+		r.zone_minutes = atoi(get_field(6));
+		m_zda.valid = true;
+		stamp(m_zda.stamp);
+		m_updated.sentence.zda = 1;
+
+	} else {
+		m_updated.sentence.unknown = 1;
+	}
+}
+
+/** rmc to utc seconds
+*
+*   Convert the date and time of an RMC sentence to seconds since the
+*   epoch, the fraction of the second is dropped.
+*
+*   @param _nmea_rmc  decoded RMC sentence
+*   @return time_t    0 - no date or time in the sentence
+*/
+time_t nmea::rmc_to_utc(const struct _nmea_rmc &rmc) {
+	struct tm time;
+	double seconds = rmc.report.utc_time;
+
+	if (rmc.report.day == 0 || std::isnan(seconds)) {
+		return 0;
+	}
+	memset(&time, 0, sizeof(time));
+	time.tm_isdst = -1;
+	time.tm_year = rmc.report.year - 1900;
+	time.tm_mon = rmc.report.month - 1;
+	time.tm_mday = rmc.report.day;
+	time.tm_hour = (int)(seconds / 3600);
+	time.tm_min = ((int)seconds % 3600) / 60;
+	time.tm_sec = (int)seconds % 60;
+
+	return timegm(&time);
+}
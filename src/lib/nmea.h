@@ -0,0 +1,191 @@
+/*
+  nmea.h - NMEA 0183 sentence decoder.
+
+  Some receivers of a site send NMEA 0183 instead of TSIP, or both on
+  two ports.  The nmea class decodes the sentences of one port behind
+  the same frame_decoder interface as tsip, so the collectors read
+  both protocols with one code path:
+
+    $GPRMC,123519.00,A,4807.0380,N,01131.0000,E,0.02,84.4,230394,,,A*6C\r\n
+
+  A sentence runs from '$' to the line feed.  The checksum, the XOR of
+  the bytes between '$' and '*', and the positions of the commas are
+  computed 16 bytes at a time with SSE2.  A sentence with a bad or a
+  missing checksum, or longer than NMEA_MAX_SENTENCE, is dropped and
+  counted, see get_frame_stats.
+
+  RMC, GGA, GSA and ZDA are decoded into m_rmc, m_gga, m_gsa and
+  m_zda, stamped like the TSIP reports.  The handler sees every
+  sentence that passed its checksum; m_updated tells which one, the
+  fields of any sentence are read with get_field:
+
+    bool on_sentence(frame_decoder &decoder, void *ctx) {
+        nmea &gps = (nmea &)decoder;
+        if (gps.m_updated.sentence.rmc && gps.m_rmc.report.status == 'A') ...
+        if (gps.m_updated.sentence.unknown) printf("%s\n", gps.get_field(0));
+        return true;
+    }
+
+  The fields are only valid in the handler, the next sentence reuses
+  the buffer.  Nothing is allocated per sentence.  The receiver is
+  only read, no sentence is sent to it.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _nmea_h
+#define _nmea_h
+
+#include <tsip.h>
+
+#define NMEA_DEFAULT_BAUD		4800	// NMEA 0183 rate, most receivers
+#define NMEA_MAX_SENTENCE		96		// '$' to the line feed, 82 in the standard
+#define NMEA_MAX_FIELDS			40		// fields split, the rest are in the last one
+#define NMEA_MAX_GSA_PRNS		12
+
+// damage seen by the sentence decoder, see nmea::get_frame_stats
+struct nmea_frame_stats {
+	unsigned long sentences;		// ended by a line feed
+	unsigned long bad_checksum;		// rejected, checksum does not match
+	unsigned long no_checksum;		// rejected, no *hh before the line end
+	unsigned long oversize;			// longer than NMEA_MAX_SENTENCE, dropped
+	unsigned long restarted;		// a '$' inside a sentence, its start was lost
+	unsigned long skipped;			// bytes dropped to find the next '$'
+};
+
+// recommended minimum data, time and position
+struct _nmea_rmc {
+	bool valid;
+	struct _report_stamp stamp;
+	struct _rmc {
+		DOUBLE utc_time;			// seconds of the UTC day, NAN - empty
+		UINT8  day;					// date, 0 - empty
+		UINT8  month;
+		UINT16 year;				// four digits, 1980..2079
+		char   status;				// 'A' - valid, 'V' - warning
+		DOUBLE latitude;			// decimal degrees, north positive
+		DOUBLE longitude;			// decimal degrees, east positive
+		SINGLE speed;				// knots
+		SINGLE course;				// degrees true
+		SINGLE variation;			// magnetic, degrees east positive
+		char   mode;				// 'A' autonomous, 'D' differential, 'N' not valid, 0 - none
+	} report;
+};
+
+// fix data
+struct _nmea_gga {
+	bool valid;
+	struct _report_stamp stamp;
+	struct _gga {
+		DOUBLE utc_time;			// seconds of the UTC day
+		DOUBLE latitude;			// decimal degrees
+		DOUBLE longitude;			// decimal degrees
+		UINT8  quality;				// 0 - no fix, 1 - GPS, 2 - DGPS ...
+		UINT8  satellites;			// in use
+		SINGLE hdop;
+		DOUBLE altitude;			// meters above mean sea level
+		SINGLE geoid_separation;	// meters, geoid above the ellipsoid
+	} report;
+};
+
+// satellites in use and DOP
+struct _nmea_gsa {
+	bool valid;
+	struct _report_stamp stamp;
+	struct _gsa {
+		char   selection;			// 'A' automatic, 'M' manual
+		UINT8  fix;					// 1 - none, 2 - 2D, 3 - 3D
+		UINT8  prn[NMEA_MAX_GSA_PRNS];	// 0 - empty
+		SINGLE pdop;
+		SINGLE hdop;
+		SINGLE vdop;
+	} report;
+};
+
+// time and date
+struct _nmea_zda {
+	bool valid;
+	struct _report_stamp stamp;
+	struct _zda {
+		DOUBLE utc_time;			// seconds of the UTC day
+		UINT8  day;
+		UINT8  month;
+		UINT16 year;
+		SINT8  zone_hours;			// local zone, not used by most receivers
+		UINT8  zone_minutes;
+	} report;
+};
+
+class nmea : public frame_decoder {
+	public:
+		bool port_status;
+
+		struct _nmea_rmc m_rmc;
+		struct _nmea_gga m_gga;
+		struct _nmea_gsa m_gsa;
+		struct _nmea_zda m_zda;
+
+		// sentence decoded, one bit set per call of the handler
+		union _update_sentence {
+			int value;
+			struct _bits {
+				int rmc     : 1;
+				int gga     : 1;
+				int gsa     : 1;
+				int zda     : 1;
+				int unknown : 1;	// any other sentence, see get_field
+			} sentence;
+		} m_updated;
+
+		nmea(const std::string &port="", int baud=NMEA_DEFAULT_BAUD);
+		~nmea(void);
+		bool open_gps_port(const std::string &port="");
+		void close_gps_port(void);
+		const std::string &get_gps_port(void);
+		int get_port_fd(void);
+		bool set_baud(int baud);		// host side, the decoder restarts
+		int get_baud(void);
+		int decode(const UINT8 *data, int len, frame_handler handler, void *ctx);
+		gps_protocol get_protocol(void);
+		void reset(void);				// drop a sentence partly decoded
+		unsigned long long get_generation(void);	// sentences decoded so far
+		int get_field_count(void);		// of the sentence in the handler
+		const char *get_field(int field);	// NUL terminated, "" - beyond the last
+		void get_frame_stats(nmea_frame_stats &stats);
+		void reset_frame_stats(void);
+		static UINT8 checksum(const UINT8 *data, int len);	// XOR of the bytes
+		static int split_fields(char *data, int len, UINT16 *start, int max_fields);
+		static time_t rmc_to_utc(const struct _nmea_rmc &rmc);
+
+	private:
+		std::string gps_port;
+		int m_fd;
+		int m_baud;
+
+		// sentence decoder states
+		enum t_state {
+			START=1,				// skipping to the next '$'
+			SENTENCE				// '$' seen, collecting up to the line feed
+		} m_state;
+		// sentence without the '$', padded for the 16 byte loads
+		alignas(16) char m_sentence[NMEA_MAX_SENTENCE + 16];
+		int m_length;
+		UINT16 m_field[NMEA_MAX_FIELDS];	// start of each field in m_sentence
+		int m_fields;
+		unsigned long long m_generation;
+		nmea_frame_stats m_stats;
+
+		bool end_sentence(void);		// check the sentence, split and update
+		void update_sentence(void);
+		void stamp(struct _report_stamp &stamp);
+		void clear_sentences(void);
+		double number(int field);		// NAN - empty
+		double coordinate(int field);	// ddmm.mmmm and N/S or E/W, NAN - empty
+		void date(int field, UINT8 &day, UINT8 &month, UINT16 &year);
+};
+
+#endif
@@ -0,0 +1,181 @@
+/**
+ *	@file position_store.cpp
+ * 	@brief local store of surveyed receiver positions
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	position_store store;
+ * 	position_store::entry_t pos;
+ *
+ * 	store.load();
+ * 	if (store.find(gps.get_serial_number(), pos)) {
+ * 		gps.set_accurate_position(pos.latitude, pos.longitude, pos.altitude);
+ * 		gps.save_to_eeprom(7);
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "position_store.h"
+#include <cstdio>
+#include <cerrno>
+#include <cmath>
+
+/** Constructor.
+*
+* 	@param string   store file name - optional
+*/
+position_store::position_store(const std::string &path) {
+	m_path = path;
+}
+
+/** get path
+*
+*   @return string store file name
+*/
+std::string position_store::get_path() {
+	return m_path;
+}
+
+/** load store
+*
+*   Read all entries from the store file.  A missing file is an empty
+*   store.  Lines that do not parse are skipped.
+*
+*   @return bool false if the file exists but cannot be read
+*/
+bool position_store::load() {
+	char line[256];
+	char serial[64];
+	entry_t entry;
+	long surveyed;
+
+	m_entries.clear();
+
+	FILE *fp = fopen(m_path.c_str(), "r");
+	if (fp == NULL) {
+		return (errno == ENOENT);
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#') {
+			continue;
+		}
+		if (sscanf(line, "%63s %lf %lf %lf %lf %lf %ld %ld", serial,
+				&entry.latitude, &entry.longitude, &entry.altitude,
+				&entry.horizontal_radius, &entry.vertical_radius,
+				&entry.samples, &surveyed) == 8) {
+			entry.serial = serial;
+			entry.surveyed = surveyed;
+			m_entries.push_back(entry);
+		}
+	}
+	fclose(fp);
+	return true;
+}
+
+/** save store
+*
+*   Write all entries to a temporary file and rename it over the store,
+*   so a crash never leaves a partial store behind.
+*
+*   @return bool true - success
+*/
+bool position_store::save() {
+	std::string tmp = m_path + ".tmp";
+
+	FILE *fp = fopen(tmp.c_str(), "w");
+	if (fp == NULL) {
+		perror(tmp.c_str());
+		return false;
+	}
+	fprintf(fp, "# serial latitude longitude altitude h95 v95 samples surveyed\n");
+	for (size_t i=0; i<m_entries.size(); i++) {
+		fprintf(fp, "%s %.12f %.12f %.4f %.4f %.4f %ld %ld\n",
+				m_entries[i].serial.c_str(),
+				m_entries[i].latitude, m_entries[i].longitude, m_entries[i].altitude,
+				m_entries[i].horizontal_radius, m_entries[i].vertical_radius,
+				m_entries[i].samples, (long)m_entries[i].surveyed);
+	}
+	if (fclose(fp) != 0) {
+		perror(tmp.c_str());
+		return false;
+	}
+	if (rename(tmp.c_str(), m_path.c_str()) != 0) {
+		perror(m_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** find entry
+*
+*   @param string   receiver serial number
+*   @param entry_t& returned entry
+*   @return bool true - entry found
+*/
+bool position_store::find(const std::string &serial, entry_t &entry) {
+	for (size_t i=0; i<m_entries.size(); i++) {
+		if (m_entries[i].serial == serial) {
+			entry = m_entries[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+/** update entry
+*
+*   Store a surveyed position.  An existing entry for the receiver is
+*   replaced when the new position is more accurate, or when it lies
+*   outside the combined confidence radii of the two surveys (the
+*   antenna was moved).  Call save() to write the store.
+*
+*   @param entry_t  surveyed position
+*   @return bool true - entry stored
+*/
+bool position_store::update(const entry_t &entry) {
+	for (size_t i=0; i<m_entries.size(); i++) {
+		if (m_entries[i].serial != entry.serial) {
+			continue;
+		}
+		bool moved = horizontal_distance(m_entries[i], entry)
+				> m_entries[i].horizontal_radius + entry.horizontal_radius
+			|| vertical_distance(m_entries[i], entry)
+				> m_entries[i].vertical_radius + entry.vertical_radius;
+		if (!moved && entry.horizontal_radius >= m_entries[i].horizontal_radius) {
+			return false;
+		}
+		m_entries[i] = entry;
+		return true;
+	}
+	m_entries.push_back(entry);
+	return true;
+}
+
+/** horizontal distance
+*
+*   Distance between two positions on a sphere of the mean earth radius,
+*   good to a few centimeters for positions within a hundred meters.
+*
+*   @return double meters
+*/
+double position_store::horizontal_distance(const entry_t &a, const entry_t &b) {
+	const double earth_radius = 6371000.0;
+	double dn = (a.latitude - b.latitude) * earth_radius;
+	double de = (a.longitude - b.longitude) * earth_radius * cos(a.latitude);
+
+	return sqrt(dn*dn + de*de);
+}
+
+/** vertical distance
+*
+*   @return double meters
+*/
+double position_store::vertical_distance(const entry_t &a, const entry_t &b) {
+	return fabs(a.altitude - b.altitude);
+}
@@ -0,0 +1,61 @@
+/*
+  position_store.h - local store of surveyed positions, one entry per
+            receiver serial number.
+
+  After a power cycle or a revert of the accurate position segment the
+  receiver has to survey again.  Keeping the best surveyed position on
+  the host allows it to be loaded back (0x32 + 8E-4C) as soon as the
+  receiver is seen again at the same place.
+
+  The store is a text file with one line per receiver:
+
+    serial latitude longitude altitude h95 v95 samples surveyed
+
+  latitude and longitude in radians, altitude and the 95% radii in
+  meters, surveyed in seconds since the epoch.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _position_store_h
+#define _position_store_h
+
+#include <string>
+#include <vector>
+#include <ctime>
+
+#define POSITION_STORE_DEFAULT "/var/lib/gps/positions.dat"
+
+class position_store {
+	public:
+		struct entry_t {
+			std::string serial;			// receiver serial number
+			double latitude;			// radians
+			double longitude;			// radians
+			double altitude;			// meters
+			double horizontal_radius;	// 95% horizontal radius, meters
+			double vertical_radius;		// 95% vertical error, meters
+			long   samples;				// positions averaged
+			time_t surveyed;			// time of the survey
+		};
+
+		position_store(const std::string &path=POSITION_STORE_DEFAULT);
+		bool load(void);
+		bool save(void);
+		bool find(const std::string &serial, entry_t &entry);
+		bool update(const entry_t &entry);
+		std::string get_path(void);
+
+		static double horizontal_distance(const entry_t &a, const entry_t &b);
+		static double vertical_distance(const entry_t &a, const entry_t &b);
+
+	private:
+		std::string m_path;
+		std::vector<entry_t> m_entries;
+};
+
+#endif
@@ -0,0 +1,436 @@
+/**
+ *	@file report_stream.cpp
+ * 	@brief decoded reports written as NDJSON or binary records
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	bool on_report(tsip &gps, void *ctx) {
+ * 		return ((report_stream *)ctx)->write(gps);
+ * 	}
+ *
+ * 	report_stream out(STDOUT_FILENO, STREAM_NDJSON);
+ * 	reactor.add(gps, on_report, &out);
+ * 	while (reactor.poll(1000) >= 0) {
+ * 		out.flush();
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "report_stream.h"
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+
+/** field size
+*
+*   @param int  FIELD_ type
+*   @return int bytes in a binary record
+*/
+static constexpr int field_size(int type) {
+	switch (type) {
+		case FIELD_U8:		return 1;
+		case FIELD_U16:		return 2;
+		case FIELD_S16:		return 2;
+		case FIELD_U32:		return 4;
+		case FIELD_F32:		return 4;
+		default:			return 8;
+	}
+}
+
+/** fields size
+*
+*   @param stream_field_t*  fields of a report
+*   @param int              count
+*   @return int             bytes of the fields in a binary record
+*/
+static constexpr int fields_size(const stream_field_t *fields, int count) {
+	int size = 0;
+
+	for (int i=0; i<count; i++) {
+		size += field_size(fields[i].type);
+	}
+	return size;
+}
+
+// a field of report structure s, key k
+#define FIELD(k, s, member, type) \
+	{ "\"" k "\":", sizeof("\"" k "\":") - 1, type, (UINT16)offsetof(s, member) }
+
+static constexpr stream_field_t primary_time_fields[] = {
+	FIELD("seconds_of_week",		_primary_time::_0x8FAB, seconds_of_week, FIELD_U32),
+	FIELD("week_number",			_primary_time::_0x8FAB, week_number, FIELD_U16),
+	FIELD("utc_offset",				_primary_time::_0x8FAB, utc_offset, FIELD_S16),
+	FIELD("flags",					_primary_time::_0x8FAB, flags.value, FIELD_U8),
+	FIELD("seconds",				_primary_time::_0x8FAB, seconds, FIELD_U8),
+	FIELD("minutes",				_primary_time::_0x8FAB, minutes, FIELD_U8),
+	FIELD("hours",					_primary_time::_0x8FAB, hours, FIELD_U8),
+	FIELD("day",					_primary_time::_0x8FAB, day, FIELD_U8),
+	FIELD("month",					_primary_time::_0x8FAB, month, FIELD_U8),
+	FIELD("year",					_primary_time::_0x8FAB, year, FIELD_U16),
+};
+
+static constexpr stream_field_t secondary_time_fields[] = {
+	FIELD("receiver_mode",			_secondary_time::_0x8FAC, receiver_mode, FIELD_U8),
+	FIELD("disciplining_mode",		_secondary_time::_0x8FAC, disciplining_mode, FIELD_U8),
+	FIELD("self_survey_progress",	_secondary_time::_0x8FAC, self_survey_progress, FIELD_U8),
+	FIELD("holdover_duration",		_secondary_time::_0x8FAC, holdover_duration, FIELD_U32),
+	FIELD("critical_alarms",		_secondary_time::_0x8FAC, critical_alarms.value, FIELD_U16),
+	FIELD("minor_alarms",			_secondary_time::_0x8FAC, minor_alarms.value, FIELD_U16),
+	FIELD("gps_decoding_status",	_secondary_time::_0x8FAC, gps_decoding_status, FIELD_U8),
+	FIELD("disciplining_activity",	_secondary_time::_0x8FAC, disciplining_activity, FIELD_U8),
+	FIELD("pps_offset",				_secondary_time::_0x8FAC, pps_offset, FIELD_F32),
+	FIELD("tenMHz_offset",			_secondary_time::_0x8FAC, tenMHz_offset, FIELD_F32),
+	FIELD("dac_value",				_secondary_time::_0x8FAC, dac_value, FIELD_U32),
+	FIELD("dac_voltage",			_secondary_time::_0x8FAC, dac_voltage, FIELD_F32),
+	FIELD("temperature",			_secondary_time::_0x8FAC, temperature, FIELD_F32),
+	FIELD("latitude",				_secondary_time::_0x8FAC, latitude, FIELD_F64),
+	FIELD("longitude",				_secondary_time::_0x8FAC, longitude, FIELD_F64),
+	FIELD("altitude",				_secondary_time::_0x8FAC, altitude, FIELD_F64),
+};
+
+static constexpr stream_field_t ecef_position_s_fields[] = {
+	FIELD("x",						_ecef_position_s::_0x42, x, FIELD_F32),
+	FIELD("y",						_ecef_position_s::_0x42, y, FIELD_F32),
+	FIELD("z",						_ecef_position_s::_0x42, z, FIELD_F32),
+	FIELD("time_of_fix",			_ecef_position_s::_0x42, time_of_fix, FIELD_F32),
+};
+
+static constexpr stream_field_t ecef_position_d_fields[] = {
+	FIELD("x",						_ecef_position_d::_0x83, x, FIELD_F64),
+	FIELD("y",						_ecef_position_d::_0x83, y, FIELD_F64),
+	FIELD("z",						_ecef_position_d::_0x83, z, FIELD_F64),
+	FIELD("clock_bias",				_ecef_position_d::_0x83, clock_bias, FIELD_F64),
+	FIELD("time_of_fix",			_ecef_position_d::_0x83, time_of_fix, FIELD_F32),
+};
+
+static constexpr stream_field_t ecef_velocity_fields[] = {
+	FIELD("x",						_ecef_velocity::_0x43, x, FIELD_F32),
+	FIELD("y",						_ecef_velocity::_0x43, y, FIELD_F32),
+	FIELD("z",						_ecef_velocity::_0x43, z, FIELD_F32),
+	FIELD("bias_rate",				_ecef_velocity::_0x43, bias_rate, FIELD_F32),
+	FIELD("time_of_fix",			_ecef_velocity::_0x43, time_of_fix, FIELD_F32),
+};
+
+static constexpr stream_field_t single_position_fields[] = {
+	FIELD("latitude",				_single_position::_0x4A, latitude, FIELD_F32),
+	FIELD("longitude",				_single_position::_0x4A, longitude, FIELD_F32),
+	FIELD("altitude",				_single_position::_0x4A, altitude, FIELD_F32),
+	FIELD("clock_bias",				_single_position::_0x4A, clock_bias, FIELD_F32),
+	FIELD("time_of_fix",			_single_position::_0x4A, time_of_fix, FIELD_F32),
+};
+
+static constexpr stream_field_t double_position_fields[] = {
+	FIELD("latitude",				_double_position::_0x84, latitude, FIELD_F64),
+	FIELD("longitude",				_double_position::_0x84, longitude, FIELD_F64),
+	FIELD("altitude",				_double_position::_0x84, altitude, FIELD_F64),
+	FIELD("clock_bias",				_double_position::_0x84, clock_bias, FIELD_F64),
+	FIELD("time_of_fix",			_double_position::_0x84, time_of_fix, FIELD_F32),
+};
+
+static constexpr stream_field_t enu_velocity_fields[] = {
+	FIELD("east",					_enu_velocity::_0x56, east, FIELD_F32),
+	FIELD("north",					_enu_velocity::_0x56, north, FIELD_F32),
+	FIELD("up",						_enu_velocity::_0x56, up, FIELD_F32),
+	FIELD("clock_bias",				_enu_velocity::_0x56, clock_bias, FIELD_F32),
+	FIELD("time_of_fix",			_enu_velocity::_0x56, time_of_fix, FIELD_F32),
+};
+
+static constexpr stream_field_t utc_gps_time_fields[] = {
+	FIELD("flags",					_utc_gps_time::_0x8FA2, bits.value, FIELD_U8),
+};
+
+static constexpr stream_field_t raw_measurement_fields[] = {
+	FIELD("prn",					_raw_measurement::_0x5A, prn, FIELD_U8),
+	FIELD("time_of_measurement",	_raw_measurement::_0x5A, time_of_measurement, FIELD_F64),
+	FIELD("sample_length",			_raw_measurement::_0x5A, sample_length, FIELD_F32),
+	FIELD("signal_level",			_raw_measurement::_0x5A, signal_level, FIELD_F32),
+	FIELD("code_phase",				_raw_measurement::_0x5A, code_phase, FIELD_F32),
+	FIELD("doppler",				_raw_measurement::_0x5A, doppler, FIELD_F32),
+};
+
+#define LAYOUT(code, subcode, name, member, fields) \
+	{ code, subcode, name, [](const tsip &gps) -> const void * { return &gps.member.report; }, \
+		fields, sizeof(fields) / sizeof(fields[0]), \
+		fields_size(fields, sizeof(fields) / sizeof(fields[0])) }
+
+static const stream_layout_t layouts[] = {
+	LAYOUT(REPORT_SUPER, REPORT_SUPER_PRIMARY_TIME, "primary_time", m_primary_time, primary_time_fields),
+	LAYOUT(REPORT_SUPER, REPORT_SUPER_SECONDARY_TIME, "secondary_time", m_secondary_time, secondary_time_fields),
+	LAYOUT(REPORT_SUPER, REPORT_SUPER_UTC_GPS_TIME, "utc_gps_time", m_utc_gps_time, utc_gps_time_fields),
+	LAYOUT(REPORT_ECEF_POSITION_S, 0, "ecef_position_s", m_ecef_position_s, ecef_position_s_fields),
+	LAYOUT(REPORT_ECEF_POSITION_D, 0, "ecef_position_d", m_ecef_position_d, ecef_position_d_fields),
+	LAYOUT(REPORT_ECEF_VELOCITY, 0, "ecef_velocity", m_ecef_velocity, ecef_velocity_fields),
+	LAYOUT(REPORT_SINGLE_POSITION, 0, "single_position", m_single_position, single_position_fields),
+	LAYOUT(REPORT_DOUBLE_POSITION, 0, "double_position", m_double_position, double_position_fields),
+	LAYOUT(REPORT_ENU_VELOCITY, 0, "enu_velocity", m_enu_velocity, enu_velocity_fields),
+	LAYOUT(REPORT_RAW_MEASUREMENT, 0, "raw_measurement", m_raw_measurement, raw_measurement_fields),
+};
+
+static const int layout_cnt = sizeof(layouts) / sizeof(layouts[0]);
+
+/** bit index
+*
+*   @param int  m_updated bit, one set
+*   @return int its index
+*/
+static int bit_index(int bit) {
+	return __builtin_ctz((unsigned int)bit);
+}
+
+/** Constructor.
+*
+*   The buffer is allocated here, writing a report never allocates.
+*
+*   @param int            file descriptor written, not closed
+*   @param stream_format  NDJSON or binary
+*   @param size_t         bytes written at most by one write
+*/
+report_stream::report_stream(int fd, stream_format format, size_t buffer) {
+	m_fd = fd;
+	m_format = format;
+	m_buffer.resize(std::max(buffer, (size_t)2 * STREAM_RECORD_MAX));
+	m_used = 0;
+	m_id = 0;
+	m_failed = false;
+	m_records = 0;
+	m_bytes = 0;
+	for (int i=0; i<32; i++) {
+		m_layouts[i] = NULL;
+	}
+	for (int i=0; i<layout_cnt; i++) {
+		m_layouts[bit_index(tsip::report_bit(layouts[i].code, layouts[i].subcode))] = &layouts[i];
+	}
+	set_source("", 0);
+}
+
+/** Destructor.
+*
+*	Write what is buffered.
+*/
+report_stream::~report_stream() {
+	flush();
+}
+
+/** set source
+*
+*   @param string  port name, the NDJSON "port"
+*   @param UINT16  id, the binary source
+*   @return void
+*/
+void report_stream::set_source(const std::string &port, UINT16 id) {
+	m_id = id;
+	m_source = "{\"port\":\"";
+	for (size_t i=0; i<port.size() && i<STREAM_RECORD_MAX / 4; i++) {
+		char c = port[i];
+		if (c == '"' || c == '\\') {
+			m_source += '\\';
+			m_source += c;
+		} else if ((unsigned char)c >= 0x20) {
+			m_source += c;
+		}
+	}
+	m_source += "\",";
+}
+
+/** get layout
+*
+*   @param int  report code
+*   @param int  subcode of a super packet
+*   @return stream_layout_t*  fields of the report, NULL - none
+*/
+const stream_layout_t *report_stream::get_layout(int code, int subcode) {
+	for (int i=0; i<layout_cnt; i++) {
+		if (layouts[i].code == code && (code != REPORT_SUPER || layouts[i].subcode == subcode)) {
+			return &layouts[i];
+		}
+	}
+	return NULL;
+}
+
+/** put
+*
+*   @return char*  end of the text copied
+*/
+static char *put(char *p, const char *text, size_t len) {
+	memcpy(p, text, len);
+	return p + len;
+}
+
+/** put number
+*
+*   Shortest exact form of a floating point value, null when not finite.
+*
+*   @return char*  end of the number
+*/
+template <typename T>
+static char *put_number(char *p, char *end, T value) {
+	if constexpr (std::is_floating_point<T>::value) {
+		if (!std::isfinite(value)) {
+			return put(p, "null", 4);
+		}
+	}
+	return std::to_chars(p, end, value).ptr;
+}
+
+/** write json
+*
+*   @return char*  end of the record
+*/
+char *report_stream::write_json(char *p, char *end, const stream_layout_t *layout, const void *report,
+		const tsip &gps, const struct _report_stamp &stamp) {
+	UINT8 code = gps.m_report.report.code;
+	UINT8 subcode = code == REPORT_SUPER ? gps.m_report.extended.subcode : 0;
+
+	p = put(p, m_source.data(), m_source.size());
+	p = put(p, "\"report\":\"", 10);
+	if (layout != NULL) {
+		p = put(p, layout->name, strlen(layout->name));
+	} else {
+		p = put(p, "other", 5);
+	}
+	p = put(p, "\",\"code\":", 9);
+	p = put_number(p, end, code);
+	p = put(p, ",\"subcode\":", 11);
+	p = put_number(p, end, subcode);
+	p = put(p, ",\"generation\":", 14);
+	p = put_number(p, end, stamp.generation);
+	p = put(p, ",\"received\":", 12);
+	p = put_number(p, end, (unsigned long long)stamp.received.tv_sec * 1000000000ULL + stamp.received.tv_nsec);
+	if (layout != NULL) {
+		const UINT8 *base = (const UINT8 *)report;
+		for (int i=0; i<layout->count; i++) {
+			const stream_field_t &f = layout->fields[i];
+			const UINT8 *v = base + f.offset;
+			*p++ = ',';
+			p = put(p, f.key, f.key_length);
+			switch (f.type) {
+				case FIELD_U8:	p = put_number(p, end, *v); break;
+				case FIELD_U16:	p = put_number(p, end, *(const UINT16 *)v); break;
+				case FIELD_S16:	p = put_number(p, end, *(const SINT16 *)v); break;
+				case FIELD_U32:	p = put_number(p, end, *(const UINT32 *)v); break;
+				case FIELD_F32:	p = put_number(p, end, *(const SINGLE *)v); break;
+				default:		p = put_number(p, end, *(const DOUBLE *)v); break;
+			}
+		}
+	} else {
+		p = put(p, ",\"length\":", 10);
+		p = put_number(p, end, gps.m_report_length);
+	}
+	return put(p, "}\n", 2);
+}
+
+/** write binary
+*
+*   @return char*  end of the record
+*/
+char *report_stream::write_binary(char *p, const stream_layout_t *layout, const void *report,
+		const tsip &gps, const struct _report_stamp &stamp) {
+	stream_record_t h;
+	char *start = p;
+
+	p += sizeof(h);
+	if (layout != NULL) {
+		const UINT8 *base = (const UINT8 *)report;
+		for (int i=0; i<layout->count; i++) {
+			int size = field_size(layout->fields[i].type);
+			p = put(p, (const char *)base + layout->fields[i].offset, size);
+		}
+	}
+	h.magic = STREAM_MAGIC;
+	h.length = p - start;
+	h.code = gps.m_report.report.code;
+	h.subcode = h.code == REPORT_SUPER ? gps.m_report.extended.subcode : 0;
+	h.source = m_id;
+	h.generation = stamp.generation;
+	h.received = (unsigned long long)stamp.received.tv_sec * 1000000000ULL + stamp.received.tv_nsec;
+	memcpy(start, &h, sizeof(h));
+	return p;
+}
+
+/** write
+*
+*   Format the report just decoded by gps into the buffer, the buffer
+*   is written first when it may not hold the record.
+*
+*   @param tsip&  decoder, from its report handler
+*   @return bool  false - a write failed, nothing more is written
+*/
+bool report_stream::write(tsip &gps) {
+	if (m_failed) {
+		return false;
+	}
+	if (m_used + STREAM_RECORD_MAX > m_buffer.size() && !flush()) {
+		return false;
+	}
+
+	int bit = tsip::report_bit(gps.m_report.report.code, gps.m_report.extended.subcode);
+	const struct _report_stamp *stamp = gps.get_stamp(bit);
+	const stream_layout_t *layout = m_layouts[bit_index(bit)];
+	struct _report_stamp none;
+	if (stamp == NULL || stamp->generation != gps.get_generation()) {
+		// not stored as its type, e.g. a 0x58 other than an almanac
+		memset(&none, 0, sizeof(none));
+		none.generation = gps.get_generation();
+		clock_gettime(CLOCK_REALTIME, &none.received);
+		stamp = &none;
+		layout = NULL;
+	}
+	const void *report = layout != NULL ? layout->report(gps) : NULL;
+
+	char *p = &m_buffer[m_used];
+	if (m_format == STREAM_NDJSON) {
+		p = write_json(p, &m_buffer[0] + m_buffer.size(), layout, report, gps, *stamp);
+	} else {
+		p = write_binary(p, layout, report, gps, *stamp);
+	}
+	m_used = p - &m_buffer[0];
+	m_records++;
+	return true;
+}
+
+/** flush
+*
+*   @return bool  false - the write failed
+*/
+bool report_stream::flush() {
+	size_t done = 0;
+
+	while (done < m_used && !m_failed) {
+		ssize_t n = ::write(m_fd, &m_buffer[done], m_used - done);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("report_stream write");
+			m_failed = true;
+			break;
+		}
+		done += n;
+	}
+	m_bytes += done;
+	m_used = 0;
+	return !m_failed;
+}
+
+/** get records
+*
+*   @return unsigned long long  records formatted
+*/
+unsigned long long report_stream::get_records() {
+	return m_records;
+}
+
+/** get bytes
+*
+*   @return unsigned long long  bytes written
+*/
+unsigned long long report_stream::get_bytes() {
+	return m_bytes;
+}
@@ -0,0 +1,119 @@
+/*
+  report_stream.h - decoded reports written as NDJSON or binary records.
+
+  A report_stream writes one record per report decoded, for tools that
+  read a receiver continuously instead of scraping the text of
+  gps_test:
+
+    report_stream out(STDOUT_FILENO, STREAM_NDJSON);
+    out.set_source("/dev/ttyUSB0", 0);
+    ...                                     // from the report handler
+    out.write(gps);
+    ...                                     // after each reactor pass
+    out.flush();
+
+  NDJSON gives an object per line:
+
+    {"port":"/dev/ttyUSB0","report":"primary_time","code":143,"subcode":171,
+     "generation":12,"received":1760000000123456789,"seconds_of_week":...}
+
+  Binary gives a stream_record_t header followed by the fields of the
+  report packed in the order of its layout, in host byte order; the
+  layouts are returned by get_layout().  A report without a layout,
+  or not stored as its type, gives the header fields only, with
+  "report":"other" in NDJSON and no fields in binary.
+
+  The fields of each report are described once, as tables of name,
+  type and offset in the report structure.  Records are formatted
+  with std::to_chars straight into one buffer allocated at
+  construction, which is written by flush() or once nearly full:
+  nothing is allocated per report and there is one write per flush.
+  Floating point values are written in their shortest exact form,
+  null when not finite.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _report_stream_h
+#define _report_stream_h
+
+#include <tsip.h>
+#include <vector>
+
+#define STREAM_BUFFER_SIZE		65536	// bytes written at most by one write
+#define STREAM_RECORD_MAX		2048	// bytes of the longest record
+#define STREAM_MAGIC			0x5354	// "TS", first bytes of a binary record
+
+enum stream_format {STREAM_NDJSON, STREAM_BINARY};
+
+// field of a report structure
+struct stream_field_t {
+	const char *key;				// NDJSON key, quoted, with its colon
+	UINT8  key_length;
+	UINT8  type;
+		#define FIELD_U8		0
+		#define FIELD_U16		1
+		#define FIELD_S16		2
+		#define FIELD_U32		3
+		#define FIELD_F32		4
+		#define FIELD_F64		5
+	UINT16 offset;					// in the report structure
+};
+
+// fields of one report
+struct stream_layout_t {
+	UINT8 code;
+	UINT8 subcode;					// 0 - not a super packet
+	const char *name;				// NDJSON "report"
+	const void *(*report)(const tsip &gps);	// the report structure in gps
+	const stream_field_t *fields;
+	int count;
+	int size;						// bytes of the fields in a binary record
+};
+
+// binary record header, the fields follow
+struct stream_record_t {
+	UINT16 magic;					// STREAM_MAGIC
+	UINT16 length;					// bytes, header included
+	UINT8  code;
+	UINT8  subcode;
+	UINT16 source;					// id given to set_source
+	unsigned long long generation;	// of the report, see _report_stamp
+	unsigned long long received;	// host clock (CLOCK_REALTIME), ns
+};
+
+class report_stream {
+	public:
+		report_stream(int fd, stream_format format, size_t buffer=STREAM_BUFFER_SIZE);
+		~report_stream(void);
+		void set_source(const std::string &port, UINT16 id);	// written with every record
+		bool write(tsip &gps);			// the report just decoded, false - write failed
+		bool flush(void);				// write the records buffered
+		unsigned long long get_records(void);
+		unsigned long long get_bytes(void);	// written
+		// layout of a report, NULL - none
+		static const stream_layout_t *get_layout(int code, int subcode);
+
+	private:
+		int m_fd;
+		stream_format m_format;
+		std::vector<char> m_buffer;
+		size_t m_used;
+		std::string m_source;			// NDJSON start of every record
+		UINT16 m_id;
+		bool m_failed;
+		unsigned long long m_records;
+		unsigned long long m_bytes;
+		const stream_layout_t *m_layouts[32];	// by bit index of tsip::report_bit
+
+		char *write_json(char *p, char *end, const stream_layout_t *layout, const void *report,
+				const tsip &gps, const struct _report_stamp &stamp);
+		char *write_binary(char *p, const stream_layout_t *layout, const void *report,
+				const tsip &gps, const struct _report_stamp &stamp);
+};
+
+#endif
@@ -0,0 +1,253 @@
+/**
+ *	@file sky_geometry.cpp
+ * 	@brief dilution of precision of the satellites tracked or predicted
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	lla_t here = { lat, lon, alt };
+ * 	sky_geometry sky(here);
+ * 	dop_t dop;
+ *
+ * 	gps.request_almanac();
+ * 	for (int minute=0; minute<60; minute+=5) {
+ * 		if (sky.predict(*gps.get_satellites(), now + 60*minute, SKY_DEFAULT_MASK, dop)) {
+ * 			printf("+%2d min  %d satellites  PDOP %.2f\n", minute, dop.satellites, dop.pdop);
+ * 		}
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "sky_geometry.h"
+#include "tsip_history.h"
+#include <cmath>
+
+#define GPS_MU				3.986005e14		// earth gravitational constant, m^3/s^2
+#define GPS_OMEGA_E_DOT		7.2921151467e-5	// earth rotation rate, radians/second
+#define GPS_WEEK_ROLLOVER	1024			// weeks of the 10 bit week number
+#define KEPLER_ITERATIONS	10
+#define DOP_MIN_PIVOT		1e-12			// smaller, the geometry is singular
+
+/** Constructor.
+*
+* 	@param lla_t&  receiver position, radians and meters
+*/
+sky_geometry::sky_geometry(const lla_t &receiver) : m_local(receiver) {
+}
+
+/** normal dop
+*
+*   Invert the 4x4 normal matrix by Cholesky, n = l l', and fill the
+*   DOPs from the diagonal of the inverse, sum over k of inv(l)[k][i]^2.
+*
+*   @param double[4][4]  normal matrix, lower triangle used
+*   @param dop_t&        returned DOPs, satellites is not set
+*   @return bool         false - the geometry is singular
+*/
+static bool normal_dop(const double n[4][4], dop_t &dop) {
+	double l[4][4];
+	double inv[4][4];
+	double q[4];
+
+	for (int j=0; j<4; j++) {
+		double d = n[j][j];
+		for (int k=0; k<j; k++) {
+			d -= l[j][k] * l[j][k];
+		}
+		if (d < DOP_MIN_PIVOT) {
+			return false;
+		}
+		l[j][j] = sqrt(d);
+		for (int i=j+1; i<4; i++) {
+			double s = n[i][j];
+			for (int k=0; k<j; k++) {
+				s -= l[i][k] * l[j][k];
+			}
+			l[i][j] = s / l[j][j];
+		}
+	}
+
+	// inverse of the lower triangle, column by column
+	for (int j=0; j<4; j++) {
+		for (int i=0; i<4; i++) {
+			if (i < j) {
+				inv[i][j] = 0;
+				continue;
+			}
+			double s = (i == j) ? 1.0 : 0.0;
+			for (int k=j; k<i; k++) {
+				s -= l[i][k] * inv[k][j];
+			}
+			inv[i][j] = s / l[i][i];
+		}
+	}
+
+	for (int i=0; i<4; i++) {
+		q[i] = 0;
+		for (int k=i; k<4; k++) {
+			q[i] += inv[k][i] * inv[k][i];
+		}
+	}
+	dop.hdop = sqrt(q[0] + q[1]);
+	dop.vdop = sqrt(q[2]);
+	dop.pdop = sqrt(q[0] + q[1] + q[2]);
+	dop.tdop = sqrt(q[3]);
+	dop.gdop = sqrt(q[0] + q[1] + q[2] + q[3]);
+	return true;
+}
+
+/** dop
+*
+*   @param SINGLE*  elevations, radians, indexed by PRN - 1
+*   @param SINGLE*  azimuths, radians, indexed by PRN - 1
+*   @param UINT32   bit PRN - 1 set for each satellite to use
+*   @param double   elevation mask, radians
+*   @param dop_t&   returned DOPs
+*   @return bool    false - fewer than 4 satellites or singular geometry
+*/
+bool sky_geometry::dop(const SINGLE *elevation, const SINGLE *azimuth, UINT32 sats,
+		double mask_angle, dop_t &dop) {
+	double n[4][4] = {{0}};
+	double h[4];
+
+	dop.satellites = 0;
+	for (int s=0; s<SATELLITE_MAX_PRN; s++) {
+		// NAN look angles fail the compare
+		if (!((sats >> s) & 1) || !(elevation[s] > mask_angle) || std::isnan(azimuth[s])) {
+			continue;
+		}
+		double ce = cos(elevation[s]);
+		h[0] = ce * sin(azimuth[s]);
+		h[1] = ce * cos(azimuth[s]);
+		h[2] = sin(elevation[s]);
+		h[3] = 1.0;
+		for (int i=0; i<4; i++) {
+			for (int j=0; j<=i; j++) {
+				n[i][j] += h[i] * h[j];
+			}
+		}
+		dop.satellites++;
+	}
+	if (dop.satellites < 4) {
+		return false;
+	}
+	return normal_dop(n, dop);
+}
+
+/** dop
+*
+*   Geometry of the satellites with 0x5C look angles.
+*
+*   @param satellite_table&    satellites of the receiver
+*   @param unsigned long long  generation taken earlier, see satellite_table::tracked
+*   @param double              elevation mask, radians
+*   @param dop_t&              returned DOPs
+*   @return bool               false - fewer than 4 satellites or singular geometry
+*/
+bool sky_geometry::dop(const satellite_table &table, unsigned long long since,
+		double mask_angle, dop_t &dop) {
+	const satellite_table::columns_t &c = table.columns();
+
+	return sky_geometry::dop(c.elevation, c.azimuth, table.tracked(since), mask_angle, dop);
+}
+
+/** almanac position
+*
+*   Satellite position from the almanac, the IS-GPS-200 algorithm
+*   without the ephemeris corrections.  Good to a few kilometers, a
+*   small fraction of a degree in the look angles.
+*
+*   @param almanac_t&  almanac of the satellite
+*   @param long long   GPS seconds, week * 604800 + seconds of week
+*   @return ecef_t     position, meters
+*/
+ecef_t sky_geometry::almanac_position(const almanac_t &alm, long long gps_seconds) {
+	const long long rollover = (long long)GPS_WEEK_ROLLOVER * GPS_SECONDS_PER_WEEK;
+	double a = (double)alm.sqrt_a * alm.sqrt_a;
+	double tk;
+	double e;
+	ecef_t pos;
+
+	// time from the almanac epoch, either week number may be 10 bit
+	long long dt = (gps_seconds - (long long)alm.wn_oa * GPS_SECONDS_PER_WEEK) % rollover;
+	if (dt >= rollover / 2) {
+		dt -= rollover;
+	} else if (dt < -rollover / 2) {
+		dt += rollover;
+	}
+	tk = dt - alm.t_oa;
+
+	// mean anomaly to eccentric anomaly
+	double m = alm.m_0 + sqrt(GPS_MU / (a * a * a)) * tk;
+	e = m;
+	for (int i=0; i<KEPLER_ITERATIONS; i++) {
+		e = m + alm.e * sin(e);
+	}
+
+	double v = atan2(sqrt(1.0 - (double)alm.e * alm.e) * sin(e), cos(e) - alm.e);
+	double phi = v + alm.omega;
+	double r = a * (1.0 - alm.e * cos(e));
+	double xp = r * cos(phi);
+	double yp = r * sin(phi);
+	double node = alm.omega_0 + (alm.omegadot - GPS_OMEGA_E_DOT) * tk
+			- GPS_OMEGA_E_DOT * alm.t_oa;
+
+	pos.x = xp * cos(node) - yp * cos(alm.i_o) * sin(node);
+	pos.y = xp * sin(node) + yp * cos(alm.i_o) * cos(node);
+	pos.z = yp * sin(alm.i_o);
+	return pos;
+}
+
+/** look angles
+*
+*   @param almanac_t&  almanac of the satellite
+*   @param long long   GPS seconds
+*   @param SINGLE&     returned elevation, radians
+*   @param SINGLE&     returned azimuth, radians 0..2pi from north
+*   @return bool       false - the almanac has no orbit
+*/
+bool sky_geometry::look_angles(const almanac_t &almanac, long long gps_seconds,
+		SINGLE &elevation, SINGLE &azimuth) const {
+	if (!(almanac.sqrt_a > 0)) {
+		return false;
+	}
+	enu_t los = m_local.ecef_to_enu(almanac_position(almanac, gps_seconds));
+	double az = atan2(los.east, los.north);
+
+	elevation = atan2(los.up, sqrt(los.east * los.east + los.north * los.north));
+	azimuth = (az < 0) ? az + 2 * M_PI : az;
+	return true;
+}
+
+/** predict
+*
+*   Geometry of the healthy satellites with an almanac at a time.
+*   Whether the receiver will track them is not known, the DOP is the
+*   best it can get.
+*
+*   @param satellite_table&  satellites of the receiver, see tsip::request_almanac
+*   @param long long         GPS seconds
+*   @param double            elevation mask, radians
+*   @param dop_t&            returned DOPs
+*   @return bool             false - fewer than 4 satellites or singular geometry
+*/
+bool sky_geometry::predict(const satellite_table &table, long long gps_seconds,
+		double mask_angle, dop_t &dop) const {
+	SINGLE elevation[SATELLITE_MAX_PRN];
+	SINGLE azimuth[SATELLITE_MAX_PRN];
+	UINT32 sats = 0;
+
+	for (int prn=1; prn<=SATELLITE_MAX_PRN; prn++) {
+		const almanac_t *alm = table.almanac(prn);
+		if (alm != NULL && alm->health == 0
+				&& look_angles(*alm, gps_seconds, elevation[prn-1], azimuth[prn-1])) {
+			sats |= 1u << (prn - 1);
+		}
+	}
+	return sky_geometry::dop(elevation, azimuth, sats, mask_angle, dop);
+}
@@ -0,0 +1,76 @@
+/*
+  sky_geometry.h - dilution of precision (DOP) of the satellites a
+            receiver tracks, now or predicted from its almanac.
+
+  The DOPs come from the look angles alone.  Each satellite gives a row
+  h = [cos(el) sin(az), cos(el) cos(az), sin(el), 1] of the geometry
+  matrix, the 4x4 normal matrix sum(h h') is inverted with a Cholesky
+  factorization in fixed memory and its diagonal is the east, north,
+  up and time variance factors:
+
+    GDOP = sqrt(Qe + Qn + Qu + Qt)    PDOP = sqrt(Qe + Qn + Qu)
+    HDOP = sqrt(Qe + Qn)              VDOP = sqrt(Qu)
+    TDOP = sqrt(Qt)
+
+  Current geometry is taken from the 0x5C look angles in the satellite
+  table, predicted geometry from the 0x58 almanacs and the receiver
+  position:
+
+    sky_geometry sky(position);            // lla_t, radians and meters
+    dop_t now, ahead;
+    sky_geometry::dop(*gps.get_satellites(), since, mask, now);
+    sky.predict(*gps.get_satellites(), gps_seconds + 600, mask, ahead);
+
+  Nothing is allocated, a prediction for all 32 satellites is a few
+  microseconds.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _sky_geometry_h
+#define _sky_geometry_h
+
+#include <tsip.h>
+#include <tsip_satellite.h>
+#include <geodesy.h>
+
+#define SKY_DEFAULT_MASK	(10 * M_PI / 180)	// elevation mask, radians
+
+struct dop_t {
+	int    satellites;			// satellites above the mask used
+	double gdop;
+	double pdop;
+	double hdop;
+	double vdop;
+	double tdop;
+};
+
+class sky_geometry {
+	public:
+		sky_geometry(const lla_t &receiver);
+
+		// DOP of look angles in radians, for the satellites of bits sats
+		static bool dop(const SINGLE *elevation, const SINGLE *azimuth, UINT32 sats,
+				double mask_angle, dop_t &dop);
+		// DOP of the satellites the table tracked after generation since
+		static bool dop(const satellite_table &table, unsigned long long since,
+				double mask_angle, dop_t &dop);
+
+		// look angles of one satellite at GPS seconds, see history_ring::gps_seconds
+		bool look_angles(const almanac_t &almanac, long long gps_seconds,
+				SINGLE &elevation, SINGLE &azimuth) const;
+		// DOP of the healthy satellites with an almanac
+		bool predict(const satellite_table &table, long long gps_seconds,
+				double mask_angle, dop_t &dop) const;
+
+		static ecef_t almanac_position(const almanac_t &almanac, long long gps_seconds);
+
+	private:
+		geodesy m_local;			// ENU frame at the receiver
+};
+
+#endif
@@ -0,0 +1,392 @@
+/**
+ *	@file survey_estimator.cpp
+ * 	@brief streaming position estimator for shortening the gps self-survey
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  The receiver averages a fixed number of position fixes during the
+ *  self-survey.  Position fixes one second apart are strongly correlated,
+ *  so most of that count adds little information.  The estimator tracks
+ *  the scatter and the correlation of the fixes and reports the
+ *  confidence radius of the mean, allowing the survey to end once the
+ *  requested accuracy is reached.
+ *
+ * Usage:
+ * @code
+ * 	survey_estimator est;
+ *
+ * 	while (!est.is_converged(1.0)) {
+ * 		gps.get_xyz();
+ * 		est.add_report(gps);
+ * 		sleep(1);
+ * 	}
+ * 	survey_estimator::estimate_t pos = est.get_estimate();
+ * 	gps.set_accurate_position(pos.latitude, pos.longitude, pos.altitude);
+ * @endcode
+ *
+ */
+
+#include "survey_estimator.h"
+#include "geodesy.h"
+
+// 95% quantiles of the normal (1 dim) and Rayleigh (2 dim) distributions
+static const double K95_1D = 1.959964;
+static const double K95_2D = 2.447747;
+
+// scale factor from MAD to standard deviation for normal samples
+static const double MAD_SIGMA = 1.4826;
+
+/** Constructor.
+*
+*	Create an empty median estimator.
+*/
+p2_median::p2_median() {
+	reset();
+}
+
+/** reset median
+*
+*   Discard all samples.
+*
+*	@return  void
+*/
+void p2_median::reset() {
+	m_count = 0;
+	for (int i=0; i<5; i++) {
+		m_q[i] = 0;
+		m_n[i] = i;
+		m_np[i] = i;
+	}
+}
+
+/** add sample to median
+*
+*   The first five samples are kept sorted, after that the five markers
+*   are moved towards their desired positions with a piecewise parabolic
+*   prediction.
+*
+* 	@param   double sample value
+*	@return  void
+*/
+void p2_median::add(double x) {
+	// marker position increments for the 0.5 quantile
+	static const double dn[5] = {0, 0.25, 0.5, 0.75, 1};
+
+	if (m_count < 5) {
+		int i = m_count++;
+		while (i > 0 && m_q[i-1] > x) {
+			m_q[i] = m_q[i-1];
+			i--;
+		}
+		m_q[i] = x;
+		return;
+	}
+	m_count++;
+
+	// find the cell holding x, extending the extremes if needed
+	int k;
+	if (x < m_q[0]) {
+		m_q[0] = x;
+		k = 0;
+	} else if (x >= m_q[4]) {
+		m_q[4] = x;
+		k = 3;
+	} else {
+		k = 0;
+		while (k < 3 && x >= m_q[k+1]) {
+			k++;
+		}
+	}
+
+	for (int i=k+1; i<5; i++) {
+		m_n[i] += 1;
+	}
+	for (int i=0; i<5; i++) {
+		m_np[i] += dn[i];
+	}
+
+	// adjust the inner markers
+	for (int i=1; i<4; i++) {
+		double d = m_np[i] - m_n[i];
+		if ((d >= 1 && m_n[i+1] - m_n[i] > 1) || (d <= -1 && m_n[i-1] - m_n[i] < -1)) {
+			int s = (d >= 0) ? 1 : -1;
+			double qp = m_q[i] + s/(m_n[i+1] - m_n[i-1]) *
+				((m_n[i] - m_n[i-1] + s)*(m_q[i+1] - m_q[i])/(m_n[i+1] - m_n[i]) +
+				 (m_n[i+1] - m_n[i] - s)*(m_q[i] - m_q[i-1])/(m_n[i] - m_n[i-1]));
+			if (m_q[i-1] < qp && qp < m_q[i+1]) {
+				m_q[i] = qp;
+			} else {
+				m_q[i] += s*(m_q[i+s] - m_q[i])/(m_n[i+s] - m_n[i]);
+			}
+			m_n[i] += s;
+		}
+	}
+}
+
+/** get median
+*
+*   Exact while fewer than five samples are seen, estimated afterwards.
+*
+*	@return  double median, 0 if no samples
+*/
+double p2_median::value() {
+	if (m_count == 0) {
+		return 0;
+	}
+	if (m_count < 5) {
+		return (m_count & 1) ? m_q[m_count/2] : (m_q[m_count/2-1] + m_q[m_count/2])/2;
+	}
+	return m_q[2];
+}
+
+
+/** Constructor.
+*
+*	The estimator will not report convergence before min_samples
+*	positions are added.
+*
+* 	@param int   minimum sample count - optional
+*/
+survey_estimator::survey_estimator(int min_samples) {
+	m_min_samples = min_samples;
+	reset();
+}
+
+/** reset estimator
+*
+*   Discard all positions, the next position becomes the origin of the
+*   local east/north/up plane.
+*
+*	@return  void
+*/
+void survey_estimator::reset() {
+	m_count = 0;
+	m_lat0 = m_lon0 = m_alt0 = 0;
+	m_m_per_rad_n = m_m_per_rad_e = 0;
+	for (int i=0; i<3; i++) {
+		m_mean[i] = 0;
+		m_prev[i] = 0;
+		m_first[i] = 0;
+		m_lag1[i] = 0;
+		m_sum[i] = 0;
+		for (int j=0; j<3; j++) {
+			m_m2[i][j] = 0;
+		}
+		m_median[i].reset();
+		m_mad[i].reset();
+	}
+}
+
+/** add lla position
+*
+*   Add a position fix.  The fix is converted to meters east, north and
+*   up of the first position.  Survey scatter is a few tens of meters so
+*   the flat earth approximation does not add measurable error.
+*
+* 	@param   double latitude radians
+* 	@param   double longitude radians
+* 	@param   double altitude meters
+*	@return  void
+*/
+void survey_estimator::add_lla(double lat, double lon, double alt) {
+	if (m_count == 0) {
+		double s = sin(lat);
+		double w = sqrt(1 - WGS84_E2*s*s);
+		m_lat0 = lat;
+		m_lon0 = lon;
+		m_alt0 = alt;
+		m_m_per_rad_n = WGS84_A*(1 - WGS84_E2)/(w*w*w) + alt;
+		m_m_per_rad_e = (WGS84_A/w + alt)*cos(lat);
+	}
+
+	double dlon = lon - m_lon0;
+	if (dlon > M_PI) {
+		dlon -= 2*M_PI;
+	} else if (dlon < -M_PI) {
+		dlon += 2*M_PI;
+	}
+
+	double enu[3];
+	enu[0] = dlon*m_m_per_rad_e;
+	enu[1] = (lat - m_lat0)*m_m_per_rad_n;
+	enu[2] = alt - m_alt0;
+	add_enu(enu);
+}
+
+/** add ecef position
+*
+*   Add an earth centered earth fixed position fix (0x83).  The fix is
+*   converted to latitude, longitude and altitude by geodesy::ecef_to_lla.
+*
+* 	@param   double x meters
+* 	@param   double y meters
+* 	@param   double z meters
+*	@return  void
+*/
+void survey_estimator::add_ecef(double x, double y, double z) {
+	ecef_t ecef = {x, y, z};
+	lla_t lla = geodesy::ecef_to_lla(ecef);
+
+	add_lla(lla.latitude, lla.longitude, lla.altitude);
+}
+
+/** add report position
+*
+*   Add the most precise position found in the reports received by the
+*   last request.  A double precision fix (0x84, 0x83) is preferred over
+*   the position in the supplemental timing packet (8F-AC).  At most one
+*   position is added per call.
+*
+* 	@param   tsip& gps  the receiver the reports were read from
+*	@return  bool true if a position was added
+*/
+bool survey_estimator::add_report(tsip &gps) {
+	if (gps.m_updated.report.double_position && gps.m_double_position.valid) {
+		add_lla(gps.m_double_position.report.latitude,
+				gps.m_double_position.report.longitude,
+				gps.m_double_position.report.altitude);
+		return true;
+	}
+	if (gps.m_updated.report.ecef_position_d && gps.m_ecef_position_d.valid) {
+		add_ecef(gps.m_ecef_position_d.report.x,
+				gps.m_ecef_position_d.report.y,
+				gps.m_ecef_position_d.report.z);
+		return true;
+	}
+	if (gps.m_updated.report.secondary_time && gps.m_secondary_time.valid) {
+		// no position until the receiver has a fix
+		if (gps.m_secondary_time.report.latitude == 0 && gps.m_secondary_time.report.longitude == 0) {
+			return false;
+		}
+		add_lla(gps.m_secondary_time.report.latitude,
+				gps.m_secondary_time.report.longitude,
+				gps.m_secondary_time.report.altitude);
+		return true;
+	}
+	return false;
+}
+
+/** add local position
+*
+*   Update the running moments with an east/north/up offset.
+*
+* 	@param   double[3] offset from the origin in meters
+*	@return  void
+*/
+void survey_estimator::add_enu(const double enu[3]) {
+	double delta[3];
+
+	m_count++;
+	for (int i=0; i<3; i++) {
+		delta[i] = enu[i] - m_mean[i];
+		m_mean[i] += delta[i]/m_count;
+	}
+	for (int i=0; i<3; i++) {
+		for (int j=0; j<3; j++) {
+			m_m2[i][j] += delta[i]*(enu[j] - m_mean[j]);
+		}
+	}
+
+	for (int i=0; i<3; i++) {
+		if (m_count == 1) {
+			m_first[i] = enu[i];
+		} else {
+			m_lag1[i] += enu[i]*m_prev[i];
+		}
+		m_prev[i] = enu[i];
+		m_sum[i] += enu[i];
+
+		// deviation is taken from the median estimate at this point
+		m_median[i].add(enu[i]);
+		m_mad[i].add(fabs(enu[i] - m_median[i].value()));
+	}
+}
+
+/** get sample count
+*
+*	@return  long positions added since the last reset
+*/
+long survey_estimator::get_samples() {
+	return m_count;
+}
+
+/** get estimate
+*
+*   Compute the position estimate and its confidence from the running
+*   moments.  The standard error of the mean is scaled by the effective
+*   number of independent samples n(1-r)/(1+r), where r is the largest
+*   lag-1 autocorrelation of the three axes.
+*
+*	@return  estimate_t
+*/
+survey_estimator::estimate_t survey_estimator::get_estimate() {
+	estimate_t est;
+	double var[3];
+	double rho = 0;
+
+	est.samples = m_count;
+	for (int i=0; i<3; i++) {
+		var[i] = (m_count > 1) ? m_m2[i][i]/(m_count - 1) : 0;
+		est.sigma[i] = sqrt(var[i]);
+		est.mad_sigma[i] = MAD_SIGMA*m_mad[i].value();
+
+		if (m_count > 2 && m_m2[i][i] > 0) {
+			double mu = m_mean[i];
+			double c1 = m_lag1[i] - mu*(m_sum[i] - m_first[i]) - mu*(m_sum[i] - m_prev[i])
+				+ (m_count - 1)*mu*mu;
+			double r = c1/m_m2[i][i];
+			if (r > rho) {
+				rho = r;
+			}
+		}
+	}
+	if (rho > 0.999) {
+		rho = 0.999;
+	}
+	est.correlation = rho;
+	est.cov_en = (m_count > 1) ? m_m2[0][1]/(m_count - 1) : 0;
+
+	double n_eff = m_count*(1 - rho)/(1 + rho);
+	if (n_eff < 1) {
+		n_eff = 1;
+	}
+	est.effective_samples = n_eff;
+
+	// largest eigenvalue of the horizontal covariance
+	double tr = var[0] + var[1];
+	double det = var[0]*var[1] - est.cov_en*est.cov_en;
+	double disc = tr*tr/4 - det;
+	double lmax = tr/2 + sqrt(disc > 0 ? disc : 0);
+
+	est.horizontal_radius = K95_2D*sqrt(lmax/n_eff);
+	est.vertical_radius = K95_1D*sqrt(var[2]/n_eff);
+
+	est.latitude = m_lat0 + (m_m_per_rad_n ? m_mean[1]/m_m_per_rad_n : 0);
+	est.longitude = m_lon0 + (m_m_per_rad_e ? m_mean[0]/m_m_per_rad_e : 0);
+	est.altitude = m_alt0 + m_mean[2];
+	est.median_latitude = m_lat0 + (m_m_per_rad_n ? m_median[1].value()/m_m_per_rad_n : 0);
+	est.median_longitude = m_lon0 + (m_m_per_rad_e ? m_median[0].value()/m_m_per_rad_e : 0);
+	est.median_altitude = m_alt0 + m_median[2].value();
+
+	return est;
+}
+
+/** is converged
+*
+*   The survey is complete when the minimum sample count is reached and
+*   both the horizontal radius and the vertical error of the mean are
+*   within the target.
+*
+* 	@param   double target accuracy in meters
+*	@return  bool
+*/
+bool survey_estimator::is_converged(double target) {
+	if (m_count < m_min_samples) {
+		return false;
+	}
+	estimate_t est = get_estimate();
+	return (est.horizontal_radius <= target && est.vertical_radius <= target);
+}
@@ -0,0 +1,101 @@
+/*
+  survey_estimator.h - host side streaming position estimator used to
+            shorten the self-survey of a Trimble Thunderbolt GPSDO.
+
+  The estimator is fed one position per second from the 8F-AC
+  supplemental timing packet, or from 0x84/0x83 position fixes when
+  they are broadcast, and keeps running statistics in fixed memory:
+
+    - mean and covariance of the east/north/up offsets (Welford)
+    - lag-1 autocorrelation, used to estimate the number of
+      independent samples in a strongly correlated fix stream
+    - median and median absolute deviation (P-square estimators)
+
+  From these it reports a 95% confidence radius of the mean position,
+  so the survey can be stopped as soon as the target accuracy is met.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _survey_estimator_h
+#define _survey_estimator_h
+
+#include <tsip.h>
+
+// running median estimate in constant memory (P-square algorithm,
+// Jain & Chlamtac 1985)
+class p2_median {
+	public:
+		p2_median();
+		void reset(void);
+		void add(double x);
+		double value(void);
+
+	private:
+		long   m_count;
+		double m_q[5];			// marker heights
+		double m_n[5];			// marker positions
+		double m_np[5];			// desired marker positions
+};
+
+// streaming position estimator
+class survey_estimator {
+	public:
+		struct estimate_t {
+			long   samples;				// positions accepted
+			double latitude;			// mean, radians
+			double longitude;			// mean, radians
+			double altitude;			// mean, meters
+			double median_latitude;		// robust estimate, radians
+			double median_longitude;	// robust estimate, radians
+			double median_altitude;		// robust estimate, meters
+			double sigma[3];			// e/n/u standard deviation, meters
+			double mad_sigma[3];		// e/n/u 1.4826 * MAD, meters
+			double cov_en;				// east/north covariance, meters^2
+			double correlation;			// lag-1 autocorrelation of the fixes
+			double effective_samples;	// independent samples in the mean
+			double horizontal_radius;	// 95% horizontal radius of the mean, meters
+			double vertical_radius;		// 95% vertical error of the mean, meters
+		};
+
+		survey_estimator(int min_samples=60);
+		void reset(void);
+		void add_lla(double lat, double lon, double alt);
+		void add_ecef(double x, double y, double z);
+		bool add_report(tsip &gps);		// add the best position in the last reports
+		long get_samples(void);
+		estimate_t get_estimate(void);
+		bool is_converged(double target);
+
+	private:
+		int    m_min_samples;
+		long   m_count;
+
+		// local tangent plane at the first sample
+		double m_lat0;
+		double m_lon0;
+		double m_alt0;
+		double m_m_per_rad_n;		// meters per radian of latitude
+		double m_m_per_rad_e;		// meters per radian of longitude
+
+		// running moments of the e/n/u offsets
+		double m_mean[3];
+		double m_m2[3][3];
+
+		// lag-1 sums
+		double m_prev[3];
+		double m_first[3];
+		double m_lag1[3];			// sum x(t) * x(t-1)
+		double m_sum[3];
+
+		p2_median m_median[3];
+		p2_median m_mad[3];
+
+		void add_enu(const double enu[3]);
+};
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * survey_fleet_test.cpp
+ *
+ * Test of the gps_survey fleet mode on receivers that do not answer,
+ * run by ctest with the path of gps_survey:
+ *
+ *   survey_fleet_test /path/to/gps_survey
+ *
+ * The fleet is a pty nobody writes to, /dev/null, which reads as end of
+ * file at once, and a port that does not exist.  gps_survey must finish
+ * within TEST_LIMIT_SEC, the first two jobs failed with "no reply" and
+ * the last with "port not opened", and exit with a failure.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_LIMIT_SEC		30		// gps_survey is killed by SIGALRM after this
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL line %d: %s\n", __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+// occurrences of what in text
+static int count(const std::string &text, const char *what) {
+	int n = 0;
+
+	for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) {
+		n++;
+	}
+	return n;
+}
+
+/** run survey
+*
+*   Run gps_survey with its output on a pipe.
+*
+*   @param char*    path of gps_survey
+*   @param char*    --gps-port value
+*   @param char*    position store
+*   @param string&  output
+*   @return int     wait status
+*/
+static int run_survey(const char *program, const char *ports, const char *store, std::string &output) {
+	int out[2];
+	int status = 0;
+	char buffer[4096];
+	ssize_t len;
+
+	if (pipe(out) < 0) {
+		perror("pipe");
+		return -1;
+	}
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	}
+	if (pid == 0) {
+		dup2(out[1], STDOUT_FILENO);
+		dup2(out[1], STDERR_FILENO);
+		close(out[0]);
+		close(out[1]);
+		alarm(TEST_LIMIT_SEC);		// kept across exec
+		execl(program, program, "-g", ports, "-w", "5", "-p", store, (char *)NULL);
+		perror(program);
+		_exit(127);
+	}
+	close(out[1]);
+	while ((len = read(out[0], buffer, sizeof(buffer))) > 0) {
+		output.append(buffer, len);
+	}
+	close(out[0]);
+	waitpid(pid, &status, 0);
+	return status;
+}
+
+int main(int argc, char **argv) {
+	char ports[256];
+	char store[64];
+	std::string output;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s gps_survey\n", argv[0]);
+		return 2;
+	}
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+		perror("posix_openpt");
+		return 1;
+	}
+	snprintf(ports, sizeof(ports), "%s,/dev/null,/nonexistent/ttyUSB9", ptsname(master));
+	snprintf(store, sizeof(store), "/tmp/survey_fleet_test.%d", (int)getpid());
+
+	time_t start = time(NULL);
+	int status = run_survey(argv[1], ports, store, output);
+	long elapsed = time(NULL) - start;
+
+	CHECK(!WIFSIGNALED(status));
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+	CHECK(elapsed < TEST_LIMIT_SEC);
+	CHECK(count(output, "summary: 3 receivers") == 1);
+	CHECK(count(output, "2 no reply") == 1);
+	CHECK(count(output, "1 port not opened") == 1);
+	CHECK(count(output, "3 receivers failed") == 1);
+	if (failures) {
+		printf("%s", output.c_str());
+	}
+	close(master);
+	unlink(store);
+	printf("survey fleet: %ld seconds, %d failures\n", elapsed, failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+/**
+ *	@file timing_spectrum.cpp
+ * 	@brief power spectral density of pps_offset and tenMHz_offset
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  The Allan deviation tells how much the oscillator wanders at each
+ *  averaging time, but not why.  A disturbance with a period, the
+ *  building heating or a reflection seen again each sidereal day,
+ *  gives a peak in the spectrum of the disciplining offsets at its
+ *  frequency, which is found here by Welch's method while the receiver
+ *  runs.
+ *
+ * Usage:
+ * @code
+ * 	timing_spectrum spectrum;
+ *
+ * 	bool on_report(tsip &gps, void *ctx) {
+ * 		((timing_spectrum *)ctx)->add_report(gps);
+ * 		return true;
+ * 	}
+ *
+ * 	reactor.add(gps, on_report, &spectrum);
+ * 	...
+ * 	const welch_psd &psd = spectrum.tenMHz_offset();
+ * 	for (int k=0; k<psd.bins(); k++) {
+ * 		printf("%g %g\n", psd.frequency(k), psd.density(k));
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "timing_spectrum.h"
+#include "tsip_history.h"
+#include <cmath>
+
+/** power of 2
+*
+*   @param int  count
+*   @return int smallest power of 2 at least count, and at least 2
+*/
+static int power_of_2(int n) {
+	int p = 2;
+
+	while (p < n) {
+		p *= 2;
+	}
+	return p;
+}
+
+/** Constructor.
+*
+*	Compute the twiddle factors and the bit reversed order.
+*
+*	@param   int  points, rounded up to a power of 2
+*/
+fft_radix2::fft_radix2(int n) {
+	int bits = 0;
+
+	m_n = power_of_2(n);
+	while ((1 << bits) < m_n) {
+		bits++;
+	}
+	m_cos.resize(m_n / 2);
+	m_sin.resize(m_n / 2);
+	for (int k=0; k<m_n/2; k++) {
+		m_cos[k] = cos(2 * M_PI * k / m_n);
+		m_sin[k] = -sin(2 * M_PI * k / m_n);
+	}
+	m_reverse.resize(m_n);
+	for (int i=0; i<m_n; i++) {
+		int r = 0;
+		for (int b=0; b<bits; b++) {
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		m_reverse[i] = r;
+	}
+}
+
+int fft_radix2::size() const {
+	return m_n;
+}
+
+/** transform
+*
+*   Forward transform in place, X(k) = sum x(j) exp(-2 pi i j k / n),
+*   decimation in time.
+*
+*	@param   double*  real parts, size() of them
+*	@param   double*  imaginary parts
+*	@return  void
+*/
+void fft_radix2::transform(double *re, double *im) const {
+	for (int i=0; i<m_n; i++) {
+		int j = m_reverse[i];
+		if (i < j) {
+			double t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+	for (int length=2; length<=m_n; length*=2) {
+		int half = length / 2;
+		int step = m_n / length;
+		for (int i=0; i<m_n; i+=length) {
+			for (int k=0; k<half; k++) {
+				double c = m_cos[k * step];
+				double s = m_sin[k * step];
+				int a = i + k;
+				int b = a + half;
+				double tr = re[b] * c - im[b] * s;
+				double ti = re[b] * s + im[b] * c;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+/** Constructor.
+*
+*	@param   int     samples per segment, rounded up to a power of 2
+*	@param   double  seconds between the samples added
+*	@param   int     samples averaged into one, 1 - none
+*	@param   int     segments of the exponential average, 0 - average all
+*/
+welch_psd::welch_psd(int segment, double interval, int decimation, int averages) : m_fft(segment) {
+	double power = 0;
+
+	m_n = m_fft.size();
+	m_decimation = decimation > 0 ? decimation : 1;
+	m_interval = interval * m_decimation;
+	m_averages = averages > 0 ? averages : 0;
+	m_input.resize(m_n);
+	m_window.resize(m_n);
+	m_re.resize(m_n);
+	m_im.resize(m_n);
+	m_psd.resize(m_n / 2 + 1);
+	for (int i=0; i<m_n; i++) {
+		m_window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / m_n);
+		power += m_window[i] * m_window[i];
+	}
+	m_scale = 2 * m_interval / power;
+	reset();
+}
+
+/** reset
+*
+*   Discard the samples and the spectrum.
+*
+*	@return  void
+*/
+void welch_psd::reset() {
+	gap();
+	for (size_t k=0; k<m_psd.size(); k++) {
+		m_psd[k] = 0;
+	}
+	m_segments = 0;
+}
+
+/** gap
+*
+*   Samples were missed: drop the partial segment, the next one starts
+*   with the next sample.  The spectrum is kept.
+*
+*	@return  void
+*/
+void welch_psd::gap() {
+	m_sum = 0;
+	m_summed = 0;
+	m_head = 0;
+	m_filled = 0;
+	m_pending = 0;
+}
+
+/** add
+*
+*   Add the next sample, and average the periodogram of the last N
+*   samples every N/2 samples.
+*
+*	@param   double  sample
+*	@return  bool    true - a segment was averaged into the spectrum
+*/
+bool welch_psd::add(double x) {
+	if (!std::isfinite(x)) {
+		gap();
+		return false;
+	}
+	m_sum += x;
+	if (++m_summed < m_decimation) {
+		return false;
+	}
+	m_input[m_head] = m_sum / m_summed;
+	m_head = (m_head + 1) % m_n;
+	m_sum = 0;
+	m_summed = 0;
+	if (m_filled < m_n) {
+		m_filled++;
+	}
+	m_pending++;
+	if (m_filled < m_n || m_pending < m_n / 2) {
+		return false;
+	}
+	segment();
+	m_pending = 0;
+	return true;
+}
+
+/** segment
+*
+*   Transform the last N samples, detrended and windowed, and average
+*   their periodogram.
+*
+*	@return  void
+*/
+void welch_psd::segment() {
+	double mean = 0;
+
+	for (int i=0; i<m_n; i++) {
+		mean += m_input[i];
+	}
+	mean /= m_n;
+	// m_head is the oldest sample once the ring is full
+	for (int i=0; i<m_n; i++) {
+		m_re[i] = (m_input[(m_head + i) % m_n] - mean) * m_window[i];
+		m_im[i] = 0;
+	}
+	m_fft.transform(&m_re[0], &m_im[0]);
+
+	m_segments++;
+	double weight = 1.0 / (m_averages > 0 && m_segments > m_averages ? m_averages : m_segments);
+	for (int k=0; k<=m_n/2; k++) {
+		double p = (m_re[k] * m_re[k] + m_im[k] * m_im[k]) * m_scale;
+		if (k == 0 || k == m_n / 2) {
+			p /= 2;				// not folded
+		}
+		m_psd[k] += (p - m_psd[k]) * weight;
+	}
+}
+
+int welch_psd::bins() const {
+	return m_n / 2 + 1;
+}
+
+double welch_psd::frequency(int bin) const {
+	return bin / (m_n * m_interval);
+}
+
+double welch_psd::density(int bin) const {
+	return m_psd[bin];
+}
+
+const double *welch_psd::densities() const {
+	return &m_psd[0];
+}
+
+/** peak
+*
+*   @param   double  lowest frequency searched, Hz
+*   @return  int     bin of the highest density, the last bin if none is searched
+*/
+int welch_psd::peak(double min_frequency) const {
+	int best = -1;
+
+	for (int k=0; k<=m_n/2; k++) {
+		if (frequency(k) >= min_frequency && (best < 0 || m_psd[k] > m_psd[best])) {
+			best = k;
+		}
+	}
+	return best < 0 ? m_n / 2 : best;
+}
+
+long welch_psd::get_segments() const {
+	return m_segments;
+}
+
+/** Constructor.
+*
+*	@param   int  samples per segment, rounded up to a power of 2
+*	@param   int  reports averaged into one sample, 1 - none
+*	@param   int  segments of the exponential average, 0 - average all
+*/
+timing_spectrum::timing_spectrum(int segment, int decimation, int averages)
+		: m_pps(segment, 1.0, decimation, averages), m_tenMHz(segment, 1.0, decimation, averages) {
+	m_last = -1;
+}
+
+/** reset
+*
+*   Discard the samples and the spectra.
+*
+*	@return  void
+*/
+void timing_spectrum::reset() {
+	m_pps.reset();
+	m_tenMHz.reset();
+	m_last = -1;
+}
+
+/** add report
+*
+*   Add the offsets of an 8F-AC just decoded, one second after the
+*   last one, as given by the 8F-AB received before it; otherwise the
+*   partial segments are dropped first.
+*
+*	@param   tsip&  decoder, from the report handler
+*	@return  bool   true - the report was an 8F-AC and was added
+*/
+bool timing_spectrum::add_report(tsip &gps) {
+	int bit = tsip::report_bit(REPORT_SUPER, REPORT_SUPER_SECONDARY_TIME);
+	const struct _report_stamp *stamp = gps.get_stamp(bit);
+
+	if (gps.m_report.report.code != REPORT_SUPER
+			|| gps.m_report.extended.subcode != REPORT_SUPER_SECONDARY_TIME
+			|| stamp == NULL || stamp->generation != gps.get_generation()
+			|| !gps.m_secondary_time.valid) {
+		return false;
+	}
+	long long time = history_ring::gps_seconds(gps.m_primary_time);
+	if (m_last < 0 || time != m_last + 1) {
+		m_pps.gap();
+		m_tenMHz.gap();
+	}
+	m_last = time;
+	m_pps.add(gps.m_secondary_time.report.pps_offset);
+	m_tenMHz.add(gps.m_secondary_time.report.tenMHz_offset);
+	return true;
+}
+
+const welch_psd &timing_spectrum::pps_offset() const {
+	return m_pps;
+}
+
+const welch_psd &timing_spectrum::tenMHz_offset() const {
+	return m_tenMHz;
+}
@@ -0,0 +1,120 @@
+/*
+  timing_spectrum.h - power spectral density of the disciplining of a
+            Trimble Thunderbolt GPSDO.
+
+  The pps_offset (ns) and tenMHz_offset (ppb) of 8F-AC show how well
+  the oscillator is held to GPS.  Periodic disturbances, an air
+  conditioning cycle or multipath repeating each sidereal day, are
+  easier to see as peaks in their spectrum than in the series.  A
+  timing_spectrum is fed every report of one receiver and keeps a
+  Welch estimate of both spectra, updated as each segment completes:
+
+    timing_spectrum spectrum(4096, 60);     // 4096 minutes per segment
+    ...                                     // from the report handler
+    if (spectrum.add_report(gps) && spectrum.pps_offset().get_segments() > 0) {
+        const welch_psd &psd = spectrum.pps_offset();
+        int k = psd.peak(1.0 / 86400 / 2);
+        printf("%g s period, %g ns^2/Hz\n", 1 / psd.frequency(k), psd.density(k));
+    }
+
+  Welch's method: the series is cut into segments of N samples which
+  overlap by half, each is detrended (mean removed), Hann windowed and
+  transformed, and the periodograms are averaged.  The average covers
+  every segment since reset(), or, given averages, decays as an
+  exponential average over about that many segments so the spectrum
+  follows the receiver.  Densities are one sided, in unit^2/Hz.
+
+  Decimation averages D reports into one sample, a segment then spans
+  N * D seconds: a sidereal day needs about 2^17 one second samples,
+  or 2^11 samples of one minute.  The average is only a crude anti
+  aliasing filter, peaks near the Nyquist frequency of the decimated
+  series may be folded.
+
+  The samples must be evenly spaced: a report missed, as seen from the
+  8F-AB time, drops the partial segment and starts a new one.
+
+  Memory is allocated by the constructor only; each segment costs one
+  radix-2 FFT of N points with twiddle factors computed once.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _timing_spectrum_h
+#define _timing_spectrum_h
+
+#include <tsip.h>
+#include <vector>
+
+#define SPECTRUM_SEGMENT		1024	// samples per segment, a power of 2
+
+// in place radix-2 FFT of a fixed size
+class fft_radix2 {
+	public:
+		fft_radix2(int n);			// n rounded up to a power of 2
+		int size(void) const;
+		void transform(double *re, double *im) const;	// forward, unscaled
+
+	private:
+		int m_n;
+		std::vector<double> m_cos;	// twiddle factors exp(-2 pi i k / n), k < n/2
+		std::vector<double> m_sin;
+		std::vector<int> m_reverse;	// bit reversed index
+};
+
+// Welch estimate of the spectral density of one series
+class welch_psd {
+	public:
+		welch_psd(int segment=SPECTRUM_SEGMENT, double interval=1.0, int decimation=1, int averages=0);
+		void reset(void);
+		bool add(double x);					// next sample, true - a segment completed
+		void gap(void);						// samples missed, drop the partial segment
+		int bins(void) const;				// N/2 + 1, DC to Nyquist
+		double frequency(int bin) const;	// Hz
+		double density(int bin) const;		// unit^2/Hz, 0 before the first segment
+		const double *densities(void) const;
+		int peak(double min_frequency) const;	// bin of the highest density from min_frequency
+		long get_segments(void) const;		// averaged since reset
+
+	private:
+		fft_radix2 m_fft;
+		int m_n;
+		double m_interval;					// seconds between samples, decimated
+		int m_decimation;
+		int m_averages;
+		double m_scale;						// periodogram to one sided density
+
+		double m_sum;						// of the samples being decimated
+		int m_summed;
+		std::vector<double> m_input;		// last N samples, a ring
+		int m_head;							// slot of the next sample
+		int m_filled;						// samples in the ring
+		int m_pending;						// samples since the last segment
+		std::vector<double> m_window;		// Hann
+		std::vector<double> m_re;			// segment being transformed
+		std::vector<double> m_im;
+		std::vector<double> m_psd;
+		long m_segments;
+
+		void segment(void);
+};
+
+// spectra of pps_offset and tenMHz_offset of one receiver
+class timing_spectrum {
+	public:
+		timing_spectrum(int segment=SPECTRUM_SEGMENT, int decimation=1, int averages=0);
+		void reset(void);
+		bool add_report(tsip &gps);			// the report just decoded, true - 8F-AC added
+		const welch_psd &pps_offset(void) const;
+		const welch_psd &tenMHz_offset(void) const;
+
+	private:
+		welch_psd m_pps;
+		welch_psd m_tenMHz;
+		long long m_last;					// GPS seconds of the last sample, -1 - none
+};
+
+#endif
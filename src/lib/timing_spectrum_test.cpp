@@ -0,0 +1,157 @@
+/*
+ * timing_spectrum_test.cpp
+ *
+ * Test of the Welch spectral density estimate, run by ctest.  The FFT
+ * is compared with the direct DFT of random samples.  A sine of known
+ * amplitude and frequency, on a bin and with white noise added, must
+ * give its peak in that bin, and the density integrated over the bins
+ * must match the variance of the series (Parseval).  A gap, called
+ * or from a NaN sample, must drop the partial segment: no segment
+ * completes until N new samples have been added.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "timing_spectrum.h"
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#define TEST_SEGMENT		256
+#define TEST_SEGMENTS		63		// averaged for the sine, 1 + 2 * 31
+#define TEST_BIN			32		// of the sine
+#define TEST_AMPLITUDE		2.0
+#define TEST_NOISE			0.5		// standard deviation of the white noise
+#define TEST_INTERVAL		60.0	// seconds between samples
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL line %d: %s\n", __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+/** check fft
+*
+*   Against the direct DFT, X(k) = sum x(j) exp(-2 pi i j k / n).
+*
+*   @return void
+*/
+static void check_fft(int n) {
+	fft_radix2 fft(n);
+	std::mt19937_64 random(n);
+	std::uniform_real_distribution<double> unit(-1, 1);
+	std::vector<double> x(n), y(n), re(n), im(n);
+	double error = 0;
+
+	CHECK(fft.size() == n);
+	for (int j=0; j<n; j++) {
+		re[j] = x[j] = unit(random);
+		im[j] = y[j] = unit(random);
+	}
+	fft.transform(&re[0], &im[0]);
+	for (int k=0; k<n; k++) {
+		double sr = 0, si = 0;
+		for (int j=0; j<n; j++) {
+			double a = -2 * M_PI * ((long)j * k % n) / n;
+			sr += x[j] * cos(a) - y[j] * sin(a);
+			si += x[j] * sin(a) + y[j] * cos(a);
+		}
+		error = fmax(error, fmax(fabs(re[k] - sr), fabs(im[k] - si)));
+	}
+	CHECK(error < 1e-9 * n);
+}
+
+/** check sine
+*
+*   Peak bin, its frequency, and the integrated density of a sine in
+*   white noise.
+*
+*   @return void
+*/
+static void check_sine() {
+	welch_psd psd(TEST_SEGMENT, TEST_INTERVAL);
+	std::mt19937_64 random(TEST_SEGMENT);
+	std::normal_distribution<double> noise(0, TEST_NOISE);
+	double f = (double)TEST_BIN / (TEST_SEGMENT * TEST_INTERVAL);
+	int samples = TEST_SEGMENT + (TEST_SEGMENTS - 1) * TEST_SEGMENT / 2;
+	int completed = 0;
+
+	for (int i=0; i<samples; i++) {
+		completed += psd.add(TEST_AMPLITUDE * sin(2 * M_PI * f * i * TEST_INTERVAL) + noise(random));
+	}
+	CHECK(completed == TEST_SEGMENTS && psd.get_segments() == TEST_SEGMENTS);
+	CHECK(psd.bins() == TEST_SEGMENT / 2 + 1);
+	CHECK(psd.peak(0) == TEST_BIN);
+	CHECK(fabs(psd.frequency(TEST_BIN) - f) < 1e-15);
+	// above the strongest bin off the sine by the window main lobe
+	CHECK(psd.density(TEST_BIN) > 100 * psd.density(TEST_BIN + 4));
+
+	double power = 0;
+	for (int k=0; k<psd.bins(); k++) {
+		power += psd.density(k) * psd.frequency(1);
+	}
+	double variance = TEST_AMPLITUDE * TEST_AMPLITUDE / 2 + TEST_NOISE * TEST_NOISE;
+	CHECK(fabs(power - variance) < 0.05 * variance);
+}
+
+/** check gap
+*
+*   A partial segment is dropped by gap() and by a NaN sample, the
+*   spectrum averaged before is kept.
+*
+*   @return void
+*/
+static void check_gap() {
+	welch_psd psd(TEST_SEGMENT);
+	int completed = 0;
+
+	for (int i=0; i<TEST_SEGMENT - 1; i++) {
+		completed += psd.add(sin(i));
+	}
+	psd.gap();
+	for (int i=0; i<TEST_SEGMENT - 1; i++) {
+		completed += psd.add(sin(i));
+	}
+	CHECK(completed == 0 && psd.get_segments() == 0);
+	CHECK(psd.add(1.0));
+	CHECK(psd.get_segments() == 1);
+
+	double before = psd.density(1);
+	CHECK(before > 0);
+	for (int i=0; i<TEST_SEGMENT / 2 - 1; i++) {
+		completed += psd.add(sin(i));
+	}
+	CHECK(!psd.add(NAN));
+	for (int i=0; i<TEST_SEGMENT - 1; i++) {
+		completed += psd.add(sin(i));
+	}
+	CHECK(completed == 0 && psd.get_segments() == 1);
+	CHECK(psd.density(1) == before);
+	CHECK(psd.add(1.0));
+	CHECK(psd.get_segments() == 2);
+
+	psd.reset();
+	CHECK(psd.get_segments() == 0 && psd.density(1) == 0);
+}
+
+int main() {
+	check_fft(2);
+	check_fft(64);
+	check_fft(1024);
+	check_sine();
+	check_gap();
+	printf("timing spectrum: %d failures\n", failures);
+	return failures == 0 ? 0 : 1;
+}
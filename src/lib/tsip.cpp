@@ -60,6 +60,21 @@
   */
 
 #include "tsip.h"
+#include "tsip_history.h"
+#include "tsip_satellite.h"
+#include "tsip_raw.h"
+#include "tsip_shm.h"
+#include "gps_frame.h"
+#include "tsip_log.h"
+#include <cerrno>
+#include <poll.h>
+#include <stdio_ext.h>
+
+#define DETECT_FRAMES		2		// known reports that identify a baud rate
+#define DETECT_REQUESTS		3		// port configuration requests per rate
+#define NEGOTIATE_CHECKS	3		// exchanges a new baud rate must carry
+#define NEGOTIATE_SETTLE_MS	200		// time the receiver takes to switch
+#define REQUEST_TIMEOUT_MS	1000
 
 /** Constructor.
 *
@@ -71,14 +86,29 @@
 * 	@param bool     verbose - optional
 *
 */
-tsip::tsip(std::string _port, bool verbose) {
+tsip::tsip(const std::string &_port, bool verbose) {
 	// set verbose
-	set_verbose(true);
+	set_verbose(verbose);
 	set_debug(false);
+	file = NULL;
+	port_status = false;
+	m_subscribed = 0;
+	m_expected = 0;
+	m_broadcast_saved = false;
+	m_baud = 9600;
+	m_primary_history = NULL;
+	m_secondary_history = NULL;
+	m_history_time = -1;
+	m_satellites = new satellite_table();
+	m_raw_ring = NULL;
+	m_publisher = NULL;
+	m_dle_run = 0;
+	reset_frame_stats();
 
 	//conversion factor to compute radians to degrees
 	_rad = 180/M_PI;
 	//init report fields
+	clear_reports();
 	init_rpt();
 
 	if (_port != "") {
@@ -105,16 +135,24 @@ tsip::tsip(std::string _port, bool verbose) {
 *	Close the gps file
 */
 tsip::~tsip() {
+	if (file != NULL && m_broadcast_saved) {
+		restore_broadcast();
+	}
 	if (file != NULL) {
-		printf("closing serial port\n");
+		if (verbose) TSIP_LOG(TSIP_LOG_INFO, "closing serial port\n");
 		fclose(file);
 	}
+	delete m_primary_history;
+	delete m_secondary_history;
+	delete m_satellites;
 }
 
 /** initilize command/report fields
 *
 *   This routine initialized the command/report fields for each
-*	command request sent to the process.
+*	command request sent to the process.  The reports decoded before
+*	stay valid, a request tells its reply from them by m_updated or by
+*	the report generation, see is_newer.
 *
 *	@return  void
 */
@@ -122,7 +160,29 @@ void tsip::init_rpt()
 {
 	m_report_length = 0;
 	m_state = START;
+	start_request();
+}
+
+/** start request
+*
+*   Clear the report flags for a new request.  Unlike init_rpt() a
+*   packet partly decoded is kept.
+*
+*	@return  void
+*/
+void tsip::start_request() {
 	m_updated.value = 0;
+}
+
+/** clear reports
+*
+*   Mark every report as never received.
+*
+*	@return  void
+*/
+void tsip::clear_reports()
+{
+	m_generation = 0;
 	m_ecef_position_s.valid = false;
 	m_ecef_position_d.valid = false;
 	m_ecef_velocity.valid = false;
@@ -134,16 +194,115 @@ void tsip::init_rpt()
 	m_utc_gps_time.valid = false;
 	m_primary_time.valid = false;
 	m_secondary_time.valid = false;
+	m_manufacturing_params.valid = false;
+	m_broadcast_mask.valid = false;
+	m_port_config.valid = false;
+	m_raw_measurement.valid = false;
 	m_unknown.valid = false;
 
-	for (int i=0; i<MAX_DATA;i++) {
-		m_report.raw.data[i]='\0';
+	memset(&m_ecef_position_s.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_ecef_position_d.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_ecef_velocity.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_sw_version.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_single_position.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_double_position.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_io_options.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_enu_velocity.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_utc_gps_time.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_primary_time.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_secondary_time.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_manufacturing_params.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_broadcast_mask.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_port_config.stamp, 0, sizeof(struct _report_stamp));
+	memset(&m_raw_measurement.stamp, 0, sizeof(struct _report_stamp));
+	memset(m_raw_measurement.report.spare, 0, sizeof(m_raw_measurement.report.spare));
+	memset(&m_unknown.stamp, 0, sizeof(struct _report_stamp));
+	m_satellites->clear();
+}
+
+/** stamp report
+*
+*   Give the report just decoded the next generation and the time it
+*   was received.
+*
+*   @param _report_stamp&  stamp of the report
+*	@return  void
+*/
+void tsip::stamp(struct _report_stamp &stamp) {
+	stamp.generation = ++m_generation;
+	clock_gettime(CLOCK_REALTIME, &stamp.received);
+}
+
+/** get generation
+*
+*   The number of reports decoded so far.  Taken before a request, a
+*   report with a higher generation arrived after it.
+*
+*	@return  unsigned long long
+*/
+unsigned long long tsip::get_generation() {
+	return m_generation;
+}
+
+/** get stamp
+*
+*   @param int  m_updated bit of one report, see report_bit
+*   @return _report_stamp*  NULL for a bit without a report
+*/
+const struct _report_stamp *tsip::get_stamp(int bit) {
+	union _update_report b;
+
+	b.value = bit;
+	if (b.report.ecef_position_s)		return &m_ecef_position_s.stamp;
+	if (b.report.ecef_position_d)		return &m_ecef_position_d.stamp;
+	if (b.report.ecef_velocity)			return &m_ecef_velocity.stamp;
+	if (b.report.sw_version)			return &m_sw_version.stamp;
+	if (b.report.single_position)		return &m_single_position.stamp;
+	if (b.report.double_position)		return &m_double_position.stamp;
+	if (b.report.io_options)			return &m_io_options.stamp;
+	if (b.report.enu_velocity)			return &m_enu_velocity.stamp;
+	if (b.report.primary_time)			return &m_primary_time.stamp;
+	if (b.report.secondary_time)		return &m_secondary_time.stamp;
+	if (b.report.utc_gps_time)			return &m_utc_gps_time.stamp;
+	if (b.report.manufacturing_params)	return &m_manufacturing_params.stamp;
+	if (b.report.broadcast_mask)		return &m_broadcast_mask.stamp;
+	if (b.report.port_config)			return &m_port_config.stamp;
+	if (b.report.satellites)			return &m_satellites->stamp;
+	if (b.report.raw_measurement)		return &m_raw_measurement.stamp;
+	if (b.report.unknown)				return &m_unknown.stamp;
+	return NULL;
+}
+
+/** is newer
+*
+*   "Has a new 8F-AB arrived since I asked" without clearing anything:
+*
+*       unsigned long long since = gps.get_generation();
+*       ...
+*       if (gps.is_newer(tsip::report_bit(0x8f, 0xab), since)) ...
+*
+*   @param int                 m_updated bits of the reports
+*   @param unsigned long long  generation taken earlier
+*   @return bool  true - every one of the reports was decoded after it
+*/
+bool tsip::is_newer(int bits, unsigned long long since) {
+	if (bits == 0) {
+		return false;
+	}
+	for (int rest = bits; rest != 0; rest &= rest - 1) {
+		const struct _report_stamp *s = get_stamp(rest & -rest);
+		if (s == NULL || s->generation <= since) {
+			return false;
+		}
 	}
+	return true;
 }
+
 /** set verbose flag
 *
 *   If the verbose flag is false, then all messages from the tsip
-* 	routine are suppressed.
+* 	routine are suppressed.  The messages are written by the logger
+* 	thread, see tsip_log.h.
 * 	The default is true
 *
 * 	@param   bool  true/false
@@ -171,7 +330,7 @@ void tsip::set_debug(bool db) {
 *
 *   @param string::gps_port  defaults to /dev/ttyS0.
 */
-void tsip::set_gps_port(std::string port="/dev/ttyS0") {
+void tsip::set_gps_port(const std::string &port="/dev/ttyS0") {
 	gps_port = port;
 }
 
@@ -181,10 +340,288 @@ void tsip::set_gps_port(std::string port="/dev/ttyS0") {
 *
 *   @return string::gps_port
 */
-std::string tsip::get_gps_port() {
+const std::string &tsip::get_gps_port() {
 	return (gps_port);
 }
 
+/** get port file descriptor
+*
+*   @return int  file descriptor of the open gps port, -1 if not open
+*/
+int tsip::get_port_fd() {
+	return (file != NULL ? fileno(file) : -1);
+}
+
+/** get reply
+*
+*   Copy the decoded reports, the report flags and the last packet
+*   received, so they can be handed to another thread or kept after
+*   the next request.
+*
+*   @param tsip_reply&  returned copy, found is not set
+*   @return void
+*/
+void tsip::get_reply(tsip_reply &reply) {
+	reply.updated = m_updated.value;
+	reply.ecef_position_s = m_ecef_position_s;
+	reply.ecef_position_d = m_ecef_position_d;
+	reply.ecef_velocity = m_ecef_velocity;
+	reply.sw_version = m_sw_version;
+	reply.single_position = m_single_position;
+	reply.double_position = m_double_position;
+	reply.io_options = m_io_options;
+	reply.enu_velocity = m_enu_velocity;
+	reply.utc_gps_time = m_utc_gps_time;
+	reply.primary_time = m_primary_time;
+	reply.secondary_time = m_secondary_time;
+	reply.manufacturing_params = m_manufacturing_params;
+	reply.broadcast_mask = m_broadcast_mask;
+	reply.port_config = m_port_config;
+	reply.report_length = m_report_length;
+	memcpy(reply.report.raw.data, m_report.raw.data, m_report_length);
+}
+
+/** keep history
+*
+*   Keep the last reports of a type, see tsip_history.h.  Supported are
+*   8F-AB and 8F-AC.  The 8F-AC entries are keyed by the time of the
+*   8F-AB before them, so 8F-AB must be broadcast (and subscribed, if
+*   subscriptions are used) for an 8F-AC history to fill.  A history
+*   already kept is replaced and starts empty.
+*
+*   @param UINT8   report code
+*   @param UINT8   report subcode
+*   @param size_t  reports kept
+*   @return bool   false - report not supported
+*/
+bool tsip::keep_history(UINT8 code, UINT8 subcode, size_t capacity) {
+	if (code != REPORT_SUPER) {
+		return false;
+	}
+	switch (subcode) {
+		case REPORT_SUPER_PRIMARY_TIME:
+			delete m_primary_history;
+			m_primary_history = new primary_time_history(capacity);
+			return true;
+		case REPORT_SUPER_SECONDARY_TIME:
+			delete m_secondary_history;
+			m_secondary_history = new secondary_time_history(capacity);
+			return true;
+		default:
+			return false;
+	}
+}
+
+/** get primary history
+*
+*   @return primary_time_history*  8F-AB history, NULL when not kept
+*/
+const primary_time_history *tsip::get_primary_history() {
+	return m_primary_history;
+}
+
+/** get secondary history
+*
+*   @return secondary_time_history*  8F-AC history, NULL when not kept
+*/
+const secondary_time_history *tsip::get_secondary_history() {
+	return m_secondary_history;
+}
+
+/** record history
+*
+*   Add the report just decoded to its history.  Called by update_report
+*   so the histories see every report, init_rpt() does not clear them.
+*
+*   @return void
+*/
+void tsip::record_history() {
+	// the report just decoded, m_updated may hold earlier ones
+	int bit = report_bit(m_report.report.code, m_report.extended.subcode);
+	const struct _report_stamp *stamp = get_stamp(bit);
+	if (stamp == NULL || stamp->generation != get_generation()) {
+		return;					// not stored as its type
+	}
+
+	if (bit == report_bit(REPORT_SUPER, REPORT_SUPER_PRIMARY_TIME)) {
+		m_history_time = history_ring::gps_seconds(m_primary_time);
+		if (m_primary_history != NULL) {
+			m_primary_history->record(m_history_time, m_primary_time);
+		}
+	}
+	if (bit == report_bit(REPORT_SUPER, REPORT_SUPER_SECONDARY_TIME) && m_secondary_history != NULL
+			&& m_history_time >= 0) {
+		m_secondary_history->record(m_history_time, m_secondary_time);
+	}
+}
+
+/** get satellites
+*
+*   @return satellite_table*  satellites of 0x47, 0x5C and 8F-A7
+*/
+const satellite_table *tsip::get_satellites() {
+	return m_satellites;
+}
+
+/** stream raw
+*
+*   Copy every 0x5A decoded into a ring, see tsip_raw.h.  The receiver
+*   only sends 0x5A with 0x35 auxiliary packet_5A set, subscribe to
+*   REPORT_RAW_MEASUREMENT and apply_subscriptions() to set it.
+*
+*   @param raw_measurement_ring*  ring fed by the decoding thread, NULL - stop
+*   @return void
+*/
+void tsip::stream_raw(raw_measurement_ring *ring) {
+	m_raw_ring = ring;
+}
+
+/** publish
+*
+*   Write every report decoded into a shared memory ring, with its
+*   structure and packet bytes, for the processes that cannot own the
+*   port, see tsip_shm.h.  With subscriptions only the reports decoded
+*   are published.
+*
+*   @param shm_packet_writer*  ring created by the caller, NULL - stop
+*   @return void
+*/
+void tsip::publish(shm_packet_writer *writer) {
+	m_publisher = writer;
+}
+
+/** request almanac  0x38
+*
+*   Ask the receiver for the almanac of every satellite, one 0x58 per
+*   PRN, for the predictions of sky_geometry.  Needs blocking reads,
+*   call it before handing the port to a reactor.  The almanac changes
+*   slowly, once a day is plenty.
+*
+*   @return int  almanacs received, satellites without one are skipped
+*/
+int tsip::request_almanac() {
+	int received = 0;
+
+	for (int prn=1; prn<=SATELLITE_MAX_PRN; prn++) {
+		unsigned long long since = get_generation();
+
+		//build 0x38 request - almanac of one satellite
+		m_command.report.code = COMMAND_REQUEST_SYSTEM_DATA;
+		m_command.report.data[0] = 1;		// request data
+		m_command.report.data[1] = 2;		// almanac
+		m_command.report.data[2] = prn;
+		m_command.report.cmd_len = 4;
+
+		// a broadcast 8F-A7 also sets the satellites bit, try again
+		for (int tries=0; tries<3; tries++) {
+			if (!get_report_msg(m_command)) {
+				break;
+			}
+			if (m_report.report.code == REPORT_SYSTEM_DATA && m_report.report.data[2] == prn) {
+				break;
+			}
+		}
+		if (m_satellites->almanac_generation(prn) > since) {
+			received++;
+		}
+	}
+	if (verbose) TSIP_LOG(TSIP_LOG_INFO, "%d almanacs received\n", received);
+	return received;
+}
+
+/** update satellites  0x47 0x5C 8F-A7 0x58
+*
+*   Write the satellite report in m_report into the table, in place.
+*   0x58 is decoded when it is the almanac, its fields:
+*     0 operation, 2 - data, 3/4 - none for the satellite
+*     1 type, 2 - almanac
+*     2 PRN
+*     3 length of the almanac, 66
+*     4 t_oa_raw, 5 SV_HEALTH, then SINGLE e, t_oa, i_o, OMEGADOT,
+*     sqrt_A, OMEGA_0, omega, M_0, a_f0, a_f1, Axis, n, OMEGA_n,
+*     ODOT_n, t_zc, then UINT16 weeknum, wn_oa
+*
+*   @return bool  false - 8F-A7 of an unknown format or 0x58 other
+*                 than the almanac, not decoded
+*/
+bool tsip::update_satellites() {
+	UINT8 *data;
+	int count;
+	almanac_t alm;
+
+	switch (m_report.report.code) {
+		// 0x47 count, then PRN and signal level of each satellite
+		case REPORT_SIGNAL_LEVELS:
+			stamp(m_satellites->stamp);
+			data = m_report.report.data;
+			count = data[0];
+			for (int i=0; i<count; i++) {
+				m_satellites->update_level(data[1+5*i], b4_to_single(2+5*i,'r'),
+						m_satellites->stamp.generation);
+			}
+			break;
+
+		// 0x5C one satellite
+		case REPORT_SATELLITE_TRACKING:
+			stamp(m_satellites->stamp);
+			m_satellites->update_status(m_report.report.data[0], b4_to_single(4,'r'),
+					b4_to_single(12,'r'), b4_to_single(16,'r'), m_satellites->stamp.generation);
+			break;
+
+		// 0x58 almanac, the reply to a request without one still
+		// answers it
+		case REPORT_SYSTEM_DATA:
+			data = m_report.report.data;
+			if (data[1] != 2) {
+				return false;
+			}
+			if (data[0] == 2 && data[3] >= 66) {
+				stamp(m_satellites->stamp);
+				alm.health = data[5];
+				alm.e = b4_to_single(6,'r');
+				alm.t_oa = b4_to_single(10,'r');
+				alm.i_o = b4_to_single(14,'r');
+				alm.omegadot = b4_to_single(18,'r');
+				alm.sqrt_a = b4_to_single(22,'r');
+				alm.omega_0 = b4_to_single(26,'r');
+				alm.omega = b4_to_single(30,'r');
+				alm.m_0 = b4_to_single(34,'r');
+				alm.af0 = b4_to_single(38,'r');
+				alm.af1 = b4_to_single(42,'r');
+				alm.wn_oa = b2_to_uint16(68,'r');
+				m_satellites->update_almanac(data[2], alm, m_satellites->stamp.generation);
+			}
+			break;
+
+		// 8F-A7 format, time of fix, clock bias and rate, then PRN and
+		// bias of each satellite, SINGLE seconds or SINT16 0.1 ns
+		default:
+			data = m_report.extended.data;
+			if (data[0] > 1) {
+				if (verbose) TSIP_LOG(TSIP_LOG_WARNING, "8F-A7 format %d not decoded\n", data[0]);
+				return false;
+			}
+			stamp(m_satellites->stamp);
+			m_satellites->start_solution();
+			if (data[0] == 0) {
+				count = (m_report_length - 15) / 5;
+				for (int i=0; i<count; i++) {
+					m_satellites->update_residual(data[13+5*i], b4_to_single(14+5*i,'e') * 1e9f,
+							m_satellites->stamp.generation);
+				}
+			} else {
+				count = (m_report_length - 11) / 3;
+				for (int i=0; i<count; i++) {
+					m_satellites->update_residual(data[9+3*i], (SINT16)b2_to_uint16(10+3*i,'e') * 0.1f,
+							m_satellites->stamp.generation);
+				}
+			}
+			break;
+	}
+	m_updated.report.satellites = 1;
+	return true;
+}
+
 /** open serial port
 *
 *   Open the gps port and initialize.
@@ -192,20 +629,19 @@ std::string tsip::get_gps_port() {
 *   @param string   port name  "/dev/ttyS0"
 *   @return bool    true - success, false = fail
 */
-bool tsip::open_gps_port(std::string port)
+bool tsip::open_gps_port(const std::string &port)
 {
-	if (port == "") {
-		port = gps_port;
+	// set the port
+	if (port != "") {
+		set_gps_port(port);
 	}
-	if (port == "") {
+	if (gps_port == "") {
 		printf("Port must be provided in call or in set_gps_port\n");
 		return(false);
 	}
 
-	// set the port
-	set_gps_port(port);
-
-    file = fopen(gps_port.c_str(), "r");
+    // opened for update, commands are written on the same port
+    file = fopen(gps_port.c_str(), "r+");
 
 	if (file != NULL) {
 		setup_gps_port(file);
@@ -230,57 +666,16 @@ bool tsip::open_gps_port(std::string port)
 
 /** set up serial port
 *
-*   Set the  parameters for the I/O comm port the gps is attached.
+*   Set the  parameters for the I/O comm port the gps is attached,
+*   8N1 raw at m_baud, 9600 until detect_baud or set_baud change it.
 *
 *   @param pointer to the serial port 'file'.
 */
 void tsip::setup_gps_port(FILE *file)
 {
-    int fd;
-    struct termios newtio;
-
-    fd = fileno(file);
-
-    memset(&newtio, 0, sizeof(newtio)); /* clear struct for new port settings */
-
-    /*
-        B9600: Set bps rate. You could also use cfsetispeed and cfsetospeed.
-        CS8     : 8n1 (8bit,no parity,1 stopbit)
-        CLOCAL  : local connection, no modem contol
-        CREAD   : enable receiving characters
-     */
-    newtio.c_cflag = B9600 | CS8 | CLOCAL | CREAD;
-
-    /*
-        IGNPAR  : ignore bytes with parity errors
-        otherwise make device raw (no other input processing)
-     */
-    newtio.c_iflag = IGNPAR;
-
-    /*
-        Raw output.
-     */
-    newtio.c_oflag = 0;
-
-    /*
-        initialize all control characters
-        default values can be found in /usr/include/termios.h, and are given
-        in the comments, but we don't need them here
-     */
-    newtio.c_cc[VTIME]    = 0;     /* inter-character timer unused */
-    newtio.c_cc[VMIN]     = 1;     /* blocking read until 1 character arrives */
-
-    /*
-        ICANON  : enable canonical input
-        disable all echo functionality, and don't send signals to calling program
-     */
-    newtio.c_lflag = 0;//ICANON;
-
-    /*
-        now clean the modem line and activate the settings for the port
-     */
-    tcflush(fd, TCIFLUSH);
-    tcsetattr(fd,TCSANOW,&newtio);
+	if (!setup_serial_port(fileno(file), m_baud)) {
+		perror(gps_port.c_str());
+	}
 }
 
 
@@ -405,94 +800,202 @@ DOUBLE tsip::b8_to_double(int bb, char r_code) {
 
 }
 
+/** convert short int to 2 bytes
+*
+*   Conversion routine to store the value in m_command beginning
+*	with the byte referenced by the passed index.
+*
+* 	@param   UINT16 value to store
+* 	@param   int  the position of the first byte in m_command
+* 	@param   char the code r or e to  idenity which array to store in
+*	@return  void
+*/
+void tsip::uint16_to_b2(UINT16 value, int bb, char r_code) {
+	UINT8 *data = (r_code == 'e') ? m_command.extended.data : m_command.report.data;
+
+	data[bb]   = (value >> 8) & 0xff;
+	data[bb+1] = value & 0xff;
+}
+
+/** convert int to 4 bytes
+*
+*   Conversion routine to store the value in m_command beginning
+*	with the byte referenced by the passed index.
+*
+* 	***note x86 is a low-endian machine, the trimble is high-endian
+*      so the bytes must be flipped
+*
+* 	@param   UINT32 value to store
+* 	@param   int  the position of the first byte in m_command
+* 	@param   char the code r or e to  idenity which array to store in
+*	@return  void
+*/
+void tsip::uint32_to_b4(UINT32 value, int bb, char r_code) {
+	UINT8 *data = (r_code == 'e') ? m_command.extended.data : m_command.report.data;
+
+	data[bb]   = (value >> 24) & 0xff;
+	data[bb+1] = (value >> 16) & 0xff;
+	data[bb+2] = (value >> 8) & 0xff;
+	data[bb+3] = value & 0xff;
+}
+
+/** convert single to 4 bytes
+*
+*   Conversion routine to store the value in m_command beginning
+*	with the byte referenced by the passed index.
+*
+* 	***note x86 is a low-endian machine, the trimble is high-endian
+*      so the bytes must be flipped
+*
+* 	@param   SINGLE value to store
+* 	@param   int  the position of the first byte in m_command
+* 	@param   char the code r or e to  idenity which array to store in
+*	@return  void
+*/
+void tsip::single_to_b4(SINGLE value, int bb, char r_code) {
+	UINT32 x;
+
+	memcpy(&x, &value, sizeof(x));
+	uint32_to_b4(x, bb, r_code);
+}
+
 
 /**  is report found
 *
 *   pass the command code and check to see if report has been found.
-* 	if no report is returned in response to a command, then true is
-* 	returned, if the command is in the list.
+*   The request is answered when all the reports it expects, see
+*   expected_reports, have been updated.
 *
 * 	@param cmd_stack_t command codereference to time fields
 *   @return bool.
 */
-bool tsip::is_report_found(_command_packet &_cmd) {
-	bool isfound = false;
+bool tsip::is_report_found(const _command_packet &_cmd) {
+	int expected = expected_reports(_cmd);
 
+	return (expected != 0 && (m_updated.value & expected) == expected);
+}
+
+/**  expected reports
+*
+*   The m_updated bits of the reports that answer a command, 0 when the
+*   command has no reply.
+*
+* 	@param _command_packet command
+*   @return int m_updated bits
+*/
+int tsip::expected_reports(const _command_packet &_cmd) {
+	union _update_report expected;
+
+	expected.value = 0;
 	switch (_cmd.report.code){
 
 		// 0x1e
 		case COMMAND_COLD_FACTORY_RESET :
-			//0x45 report_sw_version
-			if (m_updated.report.sw_version) {
-				isfound = true;
-			}
-			break;
-
 		// 0x1f
 		case COMMAND_REQUEST_SW_VERSION :
-			//0x45 report_sw_version
-			if (m_updated.report.sw_version) {
-				isfound = true;
-			}
-			break;
-
 		// 0x25
 		case COMMAND_WARM_RESET_SELF_TEST :
 			//0x45 report_sw_version
-			if (m_updated.report.sw_version) {
-				isfound = true;
-			}
+			expected.report.sw_version = 1;
 			break;
 
 		// 0x35
 		case COMMAND_SET_IO_OPTIONS :
 			// 0x55	 REPORT_IO_OPTIONS
-			if (m_updated.report.io_options) {
-				isfound = true;
-			}
+			expected.report.io_options = 1;
 			break;
 
 		// 0x37
 		case COMMAND_REQUEST_POSITION :
-			// 0x42 REPORT_ECEF_POSITION_S
-			if (m_updated.report.ecef_position_s && m_updated.report.ecef_position_d) {
-				isfound = true;
-			}
-			// 0x43 REPORT_ECEF_VELOCITY
+			// 0x42 REPORT_ECEF_POSITION_S and 0x83 REPORT_ECEF_POSITION_D
+			expected.report.ecef_position_s = 1;
+			expected.report.ecef_position_d = 1;
+			break;
 
-			// 0x83 REPORT_ECEF_POSITION_D
-			//if (m_updated.report.ecef_position_d) {
-			//	isfound = true;
-			//}
+		// 0x38
+		case COMMAND_REQUEST_SYSTEM_DATA :
+			// 0x58 REPORT_SYSTEM_DATA
+			expected.report.satellites = 1;
+			break;
+
+		// 0xbc
+		case COMMAND_SET_PORT_CONFIG :
+			// 0xbc REPORT_PORT_CONFIG
+			expected.report.port_config = 1;
 			break;
 		//0x8E
 		case COMMAND_SUPER_PACKET:
 			switch (_cmd.extended.subcode) {
 				// 0xa2
 				case REPORT_SUPER_UTC_GPS_TIME :
-					if (m_updated.report.utc_gps_time) {
-						isfound = true;
-					}
+					expected.report.utc_gps_time = 1;
+					break;
+				// 0xa5
+				case COMMAND_SET_BROADCAST_MASK :
+					expected.report.broadcast_mask = 1;
 					break;
 				// 0xab
 				case REPORT_SUPER_PRIMARY_TIME :
-					if (m_updated.report.primary_time) {
-						isfound = true;
-					}
+					expected.report.primary_time = 1;
 					break;
 				// 0xac
 				case REPORT_SUPER_SECONDARY_TIME :
-					if (m_updated.report.secondary_time) {
-						isfound = true;
-					}
+					expected.report.secondary_time = 1;
+					break;
+				// 0x41
+				case COMMAND_MANUFACTURING_PARAMS :
+					expected.report.manufacturing_params = 1;
 					break;
 			}
 			break;
 		default :
-			isfound = false;
+			break;
 		}
-	return isfound;
+	return expected.value;
 }
+
+/**  report bit
+*
+*   The m_updated bit of a report packet.
+*
+* 	@param UINT8 report code
+* 	@param UINT8 subcode of a super report
+*   @return int m_updated bit, unknown for the reports not decoded
+*/
+int tsip::report_bit(UINT8 code, UINT8 subcode) {
+	union _update_report bit;
+
+	bit.value = 0;
+	switch (code) {
+		case REPORT_ECEF_POSITION_S:	bit.report.ecef_position_s = 1; break;
+		case REPORT_ECEF_POSITION_D:	bit.report.ecef_position_d = 1; break;
+		case REPORT_ECEF_VELOCITY:		bit.report.ecef_velocity = 1; break;
+		case REPORT_SW_VERSION:			bit.report.sw_version = 1; break;
+		case REPORT_SINGLE_POSITION:	bit.report.single_position = 1; break;
+		case REPORT_DOUBLE_POSITION:	bit.report.double_position = 1; break;
+		case REPORT_IO_OPTIONS:			bit.report.io_options = 1; break;
+		case REPORT_ENU_VELOCITY:		bit.report.enu_velocity = 1; break;
+		case REPORT_PORT_CONFIG:		bit.report.port_config = 1; break;
+		case REPORT_SIGNAL_LEVELS:		bit.report.satellites = 1; break;
+		case REPORT_SATELLITE_TRACKING:	bit.report.satellites = 1; break;
+		case REPORT_SYSTEM_DATA:		bit.report.satellites = 1; break;
+		case REPORT_RAW_MEASUREMENT:	bit.report.raw_measurement = 1; break;
+		case REPORT_SUPER:
+			switch (subcode) {
+				case REPORT_SUPER_UTC_GPS_TIME:		bit.report.utc_gps_time = 1; break;
+				case REPORT_SUPER_SATELLITE_SOLUTIONS:	bit.report.satellites = 1; break;
+				case REPORT_SUPER_MANUFACTURING_PARAMS:	bit.report.manufacturing_params = 1; break;
+				case REPORT_SUPER_BROADCAST_MASK:	bit.report.broadcast_mask = 1; break;
+				case REPORT_SUPER_PRIMARY_TIME:		bit.report.primary_time = 1; break;
+				case REPORT_SUPER_SECONDARY_TIME:	bit.report.secondary_time = 1; break;
+				default:							bit.report.unknown = 1; break;
+			}
+			break;
+		default:						bit.report.unknown = 1; break;
+	}
+	return bit.value;
+}
+
 	// other reports
 	// 0x42 REPORT_ECEF_POSITION_S:
 	// 0x43 REPORT_ECEF_VELOCITY
@@ -508,6 +1011,11 @@ bool tsip::is_report_found(_command_packet &_cmd) {
 *   byte stream from a Trimble Thunderbolt GPSDO into TSIP
 *   packets. When a packet has been completed the corresponding
 *   report is updated.
+*
+*   A packet of the wrong length is dropped at its ETX, see
+*   report_length.  A DLE followed by any other byte than DLE or ETX
+*   is taken as the start of the next packet, its DLE ETX was lost.
+*   A packet longer than MAX_DATA is dropped up to its DLE ETX.
 */
 int tsip::encode(UINT8 c)
 {
@@ -539,6 +1047,10 @@ int tsip::encode(UINT8 c)
 		else if (m_report_length < MAX_DATA) {
 			m_report.raw.data[m_report_length++] = c;
 		}
+		else {
+			start_resync();
+			m_stats.skipped++;
+		}
 		break;
 
 	case DATA_DLE:
@@ -547,29 +1059,359 @@ int tsip::encode(UINT8 c)
 			m_state = DATA;
 			if (m_report_length < MAX_DATA) {
 				m_report.raw.data[m_report_length++] = c;
+			} else {
+				start_resync();
 			}
 		}
 		// end of frame
 		else if (c == ETX) {
 			m_state = START;
-			return update_report();    //Whoohoo the moment we've been waitin for
+			return end_frame();    //Whoohoo the moment we've been waitin for
+		}
+		// mis-framed, the byte starts the next packet
+		else {
+			m_stats.misframed++;
+			m_state = DATA;
+			m_report_length = 0;
+			m_report.raw.data[m_report_length++] = c;
+			if (verbose) TSIP_LOG(TSIP_LOG_INFO, "waiting gps packet......\n");
+		}
+		break;
+
+	case RESYNC:
+		// an ETX after an odd number of DLEs ends the packet
+		m_stats.skipped++;
+		if (c == DLE) {
+			m_dle_run++;
+		} else {
+			if (c == ETX && (m_dle_run & 1)) {
+				m_state = START;
+			}
+			m_dle_run = 0;
 		}
-		// mis-framed
-		else
-			m_state = START;
-			if (verbose) printf("waiting gps packet......\n");
 		break;
 
 	default:
 		m_state = START;
-		if (verbose) printf("waiting gps packet......\n");
+		if (verbose) TSIP_LOG(TSIP_LOG_INFO, "waiting gps packet......\n");
 		break;
 	}
 
 	return 0;
 }
 
-
+
+/** encode a block of bytes into TSIP packets
+*
+*   Same state machine as encode(UINT8) for a whole read buffer.  Runs
+*   of packet data and the gaps between packets are found with memchr
+*   and copied in one piece, so the cost is per DLE rather than per
+*   byte.  The end of a damaged packet is also found with memchr, on
+*   its ETX.  The handler is called after each report is decoded; at
+*   that point m_report holds the packet and m_updated the bit of that
+*   report only.
+*
+*   @param UINT8*               bytes read from the gps
+*   @param int                  number of bytes
+*   @param tsip_report_handler  called per report, may be NULL
+*   @param void*                passed to the handler
+*   @return int  bytes consumed, less than len if the handler stopped
+*/
+int tsip::encode(const UINT8 *data, int len, tsip_report_handler handler, void *ctx)
+{
+	const UINT8 *p = data;
+	const UINT8 *end = data + len;
+
+	while (p < end) {
+		switch (m_state) {
+
+		case START: {
+			// skip to the next DLE
+			const UINT8 *dle = (const UINT8 *)memchr(p, DLE, end - p);
+			if (dle == NULL) {
+				return len;
+			}
+			p = dle + 1;
+			m_state = FRAME;
+			break;
+		}
+
+		case FRAME:
+			// check if mis-framed
+			if (*p == DLE || *p == ETX) {
+				m_state = START;
+			} else {
+				m_state = DATA;
+				m_report_length = 0;
+				m_report.raw.data[m_report_length++] = *p;
+			}
+			p++;
+			break;
+
+		case DATA: {
+			// copy up to the next DLE
+			const UINT8 *dle = (const UINT8 *)memchr(p, DLE, end - p);
+			const UINT8 *stop = (dle != NULL ? dle : end);
+			int n = std::min((int)(stop - p), MAX_DATA - m_report_length);
+
+			memcpy(&m_report.raw.data[m_report_length], p, n);
+			m_report_length += n;
+			p += n;
+			if (p < stop) {
+				start_resync();
+			} else if (dle != NULL) {
+				p++;
+				m_state = DATA_DLE;
+			}
+			break;
+		}
+
+		case DATA_DLE:
+			// escaped data
+			if (*p == DLE) {
+				m_state = DATA;
+				if (m_report_length < MAX_DATA) {
+					m_report.raw.data[m_report_length++] = DLE;
+				} else {
+					start_resync();
+				}
+				p++;
+			}
+			// end of frame
+			else if (*p == ETX) {
+				m_state = START;
+				p++;
+				m_updated.value = 0;
+				if (end_frame() && handler != NULL && !handler(*this, ctx)) {
+					return p - data;
+				}
+			}
+			// mis-framed, the byte starts the next packet
+			else {
+				m_stats.misframed++;
+				m_state = DATA;
+				m_report_length = 0;
+				m_report.raw.data[m_report_length++] = *p;
+				p++;
+				if (verbose) TSIP_LOG(TSIP_LOG_INFO, "waiting gps packet......\n");
+			}
+			break;
+
+		case RESYNC: {
+			// each ETX ends the packet if an odd number of DLEs is before it
+			const UINT8 *etx = (const UINT8 *)memchr(p, ETX, end - p);
+			const UINT8 *stop = (etx != NULL ? etx : end);
+			const UINT8 *q = stop;
+
+			while (q > p && q[-1] == DLE) {
+				q--;
+			}
+			int run = (stop - q) + (q == p ? m_dle_run : 0);
+
+			m_stats.skipped += stop - p;
+			p = stop;
+			if (etx == NULL) {
+				m_dle_run = run;
+				break;
+			}
+			m_stats.skipped++;
+			p++;
+			m_dle_run = 0;
+			if (run & 1) {
+				m_state = START;
+			}
+			break;
+		}
+
+		default:
+			m_state = START;
+			if (verbose) TSIP_LOG(TSIP_LOG_INFO, "waiting gps packet......\n");
+			break;
+		}
+	}
+
+	return len;
+}
+
+// frame_handler of tsip::decode, given the reports of encode
+struct decode_frame_t {
+	frame_handler handler;
+	void *ctx;
+};
+
+static bool decode_report(tsip &gps, void *ctx) {
+	decode_frame_t *f = (decode_frame_t *)ctx;
+
+	return f->handler(gps, f->ctx);
+}
+
+/** decode
+*
+*   The block encode for a caller that does not know the protocol of
+*   the port, see frame_decoder.  The handler is given the tsip
+*   object, m_updated tells the report.
+*
+*   @param UINT8*         bytes read from the gps
+*   @param int            number of bytes
+*   @param frame_handler  called per report, may be NULL
+*   @param void*          passed to the handler
+*   @return int  bytes consumed, less than len if the handler stopped
+*/
+int tsip::decode(const UINT8 *data, int len, frame_handler handler, void *ctx) {
+	decode_frame_t f;
+
+	if (handler == NULL) {
+		return encode(data, len, NULL, NULL);
+	}
+	f.handler = handler;
+	f.ctx = ctx;
+	return encode(data, len, decode_report, &f);
+}
+
+/** get protocol
+*
+*   @return gps_protocol  PROTOCOL_TSIP
+*/
+gps_protocol tsip::get_protocol() {
+	return PROTOCOL_TSIP;
+}
+
+/** start resync
+*
+*   The packet is longer than MAX_DATA, drop it up to its DLE ETX.
+*
+*   @return void
+*/
+void tsip::start_resync() {
+	m_stats.oversize++;
+	m_state = RESYNC;
+	m_dle_run = 0;
+	if (verbose) TSIP_LOG(TSIP_LOG_WARNING, "report %x longer than %d bytes\n", m_report.report.code, MAX_DATA);
+}
+
+/** end frame
+*
+*   Check the length of a complete packet before its report is updated.
+*   A short packet would be decoded from what was left in the buffer,
+*   a long one is two packets whose DLE ETX was lost.
+*
+*   @return int  1 - report updated, see update_report
+*/
+int tsip::end_frame() {
+	int expected = frame_length();
+
+	m_stats.frames++;
+	if (expected != 0 && m_report_length != expected) {
+		if (m_report_length < expected) {
+			m_stats.short_frames++;
+		} else {
+			m_stats.long_frames++;
+		}
+		if (verbose) TSIP_LOG(TSIP_LOG_WARNING, "report %x-%x dropped, %d bytes, expected %d\n",
+				m_report.report.code, m_report.extended.subcode, m_report_length, expected);
+		return 0;
+	}
+	return update_report();
+}
+
+/** report length
+*
+*   Length of the packets decoded field by field, code and subcode
+*   included.
+*
+*   @param UINT8  report code
+*   @param UINT8  report subcode, 0x8F reports
+*   @return int   bytes, 0 - variable or not decoded
+*/
+int tsip::report_length(UINT8 code, UINT8 subcode) {
+	switch (code) {
+		case REPORT_ECEF_POSITION_S:	return 17;
+		case REPORT_ECEF_VELOCITY:		return 21;
+		case REPORT_SW_VERSION:			return 11;
+		case REPORT_SINGLE_POSITION:	return 21;
+		case REPORT_IO_OPTIONS:			return 5;
+		case REPORT_ENU_VELOCITY:		return 21;
+		case REPORT_ECEF_POSITION_D:	return 37;
+		case REPORT_DOUBLE_POSITION:	return 37;
+		case REPORT_PORT_CONFIG:		return 11;
+		case REPORT_SATELLITE_TRACKING:	return 25;
+		case REPORT_RAW_MEASUREMENT:	return 26;
+		case REPORT_SUPER:
+			switch (subcode) {
+				case REPORT_SUPER_MANUFACTURING_PARAMS:	return 18;
+				case REPORT_SUPER_UTC_GPS_TIME:			return 3;
+				case REPORT_SUPER_BROADCAST_MASK:		return 6;
+				case REPORT_SUPER_PRIMARY_TIME:			return 18;
+				case REPORT_SUPER_SECONDARY_TIME:		return 69;
+				default:								return 0;
+			}
+		default:
+			return 0;
+	}
+}
+
+/** frame length
+*
+*   Length of the packet in m_report, for the packets of variable
+*   length taken from their satellite count or format:
+*     0x47   2 + 5 per satellite
+*     0x58   5 + the data length in byte 3
+*     8F-A7  15 + 5 per satellite, format 0
+*            11 + 3 per satellite, format 1
+*
+*   @return int   bytes, 0 - not checked
+*/
+int tsip::frame_length() {
+	int header;
+	int per_sat;
+
+	if (m_report.report.code == REPORT_SIGNAL_LEVELS) {
+		if (m_report_length < 2) {
+			return 2;
+		}
+		return 2 + 5 * m_report.report.data[0];
+	}
+	if (m_report.report.code == REPORT_SYSTEM_DATA) {
+		if (m_report_length < 5) {
+			return 5;
+		}
+		return 5 + m_report.report.data[3];
+	}
+	if (m_report.report.code == REPORT_SUPER
+			&& m_report.extended.subcode == REPORT_SUPER_SATELLITE_SOLUTIONS) {
+		if (m_report_length < 3) {
+			return 3;
+		}
+		switch (m_report.extended.data[0]) {
+			case 0:  header = 15; per_sat = 5; break;
+			case 1:  header = 11; per_sat = 3; break;
+			default: return 0;
+		}
+		if (m_report_length < header) {
+			return header;
+		}
+		return header + per_sat * ((m_report_length - header) / per_sat);
+	}
+	return report_length(m_report.report.code, m_report.extended.subcode);
+}
+
+/** get frame stats
+*
+*   @param tsip_frame_stats&  damage counted since the last reset
+*   @return void
+*/
+void tsip::get_frame_stats(tsip_frame_stats &stats) {
+	stats = m_stats;
+}
+
+/** reset frame stats
+*
+*   @return void
+*/
+void tsip::reset_frame_stats() {
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
 /** update received report
 *
 *   Update received report's property buffer.
@@ -582,33 +1424,47 @@ int tsip::update_report()
 	void *dst;
 	int  rlen = 0;
 
-	if (verbose) printf("Found Report: %x-%x\n",m_report.report.code,m_report.extended.subcode);
+	// with subscriptions only the subscribed reports and the reply to
+	// the last request are decoded
+	if (m_subscribed != 0
+			&& !(report_bit(m_report.report.code, m_report.extended.subcode) & (m_subscribed | m_expected))) {
+		return 0;
+	}
+
+	if (verbose) TSIP_LOG(TSIP_LOG_INFO, "Found Report: %x-%x\n",m_report.report.code,m_report.extended.subcode);
 	// save report
 	switch (m_report.report.code) {
 
 	case REPORT_ECEF_POSITION_S:
 		m_updated.report.ecef_position_s = 1;
 		m_ecef_position_s.valid = true;
+		stamp(m_ecef_position_s.stamp);
 		rlen = sizeof(m_ecef_position_s.report);
 
-		m_ecef_position_s.report.x = (m_report.extended.data[0] << 24) + (m_report.extended.data[1] << 16) + (m_report.extended.data[2] << 8) + m_report.extended.data[3];
-		m_ecef_position_s.report.y = (m_report.extended.data[4] << 24) + (m_report.extended.data[5] << 16) + (m_report.extended.data[6] << 8) + m_report.extended.data[7];
-		m_ecef_position_s.report.z = (m_report.extended.data[8] << 24) + (m_report.extended.data[9] << 16) + (m_report.extended.data[10] << 8) + m_report.extended.data[11];
-		m_ecef_position_s.report.time_of_fix = (m_report.extended.data[12] << 24) + (m_report.extended.data[13] << 16) + (m_report.extended.data[14] << 8) + m_report.extended.data[15];
+		m_ecef_position_s.report.x = b4_to_single(0,'r');
+		m_ecef_position_s.report.y = b4_to_single(4,'r');
+		m_ecef_position_s.report.z = b4_to_single(8,'r');
+		m_ecef_position_s.report.time_of_fix = b4_to_single(12,'r');
 
 		break;
 
 	case REPORT_ECEF_POSITION_D:
 		m_updated.report.ecef_position_d = 1;
 		m_ecef_position_d.valid = true;
-		src = m_report.report.data;
-		dst = &m_ecef_position_d.report;
+		stamp(m_ecef_position_d.stamp);
 		rlen = sizeof(m_ecef_position_d.report);
+
+		m_ecef_position_d.report.x = b8_to_double(0,'r');
+		m_ecef_position_d.report.y = b8_to_double(8,'r');
+		m_ecef_position_d.report.z = b8_to_double(16,'r');
+		m_ecef_position_d.report.clock_bias = b8_to_double(24,'r');
+		m_ecef_position_d.report.time_of_fix = b4_to_single(32,'r');
 		break;
 
 	case REPORT_ECEF_VELOCITY:
 		m_updated.report.ecef_velocity = 1;
 		m_ecef_velocity.valid = true;
+		stamp(m_ecef_velocity.stamp);
 		src = m_report.report.data;
 		dst = &m_ecef_velocity.report;
 		rlen = sizeof(m_ecef_velocity.report);
@@ -617,6 +1473,7 @@ int tsip::update_report()
 	case REPORT_SW_VERSION:
 		m_updated.report.sw_version = 1;
 		m_sw_version.valid = true;
+		stamp(m_sw_version.stamp);
 		src = m_report.report.data;
 		dst = &m_sw_version.report;
 		rlen = sizeof(m_sw_version.report);
@@ -625,6 +1482,7 @@ int tsip::update_report()
 	case REPORT_SINGLE_POSITION:
 		m_updated.report.single_position = 1;
 		m_single_position.valid = true;
+		stamp(m_single_position.stamp);
 		src = m_report.report.data;
 		dst = &m_single_position.report;
 		rlen = sizeof(m_single_position.report);
@@ -633,22 +1491,94 @@ int tsip::update_report()
 	case REPORT_DOUBLE_POSITION:
 		m_updated.report.double_position = 1;
 		m_double_position.valid = true;
-		src = m_report.report.data;
-		dst = &m_double_position.report;
-		rlen = sizeof(m_single_position.report);
+		stamp(m_double_position.stamp);
+		rlen = sizeof(m_double_position.report);
+
+		m_double_position.report.latitude = b8_to_double(0,'r');
+		m_double_position.report.longitude = b8_to_double(8,'r');
+		m_double_position.report.altitude = b8_to_double(16,'r');
+		m_double_position.report.clock_bias = b8_to_double(24,'r');
+		m_double_position.report.time_of_fix = b4_to_single(32,'r');
 		break;
 
 	case REPORT_IO_OPTIONS:
 		m_updated.report.io_options = 1;
 		m_io_options.valid = true;
-		src = m_report.report.data;
-		dst = &m_io_options.report;
+		stamp(m_io_options.stamp);
 		rlen = sizeof(m_io_options.report);
+
+		m_io_options.report.position.value = m_report.report.data[0];
+		m_io_options.report.velocity.value = m_report.report.data[1];
+		m_io_options.report.timing.value = m_report.report.data[2];
+		m_io_options.report.auxiliary.value = m_report.report.data[3];
+		break;
+
+	case REPORT_PORT_CONFIG:
+		m_updated.report.port_config = 1;
+		m_port_config.valid = true;
+		stamp(m_port_config.stamp);
+		rlen = sizeof(m_port_config.report);
+
+		m_port_config.report.port = m_report.report.data[0];
+		m_port_config.report.input_baud = m_report.report.data[1];
+		m_port_config.report.output_baud = m_report.report.data[2];
+		m_port_config.report.data_bits = m_report.report.data[3];
+		m_port_config.report.parity = m_report.report.data[4];
+		m_port_config.report.stop_bits = m_report.report.data[5];
+		m_port_config.report.flow_control = m_report.report.data[6];
+		m_port_config.report.input_protocols = m_report.report.data[7];
+		m_port_config.report.output_protocols = m_report.report.data[8];
+		m_port_config.report.reserved = m_report.report.data[9];
+		break;
+
+	case REPORT_SIGNAL_LEVELS:
+	case REPORT_SATELLITE_TRACKING:
+		if (!update_satellites()) {
+			return 0;
+		}
+		rlen = m_report_length;
+		break;
+
+	// 0x5A, also into the ring when streamed
+	case REPORT_RAW_MEASUREMENT:
+		m_updated.report.raw_measurement = 1;
+		m_raw_measurement.valid = true;
+		stamp(m_raw_measurement.stamp);
+		rlen = sizeof(m_raw_measurement.report);
+
+		m_raw_measurement.report.prn = m_report.report.data[0];
+		m_raw_measurement.report.sample_length = b4_to_single(1,'r');
+		m_raw_measurement.report.signal_level = b4_to_single(5,'r');
+		m_raw_measurement.report.code_phase = b4_to_single(9,'r');
+		m_raw_measurement.report.doppler = b4_to_single(13,'r');
+		m_raw_measurement.report.time_of_measurement = b8_to_double(17,'r');
+		if (m_raw_ring != NULL) {
+			raw_record_t *record = m_raw_ring->reserve();
+			if (record != NULL) {
+				*record = m_raw_measurement.report;
+				m_raw_ring->commit();
+			}
+		}
+		break;
+
+	// 0x58 almanac, the other system data is kept undecoded
+	case REPORT_SYSTEM_DATA:
+		if (update_satellites()) {
+			rlen = m_report_length;
+			break;
+		}
+		m_updated.report.unknown = 1;
+		m_unknown.valid = true;
+		stamp(m_unknown.stamp);
+		src = m_report.raw.data;
+		dst = m_unknown.report.raw.data;
+		rlen = sizeof(m_unknown.report.raw.data);
 		break;
 
 	case REPORT_ENU_VELOCITY:
 		m_updated.report.enu_velocity = 1;
 		m_enu_velocity.valid = true;
+		stamp(m_enu_velocity.stamp);
 		src = m_report.report.data;
 		dst = &m_enu_velocity.report;
 		rlen = sizeof(m_enu_velocity.report);
@@ -661,15 +1591,53 @@ int tsip::update_report()
 		case REPORT_SUPER_UTC_GPS_TIME:
 			m_updated.report.utc_gps_time = 1;
 			m_utc_gps_time.valid = true;
+			stamp(m_utc_gps_time.stamp);
 			rlen = sizeof(m_utc_gps_time.report);
 
 			m_utc_gps_time.report.bits.value = m_report.extended.data[0];
 			break;
 
+		// 8f-41
+		case REPORT_SUPER_MANUFACTURING_PARAMS:
+			m_updated.report.manufacturing_params = 1;
+			m_manufacturing_params.valid = true;
+			stamp(m_manufacturing_params.stamp);
+			rlen = sizeof(m_manufacturing_params.report);
+
+			m_manufacturing_params.report.serial_prefix = b2_to_uint16(0,'e');
+			m_manufacturing_params.report.serial_number = b4_to_uint32(2,'e');
+			m_manufacturing_params.report.build_year = m_report.extended.data[6];
+			m_manufacturing_params.report.build_month = m_report.extended.data[7];
+			m_manufacturing_params.report.build_day = m_report.extended.data[8];
+			m_manufacturing_params.report.build_hour = m_report.extended.data[9];
+			m_manufacturing_params.report.oscillator_offset = b4_to_single(10,'e');
+			m_manufacturing_params.report.test_code = b2_to_uint16(14,'e');
+			break;
+
+		// 8f-a5
+		case REPORT_SUPER_BROADCAST_MASK:
+			m_updated.report.broadcast_mask = 1;
+			m_broadcast_mask.valid = true;
+			stamp(m_broadcast_mask.stamp);
+			rlen = sizeof(m_broadcast_mask.report);
+
+			m_broadcast_mask.report.mask0.value = b2_to_uint16(0,'e');
+			m_broadcast_mask.report.mask2 = b2_to_uint16(2,'e');
+			break;
+
+		// 8f-a7
+		case REPORT_SUPER_SATELLITE_SOLUTIONS:
+			if (!update_satellites()) {
+				return 0;
+			}
+			rlen = m_report_length;
+			break;
+
 		// 8f-ab
 		case REPORT_SUPER_PRIMARY_TIME:
 			m_updated.report.primary_time = 1;
 			m_primary_time.valid = true;
+			stamp(m_primary_time.stamp);
 			rlen = sizeof(m_primary_time.report);
 
 			m_primary_time.report.seconds_of_week = b4_to_uint32(0,'e');
@@ -689,6 +1657,7 @@ int tsip::update_report()
 		case REPORT_SUPER_SECONDARY_TIME:
 			m_updated.report.secondary_time = 1;
 			m_secondary_time.valid = true;
+			stamp(m_secondary_time.stamp);
 			rlen = sizeof(m_secondary_time.report);
 
 			m_secondary_time.report.receiver_mode = m_report.extended.data[0];
@@ -725,15 +1694,18 @@ int tsip::update_report()
 		default:
 			m_updated.report.unknown = 1;
 			m_unknown.valid = true;
+			stamp(m_unknown.stamp);
 		    src = m_report.raw.data;
 			dst = m_unknown.report.raw.data;
 			rlen = sizeof(m_unknown.report.raw.data);
 			break;
 		}
+		break;
 
 	default:
 		m_updated.report.unknown = 1;
 		m_unknown.valid = true;
+		stamp(m_unknown.stamp);
 	    src = m_report.raw.data;
 		dst = m_unknown.report.raw.data;
 		rlen = sizeof(m_unknown.report.raw.data);
@@ -743,15 +1715,14 @@ int tsip::update_report()
 	// report strucute updated
 	if (rlen > 0 ) {
 		if (debug) {
-			printf("command buffer:\n");
-			for (int k=0;k<24;k++){printf(" %x",m_command.raw.data[k]);}
-			printf("\n");
-			printf("\nreport buffer:\n");
-			for (int k=0;k<m_report_length;k++){printf(" %x",m_report.raw.data[k]);}
-			printf("\n");
+			TSIP_LOG(TSIP_LOG_DEBUG, "command buffer:\n%s\n", log_bytes(m_command.raw.data, 24));
+			TSIP_LOG(TSIP_LOG_DEBUG, "\nreport buffer:\n%s\n", log_bytes(m_report.raw.data, m_report_length));
 		}
 
-
+		record_history();
+		if (m_publisher != NULL) {
+			m_publisher->publish(*this);
+		}
 		return 1;
 	}
 
@@ -765,24 +1736,28 @@ int tsip::update_report()
 *
 *   @return bool
 */
-bool tsip::send_request_msg(_command_packet _cmd) {
-
-	unsigned char buffer[256];
-	buffer[0] = DLE;
-	int x = 1;
-	for (int j=0; j < _cmd.raw.cmd_len; j++,x++){
-		buffer[x] = _cmd.raw.data[j];
+bool tsip::send_request_msg(const _command_packet &_cmd) {
+
+	unsigned char buffer[2*MAX_COMMAND+4];
+	m_expected = expected_reports(_cmd);
+	int x = 0;
+	buffer[x++] = DLE;
+	for (int j=0; j < _cmd.raw.cmd_len; j++){
+		// a DLE in the packet data is sent twice
+		if (j > 0 && _cmd.raw.data[j] == DLE) {
+			buffer[x++] = DLE;
+		}
+		buffer[x++] = _cmd.raw.data[j];
 	}
-	buffer[x] = DLE;
-	buffer[x+1] = ETX;
-	int byte_cnt = fwrite(buffer, 1, x+1, file);
+	buffer[x++] = DLE;
+	buffer[x++] = ETX;
+	int byte_cnt = fwrite(buffer, 1, x, file);
+	fflush(file);
 	if (verbose) {
-		printf("Sending Request: ");
-		for (int k=0;k<=x+1;k++){printf(" %x",buffer[k]);}
-		printf("\n");
+		TSIP_LOG(TSIP_LOG_INFO, "Sending Request: %s\n", log_bytes(buffer, x));
 	}
 
-	return (byte_cnt == x+1 ? true : false);
+	return (byte_cnt == x ? true : false);
 }
 
 /** get_report_msg
@@ -792,7 +1767,7 @@ bool tsip::send_request_msg(_command_packet _cmd) {
 *
 *   @return bool
 */
-bool tsip::get_report_msg(_command_packet _cmd) {
+bool tsip::get_report_msg(const _command_packet &_cmd) {
 	//clear report flags
 	init_rpt();
 
@@ -821,11 +1796,10 @@ RETRY:
 
 	if(verbose){
 		if (rpt_fnd) {
-				printf("Packet %x %x found \n",m_report.report.code,m_report.extended.subcode);
+				TSIP_LOG(TSIP_LOG_INFO, "Packet %x %x found \n\n",m_report.report.code,m_report.extended.subcode);
 			}else {
-				printf("Packet for  %x %x not found \n",m_report.report.code,m_report.extended.subcode);
+				TSIP_LOG(TSIP_LOG_INFO, "Packet for  %x %x not found \n\n",m_report.report.code,m_report.extended.subcode);
 		}
-		printf("\n");
 	}
 
 	return (rpt_fnd);
@@ -860,44 +1834,59 @@ time_t tsip::get_gps_time_utc() {
     }
 
 
+    gps_time = primary_time_to_utc(m_primary_time);
+    if (verbose) {
+		TSIP_LOG(TSIP_LOG_INFO, "Got GPS time Year: %d, Month: %d, Day: %d, Hour: %d, Minutes: %d, Seconds: %d\n",
+				m_primary_time.report.year - 1900, m_primary_time.report.month - 1,
+				m_primary_time.report.day, m_primary_time.report.hours,
+				m_primary_time.report.minutes, m_primary_time.report.seconds);
+		TSIP_LOG(TSIP_LOG_INFO, "seconds: %d\n", gps_time);
+    }
+
+	return gps_time;
+}
+
+/** primary time to utc seconds
+*
+*   Convert the date and time of an 8F-AB primary timing packet to
+*   seconds since the epoch.
+*
+*   @param _primary_time  decoded 8F-AB report
+*   @return time_t
+*/
+time_t tsip::primary_time_to_utc(const struct _primary_time &pt) {
 	struct tm time;
 
     time.tm_zone = "UTC";
     time.tm_wday = -1;
     time.tm_yday = -1;
     time.tm_isdst = -1;
-    time.tm_year = m_primary_time.report.year - 1900;
-    time.tm_mon = m_primary_time.report.month - 1;
-    time.tm_mday = m_primary_time.report.day;
-    time.tm_hour = m_primary_time.report.hours;
-    time.tm_min = m_primary_time.report.minutes;
-    time.tm_sec = m_primary_time.report.seconds;
-
-    gps_time = timegm(&time);
-    if (verbose) {
-		printf("Got GPS time Year: %d, Month: %d, Day: %d, Hour: %d, Minutes: %d, Seconds: %d\n", time.tm_year, time.tm_mon, time.tm_mday, time.tm_hour, time.tm_min, time.tm_sec);
-		printf("seconds: %d\n", gps_time);
-    }
-
-	return gps_time;
+    time.tm_year = pt.report.year - 1900;
+    time.tm_mon = pt.report.month - 1;
+    time.tm_mday = pt.report.day;
+    time.tm_hour = pt.report.hours;
+    time.tm_min = pt.report.minutes;
+    time.tm_sec = pt.report.seconds;
+
+    return timegm(&time);
 }
 
 /** get xyz from gps
 *
-*   Get the xyz (lat, long, alt) from the gps.
+*   Get the xyz (lat, long, alt) from the gps.  The 8F-AC reply is
+*   waited for REQUEST_TIMEOUT_MS, m_secondary_time.stamp tells whether
+*   it came.
 *
-*   @return xyz_t lat, long, alt
+*   @return xyz_t lat, long, alt, zero if the gps did not reply
 */
 tsip::xyz_t tsip::get_xyz() {
 
-	bool rc;
-	//build ab request - request time packet
+	//build ac request - request secondary time packet
 	m_command.extended.code = COMMAND_SUPER_PACKET;
 	m_command.extended.subcode = REPORT_SUPER_SECONDARY_TIME;
 	m_command.extended.cmd_len  = 2;
-	rc = get_report_msg(m_command);
 
-	if (rc) {
+	if (request(REQUEST_TIMEOUT_MS)) {
 		xyz.latitude= m_secondary_time.report.latitude * _rad;
 		xyz.longitude= m_secondary_time.report.longitude * _rad;
 		xyz.altitude= m_secondary_time.report.altitude;
@@ -1014,8 +2003,8 @@ bool tsip::set_survey_params(int survey_cnt) {
 	//save position
 	m_command.data_8ea9.save_position = 0;
 
-	//survey length
-	m_command.data_8ea9.self_survey_length = survey_cnt;
+	//survey length, data bytes 2-5 of the extended packet
+	uint32_to_b4(survey_cnt, 2, 'e');
 	m_command.data_8ea9.reserved_8ea9 = 0;
 	m_command.data_8ea9.cmd_len = 12;
 
@@ -1023,3 +2012,643 @@ bool tsip::set_survey_params(int survey_cnt) {
 	rc = send_request_msg(m_command);
 	return rc;
 }
+
+/** set accurate position  0x32
+*
+*   load an accurate position into the gps.  If a self survey is in
+*   progress it is aborted, the position is used immediately and the
+*   gps switches to over-determined clock mode.  The position is not
+*   kept over a power cycle unless segment 7 is saved with
+*   save_to_eeprom(7).
+*
+*   The packet carries single precision values, so the position is
+*   rounded to roughly half a meter.
+*
+*   @param double latitude   radians
+*   @param double longitude  radians
+*   @param double altitude   meters
+*   @return bool rc
+*/
+bool tsip::set_accurate_position(double lat, double lon, double alt) {
+	bool rc;
+
+	//build 0x32 request - accurate lla position
+	m_command.report.code = COMMAND_SET_ACCURATE_POSITION_LLA;
+	single_to_b4(lat, 0, 'r');
+	single_to_b4(lon, 4, 'r');
+	single_to_b4(alt, 8, 'r');
+	m_command.report.cmd_len = 13;
+
+	rc = send_request_msg(m_command);
+	return rc;
+}
+
+/** verify accurate position
+*
+*   Check that the gps is using the given position for time-only fixes.
+*   The gps must report over-determined clock mode, the 'no accurate
+*   stored position' alarm must be clear and the position in 8F-AC must
+*   be within tolerance of the given position.  The gps needs a few
+*   seconds to switch modes, so the check is retried for up to 30
+*   seconds.
+*
+*   @param double latitude   radians
+*   @param double longitude  radians
+*   @param double altitude   meters
+*   @param double tolerance  meters
+*   @return bool true - position in use
+*/
+bool tsip::verify_accurate_position(double lat, double lon, double alt, double tolerance) {
+	const double earth_radius = 6371000.0;
+
+	for (int i=0; i<30; i++) {
+		unsigned long long since = m_generation;
+
+		get_xyz();
+		if (m_secondary_time.stamp.generation > since
+				&& m_secondary_time.report.receiver_mode == RECEIVE_MODE_OVERDETERMINDE_CLOCK
+				&& !m_secondary_time.report.minor_alarms.bits.no_accurate_stored_position) {
+			double dn = (m_secondary_time.report.latitude - lat) * earth_radius;
+			double de = (m_secondary_time.report.longitude - lon) * earth_radius * cos(lat);
+			double du = m_secondary_time.report.altitude - alt;
+
+			if (sqrt(dn*dn + de*de + du*du) <= tolerance) {
+				return true;
+			}
+		}
+		sleep(1);
+	}
+	return false;
+}
+
+/** get serial number  8E-41
+*
+*   Request the manufacturing parameters and format the board serial
+*   number as prefix-number.  The reply is waited for REQUEST_TIMEOUT_MS,
+*   a silent or closed port does not block.
+*
+*   @return string serial number, empty if the gps did not reply
+*/
+std::string tsip::get_serial_number() {
+	char serial[32];
+
+	//build 8E-41 request - manufacturing parameters
+	m_command.extended.code = COMMAND_SUPER_PACKET;
+	m_command.extended.subcode = COMMAND_MANUFACTURING_PARAMS;
+	m_command.extended.cmd_len = 2;
+
+	if (!request(REQUEST_TIMEOUT_MS)) {
+		return "";
+	}
+
+	snprintf(serial, sizeof(serial), "%d-%u",
+			m_manufacturing_params.report.serial_prefix,
+			m_manufacturing_params.report.serial_number);
+	return serial;
+}
+
+/** subscribe to a report
+*
+*   Record that the application uses a report.  Once anything is
+*   subscribed, reports that are neither subscribed nor the reply to
+*   the last request are dropped without being decoded.  Subscribe to
+*   REPORT_SUPER with an unknown subcode (or any undecoded code) to
+*   keep the undecoded packets.  apply_subscriptions() then turns the
+*   other broadcasts off at the receiver.
+*
+*   @param UINT8 report code, REPORT_...
+*   @param UINT8 subcode of a super report, REPORT_SUPER_...
+*   @return void
+*/
+void tsip::subscribe(UINT8 code, UINT8 subcode) {
+	m_subscribed |= report_bit(code, subcode);
+}
+
+/** clear subscriptions
+*
+*   Decode every report again.  The receiver settings are not changed.
+*
+*   @return void
+*/
+void tsip::clear_subscriptions() {
+	m_subscribed = 0;
+}
+
+/** get subscriptions
+*
+*   @return int m_updated bits of the subscribed reports, 0 - all
+*/
+int tsip::get_subscriptions() {
+	return m_subscribed;
+}
+
+/** apply subscriptions  8E-A5 0x35
+*
+*   Program the packet broadcast mask and the I/O options so the
+*   receiver only broadcasts the subscribed reports:
+*     8F-AB, 8F-AC          mask bits 0 and 2
+*     0x42/0x83, 0x4A/0x84  0x35 position ECEF, LLA and precision
+*     0x43, 0x56            0x35 velocity ECEF and ENU
+*     8F-A7                 mask bit 4 or 5, kept on for the satellites
+*     0x5A                  0x35 auxiliary packet_5A
+*   0x58/0x5B/0x6D broadcasts are not decoded by this library and are
+*   only kept on when undecoded packets are subscribed.
+*
+*   The settings found the first time are saved and restored by
+*   restore_broadcast(), which the destructor calls.  The settings are
+*   not saved to eeprom.  Reports requested with 0x37 follow the 0x35
+*   options, so a position request needs its position report
+*   subscribed.  Needs blocking reads, call it before handing the port
+*   to a reactor.
+*
+*   @return bool true - the receiver confirmed the new settings
+*/
+bool tsip::apply_subscriptions() {
+	union _update_report sub;
+	struct _broadcast_mask mask;
+	struct _io_options io;
+
+	if (m_subscribed == 0) {
+		return true;
+	}
+
+	if (!m_broadcast_saved) {
+		//request 8E-A5 - current broadcast mask
+		m_command.extended.code = COMMAND_SUPER_PACKET;
+		m_command.extended.subcode = COMMAND_SET_BROADCAST_MASK;
+		m_command.extended.cmd_len = 2;
+		if (!get_report_msg(m_command)) {
+			if (verbose) TSIP_LOG(TSIP_LOG_WARNING, "%s: no broadcast mask reply\n", gps_port.c_str());
+			return false;
+		}
+		m_saved_mask = m_broadcast_mask;
+
+		//request 0x35 - current I/O options
+		m_command.report.code = COMMAND_SET_IO_OPTIONS;
+		m_command.report.cmd_len = 1;
+		if (!get_report_msg(m_command)) {
+			if (verbose) TSIP_LOG(TSIP_LOG_WARNING, "%s: no I/O options reply\n", gps_port.c_str());
+			return false;
+		}
+		m_saved_io = m_io_options;
+		m_broadcast_saved = true;
+	}
+
+	sub.value = m_subscribed;
+	mask = m_saved_mask;
+	io = m_saved_io;
+
+	mask.report.mask0.bits.primary_time = sub.report.primary_time ? 1 : 0;
+	mask.report.mask0.bits.secondary_time = sub.report.secondary_time ? 1 : 0;
+
+	io.report.position.bits.ecef = (sub.report.ecef_position_s || sub.report.ecef_position_d) ? 1 : 0;
+	io.report.position.bits.lla = (sub.report.single_position || sub.report.double_position) ? 1 : 0;
+	io.report.position.bits.double_precision = (sub.report.ecef_position_d || sub.report.double_position) ? 1 : 0;
+	io.report.velocity.bits.ecef = sub.report.ecef_velocity ? 1 : 0;
+	io.report.velocity.bits.enu = sub.report.enu_velocity ? 1 : 0;
+
+	if (sub.report.satellites) {
+		if (!mask.report.mask0.bits.satellite_solutions_int) {
+			mask.report.mask0.bits.satellite_solutions = 1;
+		}
+	} else if (!sub.report.unknown) {
+		mask.report.mask0.bits.satellite_solutions = 0;
+		mask.report.mask0.bits.satellite_solutions_int = 0;
+	}
+	if (!sub.report.unknown) {
+		mask.report.mask0.bits.system_data = 0;
+	}
+	io.report.auxiliary.bits.packet_5A = sub.report.raw_measurement ? 1 : 0;
+
+	return set_broadcast(mask, io, true);
+}
+
+/** restore broadcast  8E-A5 0x35
+*
+*   Send back the broadcast mask and I/O options saved by
+*   apply_subscriptions().  Does not wait for the replies, so it is
+*   safe on a port the reactor reads.
+*
+*   @return bool true - sent, or nothing to restore
+*/
+bool tsip::restore_broadcast() {
+	if (!m_broadcast_saved) {
+		return true;
+	}
+	m_broadcast_saved = false;
+	return set_broadcast(m_saved_mask, m_saved_io, false);
+}
+
+/** set broadcast
+*
+*   Send 8E-A5 with the mask and 0x35 with the I/O options, and
+*   optionally check the replies echo them.
+*
+*   @return bool rc
+*/
+bool tsip::set_broadcast(const struct _broadcast_mask &mask, const struct _io_options &io, bool wait) {
+	bool rc;
+
+	//build 8E-A5 request - set broadcast mask
+	m_command.extended.code = COMMAND_SUPER_PACKET;
+	m_command.extended.subcode = COMMAND_SET_BROADCAST_MASK;
+	uint16_to_b2(mask.report.mask0.value, 0, 'e');
+	uint16_to_b2(mask.report.mask2, 2, 'e');
+	m_command.extended.cmd_len = 6;
+	if (wait) {
+		rc = get_report_msg(m_command)
+			&& m_broadcast_mask.report.mask0.value == mask.report.mask0.value;
+	} else {
+		rc = send_request_msg(m_command);
+	}
+
+	//build 0x35 request - set I/O options
+	m_command.report.code = COMMAND_SET_IO_OPTIONS;
+	m_command.report.data[0] = io.report.position.value;
+	m_command.report.data[1] = io.report.velocity.value;
+	m_command.report.data[2] = io.report.timing.value;
+	m_command.report.data[3] = io.report.auxiliary.value;
+	m_command.report.cmd_len = 5;
+	if (wait) {
+		rc = get_report_msg(m_command)
+			&& m_io_options.report.position.value == io.report.position.value
+			&& m_io_options.report.velocity.value == io.report.velocity.value && rc;
+	} else {
+		rc = send_request_msg(m_command) && rc;
+	}
+	return rc;
+}
+
+/** baud to code
+*
+*   The 0xBC baud rate code of a rate.  The manual lists codes 2-9
+*   (300-38400); 10 and 11 (57600, 115200) are used by later firmware.
+*
+*   @param int  bits per second
+*   @return int 0xBC code, 0 - not a receiver rate
+*/
+int tsip::baud_to_code(int baud) {
+	for (int code=2; code<=11; code++) {
+		if (code_to_baud(code) == baud) {
+			return code;
+		}
+	}
+	return 0;
+}
+
+/** code to baud
+*
+*   @param int  0xBC baud rate code
+*   @return int bits per second, 0 - unknown code
+*/
+int tsip::code_to_baud(int code) {
+	static const int rates[] = {0, 0, 300, 600, 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200};
+
+	if (code < 0 || code >= (int)(sizeof(rates)/sizeof(rates[0]))) {
+		return 0;
+	}
+	return rates[code];
+}
+
+/** set baud
+*
+*   Change the host side of the link only.  Pending input is dropped
+*   and the decoder restarts.
+*
+*   @param int  bits per second
+*   @return bool false - not supported or the port is not open
+*/
+bool tsip::set_baud(int baud) {
+	struct termios tio;
+	speed_t speed = serial_speed(baud);
+
+	if (file == NULL || speed == B0) {
+		return false;
+	}
+	int fd = fileno(file);
+	if (tcgetattr(fd, &tio) != 0) {
+		perror(gps_port.c_str());
+		return false;
+	}
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	if (tcsetattr(fd, TCSADRAIN, &tio) != 0) {
+		perror(gps_port.c_str());
+		return false;
+	}
+	tcflush(fd, TCIFLUSH);
+	__fpurge(file);
+	m_state = START;
+	m_baud = baud;
+	return true;
+}
+
+/** get baud
+*
+*   @return int host side rate, bits per second
+*/
+int tsip::get_baud() {
+	return m_baud;
+}
+
+// handler of read_port(), remembers that the caller's handler said stop
+struct read_port_t {
+	tsip_report_handler handler;
+	void *ctx;
+	bool stopped;
+};
+
+static bool read_port_report(tsip &gps, void *ctx) {
+	read_port_t *r = (read_port_t *)ctx;
+
+	r->stopped = !r->handler(gps, r->ctx);
+	return !r->stopped;
+}
+
+/** read port
+*
+*   Read and decode for up to timeout_ms, until the handler returns
+*   false.  Reads the descriptor directly, bytes left in the stdio
+*   buffer by getc are not seen.
+*
+*   @param int                  timeout in milliseconds
+*   @param tsip_report_handler  called for each report
+*   @param void*                passed to the handler
+*   @return int 1 - stopped by the handler, 0 - timeout, -1 - error
+*/
+int tsip::read_port(int timeout_ms, tsip_report_handler handler, void *ctx) {
+	UINT8 buffer[512];
+	struct timespec now;
+	struct pollfd p;
+	read_port_t r;
+
+	if (file == NULL) {
+		return -1;
+	}
+	r.handler = handler;
+	r.ctx = ctx;
+	r.stopped = false;
+	p.fd = fileno(file);
+	p.events = POLLIN;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long deadline = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + timeout_ms;
+
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long left = deadline - (now.tv_sec * 1000LL + now.tv_nsec / 1000000);
+		if (left <= 0) {
+			return 0;
+		}
+		int n = poll(&p, 1, (int)left);
+		if (n < 0 && errno != EINTR) {
+			perror(gps_port.c_str());
+			return -1;
+		}
+		if (n <= 0) {
+			continue;
+		}
+		ssize_t len = read(p.fd, buffer, sizeof(buffer));
+		if (len <= 0) {
+			if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+				continue;
+			}
+			return -1;
+		}
+		encode(buffer, len, read_port_report, &r);
+		if (r.stopped) {
+			return 1;
+		}
+	}
+}
+
+// reports collected by request(), the block decoder clears m_updated per report
+struct request_wait_t {
+	int expected;
+	int updated;
+};
+
+static bool request_report(tsip &gps, void *ctx) {
+	request_wait_t *w = (request_wait_t *)ctx;
+
+	w->updated |= gps.m_updated.value;
+	return (w->updated & w->expected) != w->expected;
+}
+
+/** request
+*
+*   Send m_command and wait up to timeout_ms for its reply.  Unlike
+*   get_report_msg() it does not block on a silent receiver.
+*
+*   @param int  timeout in milliseconds
+*   @return bool true - reply received
+*/
+bool tsip::request(int timeout_ms) {
+	request_wait_t w;
+
+	init_rpt();
+	w.expected = expected_reports(m_command);
+	w.updated = 0;
+	if (!send_request_msg(m_command)) {
+		return false;
+	}
+	if (w.expected == 0) {
+		return true;
+	}
+	bool found = (read_port(timeout_ms, request_report, &w) > 0);
+	m_updated.value = w.updated;
+	return found;
+}
+
+// frames counted by detect_baud()
+struct detect_count_t {
+	int known;
+	bool config;
+};
+
+static bool detect_report(tsip &gps, void *ctx) {
+	detect_count_t *c = (detect_count_t *)ctx;
+
+	if (gps.m_updated.report.port_config) {
+		// only a correctly received reply reads back as a TSIP port
+		c->config = (gps.m_port_config.report.input_protocols == 2
+				&& gps.m_port_config.report.output_protocols == 2);
+	} else if (!gps.m_updated.report.unknown) {
+		c->known++;
+	}
+	return !c->config && c->known < DETECT_FRAMES;
+}
+
+/** detect baud  0xBC
+*
+*   Find the rate the receiver talks at.  Each candidate rate is set on
+*   the host, the port configuration is requested and the input is
+*   decoded for window_ms.  A rate is accepted on a valid 0xBC reply,
+*   or on DETECT_FRAMES decoded reports of known types (the broadcasts),
+*   which noise at a wrong rate does not produce.  The current rate is
+*   tried first.
+*
+*   @param int  time per candidate in milliseconds
+*   @return int detected rate, the host is left on it; 0 - not found,
+*               the host rate is unchanged
+*/
+int tsip::detect_baud(int window_ms) {
+	static const int candidates[] = {9600, 38400, 19200, 57600, 115200, 4800, 2400, 1200};
+	int start = m_baud;
+	std::vector<int> rates;
+
+	rates.push_back(start);
+	for (size_t i=0; i<sizeof(candidates)/sizeof(candidates[0]); i++) {
+		if (candidates[i] != start) {
+			rates.push_back(candidates[i]);
+		}
+	}
+
+	for (size_t i=0; i<rates.size(); i++) {
+		detect_count_t count;
+
+		if (!set_baud(rates[i])) {
+			continue;
+		}
+		if (verbose) TSIP_LOG(TSIP_LOG_INFO, "%s: trying %d baud\n", gps_port.c_str(), rates[i]);
+
+		// the request is repeated, a single one may be lost on a bad link
+		count.known = 0;
+		count.config = false;
+		for (int k=0; k<DETECT_REQUESTS; k++) {
+			//build 0xBC request - configuration of this port
+			init_rpt();
+			m_command.report.code = COMMAND_SET_PORT_CONFIG;
+			m_command.report.data[0] = 0xff;
+			m_command.report.cmd_len = 2;
+			send_request_msg(m_command);
+
+			if (read_port(window_ms / DETECT_REQUESTS, detect_report, &count) > 0) {
+				if (verbose) TSIP_LOG(TSIP_LOG_INFO, "%s: receiver at %d baud\n", gps_port.c_str(), rates[i]);
+				return rates[i];
+			}
+		}
+	}
+
+	set_baud(start);
+	return 0;
+}
+
+/** negotiate baud  0xBC
+*
+*   Move the link to the fastest rate up to max_baud that carries
+*   NEGOTIATE_CHECKS request/reply exchanges.  Faster rates are tried
+*   first.  A rate that fails is backed out: the receiver is found
+*   with detect_baud() and set back to the starting rate.  The host
+*   must already be at the receiver's rate, see detect_baud().  The
+*   new rate is saved to eeprom (segment 5) when save is set, the
+*   other port settings are kept.
+*
+*   @param int   highest rate to try, bits per second
+*   @param bool  save the new rate to eeprom
+*   @return int  rate in use, 0 - the receiver did not reply
+*/
+int tsip::negotiate_baud(int max_baud, bool save) {
+	struct _port_config current;
+	int start = m_baud;
+
+	//request 0xBC - configuration of this port
+	m_command.report.code = COMMAND_SET_PORT_CONFIG;
+	m_command.report.data[0] = 0xff;
+	m_command.report.cmd_len = 2;
+	if (!request(REQUEST_TIMEOUT_MS)) {
+		if (verbose) TSIP_LOG(TSIP_LOG_WARNING, "%s: no port configuration reply at %d baud\n", gps_port.c_str(), start);
+		return 0;
+	}
+	current = m_port_config;
+
+	for (int code=baud_to_code(max_baud); code>baud_to_code(start); code--) {
+		int baud = code_to_baud(code);
+
+		if (serial_speed(baud) == B0) {
+			continue;
+		}
+		if (verbose) TSIP_LOG(TSIP_LOG_INFO, "%s: switching to %d baud\n", gps_port.c_str(), baud);
+		set_port_code(current, code);
+		usleep(NEGOTIATE_SETTLE_MS * 1000);
+		set_baud(baud);
+
+		// the rate is kept only when it carries several exchanges
+		bool ok = true;
+		for (int i=0; ok && i<NEGOTIATE_CHECKS; i++) {
+			m_command.report.code = COMMAND_SET_PORT_CONFIG;
+			m_command.report.data[0] = 0xff;
+			m_command.report.cmd_len = 2;
+			ok = request(REQUEST_TIMEOUT_MS) && m_port_config.report.output_baud == code;
+		}
+		if (ok) {
+			if (save) {
+				save_to_eeprom(5);
+			}
+			if (verbose) TSIP_LOG(TSIP_LOG_INFO, "%s: link at %d baud\n", gps_port.c_str(), baud);
+			return baud;
+		}
+
+		// back out, the receiver may or may not have switched
+		if (verbose) TSIP_LOG(TSIP_LOG_WARNING, "%s: %d baud not reliable\n", gps_port.c_str(), baud);
+		if (!return_to_baud(current, start)) {
+			if (verbose) TSIP_LOG(TSIP_LOG_ERROR, "%s: receiver lost\n", gps_port.c_str());
+			return 0;
+		}
+	}
+	return m_baud;
+}
+
+/** return to baud  0xBC
+*
+*   Find the receiver and set it back to a rate, which the failed set
+*   over a bad link may take more than one try to do.
+*
+*   @return bool true - receiver and host are at the rate
+*/
+bool tsip::return_to_baud(const struct _port_config &config, int baud) {
+	for (int i=0; ; i++) {
+		int found = detect_baud();
+		if (found == baud) {
+			return true;
+		}
+		if (i == NEGOTIATE_CHECKS) {
+			break;
+		}
+		if (found != 0) {
+			set_port_code(config, baud_to_code(baud));
+			usleep(NEGOTIATE_SETTLE_MS * 1000);
+			set_baud(baud);
+		}
+	}
+	set_baud(baud);
+	return false;
+}
+
+/** set port code  0xBC
+*
+*   Send the port configuration with a new input and output baud rate
+*   code and wait until it has left at the current rate.
+*
+*   @return bool rc
+*/
+bool tsip::set_port_code(const struct _port_config &config, int code) {
+	bool rc;
+
+	//build 0xBC request - set port configuration
+	m_command.report.code = COMMAND_SET_PORT_CONFIG;
+	m_command.report.data[0] = 0xff;
+	m_command.report.data[1] = code;
+	m_command.report.data[2] = code;
+	m_command.report.data[3] = config.report.data_bits;
+	m_command.report.data[4] = config.report.parity;
+	m_command.report.data[5] = config.report.stop_bits;
+	m_command.report.data[6] = config.report.flow_control;
+	m_command.report.data[7] = config.report.input_protocols;
+	m_command.report.data[8] = config.report.output_protocols;
+	m_command.report.data[9] = 0;
+	m_command.report.cmd_len = 11;
+
+	rc = send_request_msg(m_command);
+	tcdrain(fileno(file));
+	return rc;
+}
@@ -41,6 +41,7 @@
 #include <vector>
 #include <cmath>
 #include <termios.h>
+#include <unistd.h>
 #include <ctime>
 
 #define BIT0  0x0001
@@ -69,6 +70,7 @@
 
 #define MAX_DATA     1024			// report buffer size
 #define MAX_COMMAND  64				// command buffer size
+#define HISTORY_DEFAULT_CAPACITY	3600	// reports kept by a history, one hour at 1 Hz
 
 //#define DLE		0x10
 //#define ETX		0x03
@@ -93,14 +95,22 @@ typedef double DOUBLE;
 const UINT8 REPORT_ECEF_POSITION_S			= 0x42;
 const UINT8 REPORT_ECEF_VELOCITY			= 0x43;
 const UINT8 REPORT_SW_VERSION				= 0x45;
+const UINT8 REPORT_SIGNAL_LEVELS			= 0x47;
 const UINT8 REPORT_SINGLE_POSITION			= 0x4a;
 const UINT8 REPORT_IO_OPTIONS				= 0x55;
 const UINT8 REPORT_ENU_VELOCITY				= 0x56;
+const UINT8 REPORT_SYSTEM_DATA				= 0x58;
+const UINT8 REPORT_RAW_MEASUREMENT			= 0x5a;
+const UINT8 REPORT_SATELLITE_TRACKING		= 0x5c;
 const UINT8 REPORT_ECEF_POSITION_D			= 0x83;
 const UINT8 REPORT_DOUBLE_POSITION			= 0x84;
+const UINT8 REPORT_PORT_CONFIG				= 0xbc;
 
 const UINT8 REPORT_SUPER					= 0x8f;
+const UINT8 REPORT_SUPER_MANUFACTURING_PARAMS	= 0x41;
 const UINT8 REPORT_SUPER_UTC_GPS_TIME		= 0xa2;
+const UINT8 REPORT_SUPER_BROADCAST_MASK		= 0xa5;
+const UINT8 REPORT_SUPER_SATELLITE_SOLUTIONS	= 0xa7;
 const UINT8 REPORT_SUPER_PRIMARY_TIME		= 0xab;
 const UINT8 REPORT_SUPER_SECONDARY_TIME		= 0xac;
 
@@ -108,14 +118,19 @@ const UINT8 REPORT_SUPER_SECONDARY_TIME		= 0xac;
 const UINT8 COMMAND_COLD_FACTORY_RESET		= 0x1e;
 const UINT8 COMMAND_REQUEST_SW_VERSION		= 0x1f;
 const UINT8 COMMAND_WARM_RESET_SELF_TEST	= 0x25;
+const UINT8 COMMAND_SET_ACCURATE_POSITION_XYZ = 0x31;
+const UINT8 COMMAND_SET_ACCURATE_POSITION_LLA = 0x32;
 const UINT8 COMMAND_SET_IO_OPTIONS			= 0x35;
 const UINT8 COMMAND_REQUEST_POSITION		= 0x37;
+const UINT8 COMMAND_REQUEST_SYSTEM_DATA		= 0x38;
+const UINT8 COMMAND_SET_PORT_CONFIG			= 0xbc;
 
 // supported super-commands and subcommands
 const UINT8 COMMAND_SUPER_PACKET			= 0x8e;
 const UINT8 COMMAND_MANUFACTURING_PARAMS	= 0x41;
 const UINT8 COMMAND_REVERT_TO_DEFAULT       = 0x45;
 const UINT8 COMMAND_SAVE_EEPROM             = 0x4c;
+const UINT8 COMMAND_SET_BROADCAST_MASK      = 0xa5;
 const UINT8 COMMAND_SELF_SURVEY             = 0xa6;
 const UINT8 COMMAND_SET_SELF_SURVEY_PARAMS  = 0xa9;
 
@@ -156,6 +171,12 @@ union _command_packet {
  * Report packet structures *
  ****************************/
 
+// when a report was decoded, kept in every report structure
+struct _report_stamp {
+	unsigned long long generation;	// tsip::get_generation() after the report, 0 - never received
+	struct timespec received;		// host clock (CLOCK_REALTIME) at the end of the packet
+};
+
 // generic report TSIP packet
 union _report_packet {
 	struct _raw {
@@ -175,6 +196,7 @@ union _report_packet {
 // Single precision XYZ Earth Centered Earth Fixed (ECEF) Position Packet
 struct _ecef_position_s {
 	bool  valid;
+	struct _report_stamp stamp;
 	struct _0x42 {
 		SINGLE x;				// X meters
 		SINGLE y; 				// Y meters
@@ -186,6 +208,7 @@ struct _ecef_position_s {
 // XYZ Earth Centered Earth Fixed (ECEF) Velocity Packet
 struct _ecef_velocity {
 	bool  valid;
+	struct _report_stamp stamp;
 	struct _0x43 {
 		SINGLE x;				// X meters/second
 		SINGLE y;				// Y meters/second
@@ -198,6 +221,7 @@ struct _ecef_velocity {
 // Software Version Packet
 struct _sw_version {
 	bool  valid;
+	struct _report_stamp stamp;
 	struct _0x45 {
 		UINT8 app_major;
 		UINT8 app_minor;
@@ -215,6 +239,7 @@ struct _sw_version {
 // Single precision LLA position fix
 struct _single_position {
 	bool  valid;
+	struct _report_stamp stamp;
 	struct _0x4A {
 		SINGLE latitude;		// radians + north, - south
 		SINGLE longitude;		// radians + east, - west
@@ -227,6 +252,7 @@ struct _single_position {
 // I/O options
 struct _io_options {
 	bool  valid;
+	struct _report_stamp stamp;
 	struct _report {
 		union _position {
 			UINT8 value;						// position options
@@ -270,6 +296,7 @@ struct _io_options {
 // Single precision East-North-Up (ENU) velocity fix
 struct _enu_velocity {
 	bool  valid;
+	struct _report_stamp stamp;
 	struct _0x56 {
 		SINGLE east;			// m/s + east, - west
 		SINGLE north;			// m/s + north, - south
@@ -282,6 +309,7 @@ struct _enu_velocity {
 // Double precision XYZ Earth Centered Earth Fixed (ECEF) Position Packet
 struct _ecef_position_d {
 	bool  valid;
+	struct _report_stamp stamp;
 	struct _0x83 {
 		DOUBLE x;				// X meters
 		DOUBLE y; 				// Y meters
@@ -294,18 +322,76 @@ struct _ecef_position_d {
 // Double precision LLA position fix
 struct _double_position {
 	bool  valid;
+	struct _report_stamp stamp;
 	struct _0x84 {
 		DOUBLE latitude;		// radians + north, - south
 		DOUBLE longitude;		// radians + east, - west
 		DOUBLE altitude;		// meters
 		DOUBLE clock_bias;		// meters relative to GPS
-		DOUBLE time_of_fix;		// seconds (GPS/UTC)
+		SINGLE time_of_fix;		// seconds (GPS/UTC)
+	} report;
+};
+
+// 8F-41 Stored Manufacturing Operating Parameters
+struct _manufacturing_params {
+	bool  valid;
+	struct _report_stamp stamp;
+	struct _0x8F41 {
+		SINT16  serial_prefix;		// board serial number prefix
+		UINT32  serial_number;		// board serial number
+		UINT8   build_year;			// year - 2000
+		UINT8   build_month;
+		UINT8   build_day;
+		UINT8   build_hour;
+		SINGLE  oscillator_offset;
+		UINT16  test_code;			// test code identification number
+	} report;
+};
+
+// 0xBC Serial Port Configuration
+struct _port_config {
+	bool  valid;
+	struct _report_stamp stamp;
+	struct _0xBC {
+		UINT8 port;						// 0 - port 1, 0xFF - current port
+		UINT8 input_baud;				// baud code, see tsip::baud_to_code
+		UINT8 output_baud;
+		UINT8 data_bits;				// 2 - 7 bits, 3 - 8 bits
+		UINT8 parity;					// 0 - none, 1 - odd, 2 - even
+		UINT8 stop_bits;				// 0 - 1 bit, 1 - 2 bits
+		UINT8 flow_control;				// 0 - none
+		UINT8 input_protocols;			// 2 - TSIP
+		UINT8 output_protocols;			// 2 - TSIP
+		UINT8 reserved;
+	} report;
+};
+
+// 8F-A5 Packet Broadcast Mask
+struct _broadcast_mask {
+	bool  valid;
+	struct _report_stamp stamp;
+	struct _0x8FA5 {
+		union _mask0 {
+			UINT16 value;
+			struct _bits {
+				UINT16 primary_time			: 1;	// 8F-AB
+				UINT16 reserved_0			: 1;
+				UINT16 secondary_time		: 1;	// 8F-AC
+				UINT16 reserved_1			: 1;
+				UINT16 satellite_solutions	: 1;	// 8F-A7 format 0
+				UINT16 satellite_solutions_int	: 1;	// 8F-A7 format 1
+				UINT16 system_data			: 1;	// 0x58, 0x5B, 0x6D
+				UINT16 reserved_2			: 9;
+			} bits;
+		} mask0;
+		UINT16 mask2;					// reserved
 	} report;
 };
 
 // 8F-A2 UTC GPS Time
 struct _utc_gps_time {
 	bool  valid;
+	struct _report_stamp stamp;
 	struct _0x8FA2 {
 		union _flags {
 			UINT8 value;
@@ -320,6 +406,7 @@ struct _utc_gps_time {
 //8F-AB Primary Timing Packet
 struct _primary_time {
 	bool  valid;
+	struct _report_stamp stamp;
 	struct _0x8FAB {
 		UINT32  seconds_of_week; // GPS seconds since GPS Sunday 00:00:00
 		UINT16  week_number;	// GPS week number
@@ -347,6 +434,7 @@ struct _primary_time {
 //8F-AC Secondary Timing Packet
 struct _secondary_time {
 	bool  valid;
+	struct _report_stamp stamp;
 	struct _0x8FAC {
 		UINT8  receiver_mode;
 			#define RECEIVE_MODE_AUTO_2D_3D					0
@@ -429,15 +517,97 @@ struct _secondary_time {
 	} report;
 };
 
+// 0x5A Raw Measurement Data, enabled by 0x35 auxiliary packet_5A
+struct _raw_measurement {
+	bool  valid;
+	struct _report_stamp stamp;
+	struct _0x5A {					// also the record of raw_measurement_ring
+		DOUBLE time_of_measurement;	// GPS seconds of week
+		SINGLE sample_length;		// milliseconds
+		SINGLE signal_level;		// AMU or dB-Hz as set by 0x35 auxiliary dbhz
+		SINGLE code_phase;			// 1/16 chip
+		SINGLE doppler;				// Hz
+		UINT8  prn;
+		UINT8  spare[7];			// zero, the record is 32 bytes
+	} report;
+};
+
 // unknown report packet
 struct _unknown {
 	bool  valid;
+	struct _report_stamp stamp;
 	union _report_packet report;
 };
 
+// decoded reports at completion of one request, see tsip::get_reply
+struct tsip_reply {
+	bool  found;							// the expected report was received
+	int   updated;						// tsip::m_updated bits set by the request
+	struct _ecef_position_s		ecef_position_s;
+	struct _ecef_position_d		ecef_position_d;
+	struct _ecef_velocity		ecef_velocity;
+	struct _sw_version			sw_version;
+	struct _single_position		single_position;
+	struct _double_position		double_position;
+	struct _io_options			io_options;
+	struct _enu_velocity		enu_velocity;
+	struct _utc_gps_time		utc_gps_time;
+	struct _primary_time		primary_time;
+	struct _secondary_time		secondary_time;
+	struct _manufacturing_params	manufacturing_params;
+	struct _broadcast_mask		broadcast_mask;
+	struct _port_config			port_config;
+	union _report_packet		report;		// last packet received
+	int   report_length;
+};
+
+// damage seen by the packet decoder, see tsip::get_frame_stats
+struct tsip_frame_stats {
+	unsigned long frames;			// packets ended by DLE ETX
+	unsigned long short_frames;		// rejected, shorter than the report
+	unsigned long long_frames;		// rejected, longer than the report
+	unsigned long oversize;			// longer than MAX_DATA, dropped
+	unsigned long misframed;		// DLE followed by a byte other than DLE or ETX
+	unsigned long skipped;			// bytes dropped to find the next packet
+};
+
+class tsip;
+class frame_decoder;
+class primary_time_history;
+class secondary_time_history;
+class satellite_table;
+class raw_measurement_ring;
+class shm_packet_writer;
+
+// called for each report decoded by tsip::encode(data, len, ...),
+// return false to stop decoding
+typedef bool (*tsip_report_handler)(tsip &gps, void *ctx);
+
+// called for each report or sentence decoded by frame_decoder::decode,
+// return false to stop decoding
+typedef bool (*frame_handler)(frame_decoder &decoder, void *ctx);
+
+enum gps_protocol {
+	PROTOCOL_UNKNOWN = 0,
+	PROTOCOL_TSIP,					// DLE ... DLE ETX packets, class tsip
+	PROTOCOL_NMEA					// NMEA 0183 sentences, class nmea
+};
+
+// decoder of the byte stream of one receiver port, whatever its
+// protocol; the collectors (tsip_reactor) only use this interface,
+// see gps_frame.h for the protocol detection
+class frame_decoder {
+	public:
+		virtual ~frame_decoder(void) {}
+		// bytes consumed, less than len if the handler stopped
+		virtual int decode(const UINT8 *data, int len, frame_handler handler, void *ctx) = 0;
+		virtual gps_protocol get_protocol(void) = 0;
+		virtual int get_port_fd(void) = 0;			// -1 - not open
+		virtual const std::string &get_gps_port(void) = 0;
+};
 
 // Trimble Standard Interface Protocol (TSIP) class
-class tsip {
+class tsip : public frame_decoder {
 	public:
 		bool port_status;
 
@@ -464,6 +634,10 @@ class tsip {
 		struct _utc_gps_time        m_utc_gps_time;
 		struct _primary_time		m_primary_time;
 		struct _secondary_time		m_secondary_time;
+		struct _manufacturing_params	m_manufacturing_params;
+		struct _broadcast_mask		m_broadcast_mask;
+		struct _port_config			m_port_config;
+		struct _raw_measurement		m_raw_measurement;
 		struct _unknown				m_unknown;
 
 		// report updated flags
@@ -482,7 +656,11 @@ class tsip {
 				int primary_time    : 1;
 				int secondary_time  : 1;
 				int utc_gps_time    : 1;
-				int unused          : 4;	// future expansion
+				int manufacturing_params : 1;
+				int broadcast_mask  : 1;
+				int port_config     : 1;
+				int satellites      : 1;	// 0x47, 0x5C, 8F-A7, 0x58, see get_satellites
+				int raw_measurement : 1;	// 0x5A, see stream_raw
 				int unknown			: 1;	// unknown report
 			} report;
 		} m_updated;
@@ -495,22 +673,60 @@ class tsip {
 		int   m_report_length;
 
 		//public methods
-		tsip(std::string port="", bool verbose=true);
+		tsip(const std::string &port="", bool verbose=true);
 		~tsip(void);
 		int encode(UINT8 c);			// encode byte stream into packets
-		void init_rpt(void); 			// initialize the report fields
+		int encode(const UINT8 *data, int len, tsip_report_handler handler, void *ctx);
+		int decode(const UINT8 *data, int len, frame_handler handler, void *ctx);	// encode for any protocol
+		gps_protocol get_protocol(void);
+		void init_rpt(void); 			// start a request, the decoded reports are kept
+		void start_request(void);		// clear m_updated, keep the decoder state
+		unsigned long long get_generation(void);	// reports decoded so far
+		const struct _report_stamp *get_stamp(int bit);	// stamp of the report of an m_updated bit
+		bool is_newer(int bits, unsigned long long since);	// all the reports decoded after since
 		void set_verbose(bool);         // set verbose
 		void set_debug(bool);        	// set debug
-		void set_gps_port(std::string gps_port);
+		void set_gps_port(const std::string &gps_port);
 		bool set_survey_params(int survey_cnt);
 		bool revert_to_default(int seg_num);
 		bool save_to_eeprom(int seg_num);
 		bool store_position();
+		bool set_accurate_position(double lat, double lon, double alt);
+		bool verify_accurate_position(double lat, double lon, double alt, double tolerance);
+		std::string get_serial_number();
 		bool start_self_survey();
-		bool open_gps_port(std::string port="");
-		std::string get_gps_port();
-		bool send_request_msg(_command_packet _cmd);
-		bool get_report_msg(_command_packet _cmd);
+		bool open_gps_port(const std::string &port="");
+		const std::string &get_gps_port();
+		bool send_request_msg(const _command_packet &_cmd);
+		bool get_report_msg(const _command_packet &_cmd);
+		bool is_report_found(const _command_packet &_cmd);
+		int get_port_fd(void);
+		void subscribe(UINT8 code, UINT8 subcode=0);	// report the application uses
+		void clear_subscriptions(void);
+		int get_subscriptions(void);
+		bool apply_subscriptions(void);	// program 8E-A5 and 0x35 to send only those
+		bool restore_broadcast(void);	// back to the settings found by apply_subscriptions
+		static int report_bit(UINT8 code, UINT8 subcode);
+		int detect_baud(int window_ms=1500);	// find the receiver's rate, 0 - not found
+		int negotiate_baud(int max_baud=38400, bool save=true);	// fastest reliable rate
+		bool set_baud(int baud);		// host side only
+		int get_baud(void);
+		static int baud_to_code(int baud);
+		static int code_to_baud(int code);
+		bool request(int timeout_ms);	// send m_command, wait for its reply
+		static int expected_reports(const _command_packet &cmd);
+		static int report_length(UINT8 code, UINT8 subcode);	// packet bytes, 0 - not checked
+		void get_frame_stats(tsip_frame_stats &stats);
+		void reset_frame_stats(void);
+		bool keep_history(UINT8 code, UINT8 subcode, size_t capacity=HISTORY_DEFAULT_CAPACITY);
+		const primary_time_history *get_primary_history(void);		// NULL when not kept
+		const secondary_time_history *get_secondary_history(void);
+		const satellite_table *get_satellites(void);	// see tsip_satellite.h
+		int request_almanac(void);		// 0x38, almanacs received
+		void stream_raw(raw_measurement_ring *ring);	// 0x5A records, NULL - stop
+		void publish(shm_packet_writer *writer);	// every report to other processes, NULL - stop
+		void get_reply(tsip_reply &reply);
+		static time_t primary_time_to_utc(const struct _primary_time &time);
 
 		//gps_api(std::string port, bool verbose=true);
 		//bool get_gps_time_utc(time_t &seconds_since_epoch);
@@ -525,23 +741,58 @@ class tsip {
 
 		std::string gps_port;
 		FILE *file;
+		int m_baud;						// host side rate, bits per second
+
+		// report subscriptions, m_updated bits
+		int m_subscribed;				// 0 - decode every report
+		int m_expected;					// reply to the last request, always decoded
+		bool m_broadcast_saved;			// m_saved_* hold the settings to restore
+		struct _broadcast_mask m_saved_mask;
+		struct _io_options m_saved_io;
+
+		// report histories, see tsip_history.h
+		primary_time_history *m_primary_history;
+		secondary_time_history *m_secondary_history;
+		long long m_history_time;		// GPS seconds of the last 8F-AB, -1 - none yet
+
+		satellite_table *m_satellites;	// from 0x47, 0x5C and 8F-A7
+		raw_measurement_ring *m_raw_ring;	// 0x5A records, NULL - not streamed
+		shm_packet_writer *m_publisher;	// reports shared, NULL - not published
+
+		unsigned long long m_generation;	// reports decoded, stamps the next report
 
 		// packet decoder states
 		enum t_state {
 			START=1,
 			FRAME,
 			DATA,
-			DATA_DLE
+			DATA_DLE,
+			RESYNC					// skip to the end of a damaged packet
 		} m_state;
+		int m_dle_run;				// RESYNC, DLEs in a row before the current byte
+		tsip_frame_stats m_stats;
 
 		//methods
 		void setup_gps_port(FILE *file);
+		int read_port(int timeout_ms, tsip_report_handler handler, void *ctx);
+		bool set_port_code(const struct _port_config &config, int code);
+		bool return_to_baud(const struct _port_config &config, int baud);
+		bool set_broadcast(const struct _broadcast_mask &mask, const struct _io_options &io, bool wait);
+		int end_frame(void);			// check the packet length, then update_report
+		int frame_length(void);			// expected length of the packet in m_report
+		void start_resync(void);
 		int update_report(void);		// update report with packet data
-		bool is_report_found(_command_packet &_cmd);
+		void clear_reports(void);
+		void stamp(struct _report_stamp &stamp);
+		void record_history(void);
+		bool update_satellites(void);	// 0x47, 0x5C, 8F-A7, 0x58 into m_satellites
 		UINT16 b2_to_uint16(int bb, char r_code);	// convert 2 bytes to short integer
 		UINT32 b4_to_uint32(int bb, char r_code);	// convert 4 bytes to integer
 		SINGLE b4_to_single(int bb, char r_code);	// convert 4 bytes to float
 		DOUBLE b8_to_double(int bb, char r_code);	// convert 8 bytes to double
+		void uint16_to_b2(UINT16 value, int bb, char r_code);	// store short integer as 2 command bytes
+		void uint32_to_b4(UINT32 value, int bb, char r_code);	// store integer as 4 command bytes
+		void single_to_b4(SINGLE value, int bb, char r_code);	// store float as 4 command bytes
 };
 
 
@@ -0,0 +1,614 @@
+/**
+ *	@file tsip_coro.cpp
+ * 	@brief coroutine event loop and awaitable TSIP operations
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	tsip_loop loop;
+ * 	std::vector<tsip_channel *> gps;
+ * 	std::vector<tsip_task> tasks;
+ *
+ * 	for (size_t i=0; i<ports.size(); i++) {
+ * 		gps.push_back(new tsip_channel(loop, ports[i]));
+ * 		tasks.push_back(survey_workflow(*gps[i], 2000, 7200));
+ * 		loop.spawn(tasks[i]);
+ * 	}
+ * 	loop.run();
+ * @endcode
+ *
+ */
+
+#include "tsip_coro.h"
+#include <algorithm>
+#include <cerrno>
+#include <poll.h>
+
+/****************************
+ * task                     *
+ ****************************/
+
+tsip_task::tsip_task(tsip_task &&other) noexcept {
+	m_handle = other.m_handle;
+	other.m_handle = handle_t();
+}
+
+tsip_task &tsip_task::operator=(tsip_task &&other) noexcept {
+	if (this != &other) {
+		if (m_handle) {
+			m_handle.destroy();
+		}
+		m_handle = other.m_handle;
+		other.m_handle = handle_t();
+	}
+	return *this;
+}
+
+tsip_task::~tsip_task() {
+	if (m_handle) {
+		m_handle.destroy();
+	}
+}
+
+/** done
+*
+*   @return bool true - the coroutine has returned
+*/
+bool tsip_task::done() const {
+	return (!m_handle || m_handle.done());
+}
+
+/** result
+*
+*   @return int value of co_return, -1 if the task has not finished
+*/
+int tsip_task::result() const {
+	return (m_handle && m_handle.done() ? m_handle.promise().result : -1);
+}
+
+tsip_task::handle_t tsip_task::handle() const {
+	return m_handle;
+}
+
+/****************************
+ * loop                     *
+ ****************************/
+
+/** Constructor.
+*
+*	Create an empty loop.  Channels register themselves when created.
+*/
+tsip_loop::tsip_loop() {
+	m_stop = false;
+}
+
+/** spawn task
+*
+*   Schedule a task to start on the next pass of run().  The task
+*   object must outlive the loop run.
+*
+*   @param tsip_task&  task
+*   @return void
+*/
+void tsip_loop::spawn(tsip_task &task) {
+	if (!task.done()) {
+		m_tasks.push_back(task.handle());
+		m_ready.push_back(task.handle());
+	}
+}
+
+/** stop
+*
+*   Make run() return after the current pass.  Suspended tasks stay
+*   suspended.
+*
+*   @return void
+*/
+void tsip_loop::stop() {
+	m_stop = true;
+}
+
+/** sleep
+*
+*   @param int  milliseconds
+*   @return sleep_awaiter, co_await it
+*/
+tsip_loop::sleep_awaiter tsip_loop::sleep(int ms) {
+	sleep_awaiter a;
+
+	a.loop = this;
+	a.w.kind = tsip_waiter::SLEEP;
+	a.w.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+	return a;
+}
+
+void tsip_loop::sleep_awaiter::await_suspend(std::coroutine_handle<> h) {
+	w.handle = h;
+	loop->m_timers.push_back(&w);
+}
+
+/** run
+*
+*   Resume ready coroutines, then poll all ports until the next report
+*   or deadline, until every spawned task has returned.
+*
+*   @return void
+*/
+void tsip_loop::run() {
+	m_stop = false;
+
+	while (!m_stop) {
+		while (!m_ready.empty()) {
+			std::coroutine_handle<> h = m_ready.front();
+			m_ready.pop_front();
+			h.resume();
+		}
+		if (!pending()) {
+			break;
+		}
+
+		tsip_deadline now = std::chrono::steady_clock::now();
+		expire(now);
+		if (!m_ready.empty()) {
+			continue;
+		}
+
+		std::vector<struct pollfd> fds;
+		std::vector<tsip_channel *> owners;
+		for (size_t i=0; i<m_channels.size(); i++) {
+			if (m_channels[i]->m_fd >= 0) {
+				struct pollfd p;
+				p.fd = m_channels[i]->m_fd;
+				p.events = POLLIN;
+				p.revents = 0;
+				fds.push_back(p);
+				owners.push_back(m_channels[i]);
+			}
+		}
+
+		int timeout = next_timeout(now);
+		if (fds.empty() && timeout < 0) {
+			// nothing left that could wake a task
+			fprintf(stderr, "tsip_loop: tasks waiting without a port or deadline\n");
+			break;
+		}
+		int rc = poll(fds.data(), fds.size(), timeout);
+		if (rc < 0 && errno != EINTR) {
+			perror("tsip_loop poll");
+			break;
+		}
+		for (size_t i=0; rc > 0 && i<fds.size(); i++) {
+			if (fds[i].revents) {
+				owners[i]->read_port();
+			}
+		}
+	}
+}
+
+/** wake waiter
+*
+*   Record the result and schedule the suspended coroutine.
+*
+*   @return void
+*/
+void tsip_loop::wake(tsip_waiter *w, bool found) {
+	w->found = found;
+	m_ready.push_back(w->handle);
+}
+
+/** expire deadlines
+*
+*   Wake every timer and channel waiter whose deadline has passed.
+*
+*   @return void
+*/
+void tsip_loop::expire(tsip_deadline now) {
+	for (size_t i=0; i<m_timers.size(); ) {
+		if (m_timers[i]->deadline <= now) {
+			wake(m_timers[i], true);
+			m_timers.erase(m_timers.begin() + i);
+		} else {
+			i++;
+		}
+	}
+	for (size_t i=0; i<m_channels.size(); i++) {
+		m_channels[i]->expire(now);
+	}
+}
+
+/** next timeout
+*
+*   @return int milliseconds to the nearest deadline, -1 if none
+*/
+int tsip_loop::next_timeout(tsip_deadline now) {
+	tsip_deadline next = tsip_deadline::max();
+
+	for (size_t i=0; i<m_timers.size(); i++) {
+		next = std::min(next, m_timers[i]->deadline);
+	}
+	for (size_t i=0; i<m_channels.size(); i++) {
+		tsip_channel *c = m_channels[i];
+		if (!c->m_requests.empty() && c->m_requests.front()->started) {
+			next = std::min(next, c->m_requests.front()->deadline);
+		}
+		for (size_t j=0; j<c->m_watchers.size(); j++) {
+			next = std::min(next, c->m_watchers[j]->deadline);
+		}
+	}
+	if (next == tsip_deadline::max()) {
+		return -1;
+	}
+	if (next <= now) {
+		return 0;
+	}
+	// round up so the deadline has passed when poll returns
+	return std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+}
+
+/** pending
+*
+*   @return bool true - a spawned task has not returned
+*/
+bool tsip_loop::pending() {
+	for (size_t i=0; i<m_tasks.size(); i++) {
+		if (!m_tasks[i].done()) {
+			return true;
+		}
+	}
+	m_tasks.clear();
+	return false;
+}
+
+/****************************
+ * channel                  *
+ ****************************/
+
+/** Constructor.
+*
+*	Open the port and register the channel with the loop.
+*
+* 	@param tsip_loop&  loop that drives the channel
+* 	@param string      port name  "/dev/ttyS0"
+* 	@param bool        verbose - optional
+*/
+tsip_channel::tsip_channel(tsip_loop &loop, const std::string &port, bool verbose)
+	: m_gps(port, verbose) {
+	m_loop = &loop;
+	m_fd = m_gps.get_port_fd();
+	m_loop->m_channels.push_back(this);
+}
+
+/** Destructor.
+*
+*	Unregister from the loop.  No coroutine may be waiting on the
+*	channel.
+*/
+tsip_channel::~tsip_channel() {
+	std::vector<tsip_channel *> &c = m_loop->m_channels;
+	c.erase(std::remove(c.begin(), c.end(), this), c.end());
+}
+
+bool tsip_channel::is_open() {
+	return (m_fd >= 0);
+}
+
+const std::string &tsip_channel::get_gps_port() {
+	return m_gps.get_gps_port();
+}
+
+tsip_loop &tsip_channel::get_loop() {
+	return *m_loop;
+}
+
+/** deadline
+*
+*   @param int  seconds from now
+*   @return tsip_deadline
+*/
+tsip_deadline tsip_channel::deadline(int seconds) {
+	return std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+}
+
+/** request
+*
+*   Send a command and wait for the report answering it.  The timeout
+*   starts when the command is sent, after the requests queued before
+*   it.  A command with cmd_len 0 waits for the next report.
+*
+*   @param _command_packet  command
+*   @param bool             wait for the report answering the command
+*   @param int              reply timeout in milliseconds
+*   @return request_awaiter, co_await it
+*/
+tsip_channel::request_awaiter tsip_channel::request(const _command_packet &cmd, bool reply, int timeout_ms) {
+	request_awaiter a;
+
+	a.channel = this;
+	a.w.kind = tsip_waiter::REQUEST;
+	a.w.command = cmd;
+	a.w.reply = reply;
+	a.w.timeout_ms = timeout_ms;
+	a.w.started = false;
+	a.w.updated = 0;
+	return a;
+}
+
+void tsip_channel::request_awaiter::await_suspend(std::coroutine_handle<> h) {
+	w.handle = h;
+	w.result = &reply;
+	channel->queue(&w);
+}
+
+/** send
+*
+*   Call a tsip method that sends a command without a reply, such as
+*   save_to_eeprom(), in turn with the queued requests.
+*
+*   @param function  call, returns the rc of the tsip method
+*   @return send_awaiter, co_await it
+*/
+tsip_channel::send_awaiter tsip_channel::send(std::function<bool(tsip &)> call) {
+	send_awaiter a;
+
+	a.channel = this;
+	a.w.kind = tsip_waiter::SEND;
+	a.w.call = call;
+	a.w.started = false;
+	return a;
+}
+
+void tsip_channel::send_awaiter::await_suspend(std::coroutine_handle<> h) {
+	w.handle = h;
+	channel->queue(&w);
+}
+
+/** until
+*
+*   Wait until the predicate holds.  It is tested after every report
+*   decoded on the channel, with m_updated holding the bits of that
+*   report only.
+*
+*   @param function       predicate
+*   @param tsip_deadline  give up at
+*   @return until_awaiter, co_await it
+*/
+tsip_channel::until_awaiter tsip_channel::until(std::function<bool(const tsip &)> pred, tsip_deadline deadline) {
+	until_awaiter a;
+
+	a.channel = this;
+	a.w.kind = tsip_waiter::UNTIL;
+	a.w.pred = pred;
+	a.w.deadline = deadline;
+	return a;
+}
+
+void tsip_channel::until_awaiter::await_suspend(std::coroutine_handle<> h) {
+	w.handle = h;
+	channel->watch(&w);
+}
+
+/** queue request
+*
+*   @return void
+*/
+void tsip_channel::queue(tsip_waiter *w) {
+	m_requests.push_back(w);
+	if (m_requests.size() == 1) {
+		start_request();
+	}
+}
+
+/** watch reports
+*
+*   @return void
+*/
+void tsip_channel::watch(tsip_waiter *w) {
+	m_watchers.push_back(w);
+}
+
+/** start request
+*
+*   Send the command at the head of the queue.  Sends and requests
+*   without a reply complete at once, so continue down the queue until
+*   a request waits for a reply.
+*
+*   @return void
+*/
+void tsip_channel::start_request() {
+	while (!m_requests.empty() && !m_requests.front()->started) {
+		tsip_waiter *w = m_requests.front();
+
+		w->started = true;
+		if (m_fd < 0) {
+			m_requests.pop_front();
+			m_loop->wake(w, false);
+			continue;
+		}
+		if (w->kind == tsip_waiter::SEND) {
+			m_requests.pop_front();
+			m_loop->wake(w, w->call(m_gps));
+			continue;
+		}
+		if (w->command.raw.cmd_len > 0) {
+			bool rc = m_gps.send_request_msg(w->command);
+			if (!rc || !w->reply) {
+				m_requests.pop_front();
+				m_loop->wake(w, rc);
+				continue;
+			}
+		}
+		w->updated = 0;
+		w->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(w->timeout_ms);
+	}
+}
+
+/** read port
+*
+*   Read the bytes available on the port and decode them, dispatching
+*   every completed report.  A closed port fails all waiters.
+*
+*   @return void
+*/
+void tsip_channel::read_port() {
+	UINT8 buffer[256];
+
+	ssize_t len = read(m_fd, buffer, sizeof(buffer));
+	if (len <= 0) {
+		if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+			return;
+		}
+		if (len < 0) {
+			perror(m_gps.get_gps_port().c_str());
+		} else {
+			printf("%s closed\n", m_gps.get_gps_port().c_str());
+		}
+		m_fd = -1;
+		while (!m_requests.empty()) {
+			m_loop->wake(m_requests.front(), false);
+			m_requests.pop_front();
+		}
+		for (size_t i=0; i<m_watchers.size(); i++) {
+			m_loop->wake(m_watchers[i], false);
+		}
+		m_watchers.clear();
+		return;
+	}
+
+	m_gps.encode(buffer, len, on_report, this);
+}
+
+/** on report
+*
+*   Decoder callback, dispatches each report to the waiters.
+*
+*   @return bool true - keep decoding
+*/
+bool tsip_channel::on_report(tsip &, void *ctx) {
+	((tsip_channel *)ctx)->dispatch();
+	return true;
+}
+
+/** dispatch report
+*
+*   Offer the report just decoded to the request in progress and to
+*   the watchers, then clear the report bits for the next one.
+*
+*   @return void
+*/
+void tsip_channel::dispatch() {
+	int bits = m_gps.m_updated.value;
+
+	if (!m_requests.empty() && m_requests.front()->started) {
+		tsip_waiter *w = m_requests.front();
+		bool found;
+
+		// test against every report seen since the command was sent
+		w->updated |= bits;
+		m_gps.m_updated.value = w->updated;
+		if (w->command.raw.cmd_len == 0) {
+			found = true;
+		} else {
+			found = m_gps.is_report_found(w->command);
+		}
+		if (found) {
+			m_gps.get_reply(*w->result);
+			m_requests.pop_front();
+			m_loop->wake(w, true);
+		}
+		m_gps.m_updated.value = bits;
+		if (found) {
+			start_request();
+		}
+	}
+
+	for (size_t i=0; i<m_watchers.size(); ) {
+		tsip_waiter *w = m_watchers[i];
+		bool found;
+
+		if (w->kind == tsip_waiter::REPORT) {
+			found = w->match(m_gps);
+			if (found) {
+				w->copy(m_gps, w->value);
+			}
+		} else {
+			found = w->pred(m_gps);
+		}
+		if (found) {
+			m_loop->wake(w, true);
+			m_watchers.erase(m_watchers.begin() + i);
+		} else {
+			i++;
+		}
+	}
+	m_gps.m_updated.value = 0;
+}
+
+/** expire deadlines
+*
+*   Fail the request in progress and the watchers whose deadline has
+*   passed.
+*
+*   @return void
+*/
+void tsip_channel::expire(tsip_deadline now) {
+	if (!m_requests.empty() && m_requests.front()->started
+			&& m_requests.front()->deadline <= now) {
+		tsip_waiter *w = m_requests.front();
+		m_gps.get_reply(*w->result);
+		m_requests.pop_front();
+		m_loop->wake(w, false);
+		start_request();
+	}
+	for (size_t i=0; i<m_watchers.size(); ) {
+		if (m_watchers[i]->deadline <= now) {
+			m_loop->wake(m_watchers[i], false);
+			m_watchers.erase(m_watchers.begin() + i);
+		} else {
+			i++;
+		}
+	}
+}
+
+/****************************
+ * workflows                *
+ ****************************/
+
+/** survey workflow
+*
+*   Clear the stored position (8E-45 segment 7), set the survey length
+*   and start a self survey, then follow the broadcast 8F-AC until the
+*   survey has started and finished.
+*
+*   @param tsip_channel&  receiver
+*   @param int            positions to average
+*   @param int            give up after seconds
+*   @return tsip_task     0 - done, 1 - timeout, 2 - no reply
+*/
+tsip_task survey_workflow(tsip_channel &gps, int survey_cnt, int timeout_sec) {
+	tsip_deadline end = gps.deadline(timeout_sec);
+
+	co_await gps.send([](tsip &g) { return g.revert_to_default(7); });
+	co_await gps.send([survey_cnt](tsip &g) { return g.set_survey_params(survey_cnt); });
+	if (!co_await gps.send([](tsip &g) { return g.start_self_survey(); })) {
+		co_return 2;
+	}
+
+	// the survey in progress alarm is set once the survey has started
+	bool started = co_await gps.until([](const tsip &g) {
+			return g.m_updated.report.secondary_time
+				&& g.m_secondary_time.report.minor_alarms.bits.self_survey_in_progress;
+		}, std::min(end, gps.deadline(30)));
+	if (!started) {
+		co_return 2;
+	}
+
+	bool done = co_await gps.until([](const tsip &g) {
+			return g.m_updated.report.secondary_time
+				&& !g.m_secondary_time.report.minor_alarms.bits.self_survey_in_progress;
+		}, end);
+	co_return (done ? 0 : 1);
+}
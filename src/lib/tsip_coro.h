@@ -0,0 +1,257 @@
+/*
+  tsip_coro.h - C++20 coroutine interface for TSIP command workflows.
+
+  Multi-step procedures (revert, set parameters, start a survey, wait
+  for progress) are written as straight-line coroutines instead of
+  blocking calls with sleeps.  A tsip_loop drives any number of
+  receivers from one thread: it polls every port, decodes the reports
+  and resumes the coroutines waiting on them.
+
+    tsip_task survey(tsip_channel &gps) {
+        co_await gps.send([](tsip &g) { return g.start_self_survey(); });
+        tsip_reply r = co_await gps.request(cmd_8eac);
+        _primary_time t = co_await gps.next<_primary_time>();
+        bool ok = co_await gps.until(pred, gps.deadline(3600));
+        co_return 0;
+    }
+
+    tsip_loop loop;
+    tsip_channel gps(loop, "/dev/ttyS0");
+    tsip_task task = survey(gps);
+    loop.spawn(task);
+    loop.run();
+
+  Requests on a channel are sent one at a time in the order they are
+  awaited, so several coroutines may share a receiver.  Only built when
+  the compiler supports C++20 coroutines (GPS_HAVE_COROUTINES).
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _tsip_coro_h
+#define _tsip_coro_h
+
+#include <tsip.h>
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <vector>
+
+#define TSIP_CORO_TIMEOUT_MS	3000	// default wait for a reply or report
+
+class tsip_loop;
+class tsip_channel;
+
+typedef std::chrono::steady_clock::time_point tsip_deadline;
+
+// coroutine returned by a workflow, co_return an exit status
+class tsip_task {
+	public:
+		struct promise_type {
+			int result;
+			tsip_task get_return_object() {
+				return tsip_task(std::coroutine_handle<promise_type>::from_promise(*this));
+			}
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			std::suspend_always final_suspend() noexcept { return {}; }
+			void return_value(int rc) { result = rc; }
+			void unhandled_exception() { std::terminate(); }
+		};
+		typedef std::coroutine_handle<promise_type> handle_t;
+
+		tsip_task(tsip_task &&other) noexcept;
+		tsip_task &operator=(tsip_task &&other) noexcept;
+		~tsip_task(void);
+		bool done(void) const;
+		int result(void) const;			// co_return value, once done
+		handle_t handle(void) const;
+
+	private:
+		explicit tsip_task(handle_t h) : m_handle(h) {}
+		tsip_task(const tsip_task &);
+		tsip_task &operator=(const tsip_task &);
+
+		handle_t m_handle;
+};
+
+// a coroutine suspended on a channel or timer
+struct tsip_waiter {
+	enum kind_t {
+		REQUEST,				// send a command, wait for the reply
+		SEND,					// call a tsip method in turn
+		REPORT,					// wait for a report type
+		UNTIL,					// wait for a predicate
+		SLEEP					// wait for the deadline
+	} kind;
+	std::coroutine_handle<> handle;
+	tsip_deadline deadline;
+	bool found;					// result, false on timeout
+
+	_command_packet command;	// REQUEST
+	bool reply;
+	int  timeout_ms;			// from the time the command is sent
+	bool started;
+	int  updated;				// report bits seen since the command was sent
+	tsip_reply *result;
+
+	std::function<bool(tsip &)> call;				// SEND
+	bool (*match)(const tsip &);					// REPORT
+	void (*copy)(const tsip &, void *);
+	void *value;
+	std::function<bool(const tsip &)> pred;			// UNTIL
+};
+
+// event loop, drives all channels and sleeping coroutines
+class tsip_loop {
+	public:
+		tsip_loop(void);
+		void spawn(tsip_task &task);
+		void run(void);
+		void stop(void);
+
+		// co_await loop.sleep(ms)
+		struct sleep_awaiter {
+			tsip_loop *loop;
+			tsip_waiter w;
+			bool await_ready(void) { return false; }
+			void await_suspend(std::coroutine_handle<> h);
+			void await_resume(void) {}
+		};
+		sleep_awaiter sleep(int ms);
+
+	private:
+		friend class tsip_channel;
+
+		std::vector<tsip_channel *> m_channels;
+		std::vector<tsip_task::handle_t> m_tasks;
+		std::vector<tsip_waiter *> m_timers;
+		std::deque<std::coroutine_handle<> > m_ready;
+		bool m_stop;
+
+		void wake(tsip_waiter *w, bool found);
+		void expire(tsip_deadline now);
+		int next_timeout(tsip_deadline now);
+		bool pending(void);
+};
+
+// traits for next<T>(): the updated bit and decoded member of a report
+template <class T> struct tsip_report_traits;
+
+#define TSIP_REPORT_TRAITS(type, field) \
+	template <> struct tsip_report_traits<type> { \
+		static bool match(const tsip &g) { return g.m_updated.report.field; } \
+		static void copy(const tsip &g, void *v) { *(type *)v = g.m_##field; } \
+	};
+
+TSIP_REPORT_TRAITS(_ecef_position_s, ecef_position_s)
+TSIP_REPORT_TRAITS(_ecef_position_d, ecef_position_d)
+TSIP_REPORT_TRAITS(_ecef_velocity, ecef_velocity)
+TSIP_REPORT_TRAITS(_sw_version, sw_version)
+TSIP_REPORT_TRAITS(_single_position, single_position)
+TSIP_REPORT_TRAITS(_double_position, double_position)
+TSIP_REPORT_TRAITS(_io_options, io_options)
+TSIP_REPORT_TRAITS(_enu_velocity, enu_velocity)
+TSIP_REPORT_TRAITS(_utc_gps_time, utc_gps_time)
+TSIP_REPORT_TRAITS(_primary_time, primary_time)
+TSIP_REPORT_TRAITS(_secondary_time, secondary_time)
+TSIP_REPORT_TRAITS(_manufacturing_params, manufacturing_params)
+TSIP_REPORT_TRAITS(_broadcast_mask, broadcast_mask)
+TSIP_REPORT_TRAITS(_port_config, port_config)
+
+// one receiver on a loop
+class tsip_channel {
+	public:
+		tsip_channel(tsip_loop &loop, const std::string &port, bool verbose=false);
+		~tsip_channel(void);
+		bool is_open(void);
+		const std::string &get_gps_port(void);
+		tsip_loop &get_loop(void);
+		tsip_deadline deadline(int seconds);
+
+		// co_await gps.request(cmd): tsip_reply, found false on timeout
+		struct request_awaiter {
+			tsip_channel *channel;
+			tsip_waiter w;
+			tsip_reply reply;
+			bool await_ready(void) { return false; }
+			void await_suspend(std::coroutine_handle<> h);
+			tsip_reply await_resume(void) { reply.found = w.found; return reply; }
+		};
+		request_awaiter request(const _command_packet &cmd, bool reply=true,
+				int timeout_ms=TSIP_CORO_TIMEOUT_MS);
+
+		// co_await gps.send(fn): bool returned by fn(tsip&), called in turn
+		struct send_awaiter {
+			tsip_channel *channel;
+			tsip_waiter w;
+			bool await_ready(void) { return false; }
+			void await_suspend(std::coroutine_handle<> h);
+			bool await_resume(void) { return w.found; }
+		};
+		send_awaiter send(std::function<bool(tsip &)> call);
+
+		// co_await gps.next<T>(): the next report of type T, valid false on timeout
+		template <class T>
+		struct report_awaiter {
+			tsip_channel *channel;
+			tsip_waiter w;
+			T value;
+			bool await_ready(void) { return false; }
+			void await_suspend(std::coroutine_handle<> h) {
+				w.handle = h;
+				w.value = &value;
+				channel->watch(&w);
+			}
+			T await_resume(void) { value.valid = w.found; return value; }
+		};
+		template <class T>
+		report_awaiter<T> next(int timeout_ms=TSIP_CORO_TIMEOUT_MS) {
+			report_awaiter<T> a;
+			a.channel = this;
+			a.w.kind = tsip_waiter::REPORT;
+			a.w.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+			a.w.match = &tsip_report_traits<T>::match;
+			a.w.copy = &tsip_report_traits<T>::copy;
+			return a;
+		}
+
+		// co_await gps.until(pred, deadline): true once pred holds after a report
+		struct until_awaiter {
+			tsip_channel *channel;
+			tsip_waiter w;
+			bool await_ready(void) { return false; }
+			void await_suspend(std::coroutine_handle<> h);
+			bool await_resume(void) { return w.found; }
+		};
+		until_awaiter until(std::function<bool(const tsip &)> pred, tsip_deadline deadline);
+
+	private:
+		friend class tsip_loop;
+
+		tsip_loop *m_loop;
+		tsip m_gps;
+		int  m_fd;
+		std::deque<tsip_waiter *> m_requests;	// head is in progress
+		std::vector<tsip_waiter *> m_watchers;	// REPORT and UNTIL
+
+		void queue(tsip_waiter *w);
+		void watch(tsip_waiter *w);
+		void start_request(void);
+		void read_port(void);
+		static bool on_report(tsip &gps, void *ctx);
+		void dispatch(void);
+		void expire(tsip_deadline now);
+		bool pending(void);
+};
+
+// revert the stored position, set the survey length, start the survey
+// and wait for it to finish.  0 - done, 1 - timeout, 2 - no reply
+tsip_task survey_workflow(tsip_channel &gps, int survey_cnt, int timeout_sec);
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * tsip_coro_test.cpp
+ *
+ * Test of the coroutine survey workflow on ptys, run by ctest when the
+ * compiler has C++20 coroutines.  One loop drives two channels: a
+ * simulated receiver that broadcasts an 8F-AC every TEST_BROADCAST_MS
+ * and, once told to start a self survey, reports it in progress for
+ * TEST_SURVEY_REPORTS broadcasts; and a pty nobody writes to.  The
+ * first workflow must finish with 0 after sending 8E-45, 8E-A9 and
+ * 8E-A6 in that order, the second must give up with 2 after its
+ * timeout, and the loop must return once both are done.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "tsip.h"
+#include "tsip_coro.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define TEST_BROADCAST_MS	20
+#define TEST_SURVEY_REPORTS	5
+#define TEST_TIMEOUT_SEC	1		// of the silent receiver
+#define TEST_SURVEY_CNT		100
+
+#define MINOR_SELF_SURVEY	0x0020	// 8F-AC minor alarm, self survey in progress
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL line %d: %s\n", __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+// big endian fields of a TSIP packet body
+static void put_be(std::vector<UINT8> &body, const void *value, int size) {
+	for (int i=size-1; i>=0; i--) {
+		body.push_back(((const UINT8 *)value)[i]);
+	}
+}
+
+// simulated receiver on the master side of a pty
+struct receiver_t {
+	int fd;
+	std::atomic<bool> stop;
+	std::vector<std::vector<UINT8> > commands;	// read once stopped
+};
+
+/** send secondary
+*
+*   Write an 8F-AC with the minor alarms given, framed and with its DLE
+*   bytes stuffed.
+*
+*   @return void
+*/
+static void send_secondary(int fd, UINT16 minor_alarms) {
+	std::vector<UINT8> b = {REPORT_SUPER, REPORT_SUPER_SECONDARY_TIME, 7, 0, 100};
+	std::vector<UINT8> frame;
+	UINT32 holdover = 0;
+	UINT16 critical_alarms = 0;
+	UINT32 dac = 0x8000;
+	float pps = 1.5f, tenMHz = -0.25f, voltage = 1.2f, temperature = 40.5f;
+	double latitude = 0.7, longitude = -1.8, altitude = 1600;
+
+	put_be(b, &holdover, 4);
+	put_be(b, &critical_alarms, 2);
+	put_be(b, &minor_alarms, 2);
+	b.insert(b.end(), 4, 0);			// decoding status, activity, spares
+	put_be(b, &pps, 4);
+	put_be(b, &tenMHz, 4);
+	put_be(b, &dac, 4);
+	put_be(b, &voltage, 4);
+	put_be(b, &temperature, 4);
+	put_be(b, &latitude, 8);
+	put_be(b, &longitude, 8);
+	put_be(b, &altitude, 8);
+	b.insert(b.end(), 8, 0);
+
+	frame.push_back(0x10);
+	for (size_t i=0; i<b.size(); i++) {
+		frame.push_back(b[i]);
+		if (b[i] == 0x10) {
+			frame.push_back(0x10);
+		}
+	}
+	frame.push_back(0x10);
+	frame.push_back(0x03);
+	if (write(fd, &frame[0], frame.size()) != (ssize_t)frame.size()) {
+		perror("receiver write");
+	}
+}
+
+/** run receiver
+*
+*   Record the commands written to the pty and broadcast the 8F-AC,
+*   with the survey in progress for TEST_SURVEY_REPORTS broadcasts
+*   after an 8E-A6.
+*
+*   @return void
+*/
+static void run_receiver(receiver_t *r) {
+	std::vector<UINT8> command;
+	bool dle = false, inside = false;
+	int surveying = 0;
+	UINT8 buffer[256];
+	struct pollfd p;
+
+	p.fd = r->fd;
+	p.events = POLLIN;
+	while (!r->stop) {
+		if (poll(&p, 1, TEST_BROADCAST_MS) <= 0) {
+			send_secondary(r->fd, surveying > 0 ? MINOR_SELF_SURVEY : 0);
+			if (surveying > 0) {
+				surveying--;
+			}
+			continue;
+		}
+		ssize_t len = read(r->fd, buffer, sizeof(buffer));
+		if (len <= 0) {
+			break;
+		}
+		for (ssize_t i=0; i<len; i++) {
+			UINT8 c = buffer[i];
+			if (dle) {
+				dle = false;
+				if (c == 0x03) {
+					inside = false;
+					r->commands.push_back(command);
+					if (command.size() >= 2 && command[0] == COMMAND_SUPER_PACKET
+							&& command[1] == COMMAND_SELF_SURVEY) {
+						surveying = TEST_SURVEY_REPORTS;
+					}
+					continue;
+				}
+				if (c != 0x10) {
+					inside = true;		// start of a packet
+					command.clear();
+				}
+				command.push_back(c);
+			} else if (c == 0x10) {
+				dle = true;
+			} else if (inside) {
+				command.push_back(c);
+			}
+		}
+	}
+}
+
+static int open_master(void) {
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+		perror("posix_openpt");
+		exit(1);
+	}
+	return fd;
+}
+
+int main() {
+	receiver_t receiver;
+	int silent = open_master();
+
+	receiver.fd = open_master();
+	receiver.stop = false;
+	std::thread simulator(run_receiver, &receiver);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	{
+		tsip_loop loop;
+		tsip_channel answering(loop, ptsname(receiver.fd));
+		tsip_channel quiet(loop, ptsname(silent));
+		CHECK(answering.is_open() && quiet.is_open());
+
+		tsip_task surveyed = survey_workflow(answering, TEST_SURVEY_CNT, 60);
+		tsip_task timed_out = survey_workflow(quiet, TEST_SURVEY_CNT, TEST_TIMEOUT_SEC);
+		loop.spawn(surveyed);
+		loop.spawn(timed_out);
+		loop.run();
+
+		CHECK(surveyed.done() && surveyed.result() == 0);
+		CHECK(timed_out.done() && timed_out.result() == 2);
+	}
+	long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start).count();
+	CHECK(elapsed >= TEST_TIMEOUT_SEC * 1000 && elapsed < 10 * TEST_TIMEOUT_SEC * 1000);
+
+	receiver.stop = true;
+	simulator.join();
+	close(receiver.fd);
+	close(silent);
+
+	const std::vector<std::vector<UINT8> > &c = receiver.commands;
+	CHECK(c.size() == 3);
+	if (c.size() == 3) {
+		CHECK(c[0].size() == 3 && c[0][0] == COMMAND_SUPER_PACKET
+				&& c[0][1] == COMMAND_REVERT_TO_DEFAULT && c[0][2] == 7);
+		CHECK(c[1].size() > 2 && c[1][0] == COMMAND_SUPER_PACKET
+				&& c[1][1] == COMMAND_SET_SELF_SURVEY_PARAMS);
+		CHECK(c[2].size() == 3 && c[2][0] == COMMAND_SUPER_PACKET
+				&& c[2][1] == COMMAND_SELF_SURVEY && c[2][2] == 0);
+	}
+	printf("survey workflow: %ld ms, %d failures\n", elapsed, failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,516 @@
+/**
+ *	@file tsip_executor.cpp
+ * 	@brief thread safe request queue in front of a tsip object
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	tsip_executor gps("/dev/ttyS0");
+ *
+ * 	// time service thread
+ * 	time_t now = gps.get_gps_time_utc();
+ *
+ * 	// position service thread
+ * 	tsip::xyz_t xyz;
+ * 	if (gps.get_xyz(xyz)) ...
+ *
+ * 	// any request
+ * 	std::future<tsip_reply> f = gps.submit(cmd);
+ * 	tsip_reply reply = f.get();
+ * 	if (reply.found) ...
+ * @endcode
+ *
+ */
+
+#include "tsip_executor.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+
+/** Constructor.
+*
+*	Open the port and start the worker thread.  Requests on an executor
+*	whose port could not be opened complete with found = false.
+*
+* 	@param string   port name  "/dev/ttyS0"
+* 	@param bool     verbose - optional
+*/
+tsip_executor::tsip_executor(const std::string &port, bool verbose)
+	: m_gps(port, verbose) {
+	m_stop = false;
+	m_fd = m_gps.get_port_fd();
+	m_buffer_pos = 0;
+	m_buffer_len = 0;
+	m_generation = 0;
+	m_waiting = 0;
+
+	if (pipe2(m_wakeup, O_NONBLOCK | O_CLOEXEC) != 0) {
+		perror("tsip_executor pipe");
+		m_wakeup[0] = m_wakeup[1] = -1;
+	}
+	m_worker = std::thread(&tsip_executor::run, this);
+}
+
+/** Destructor.
+*
+*	Stop the worker; queued requests complete with found = false.
+*/
+tsip_executor::~tsip_executor() {
+	stop();
+	if (m_wakeup[0] >= 0) {
+		close(m_wakeup[0]);
+		close(m_wakeup[1]);
+	}
+}
+
+/** is open
+*
+*   @return bool true - the port is open
+*/
+bool tsip_executor::is_open() {
+	return m_gps.port_status;
+}
+
+/** stop
+*
+*   Stop the worker thread.  The request in progress and all queued
+*   requests complete with found = false.  Later requests complete
+*   immediately.
+*
+*   @return void
+*/
+void tsip_executor::stop() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_decoded.notify_all();
+	if (m_wakeup[1] >= 0) {
+		char c = 0;
+		if (write(m_wakeup[1], &c, 1) < 0 && errno != EAGAIN) {
+			perror("tsip_executor wakeup");
+		}
+	}
+	if (m_worker.joinable()) {
+		m_worker.join();
+	}
+}
+
+/** submit request
+*
+*   Queue a command for the gps.
+*
+*   @param _command_packet  command, cmd_len 0 waits for the next report
+*   @param bool             wait for the report answering the command
+*   @param int              reply timeout in milliseconds
+*   @return future<tsip_reply> ready when the request completes
+*/
+std::future<tsip_reply> tsip_executor::submit(const _command_packet &cmd, bool reply, int timeout_ms) {
+	request_t req;
+
+	req.command = cmd;
+	req.reply = reply;
+	req.timeout_ms = timeout_ms;
+	req.promise = std::make_shared<std::promise<tsip_reply> >();
+
+	std::future<tsip_reply> result = req.promise->get_future();
+	enqueue(req);
+	return result;
+}
+
+/** submit request
+*
+*   Queue a command for the gps.  The callback is run on the worker
+*   thread and must not block; it must not call back into the executor
+*   and wait for the result.
+*
+*   @param _command_packet  command, cmd_len 0 waits for the next report
+*   @param callback_t       called with the reply
+*   @param bool             wait for the report answering the command
+*   @param int              reply timeout in milliseconds
+*   @return void
+*/
+void tsip_executor::submit(const _command_packet &cmd, callback_t callback, bool reply, int timeout_ms) {
+	request_t req;
+
+	req.command = cmd;
+	req.reply = reply;
+	req.timeout_ms = timeout_ms;
+	req.callback = callback;
+	enqueue(req);
+}
+
+/** next report
+*
+*   Wait for the next report from the gps, without sending a command.
+*
+*   @param int  timeout in milliseconds
+*   @return future<tsip_reply>
+*/
+std::future<tsip_reply> tsip_executor::next_report(int timeout_ms) {
+	_command_packet cmd;
+
+	cmd.raw.cmd_len = 0;
+	return submit(cmd, true, timeout_ms);
+}
+
+/** wait for next report
+*
+*   Block until a report is decoded after the call, a broadcast or the
+*   reply to another caller's request.  Nothing is sent and nothing
+*   decoded before is cleared.  With several bits every one of the
+*   reports must be decoded again.
+*
+*   @param int          report bits, see tsip::report_bit
+*   @param tsip_reply&  snapshot of the reports once they arrived
+*   @param int          timeout in milliseconds
+*   @return bool        false - timeout or stopped
+*/
+bool tsip_executor::wait_for_next(int report_bits, tsip_reply &reply, int timeout_ms) {
+	next_t next;
+
+	next.bits = report_bits;
+	next.since = m_generation;
+	next.reply = &reply;
+	next.done = false;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_stop) {
+		return false;
+	}
+	m_next.push_back(&next);
+	m_waiting++;
+	m_decoded.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+			[&] { return next.done || m_stop; });
+	if (!next.done) {
+		m_next.erase(std::find(m_next.begin(), m_next.end(), &next));
+		m_waiting--;
+	}
+	reply.found = next.done;
+	return next.done;
+}
+
+/** get gps time in utc seconds
+*
+*   Select UTC time (8E-A2) and request the primary timing packet.
+*
+*   @return time_t  0 if the gps did not reply
+*/
+time_t tsip_executor::get_gps_time_utc() {
+	_command_packet cmd;
+
+	//build a2 request - set UTC
+	cmd.extended.code = COMMAND_SUPER_PACKET;
+	cmd.extended.subcode = REPORT_SUPER_UTC_GPS_TIME;
+	cmd.extended.data[0] = 0x3;
+	cmd.extended.cmd_len = 3;
+	submit(cmd, false);
+
+	//build ab request - request time packet
+	cmd.extended.subcode = REPORT_SUPER_PRIMARY_TIME;
+	cmd.extended.cmd_len = 2;
+	tsip_reply reply = submit(cmd).get();
+	if (!reply.found) {
+		return 0;
+	}
+	return tsip::primary_time_to_utc(reply.primary_time);
+}
+
+/** get xyz from gps
+*
+*   Get the position (lat, long, alt) from the secondary timing packet.
+*
+*   @param xyz_t&   returned position, degrees and meters
+*   @return bool    true - the gps replied
+*/
+bool tsip_executor::get_xyz(tsip::xyz_t &xyz) {
+	_command_packet cmd;
+
+	//build ac request - secondary timing packet
+	cmd.extended.code = COMMAND_SUPER_PACKET;
+	cmd.extended.subcode = REPORT_SUPER_SECONDARY_TIME;
+	cmd.extended.cmd_len = 2;
+	tsip_reply reply = submit(cmd).get();
+	if (!reply.found) {
+		return false;
+	}
+	xyz.latitude = reply.secondary_time.report.latitude * m_gps._rad;
+	xyz.longitude = reply.secondary_time.report.longitude * m_gps._rad;
+	xyz.altitude = reply.secondary_time.report.altitude;
+	return true;
+}
+
+/** get serial number  8E-41
+*
+*   @return string serial number, empty if the gps did not reply
+*/
+std::string tsip_executor::get_serial_number() {
+	_command_packet cmd;
+	char serial[32];
+
+	//build 8E-41 request - manufacturing parameters
+	cmd.extended.code = COMMAND_SUPER_PACKET;
+	cmd.extended.subcode = COMMAND_MANUFACTURING_PARAMS;
+	cmd.extended.cmd_len = 2;
+	tsip_reply reply = submit(cmd).get();
+	if (!reply.found) {
+		return "";
+	}
+	snprintf(serial, sizeof(serial), "%d-%u",
+			reply.manufacturing_params.report.serial_prefix,
+			reply.manufacturing_params.report.serial_number);
+	return serial;
+}
+
+/** enqueue request
+*
+*   Add the request to the queue and wake the worker.
+*
+*   @return void
+*/
+void tsip_executor::enqueue(const request_t &req) {
+	bool queued = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_stop) {
+			m_queue.push_back(req);
+			queued = true;
+		}
+	}
+	if (!queued) {
+		// stopped, the decoded reports belong to the worker
+		tsip_reply reply;
+		memset(&reply, 0, sizeof(reply));
+		if (req.promise) {
+			req.promise->set_value(reply);
+		} else if (req.callback) {
+			req.callback(reply);
+		}
+		return;
+	}
+	char c = 0;
+	if (write(m_wakeup[1], &c, 1) < 0 && errno != EAGAIN) {
+		perror("tsip_executor wakeup");
+	}
+}
+
+/** worker thread
+*
+*   Execute queued requests in order.  While the queue is empty, keep
+*   decoding the reports the gps broadcasts.
+*
+*   @return void
+*/
+void tsip_executor::run() {
+	for (;;) {
+		request_t req;
+		bool have_req = false;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_stop) {
+				break;
+			}
+			if (!m_queue.empty()) {
+				req = m_queue.front();
+				m_queue.pop_front();
+				have_req = true;
+			}
+		}
+		if (have_req) {
+			execute(req);
+		} else {
+			decode(NULL);
+			read_port(-1);
+		}
+	}
+
+	// fail everything still queued
+	std::deque<request_t> pending;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		pending.swap(m_queue);
+	}
+	for (size_t i=0; i<pending.size(); i++) {
+		complete(pending[i], false);
+	}
+}
+
+/** execute request
+*
+*   Send the command and decode reports until the expected report is
+*   found, the timeout expires or the executor is stopped.
+*
+*   @return void
+*/
+void tsip_executor::execute(request_t &req) {
+	m_gps.start_request();
+
+	if (m_fd < 0) {
+		complete(req, false);
+		return;
+	}
+	if (req.command.raw.cmd_len > 0) {
+		bool rc = m_gps.send_request_msg(req.command);
+		if (!rc || !req.reply) {
+			complete(req, rc);
+			return;
+		}
+	}
+
+	std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() + std::chrono::milliseconds(req.timeout_ms);
+	bool found = decode(&req);
+
+	while (!found && m_fd >= 0) {
+		// rounded up, poll would return before the deadline
+		long remaining = std::chrono::ceil<std::chrono::milliseconds>(
+				deadline - std::chrono::steady_clock::now()).count();
+		if (remaining <= 0) {
+			break;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_stop) {
+				break;
+			}
+		}
+		read_port(remaining);
+		found = decode(&req);
+	}
+	complete(req, found);
+}
+
+/** complete request
+*
+*   Take a snapshot of the decoded reports and hand it to the caller.
+*
+*   @param request_t&  request
+*   @param bool        expected report found
+*   @return void
+*/
+void tsip_executor::complete(request_t &req, bool found) {
+	tsip_reply reply;
+
+	m_gps.get_reply(reply);
+	reply.found = found;
+
+	if (req.promise) {
+		req.promise->set_value(reply);
+	} else if (req.callback) {
+		req.callback(reply);
+	}
+}
+
+/** decode buffered bytes
+*
+*   Pass buffered bytes to the packet decoder, stopping as soon as the
+*   report the request waits for is complete.  Bytes after it stay in
+*   the buffer for the next request.
+*
+*   @param request_t*  request in progress, NULL to decode everything
+*   @return bool       true - the expected report was found
+*/
+bool tsip_executor::decode(request_t *req) {
+	while (m_buffer_pos < m_buffer_len) {
+		if (m_gps.encode(m_buffer[m_buffer_pos++]) == 0) {
+			continue;
+		}
+		m_generation = m_gps.get_generation();
+		if (m_waiting > 0) {
+			wake_next();
+		}
+		if (req == NULL) {
+			continue;
+		}
+		if (req->command.raw.cmd_len == 0 || m_gps.is_report_found(req->command)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/** read port
+*
+*   Wait for bytes from the gps or a wakeup, up to timeout_ms (-1 for
+*   no limit), and refill the buffer.  The buffer must be empty.  A
+*   closed or failed port is marked with m_fd = -1.
+*
+*   @param int  timeout in milliseconds
+*   @return void
+*/
+void tsip_executor::read_port(int timeout_ms) {
+	struct pollfd fds[2];
+	int nfds = 0;
+
+	if (m_fd >= 0) {
+		fds[nfds].fd = m_fd;
+		fds[nfds++].events = POLLIN;
+	}
+	fds[nfds].fd = m_wakeup[0];
+	fds[nfds++].events = POLLIN;
+
+	int rc = poll(fds, nfds, timeout_ms);
+	if (rc <= 0) {
+		if (rc < 0 && errno != EINTR) {
+			perror("tsip_executor poll");
+		}
+		return;
+	}
+
+	// drain wakeups, the caller checks the queue
+	if (fds[nfds-1].revents) {
+		char drain[64];
+		while (read(m_wakeup[0], drain, sizeof(drain)) > 0) {
+		}
+	}
+
+	if (m_fd >= 0 && fds[0].revents) {
+		ssize_t len = read(m_fd, m_buffer, sizeof(m_buffer));
+		if (len > 0) {
+			m_buffer_pos = 0;
+			m_buffer_len = len;
+		} else if (len == 0 || (errno != EINTR && errno != EAGAIN)) {
+			if (len < 0) {
+				perror(m_gps.get_gps_port().c_str());
+			} else {
+				printf("%s closed\n", m_gps.get_gps_port().c_str());
+			}
+			m_fd = -1;
+		}
+	}
+}
+
+/** wake next
+*
+*   Complete the wait_for_next callers whose reports have all been
+*   decoded since they started waiting.
+*
+*   @return void
+*/
+void tsip_executor::wake_next() {
+	bool woken = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i=0; i<m_next.size(); ) {
+			next_t *next = m_next[i];
+			if (m_gps.is_newer(next->bits, next->since)) {
+				m_gps.get_reply(*next->reply);
+				next->done = true;
+				m_next.erase(m_next.begin() + i);
+				m_waiting--;
+				woken = true;
+			} else {
+				i++;
+			}
+		}
+	}
+	if (woken) {
+		m_decoded.notify_all();
+	}
+}
@@ -0,0 +1,108 @@
+/*
+  tsip_executor.h - thread safe access to a Trimble Thunderbolt GPSDO.
+
+  A tsip object keeps the command buffer, the packet decoder and every
+  decoded report in shared members, so it can only be used from one
+  thread.  The executor owns the tsip object and runs it on a worker
+  thread: callers on any thread queue a request and wait on a future,
+  or pass a callback.  Requests are sent one at a time in queue order.
+  Each request completes with its own snapshot of the decoded reports
+  (tsip_reply), so concurrent callers never see each other's results.
+
+  Between requests the worker keeps reading the port, so broadcast
+  reports are decoded as they arrive.  wait_for_next() blocks a caller
+  until the next report of a type is decoded, without sending anything.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _tsip_executor_h
+#define _tsip_executor_h
+
+#include <tsip.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#define TSIP_REQUEST_TIMEOUT_MS	3000	// default wait for a reply
+
+class tsip_executor {
+	public:
+		typedef std::function<void(const tsip_reply &)> callback_t;
+
+		tsip_executor(const std::string &port, bool verbose=false);
+		~tsip_executor(void);
+		bool is_open(void);
+		void stop(void);
+
+		// queue a command; reply=false completes once the command is sent.
+		// A command with cmd_len 0 sends nothing and completes on the next
+		// report received.
+		std::future<tsip_reply> submit(const _command_packet &cmd, bool reply=true,
+				int timeout_ms=TSIP_REQUEST_TIMEOUT_MS);
+		void submit(const _command_packet &cmd, callback_t callback, bool reply=true,
+				int timeout_ms=TSIP_REQUEST_TIMEOUT_MS);
+		std::future<tsip_reply> next_report(int timeout_ms=TSIP_REQUEST_TIMEOUT_MS);
+
+		// wait for a report decoded after the call, report_bits as in
+		// tsip::report_bit(); false on timeout or stop
+		bool wait_for_next(int report_bits, tsip_reply &reply,
+				int timeout_ms=TSIP_REQUEST_TIMEOUT_MS);
+
+		// blocking requests, safe from any thread
+		time_t get_gps_time_utc(void);
+		bool get_xyz(tsip::xyz_t &xyz);
+		std::string get_serial_number(void);
+
+	private:
+		struct request_t {
+			_command_packet command;
+			bool reply;
+			int  timeout_ms;
+			std::shared_ptr<std::promise<tsip_reply> > promise;
+			callback_t callback;
+		};
+
+		// caller blocked in wait_for_next
+		struct next_t {
+			int bits;
+			unsigned long long since;	// tsip generation when the wait started
+			tsip_reply *reply;
+			bool done;
+		};
+
+		tsip m_gps;
+		std::mutex m_mutex;
+		std::deque<request_t> m_queue;
+		bool m_stop;
+		int  m_wakeup[2];			// pipe, wakes the worker from poll
+		std::vector<next_t *> m_next;	// guarded by m_mutex
+		std::condition_variable m_decoded;
+		std::atomic<unsigned long long> m_generation;	// of m_gps, published by the worker
+		std::atomic<int> m_waiting;		// m_next.size(), read without the lock
+
+		// worker thread only
+		int   m_fd;					// port, -1 when closed
+		UINT8 m_buffer[256];		// bytes read and not yet decoded
+		int   m_buffer_pos;
+		int   m_buffer_len;
+		std::thread m_worker;
+
+		void enqueue(const request_t &req);
+		void run(void);
+		void execute(request_t &req);
+		void complete(request_t &req, bool found);
+		bool decode(request_t *req);
+		void read_port(int timeout_ms);
+		void wake_next(void);
+};
+
+#endif
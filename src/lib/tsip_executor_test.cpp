@@ -0,0 +1,273 @@
+/*
+ * tsip_executor_test.cpp
+ *
+ * Test of the request executor on a pty, run by ctest.  A simulated
+ * receiver on the master side answers 8E-AB with an 8F-AB and 8E-AC
+ * with an 8F-AC, and never answers anything else.  A request for the
+ * manufacturing parameters must time out after its own timeout, then
+ * TEST_THREADS threads share one executor, half asking for the position
+ * and half for the time, and every reply must be found and hold the
+ * report the receiver sent.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "tsip.h"
+#include "tsip_executor.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define TEST_THREADS		4
+#define TEST_REQUESTS		25		// per thread
+#define TEST_TIMEOUT_MS		300
+#define TEST_LATITUDE		0.7		// radians
+#define TEST_ALTITUDE		1600
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL line %d: %s\n", __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+// big endian fields of a TSIP packet body
+static void put_be(std::vector<UINT8> &body, const void *value, int size) {
+	for (int i=size-1; i>=0; i--) {
+		body.push_back(((const UINT8 *)value)[i]);
+	}
+}
+
+// simulated receiver on the master side of the pty
+struct receiver_t {
+	int fd;
+	std::atomic<bool> stop;
+	std::atomic<int> answered;
+	std::atomic<int> ignored;
+};
+
+/** send packet
+*
+*   Write a packet body, framed and with its DLE bytes stuffed.
+*
+*   @return void
+*/
+static void send_packet(int fd, const std::vector<UINT8> &body) {
+	std::vector<UINT8> frame;
+
+	frame.push_back(0x10);
+	for (size_t i=0; i<body.size(); i++) {
+		frame.push_back(body[i]);
+		if (body[i] == 0x10) {
+			frame.push_back(0x10);
+		}
+	}
+	frame.push_back(0x10);
+	frame.push_back(0x03);
+	if (write(fd, &frame[0], frame.size()) != (ssize_t)frame.size()) {
+		perror("receiver write");
+	}
+}
+
+static void send_primary(int fd) {
+	std::vector<UINT8> b = {REPORT_SUPER, REPORT_SUPER_PRIMARY_TIME};
+	UINT32 seconds_of_week = 100000;
+	UINT16 week = 2300;
+	SINT16 offset = 18;
+	UINT16 year = 2026;
+
+	put_be(b, &seconds_of_week, 4);
+	put_be(b, &week, 2);
+	put_be(b, &offset, 2);
+	b.insert(b.end(), {3, 40, 30, 12, 19, 10});
+	put_be(b, &year, 2);
+	send_packet(fd, b);
+}
+
+static void send_secondary(int fd) {
+	std::vector<UINT8> b = {REPORT_SUPER, REPORT_SUPER_SECONDARY_TIME, 7, 0, 100};
+	UINT32 holdover = 0;
+	UINT32 dac = 0x8000;
+	float pps = 1.5f, tenMHz = -0.25f, voltage = 1.2f, temperature = 40.5f;
+	double latitude = TEST_LATITUDE, longitude = -1.8, altitude = TEST_ALTITUDE;
+
+	put_be(b, &holdover, 4);
+	b.insert(b.end(), 8, 0);			// alarms, decoding status, activity, spares
+	put_be(b, &pps, 4);
+	put_be(b, &tenMHz, 4);
+	put_be(b, &dac, 4);
+	put_be(b, &voltage, 4);
+	put_be(b, &temperature, 4);
+	put_be(b, &latitude, 8);
+	put_be(b, &longitude, 8);
+	put_be(b, &altitude, 8);
+	b.insert(b.end(), 8, 0);
+	send_packet(fd, b);
+}
+
+/** run receiver
+*
+*   Unframe the commands written to the pty and answer 8E-AB and 8E-AC.
+*
+*   @return void
+*/
+static void run_receiver(receiver_t *r) {
+	std::vector<UINT8> command;
+	bool dle = false, inside = false;
+	UINT8 buffer[256];
+	struct pollfd p;
+
+	p.fd = r->fd;
+	p.events = POLLIN;
+	while (!r->stop) {
+		if (poll(&p, 1, 50) <= 0) {
+			continue;
+		}
+		ssize_t len = read(r->fd, buffer, sizeof(buffer));
+		if (len <= 0) {
+			break;
+		}
+		for (ssize_t i=0; i<len; i++) {
+			UINT8 c = buffer[i];
+			if (dle) {
+				dle = false;
+				if (c == 0x03) {
+					inside = false;
+					if (command.size() == 2 && command[0] == COMMAND_SUPER_PACKET
+							&& command[1] == REPORT_SUPER_PRIMARY_TIME) {
+						send_primary(r->fd);
+						r->answered++;
+					} else if (command.size() == 2 && command[0] == COMMAND_SUPER_PACKET
+							&& command[1] == REPORT_SUPER_SECONDARY_TIME) {
+						send_secondary(r->fd);
+						r->answered++;
+					} else {
+						r->ignored++;
+					}
+					continue;
+				}
+				if (c != 0x10) {
+					inside = true;		// start of a packet
+					command.clear();
+				}
+				command.push_back(c);
+			} else if (c == 0x10) {
+				dle = true;
+			} else if (inside) {
+				command.push_back(c);
+			}
+		}
+	}
+}
+
+/** check timeout
+*
+*   A request nobody answers completes with found false after its
+*   timeout, and the executor still answers afterwards.
+*
+*   @return void
+*/
+static void check_timeout(tsip_executor &gps) {
+	_command_packet cmd;
+
+	cmd.extended.code = COMMAND_SUPER_PACKET;
+	cmd.extended.subcode = COMMAND_MANUFACTURING_PARAMS;
+	cmd.extended.cmd_len = 2;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	tsip_reply reply = gps.submit(cmd, true, TEST_TIMEOUT_MS).get();
+	long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start).count();
+	CHECK(!reply.found);
+	CHECK(elapsed >= TEST_TIMEOUT_MS && elapsed < 10 * TEST_TIMEOUT_MS);
+
+	tsip::xyz_t xyz;
+	CHECK(gps.get_xyz(xyz));
+}
+
+/** check concurrent
+*
+*   Threads alternating position and time requests on one executor.
+*
+*   @return void
+*/
+static void check_concurrent(tsip_executor &gps) {
+	struct tm date = {};
+	std::vector<std::thread> threads;
+	std::atomic<int> wrong(0);
+
+	date.tm_year = 2026 - 1900;
+	date.tm_mon = 10 - 1;
+	date.tm_mday = 19;
+	date.tm_hour = 12;
+	date.tm_min = 30;
+	date.tm_sec = 40;
+	time_t expected = timegm(&date);
+
+	for (int t=0; t<TEST_THREADS; t++) {
+		threads.push_back(std::thread([&gps, &wrong, expected, t]() {
+			for (int i=0; i<TEST_REQUESTS; i++) {
+				if (t % 2 == 0) {
+					tsip::xyz_t xyz;
+					if (!gps.get_xyz(xyz) || xyz.latitude != TEST_LATITUDE * 180 / M_PI
+							|| xyz.altitude != TEST_ALTITUDE) {
+						wrong++;
+					}
+				} else if (gps.get_gps_time_utc() != expected) {
+					wrong++;
+				}
+			}
+		}));
+	}
+	for (size_t t=0; t<threads.size(); t++) {
+		threads[t].join();
+	}
+	CHECK(wrong == 0);
+}
+
+int main() {
+	receiver_t receiver;
+
+	receiver.fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (receiver.fd < 0 || grantpt(receiver.fd) < 0 || unlockpt(receiver.fd) < 0) {
+		perror("posix_openpt");
+		return 1;
+	}
+	receiver.stop = false;
+	receiver.answered = 0;
+	receiver.ignored = 0;
+	std::thread simulator(run_receiver, &receiver);
+	{
+		tsip_executor gps(ptsname(receiver.fd), false);
+		CHECK(gps.is_open());
+		check_timeout(gps);
+		check_concurrent(gps);
+	}
+	receiver.stop = true;
+	simulator.join();
+	close(receiver.fd);
+
+	// the position of check_timeout, then one request per call
+	CHECK(receiver.answered == 1 + TEST_THREADS * TEST_REQUESTS);
+	// the 8E-41, and the 8E-A2 sent before each time request
+	CHECK(receiver.ignored == 1 + TEST_THREADS / 2 * TEST_REQUESTS);
+	printf("executor: %d failures\n", failures);
+	return failures == 0 ? 0 : 1;
+}
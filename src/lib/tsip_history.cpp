@@ -0,0 +1,286 @@
+/**
+ *	@file tsip_history.cpp
+ * 	@brief bounded histories of the timing reports
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	gps.keep_history(REPORT_SUPER, REPORT_SUPER_SECONDARY_TIME, 3600);
+ * 	...
+ * 	const secondary_time_history *h = gps.get_secondary_history();
+ * 	const std::vector<SINGLE> &temp = h->columns().temperature;
+ * 	history_ring::span_t span[2];
+ * 	size_t first, count;
+ * 	double sum = 0;
+ *
+ * 	h->range(h->time(h->size()-1) - 3600, h->time(h->size()-1), first, count);
+ * 	for (int s=0; s<h->spans(first, count, span); s++) {
+ * 		for (size_t k=span[s].begin; k<span[s].begin+span[s].count; k++) {
+ * 			sum += temp[k];
+ * 		}
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "tsip_history.h"
+
+/** Constructor.
+*
+*   All the slots are allocated here, recording never allocates.
+*
+* 	@param size_t   entries kept, at least 1
+*/
+history_ring::history_ring(size_t capacity) {
+	m_time.resize(capacity > 0 ? capacity : 1);
+	m_head = 0;
+	m_size = 0;
+}
+
+/** capacity
+*
+*   @return size_t  entries kept
+*/
+size_t history_ring::capacity() const {
+	return m_time.size();
+}
+
+/** size
+*
+*   @return size_t  entries recorded, up to the capacity
+*/
+size_t history_ring::size() const {
+	return m_size;
+}
+
+/** clear
+*
+*   @return void
+*/
+void history_ring::clear() {
+	m_head = 0;
+	m_size = 0;
+}
+
+/** slot
+*
+*   @param size_t  entry, 0 - oldest, size()-1 - newest
+*   @return size_t index of the entry in every column
+*/
+size_t history_ring::slot(size_t i) const {
+	size_t s = m_head + i;
+	return (s < m_time.size()) ? s : s - m_time.size();
+}
+
+/** time
+*
+*   @param size_t     entry, 0 - oldest
+*   @return long long GPS seconds of the entry
+*/
+long long history_ring::time(size_t i) const {
+	return m_time[slot(i)];
+}
+
+/** lower bound
+*
+*   Binary search of the time keys.
+*
+*   @param long long  GPS seconds
+*   @return size_t    first entry at or after the time, size() if none
+*/
+size_t history_ring::lower_bound(long long time) const {
+	size_t low = 0;
+	size_t high = m_size;
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (m_time[slot(mid)] < time) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+/** range
+*
+*   Entries with from <= time <= to.
+*
+*   @param long long  GPS seconds, first time
+*   @param long long  GPS seconds, last time
+*   @param size_t&    first entry
+*   @param size_t&    entries in the range
+*   @return bool      true - the range is not empty
+*/
+bool history_ring::range(long long from, long long to, size_t &first, size_t &count) const {
+	first = lower_bound(from);
+	size_t end = (to < from) ? first : lower_bound(to + 1);
+	count = end - first;
+	return count > 0;
+}
+
+/** spans
+*
+*   Slots of a run of entries.  The run is split in two where the ring
+*   wraps.
+*
+*   @param size_t   first entry
+*   @param size_t   entries
+*   @param span_t[] filled with up to two runs of slots
+*   @return int     runs filled
+*/
+int history_ring::spans(size_t first, size_t count, span_t span[2]) const {
+	if (count == 0 || first >= m_size) {
+		return 0;
+	}
+	if (count > m_size - first) {
+		count = m_size - first;
+	}
+	size_t begin = slot(first);
+	span[0].begin = begin;
+	if (begin + count <= m_time.size()) {
+		span[0].count = count;
+		return 1;
+	}
+	span[0].count = m_time.size() - begin;
+	span[1].begin = 0;
+	span[1].count = count - span[0].count;
+	return 2;
+}
+
+/** gps seconds
+*
+*   @param _primary_time&  8F-AB report
+*   @return long long      seconds since the GPS epoch
+*/
+long long history_ring::gps_seconds(const struct _primary_time &time) {
+	return (long long)time.report.week_number * GPS_SECONDS_PER_WEEK
+			+ time.report.seconds_of_week;
+}
+
+/** push
+*
+*   Take the slot of a new entry, the oldest one once the ring is full.
+*   A time before the newest entry means the receiver time was reset,
+*   the history is restarted so the keys stay ordered.
+*
+*   @param long long  GPS seconds of the entry
+*   @return size_t    slot to fill
+*/
+size_t history_ring::push(long long time) {
+	size_t s;
+
+	if (m_size > 0 && time < m_time[slot(m_size - 1)]) {
+		clear();
+	}
+	if (m_size < m_time.size()) {
+		s = slot(m_size);
+		m_size++;
+	} else {
+		s = m_head;
+		m_head = slot(1);
+	}
+	m_time[s] = time;
+	return s;
+}
+
+/** Constructor.
+*
+* 	@param size_t   entries kept
+*/
+primary_time_history::primary_time_history(size_t capacity) : history_ring(capacity) {
+	size_t n = history_ring::capacity();
+
+	m_columns.seconds_of_week.resize(n);
+	m_columns.week_number.resize(n);
+	m_columns.utc_offset.resize(n);
+	m_columns.flags.resize(n);
+}
+
+/** record
+*
+*   @param long long       GPS seconds
+*   @param _primary_time&  8F-AB report
+*   @return void
+*/
+void primary_time_history::record(long long time, const struct _primary_time &report) {
+	size_t s = push(time);
+
+	m_columns.seconds_of_week[s] = report.report.seconds_of_week;
+	m_columns.week_number[s] = report.report.week_number;
+	m_columns.utc_offset[s] = report.report.utc_offset;
+	m_columns.flags[s] = report.report.flags.value;
+}
+
+/** columns
+*
+*   @return columns_t&  one array per field, indexed by slot
+*/
+const primary_time_history::columns_t &primary_time_history::columns() const {
+	return m_columns;
+}
+
+/** Constructor.
+*
+* 	@param size_t   entries kept
+*/
+secondary_time_history::secondary_time_history(size_t capacity) : history_ring(capacity) {
+	size_t n = history_ring::capacity();
+
+	m_columns.receiver_mode.resize(n);
+	m_columns.disciplining_mode.resize(n);
+	m_columns.self_survey_progress.resize(n);
+	m_columns.holdover_duration.resize(n);
+	m_columns.critical_alarms.resize(n);
+	m_columns.minor_alarms.resize(n);
+	m_columns.gps_decoding_status.resize(n);
+	m_columns.disciplining_activity.resize(n);
+	m_columns.pps_offset.resize(n);
+	m_columns.tenMHz_offset.resize(n);
+	m_columns.dac_value.resize(n);
+	m_columns.dac_voltage.resize(n);
+	m_columns.temperature.resize(n);
+	m_columns.latitude.resize(n);
+	m_columns.longitude.resize(n);
+	m_columns.altitude.resize(n);
+}
+
+/** record
+*
+*   @param long long         GPS seconds
+*   @param _secondary_time&  8F-AC report
+*   @return void
+*/
+void secondary_time_history::record(long long time, const struct _secondary_time &report) {
+	size_t s = push(time);
+
+	m_columns.receiver_mode[s] = report.report.receiver_mode;
+	m_columns.disciplining_mode[s] = report.report.disciplining_mode;
+	m_columns.self_survey_progress[s] = report.report.self_survey_progress;
+	m_columns.holdover_duration[s] = report.report.holdover_duration;
+	m_columns.critical_alarms[s] = report.report.critical_alarms.value;
+	m_columns.minor_alarms[s] = report.report.minor_alarms.value;
+	m_columns.gps_decoding_status[s] = report.report.gps_decoding_status;
+	m_columns.disciplining_activity[s] = report.report.disciplining_activity;
+	m_columns.pps_offset[s] = report.report.pps_offset;
+	m_columns.tenMHz_offset[s] = report.report.tenMHz_offset;
+	m_columns.dac_value[s] = report.report.dac_value;
+	m_columns.dac_voltage[s] = report.report.dac_voltage;
+	m_columns.temperature[s] = report.report.temperature;
+	m_columns.latitude[s] = report.report.latitude;
+	m_columns.longitude[s] = report.report.longitude;
+	m_columns.altitude[s] = report.report.altitude;
+}
+
+/** columns
+*
+*   @return columns_t&  one array per field, indexed by slot
+*/
+const secondary_time_history::columns_t &secondary_time_history::columns() const {
+	return m_columns;
+}
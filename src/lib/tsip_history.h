@@ -0,0 +1,121 @@
+/*
+  tsip_history.h - bounded histories of the timing reports.
+
+  A tsip object keeps only the last report of each type.  A history
+  keeps the last N reports of one type in a ring allocated once, so
+  questions like "temperature over the last hour" are answered from
+  memory, without an external store:
+
+    gps.keep_history(REPORT_SUPER, REPORT_SUPER_SECONDARY_TIME, 3600);
+    ...
+    const secondary_time_history *h = gps.get_secondary_history();
+    size_t first, count;
+    h->range(from, to, first, count);
+
+  Every entry is keyed by GPS time, week_number * 604800 +
+  seconds_of_week, taken from 8F-AB.  8F-AC has no time of its own and
+  is keyed by the 8F-AB received before it, the receiver sends the two
+  back to back each second.  Keys only grow, range() is a binary search.
+
+  The fields are kept as a structure of arrays (columns()), one array
+  per field, so a scan over one field reads only that field.  An entry
+  is at slot(i) of every array, i = 0 for the oldest; spans() splits a
+  run of entries into at most two runs of consecutive slots.
+
+  The histories belong to the tsip object and follow its threading
+  rule: read them from the thread that decodes the reports.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _tsip_history_h
+#define _tsip_history_h
+
+#include <tsip.h>
+#include <vector>
+
+#define GPS_SECONDS_PER_WEEK		604800
+
+// ring bookkeeping and time keys, shared by the report histories
+class history_ring {
+	public:
+		// run of consecutive slots
+		struct span_t {
+			size_t begin;
+			size_t count;
+		};
+
+		history_ring(size_t capacity);
+		size_t capacity(void) const;
+		size_t size(void) const;
+		void clear(void);
+		size_t slot(size_t i) const;			// slot of the i-th oldest entry
+		long long time(size_t i) const;			// GPS seconds of the i-th oldest entry
+		size_t lower_bound(long long time) const;	// first entry at or after time
+		bool range(long long from, long long to, size_t &first, size_t &count) const;
+		int spans(size_t first, size_t count, span_t span[2]) const;
+
+		static long long gps_seconds(const struct _primary_time &time);
+
+	protected:
+		size_t push(long long time);			// slot of the new entry
+
+	private:
+		std::vector<long long> m_time;
+		size_t m_head;							// slot of the oldest entry
+		size_t m_size;
+};
+
+// 8F-AB history
+class primary_time_history : public history_ring {
+	public:
+		struct columns_t {
+			std::vector<UINT32> seconds_of_week;
+			std::vector<UINT16> week_number;
+			std::vector<SINT16> utc_offset;
+			std::vector<UINT8>  flags;
+		};
+
+		primary_time_history(size_t capacity=HISTORY_DEFAULT_CAPACITY);
+		void record(long long time, const struct _primary_time &report);
+		const columns_t &columns(void) const;
+
+	private:
+		columns_t m_columns;
+};
+
+// 8F-AC history
+class secondary_time_history : public history_ring {
+	public:
+		struct columns_t {
+			std::vector<UINT8>  receiver_mode;
+			std::vector<UINT8>  disciplining_mode;
+			std::vector<UINT8>  self_survey_progress;
+			std::vector<UINT32> holdover_duration;
+			std::vector<UINT16> critical_alarms;
+			std::vector<UINT16> minor_alarms;
+			std::vector<UINT8>  gps_decoding_status;
+			std::vector<UINT8>  disciplining_activity;
+			std::vector<SINGLE> pps_offset;
+			std::vector<SINGLE> tenMHz_offset;
+			std::vector<UINT32> dac_value;
+			std::vector<SINGLE> dac_voltage;
+			std::vector<SINGLE> temperature;
+			std::vector<DOUBLE> latitude;
+			std::vector<DOUBLE> longitude;
+			std::vector<DOUBLE> altitude;
+		};
+
+		secondary_time_history(size_t capacity=HISTORY_DEFAULT_CAPACITY);
+		void record(long long time, const struct _secondary_time &report);
+		const columns_t &columns(void) const;
+
+	private:
+		columns_t m_columns;
+};
+
+#endif
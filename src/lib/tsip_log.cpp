@@ -0,0 +1,559 @@
+/**
+ *	@file tsip_log.cpp
+ * 	@brief asynchronous logging of the decoder messages
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	int fd = open("/var/log/gps.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
+ *
+ * 	log_set_output(fd, true);
+ * 	log_set_level(TSIP_LOG_WARNING);
+ * 	TSIP_LOG(TSIP_LOG_WARNING, "%s: no reply to %x\n", port, code);
+ * 	...
+ * 	log_flush();
+ * @endcode
+ *
+ */
+
+#include "tsip_log.h"
+#include <cerrno>
+#include <cstdio>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+/** Constructor.
+*
+*   All the records are allocated here, logging never allocates.
+*/
+log_ring::log_ring() : owned(false), m_tail(0), m_head(0), m_dropped(0) {
+	m_records.resize(LOG_RING_RECORDS);
+}
+
+/** reserve
+*
+*   @return log_record_t*  record to fill, NULL - the ring is full
+*/
+log_record_t *log_ring::reserve() {
+	size_t tail = m_tail.load(std::memory_order_relaxed);
+
+	if (tail - m_head.load(std::memory_order_acquire) == LOG_RING_RECORDS) {
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+	return &m_records[tail & (LOG_RING_RECORDS - 1)];
+}
+
+/** commit
+*
+*   Publish the record reserved to the logger thread.
+*
+*   @return void
+*/
+void log_ring::commit() {
+	m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/** peek
+*
+*   @return log_record_t*  oldest record not written, NULL - none
+*/
+const log_record_t *log_ring::peek() {
+	size_t head = m_head.load(std::memory_order_relaxed);
+
+	if (head == m_tail.load(std::memory_order_acquire)) {
+		return NULL;
+	}
+	return &m_records[head & (LOG_RING_RECORDS - 1)];
+}
+
+/** release
+*
+*   The record peeked is written, its slot may be reused.
+*
+*   @return void
+*/
+void log_ring::release() {
+	m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/** get dropped
+*
+*   @return unsigned long long  records that found the ring full
+*/
+unsigned long long log_ring::get_dropped() {
+	return m_dropped.load(std::memory_order_relaxed);
+}
+
+// the rings and the logger thread, shared by the process
+struct log_backend {
+	std::mutex mutex;
+	std::condition_variable wakeup;		// the logger, on log_flush
+	std::condition_variable written;	// log_flush, a pass is done
+	std::vector<log_ring *> rings;		// never freed, reused once released
+	std::thread thread;
+	bool started;
+	bool stopping;
+	std::atomic<bool> synchronous;		// the logger has stopped, messages are written at once
+	unsigned long long flush_requested;
+	unsigned long long flush_done;
+	unsigned long long dropped;			// reported so far
+	std::atomic<int> level;
+	std::atomic<int> fd;
+	std::atomic<bool> stamp;
+};
+
+/** backend
+*
+*   Created on first use and never destroyed, so a message logged by
+*   a static destructor still finds it.
+*
+*   @return log_backend&
+*/
+static log_backend &backend() {
+	static log_backend *b = NULL;
+	static std::once_flag once;
+
+	std::call_once(once, []() {
+		b = new log_backend();
+		b->started = false;
+		b->stopping = false;
+		b->synchronous = false;
+		b->flush_requested = 0;
+		b->flush_done = 0;
+		b->dropped = 0;
+		b->level = TSIP_LOG_DEBUG;
+		b->fd = STDOUT_FILENO;
+		b->stamp = false;
+	});
+	return *b;
+}
+
+/** write all
+*
+*   @return void
+*/
+static void write_all(int fd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+/** format arg
+*
+*   Format one argument by a conversion of the format, the length
+*   modifier of the format is replaced by the one of the value stored.
+*
+*   @param char*         output
+*   @param size_t        room left
+*   @param string        conversion, '%' to the flags, width and precision
+*   @param char          conversion character
+*   @param log_record_t  record of the argument
+*   @param int           argument index
+*   @return int          characters written, as snprintf
+*/
+static int format_arg(char *out, size_t size, std::string &spec, char conversion,
+		const log_record_t &r, int k) {
+	const log_record_t::arg_t &a = r.args[k];
+	int type = r.types[k];
+
+	if (type == log_record_t::ARG_BYTES) {
+		int n = 0;
+		for (int i=0; i<a.text.length && (size_t)n < size; i++) {
+			n += snprintf(out + n, size - n, " %x", (UINT8)r.text[a.text.offset + i]);
+		}
+		if (a.text.full > a.text.length && (size_t)n < size) {
+			n += snprintf(out + n, size - n, " ...");
+		}
+		return n;
+	}
+	switch (conversion) {
+		case 'd': case 'i': {
+			long long v = type == log_record_t::ARG_DOUBLE ? (long long)a.d : a.i;
+			return snprintf(out, size, (spec + "ll" + conversion).c_str(), v);
+		}
+		case 'u': case 'x': case 'X': case 'o': {
+			unsigned long long v = type == log_record_t::ARG_DOUBLE ? (unsigned long long)a.d : a.u;
+			return snprintf(out, size, (spec + "ll" + conversion).c_str(), v);
+		}
+		case 'c':
+			return snprintf(out, size, (spec + conversion).c_str(), (int)a.i);
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+			double v = type == log_record_t::ARG_DOUBLE ? a.d
+					: type == log_record_t::ARG_INT ? (double)a.i : (double)a.u;
+			return snprintf(out, size, (spec + conversion).c_str(), v);
+		}
+		case 's':
+			if (type == log_record_t::ARG_TEXT) {
+				std::string text(r.text + a.text.offset, a.text.length);
+				return snprintf(out, size, (spec + 's').c_str(), text.c_str());
+			}
+			return snprintf(out, size, (spec + 's').c_str(), "(not a string)");
+		default:
+			return snprintf(out, size, "%p", a.p);
+	}
+}
+
+/** format record
+*
+*   @param log_record_t  record
+*   @param bool          stamp - time and level first
+*   @param char*         output
+*   @param size_t        size of output
+*   @return size_t       characters written, cut at size - 1
+*/
+static size_t format_record(const log_record_t &r, bool stamp, char *out, size_t size) {
+	static const char *levels[] = {"error", "warning", "info", "debug"};
+	size_t n = 0;
+	int k = 0;
+
+	if (stamp) {
+		time_t sec = r.time / 1000000000ULL;
+		struct tm tm;
+		gmtime_r(&sec, &tm);
+		n += snprintf(out, size, "%02d:%02d:%02d.%06llu %s: ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+				(r.time % 1000000000ULL) / 1000, levels[r.level & 3]);
+	}
+	for (const char *f = r.format; *f != '\0' && n < size - 1; f++) {
+		if (*f != '%') {
+			out[n++] = *f;
+			continue;
+		}
+		if (f[1] == '%') {
+			out[n++] = '%';
+			f++;
+			continue;
+		}
+		// flags, width and precision kept, length modifiers dropped
+		std::string spec("%");
+		const char *c = f + 1;
+		while (*c != '\0' && strchr("-+ #0123456789.", *c) != NULL) {
+			spec += *c++;
+		}
+		while (*c != '\0' && strchr("hlLqjzt", *c) != NULL) {
+			c++;
+		}
+		if (*c == '\0') {
+			break;
+		}
+		if (k < r.count) {
+			int w = format_arg(out + n, size - n, spec, *c, r, k++);
+			if (w > 0) {
+				n = std::min(n + w, size - 1);
+			}
+		} else {
+			for (const char *s = f; s <= c && n < size - 1; s++) {
+				out[n++] = *s;
+			}
+		}
+		f = c;
+	}
+	out[n] = '\0';
+	return n;
+}
+
+/** write records
+*
+*   Write the records of all the rings in time order, and the count of
+*   the records dropped since the last time.  Called by one thread at a
+*   time, the logger or, once it stopped, the thread logging.
+*
+*   @param log_backend*   backend
+*   @param std::vector&   rings to write
+*   @param char*          buffer of LOG_WRITE_BUFFER bytes
+*   @return void
+*/
+static void write_records(log_backend *b, const std::vector<log_ring *> &rings, char *buffer) {
+	int fd = b->fd;
+	bool stamp = b->stamp;
+	size_t used = 0;
+	unsigned long long dropped = 0;
+
+	// what was printed before goes first
+	if (fd == STDOUT_FILENO) {
+		fflush(stdout);
+	}
+	for (;;) {
+		log_ring *oldest = NULL;
+		const log_record_t *record = NULL;
+		for (size_t i=0; i<rings.size(); i++) {
+			const log_record_t *r = rings[i]->peek();
+			if (r != NULL && (record == NULL || r->time < record->time)) {
+				record = r;
+				oldest = rings[i];
+			}
+		}
+		if (record == NULL) {
+			break;
+		}
+		// room for a message of LOG_WRITE_BUFFER / 4
+		if (used > LOG_WRITE_BUFFER - LOG_WRITE_BUFFER / 4) {
+			write_all(fd, buffer, used);
+			used = 0;
+		}
+		used += format_record(*record, stamp, &buffer[used], LOG_WRITE_BUFFER - used);
+		oldest->release();
+	}
+	if (used > 0) {
+		write_all(fd, buffer, used);
+	}
+	for (size_t i=0; i<rings.size(); i++) {
+		dropped += rings[i]->get_dropped();
+	}
+	if (dropped > b->dropped) {
+		used = snprintf(buffer, LOG_WRITE_BUFFER, "%llu log messages dropped\n", dropped - b->dropped);
+		write_all(fd, buffer, used);
+		b->dropped = dropped;
+	}
+}
+
+/** run
+*
+*   Logger thread: every LOG_WRITE_INTERVAL_MS, or at once on
+*   log_flush, write the records of all the rings in time order.
+*
+*   @return void
+*/
+static void run(log_backend *b) {
+	std::vector<char> buffer(LOG_WRITE_BUFFER);
+	std::vector<log_ring *> rings;
+	std::unique_lock<std::mutex> lock(b->mutex);
+
+	for (;;) {
+		unsigned long long ticket = b->flush_requested;
+		bool stopping = b->stopping;
+		rings = b->rings;
+		lock.unlock();
+
+		write_records(b, rings, &buffer[0]);
+
+		lock.lock();
+		b->flush_done = ticket;
+		b->written.notify_all();
+		if (stopping) {
+			return;
+		}
+		if (b->flush_requested == ticket) {
+			b->wakeup.wait_for(lock, std::chrono::milliseconds(LOG_WRITE_INTERVAL_MS));
+		}
+	}
+}
+
+/** stop
+*
+*   Write what is left at exit and stop the logger thread.
+*
+*   @return void
+*/
+static void stop() {
+	log_backend &b = backend();
+	std::unique_lock<std::mutex> lock(b.mutex);
+
+	if (!b.started || b.stopping) {
+		return;
+	}
+	b.stopping = true;
+	b.flush_requested++;
+	b.wakeup.notify_all();
+	lock.unlock();
+	b.thread.join();
+
+	// static destructors run after this, their messages are written by
+	// log_commit; first what was logged since the last pass
+	char buffer[LOG_WRITE_BUFFER];
+	lock.lock();
+	b.synchronous.store(true, std::memory_order_release);
+	write_records(&b, b.rings, buffer);
+}
+
+// holds the ring of a thread, releases it when the thread exits
+struct log_thread_holder {
+	log_ring *ring;
+
+	log_thread_holder() {
+		log_backend &b = backend();
+		std::lock_guard<std::mutex> lock(b.mutex);
+
+		ring = NULL;
+		for (size_t i=0; i<b.rings.size(); i++) {
+			if (!b.rings[i]->owned && b.rings[i]->peek() == NULL) {
+				ring = b.rings[i];
+				break;
+			}
+		}
+		if (ring == NULL) {
+			ring = new log_ring();
+			b.rings.push_back(ring);
+		}
+		ring->owned = true;
+		if (!b.started && !b.stopping) {
+			b.started = true;
+			b.thread = std::thread(run, &b);
+			atexit(stop);
+		}
+	}
+
+	~log_thread_holder() {
+		ring->owned = false;
+	}
+};
+
+/** log thread ring
+*
+*   The ring of the calling thread, taken on its first message.
+*
+*   @return log_ring*
+*/
+log_ring *log_thread_ring() {
+	static thread_local log_thread_holder holder;
+
+	return holder.ring;
+}
+
+/** log commit
+*
+*   Publish the record reserved in the ring of the calling thread; it
+*   is written at once when the logger thread has stopped, at exit.
+*
+*   @param log_ring*  ring of the calling thread
+*   @return void
+*/
+void log_commit(log_ring *ring) {
+	ring->commit();
+	if (!backend().synchronous.load(std::memory_order_acquire)) {
+		return;
+	}
+	log_backend &b = backend();
+	char buffer[LOG_WRITE_BUFFER];
+	std::lock_guard<std::mutex> lock(b.mutex);
+	write_records(&b, b.rings, buffer);
+}
+
+/** log now
+*
+*   @return unsigned long long  host clock (CLOCK_REALTIME), ns
+*/
+unsigned long long log_now() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/** log enabled
+*
+*   @param int   level
+*   @return bool false - filtered by log_set_level
+*/
+bool log_enabled(int level) {
+	return level <= backend().level.load(std::memory_order_relaxed);
+}
+
+/** log set level
+*
+*   @param int  highest level written, TSIP_LOG_ERROR to TSIP_LOG_DEBUG
+*   @return void
+*/
+void log_set_level(int level) {
+	backend().level = level;
+}
+
+/** log set output
+*
+*   The messages already logged may still go to the previous output,
+*   flush first.
+*
+*   @param int   file descriptor written, not closed
+*   @param bool  write the time and level before each message
+*   @return void
+*/
+void log_set_output(int fd, bool stamp) {
+	backend().fd = fd;
+	backend().stamp = stamp;
+}
+
+/** log flush
+*
+*   Wait until the logger thread has written the messages logged so
+*   far, by any thread.
+*
+*   @return void
+*/
+void log_flush() {
+	log_backend &b = backend();
+	std::unique_lock<std::mutex> lock(b.mutex);
+
+	if (!b.started || b.stopping) {
+		return;
+	}
+	unsigned long long ticket = ++b.flush_requested;
+	b.wakeup.notify_all();
+	b.written.wait(lock, [&b, ticket]() { return b.flush_done >= ticket; });
+}
+
+/** log get dropped
+*
+*   @return unsigned long long  messages that found their ring full
+*/
+unsigned long long log_get_dropped() {
+	log_backend &b = backend();
+	std::lock_guard<std::mutex> lock(b.mutex);
+	unsigned long long dropped = 0;
+
+	for (size_t i=0; i<b.rings.size(); i++) {
+		dropped += b.rings[i]->get_dropped();
+	}
+	return dropped;
+}
+
+/** log put text
+*
+*   Copy a string argument into the record, cut to the room left.
+*
+*   @return void
+*/
+void log_put_text(log_record_t &r, const char *s) {
+	size_t len = s != NULL ? strlen(s) : 0;
+	size_t room = LOG_TEXT_MAX - r.text_used;
+	log_record_t::arg_t &a = r.args[r.count];
+
+	a.text.offset = r.text_used;
+	a.text.full = std::min(len, (size_t)0xffff);
+	a.text.length = std::min(len, room);
+	memcpy(r.text + r.text_used, s, a.text.length);
+	r.text_used += a.text.length;
+	r.types[r.count++] = log_record_t::ARG_TEXT;
+}
+
+/** log put bytes
+*
+*   Copy a byte argument into the record, cut to the room left.
+*
+*   @return void
+*/
+void log_put_bytes(log_record_t &r, const log_bytes &b) {
+	size_t len = b.length > 0 ? b.length : 0;
+	size_t room = LOG_TEXT_MAX - r.text_used;
+	log_record_t::arg_t &a = r.args[r.count];
+
+	a.text.offset = r.text_used;
+	a.text.full = std::min(len, (size_t)0xffff);
+	a.text.length = std::min(len, room);
+	memcpy(r.text + r.text_used, b.data, a.text.length);
+	r.text_used += a.text.length;
+	r.types[r.count++] = log_record_t::ARG_BYTES;
+}
@@ -0,0 +1,194 @@
+/*
+  tsip_log.h - asynchronous logging of the decoder messages.
+
+  A message is not formatted where it is logged.  TSIP_LOG stores the
+  address of its format, the host time and the arguments, as binary
+  values, in a record of a ring owned by the calling thread; a logger
+  thread takes the records of all the rings in time order, formats
+  them and writes them in batches.  Logging costs a clock read and a
+  few stores, the decoder never waits on a terminal or a disk:
+
+    TSIP_LOG(TSIP_LOG_INFO, "report %x-%x dropped, %d bytes\n", code, subcode, len);
+    TSIP_LOG(TSIP_LOG_DEBUG, "report buffer:%s\n", log_bytes(data, len));
+
+  The format is a printf format and must be a string literal, only its
+  address is kept.  Integers, floating point values, pointers,
+  strings and log_bytes are taken; strings and bytes are copied into
+  the record, up to LOG_TEXT_MAX bytes in all, so they may change once
+  TSIP_LOG returns.  A record finding its ring full is dropped and
+  counted, the logger reports the count.
+
+  Messages above TSIP_LOG_LEVEL are compiled out, arguments included;
+  build with -DTSIP_LOG_LEVEL=1 to keep only the errors and warnings.
+  log_set_level() filters further at run time.  The logger thread is
+  started by the first message and writes to standard output until
+  log_set_output() is called; log_flush() waits until everything
+  logged so far is written, and is done at exit.  Messages logged
+  after that, by static destructors, are written at once.
+
+  The logger flushes stdout before writing to it, so text printed
+  before a pass comes first; text printed after a message may come
+  before it, call log_flush() before printing to keep the order.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _tsip_log_h
+#define _tsip_log_h
+
+#include <tsip.h>
+#include <atomic>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#define TSIP_LOG_ERROR			0
+#define TSIP_LOG_WARNING		1
+#define TSIP_LOG_INFO			2
+#define TSIP_LOG_DEBUG			3
+
+#ifndef TSIP_LOG_LEVEL
+#define TSIP_LOG_LEVEL			TSIP_LOG_DEBUG	// highest level compiled in
+#endif
+
+#define LOG_RING_RECORDS		1024	// records per thread, a power of two
+#define LOG_ARGS_MAX			8		// arguments kept per message
+#define LOG_TEXT_MAX			64		// string and byte arguments, bytes per message
+#define LOG_WRITE_INTERVAL_MS	50		// logger wakes up to write
+#define LOG_WRITE_BUFFER		8192	// bytes formatted per write
+
+// a message of level, printf format and arguments
+#define TSIP_LOG(level, ...) \
+	do { \
+		if ((level) <= TSIP_LOG_LEVEL) { \
+			log_message((level), __VA_ARGS__); \
+		} \
+	} while (0)
+
+// argument written as " %x" per byte, at most LOG_TEXT_MAX bytes
+struct log_bytes {
+	log_bytes(const void *d, int len) : data((const UINT8 *)d), length(len) {}
+	const UINT8 *data;
+	int length;
+};
+
+// one message, as stored by the thread that logged it
+struct log_record_t {
+	enum arg_type { ARG_INT, ARG_UINT, ARG_DOUBLE, ARG_POINTER, ARG_TEXT, ARG_BYTES };
+	union arg_t {
+		long long i;
+		unsigned long long u;
+		double d;
+		const void *p;
+		struct {
+			UINT16 offset;				// in text
+			UINT16 length;				// copied
+			UINT16 full;				// given, a longer one is cut
+		} text;
+	};
+
+	const char *format;
+	unsigned long long time;			// host clock (CLOCK_REALTIME), ns
+	UINT8 level;
+	UINT8 count;						// arguments
+	UINT16 text_used;
+	UINT8 types[LOG_ARGS_MAX];			// arg_type
+	arg_t args[LOG_ARGS_MAX];
+	char text[LOG_TEXT_MAX];
+};
+
+// records of one thread, it logs, the logger thread writes
+class log_ring {
+	public:
+		log_ring(void);
+		log_record_t *reserve(void);	// NULL - full, counted as dropped
+		void commit(void);
+		const log_record_t *peek(void);	// oldest record, NULL - none
+		void release(void);
+		unsigned long long get_dropped(void);
+
+		std::atomic<bool> owned;		// a thread logs into the ring
+
+	private:
+		std::vector<log_record_t> m_records;
+		alignas(64) std::atomic<size_t> m_tail;	// next record to commit
+		alignas(64) std::atomic<size_t> m_head;	// next record to write
+		std::atomic<unsigned long long> m_dropped;
+};
+
+log_ring *log_thread_ring(void);		// the calling thread's, NULL - none
+void log_commit(log_ring *ring);		// commit, and write at once after exit
+unsigned long long log_now(void);
+bool log_enabled(int level);			// level set by log_set_level
+
+void log_set_level(int level);			// messages above it are dropped, default all
+void log_set_output(int fd, bool stamp=false);	// stamp - time and level before each message
+void log_flush(void);					// wait until the messages logged are written
+unsigned long long log_get_dropped(void);	// all threads, since start
+
+void log_put_text(log_record_t &r, const char *s);
+void log_put_bytes(log_record_t &r, const log_bytes &b);
+
+/** log put
+*
+*   Store one argument in the record, by its type.
+*/
+template <typename T>
+inline void log_put(log_record_t &r, const T &v) {
+	if (r.count == LOG_ARGS_MAX) {
+		return;
+	}
+	if constexpr (std::is_same<T, log_bytes>::value) {
+		log_put_bytes(r, v);
+	} else if constexpr (std::is_same<T, std::string>::value) {
+		log_put_text(r, v.c_str());
+	} else if constexpr (std::is_convertible<T, const char *>::value) {
+		log_put_text(r, v);
+	} else if constexpr (std::is_floating_point<T>::value) {
+		r.types[r.count] = log_record_t::ARG_DOUBLE;
+		r.args[r.count++].d = v;
+	} else if constexpr (std::is_enum<T>::value || std::is_signed<T>::value) {
+		r.types[r.count] = log_record_t::ARG_INT;
+		r.args[r.count++].i = (long long)v;
+	} else if constexpr (std::is_integral<T>::value) {
+		r.types[r.count] = log_record_t::ARG_UINT;
+		r.args[r.count++].u = (unsigned long long)v;
+	} else {
+		static_assert(std::is_pointer<T>::value, "TSIP_LOG argument of a type not logged");
+		r.types[r.count] = log_record_t::ARG_POINTER;
+		r.args[r.count++].p = (const void *)v;
+	}
+}
+
+/** log message
+*
+*   Store a message in the calling thread's ring, see TSIP_LOG.
+*
+*   @param int    level
+*   @param char*  printf format, a string literal
+*   @return void
+*/
+template <typename... Args>
+inline void log_message(int level, const char *format, const Args &... args) {
+	if (!log_enabled(level)) {
+		return;
+	}
+	log_ring *ring = log_thread_ring();
+	log_record_t *r = ring != NULL ? ring->reserve() : NULL;
+	if (r == NULL) {
+		return;
+	}
+	r->format = format;
+	r->time = log_now();
+	r->level = level;
+	r->count = 0;
+	r->text_used = 0;
+	(log_put(*r, args), ...);
+	log_commit(ring);
+}
+
+#endif
@@ -0,0 +1,452 @@
+/**
+ *	@file tsip_multicast.cpp
+ * 	@brief timing snapshots multicast to the monitoring hosts
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	mcast_subscriber subscriber;
+ * 	const mcast_timing_t *records;
+ *
+ * 	if (subscriber.open(MCAST_DEFAULT_GROUP)) {
+ * 		for (;;) {
+ * 			int n = subscriber.receive(records, 2000);
+ * 			if (n < 0) {
+ * 				break;
+ * 			}
+ * 			for (int i=0; i<n; i++) {
+ * 				if (records[i].valid & MCAST_SECONDARY_VALID) {
+ * 					printf("%u %f ns\n", records[i].receiver, records[i].pps_offset);
+ * 				}
+ * 			}
+ * 		}
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "tsip_multicast.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+
+/** ns
+*
+*   @return uint64_t  nanoseconds of a host time
+*/
+static uint64_t ns(const struct timespec &t) {
+	return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/** parse address
+*
+*   @param string        dotted IPv4 address
+*   @param in_addr&      returned address
+*   @return bool         false - not an address, printed
+*/
+static bool parse_address(const std::string &address, struct in_addr &addr) {
+	if (inet_pton(AF_INET, address.c_str(), &addr) != 1) {
+		printf("%s: not an IPv4 address\n", address.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** Constructor.
+*/
+mcast_publisher::mcast_publisher() {
+	m_fd = -1;
+	memset(&m_group, 0, sizeof(m_group));
+	m_sender = 0;
+	m_sequence = 0;
+	m_count = 0;
+	m_datagrams = 0;
+	m_records = 0;
+	m_errors = 0;
+	memset(&m_datagram, 0, sizeof(m_datagram));
+}
+
+/** Destructor.
+*/
+mcast_publisher::~mcast_publisher() {
+	close();
+}
+
+/** open
+*
+*   @param string  group, or a unicast address to send to
+*   @param int     UDP port
+*   @param string  address of the interface to send on, "" - by route
+*   @param int     hops of the multicast datagrams, 1 - the LAN
+*   @param UINT32  id of this publisher, 0 - the process id
+*   @return bool   false - not opened
+*/
+bool mcast_publisher::open(const std::string &group, int port,
+		const std::string &interface, int ttl, UINT32 sender) {
+	struct in_addr ifaddr;
+	int loop = 1;
+
+	close();
+	m_group.sin_family = AF_INET;
+	m_group.sin_port = htons(port);
+	if (!parse_address(group, m_group.sin_addr)) {
+		return false;
+	}
+	if (!interface.empty() && !parse_address(interface, ifaddr)) {
+		return false;
+	}
+	m_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (m_fd < 0) {
+		perror("mcast_publisher socket");
+		return false;
+	}
+	if (IN_MULTICAST(ntohl(m_group.sin_addr.s_addr))) {
+		// loop - a subscriber on this host receives too
+		if (setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0
+				|| setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0
+				|| (!interface.empty()
+					&& setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_IF, &ifaddr, sizeof(ifaddr)) < 0)) {
+			perror("mcast_publisher setsockopt");
+			close();
+			return false;
+		}
+	}
+	m_sender = sender != 0 ? sender : (UINT32)getpid();
+	m_sequence = 0;
+	m_count = 0;
+	m_datagram.header.magic = MCAST_MAGIC;
+	m_datagram.header.version = MCAST_VERSION;
+	m_datagram.header.record_size = sizeof(mcast_timing_t);
+	m_datagram.header.sender = m_sender;
+	return true;
+}
+
+/** close
+*
+*   The records pending are not sent, flush first.
+*
+*   @return void
+*/
+void mcast_publisher::close() {
+	if (m_fd >= 0) {
+		::close(m_fd);
+		m_fd = -1;
+	}
+	m_count = 0;
+}
+
+/** update
+*
+*   Append the snapshot of gps, its last 8F-AB and 8F-AC, to the
+*   datagram being filled and send the datagram once full.
+*
+*   @param UINT32  receiver id
+*   @param tsip&   decoder of the receiver
+*   @return bool   false - not open, or a full datagram could not be sent
+*/
+bool mcast_publisher::update(UINT32 receiver, tsip &gps) {
+	if (m_fd < 0) {
+		return false;
+	}
+	mcast_timing_t *r = (mcast_timing_t *)(m_datagram.bytes + sizeof(mcast_header_t)) + m_count++;
+	const struct _primary_time::_0x8FAB &p = gps.m_primary_time.report;
+	const struct _secondary_time::_0x8FAC &s = gps.m_secondary_time.report;
+
+	memset(r, 0, sizeof(*r));
+	r->receiver = receiver;
+	if (gps.m_primary_time.stamp.generation != 0) {
+		r->valid |= MCAST_PRIMARY_VALID;
+		r->primary_received = ns(gps.m_primary_time.stamp.received);
+		r->seconds_of_week = p.seconds_of_week;
+		r->week_number = p.week_number;
+		r->utc_offset = p.utc_offset;
+		r->year = p.year;
+		r->time_flags = p.flags.value;
+		r->seconds = p.seconds;
+		r->minutes = p.minutes;
+		r->hours = p.hours;
+		r->day = p.day;
+		r->month = p.month;
+	}
+	if (gps.m_secondary_time.stamp.generation != 0) {
+		r->valid |= MCAST_SECONDARY_VALID;
+		r->secondary_received = ns(gps.m_secondary_time.stamp.received);
+		r->receiver_mode = s.receiver_mode;
+		r->disciplining_mode = s.disciplining_mode;
+		r->self_survey_progress = s.self_survey_progress;
+		r->gps_decoding_status = s.gps_decoding_status;
+		r->disciplining_activity = s.disciplining_activity;
+		r->critical_alarms = s.critical_alarms.value;
+		r->minor_alarms = s.minor_alarms.value;
+		r->holdover_duration = s.holdover_duration;
+		r->dac_value = s.dac_value;
+		r->pps_offset = s.pps_offset;
+		r->tenMHz_offset = s.tenMHz_offset;
+		r->dac_voltage = s.dac_voltage;
+		r->temperature = s.temperature;
+		r->latitude = s.latitude;
+		r->longitude = s.longitude;
+		r->altitude = s.altitude;
+	}
+	m_records++;
+	if (m_count == MCAST_BATCH_MAX) {
+		return flush();
+	}
+	return true;
+}
+
+/** flush
+*
+*   Send the records pending as one datagram.  A datagram that cannot
+*   be sent is counted and dropped, the publisher never blocks on a
+*   subscriber.
+*
+*   @return bool  false - not sent
+*/
+bool mcast_publisher::flush() {
+	struct timespec now;
+
+	if (m_fd < 0 || m_count == 0) {
+		return m_fd >= 0;
+	}
+	clock_gettime(CLOCK_REALTIME, &now);
+	m_datagram.header.sequence = m_sequence++;
+	m_datagram.header.sent = ns(now);
+	m_datagram.header.count = m_count;
+	size_t len = sizeof(mcast_header_t) + m_count * sizeof(mcast_timing_t);
+	m_count = 0;
+	if (sendto(m_fd, m_datagram.bytes, len, MSG_DONTWAIT,
+			(const struct sockaddr *)&m_group, sizeof(m_group)) != (ssize_t)len) {
+		m_errors++;
+		return false;
+	}
+	m_datagrams++;
+	return true;
+}
+
+/** get datagrams
+*
+*   @return unsigned long long  datagrams sent
+*/
+unsigned long long mcast_publisher::get_datagrams() {
+	return m_datagrams;
+}
+
+/** get records
+*
+*   @return unsigned long long  records given to update
+*/
+unsigned long long mcast_publisher::get_records() {
+	return m_records;
+}
+
+/** get errors
+*
+*   @return unsigned long long  datagrams not sent
+*/
+unsigned long long mcast_publisher::get_errors() {
+	return m_errors;
+}
+
+/** Constructor.
+*/
+mcast_subscriber::mcast_subscriber() {
+	m_fd = -1;
+	m_sender_count = 0;
+	memset(&m_stats, 0, sizeof(m_stats));
+	memset(&m_datagram, 0, sizeof(m_datagram));
+}
+
+/** Destructor.
+*/
+mcast_subscriber::~mcast_subscriber() {
+	close();
+}
+
+/** open
+*
+*   Bind the port and join the group.  Other subscribers on the host
+*   may bind the same port.
+*
+*   @param string  group, or a unicast address of this host
+*   @param int     UDP port
+*   @param string  address of the interface to join on, "" - any
+*   @return bool   false - not opened
+*/
+bool mcast_subscriber::open(const std::string &group, int port, const std::string &interface) {
+	struct sockaddr_in addr;
+	struct ip_mreq mreq;
+	int on = 1;
+	int size = MCAST_RECEIVE_BUFFER;
+
+	close();
+	memset(&addr, 0, sizeof(addr));
+	memset(&mreq, 0, sizeof(mreq));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (!parse_address(group, addr.sin_addr)) {
+		return false;
+	}
+	mreq.imr_multiaddr = addr.sin_addr;
+	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+	if (!interface.empty() && !parse_address(interface, mreq.imr_interface)) {
+		return false;
+	}
+	m_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (m_fd < 0) {
+		perror("mcast_subscriber socket");
+		return false;
+	}
+	// a small buffer only costs lost datagrams
+	setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	if (setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0
+			|| bind(m_fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("mcast_subscriber bind");
+		close();
+		return false;
+	}
+	if (IN_MULTICAST(ntohl(addr.sin_addr.s_addr))
+			&& setsockopt(m_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+		perror("mcast_subscriber join");
+		close();
+		return false;
+	}
+	m_sender_count = 0;
+	memset(&m_stats, 0, sizeof(m_stats));
+	return true;
+}
+
+/** close
+*
+*   @return void
+*/
+void mcast_subscriber::close() {
+	if (m_fd >= 0) {
+		::close(m_fd);
+		m_fd = -1;
+	}
+}
+
+/** get fd
+*
+*   @return int  socket, -1 - not open
+*/
+int mcast_subscriber::get_fd() {
+	return m_fd;
+}
+
+/** accept
+*
+*   Check the datagram just received and count the datagrams of its
+*   sender skipped since the last one.
+*
+*   @param sockaddr_in&  source of the datagram
+*   @param ssize_t       its length
+*   @return bool         false - rejected
+*/
+bool mcast_subscriber::accept(const struct sockaddr_in &from, ssize_t len) {
+	const mcast_header_t &h = m_datagram.header;
+
+	if (len < (ssize_t)sizeof(mcast_header_t) || len > MCAST_DATAGRAM_MAX
+			|| h.magic != MCAST_MAGIC || h.version != MCAST_VERSION
+			|| h.record_size != sizeof(mcast_timing_t)
+			|| len != (ssize_t)(sizeof(mcast_header_t) + h.count * sizeof(mcast_timing_t))) {
+		m_stats.rejected++;
+		return false;
+	}
+
+	size_t i;
+	for (i=0; i<m_sender_count; i++) {
+		if (m_senders[i].address == from.sin_addr.s_addr && m_senders[i].sender == h.sender) {
+			break;
+		}
+	}
+	if (i == m_sender_count) {
+		if (m_sender_count == MCAST_SENDERS_MAX) {
+			// too many publishers, losses are no longer counted for new ones
+			return true;
+		}
+		m_senders[i].address = from.sin_addr.s_addr;
+		m_senders[i].sender = h.sender;
+		m_sender_count++;
+	} else {
+		SINT32 gap = (SINT32)(h.sequence - m_senders[i].next);
+		if (gap > 0) {
+			m_stats.lost += gap;
+		}
+	}
+	m_senders[i].next = h.sequence + 1;
+	return true;
+}
+
+/** receive
+*
+*   Wait for the next datagram accepted.  The records are used in the
+*   receive buffer, they are valid until the next call.
+*
+*   @param mcast_timing_t*&  returned records
+*   @param int               milliseconds to wait, -1 - until one comes
+*   @return int              records, 0 - none in time, -1 - error
+*/
+int mcast_subscriber::receive(const mcast_timing_t *&records, int timeout_ms) {
+	struct pollfd p;
+
+	records = NULL;
+	if (m_fd < 0) {
+		return -1;
+	}
+	p.fd = m_fd;
+	p.events = POLLIN;
+	for (;;) {
+		struct sockaddr_in from;
+		socklen_t from_len = sizeof(from);
+		ssize_t len = recvfrom(m_fd, m_datagram.bytes, sizeof(m_datagram.bytes), MSG_DONTWAIT,
+				(struct sockaddr *)&from, &from_len);
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				perror("mcast_subscriber recvfrom");
+				return -1;
+			}
+			int n = poll(&p, 1, timeout_ms);
+			if (n < 0 && errno != EINTR) {
+				perror("mcast_subscriber poll");
+				return -1;
+			}
+			if (n == 0) {
+				return 0;
+			}
+			continue;
+		}
+		if (accept(from, len)) {
+			m_stats.datagrams++;
+			m_stats.records += m_datagram.header.count;
+			records = (const mcast_timing_t *)(m_datagram.bytes + sizeof(mcast_header_t));
+			return m_datagram.header.count;
+		}
+	}
+}
+
+/** get header
+*
+*   @return mcast_header_t*  header of the datagram last accepted
+*/
+const mcast_header_t *mcast_subscriber::get_header() {
+	return &m_datagram.header;
+}
+
+/** get stats
+*
+*   @param stats_t&  returned counts since open
+*   @return void
+*/
+void mcast_subscriber::get_stats(stats_t &stats) {
+	stats = m_stats;
+}
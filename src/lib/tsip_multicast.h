@@ -0,0 +1,191 @@
+/*
+  tsip_multicast.h - timing snapshots multicast to the monitoring hosts.
+
+  A collector publishes the 8F-AB and 8F-AC state of each of its
+  receivers as a fixed layout record, several receivers to a UDP
+  datagram, to a multicast group.  Any host on the LAN joins the group
+  and reads the records in place from the datagram received, there is
+  no parsing and no port of the collector to open:
+
+    // collector, from the report handler of each receiver
+    mcast_publisher publisher;
+    publisher.open(MCAST_DEFAULT_GROUP);
+    ...
+    if (gps.m_updated.report.secondary_time) publisher.update(id, gps);
+    ...                                   // after each reactor pass
+    publisher.flush();
+
+    // monitoring host
+    mcast_subscriber subscriber;
+    subscriber.open(MCAST_DEFAULT_GROUP);
+    const mcast_timing_t *records;
+    int n = subscriber.receive(records, 1000);
+    for (i=0; i<n; i++) ... records[i].pps_offset
+
+  update() appends the receiver's snapshot to the datagram being
+  filled and sends it once MCAST_BATCH_MAX records are in; flush()
+  sends what is left.  Receivers all broadcast at the top of the
+  second, so a flush after each reactor pass carries the receivers of
+  that pass together.
+
+  The layout is naturally aligned and in host byte order: the magic
+  reads wrong on a host of the other byte order and its datagrams are
+  rejected.  Each publisher numbers its datagrams, the subscriber
+  counts the gaps as lost.  A group that is not a multicast address,
+  127.0.0.1 say, is sent to and bound as a plain UDP address, so the
+  whole path runs on loopback; a group is kept on loopback by giving
+  interface "127.0.0.1" to both sides.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _tsip_multicast_h
+#define _tsip_multicast_h
+
+#include <tsip.h>
+#include <cstdint>
+#include <netinet/in.h>
+
+#define MCAST_DEFAULT_GROUP		"239.255.84.83"
+#define MCAST_DEFAULT_PORT		4583
+#define MCAST_MAGIC				0x544d5453	// "TSMT"
+#define MCAST_VERSION			1
+#define MCAST_DATAGRAM_MAX		1472	// bytes, a 1500 byte Ethernet frame
+#define MCAST_SENDERS_MAX		64		// publishers whose losses are counted
+#define MCAST_RECEIVE_BUFFER	(1 << 20)	// socket receive buffer asked for, bytes
+
+// snapshot of one receiver, 8F-AB and 8F-AC
+struct mcast_timing_t {
+	UINT32   receiver;					// id given by the publisher
+	UINT32   valid;						// MCAST_PRIMARY_VALID | MCAST_SECONDARY_VALID
+		#define MCAST_PRIMARY_VALID		1
+		#define MCAST_SECONDARY_VALID	2
+	uint64_t primary_received;			// host clock (CLOCK_REALTIME) of the reports, ns
+	uint64_t secondary_received;
+	// 8F-AB
+	UINT32   seconds_of_week;
+	UINT16   week_number;
+	SINT16   utc_offset;
+	UINT16   year;
+	UINT8    time_flags;
+	UINT8    seconds;
+	UINT8    minutes;
+	UINT8    hours;
+	UINT8    day;
+	UINT8    month;
+	// 8F-AC
+	UINT8    receiver_mode;
+	UINT8    disciplining_mode;
+	UINT8    self_survey_progress;
+	UINT8    gps_decoding_status;
+	UINT8    disciplining_activity;
+	UINT8    spare0;
+	UINT16   critical_alarms;
+	UINT16   minor_alarms;
+	UINT16   spare1;
+	UINT32   holdover_duration;
+	UINT32   dac_value;
+	SINGLE   pps_offset;
+	SINGLE   tenMHz_offset;
+	SINGLE   dac_voltage;
+	SINGLE   temperature;
+	UINT32   spare2;
+	DOUBLE   latitude;
+	DOUBLE   longitude;
+	DOUBLE   altitude;
+};
+
+// start of every datagram, the records follow
+struct mcast_header_t {
+	UINT32   magic;						// MCAST_MAGIC
+	UINT16   version;
+	UINT16   record_size;				// sizeof(mcast_timing_t)
+	UINT32   sender;					// publisher id
+	UINT32   sequence;					// datagram number of the sender
+	uint64_t sent;						// host clock at send, ns
+	UINT16   count;						// records
+	UINT16   spare[3];
+};
+
+static_assert(sizeof(mcast_timing_t) == 104, "mcast_timing_t is a wire layout");
+static_assert(sizeof(mcast_header_t) == 32, "mcast_header_t is a wire layout");
+
+#define MCAST_BATCH_MAX	((MCAST_DATAGRAM_MAX - sizeof(mcast_header_t)) / sizeof(mcast_timing_t))
+
+// sends the snapshots of the receivers of a collector
+class mcast_publisher {
+	public:
+		mcast_publisher(void);
+		~mcast_publisher(void);
+		// interface - address of the interface to send on, "" - routing table
+		bool open(const std::string &group, int port=MCAST_DEFAULT_PORT,
+				const std::string &interface="", int ttl=1, UINT32 sender=0);
+		void close(void);
+		bool update(UINT32 receiver, tsip &gps);	// false - a full datagram not sent
+		bool flush(void);						// send the records pending
+		unsigned long long get_datagrams(void);	// sent
+		unsigned long long get_records(void);
+		unsigned long long get_errors(void);	// datagrams not sent
+
+	private:
+		int m_fd;
+		struct sockaddr_in m_group;
+		UINT32 m_sender;
+		UINT32 m_sequence;
+		size_t m_count;						// records pending
+		unsigned long long m_datagrams;
+		unsigned long long m_records;
+		unsigned long long m_errors;
+		union {
+			mcast_header_t header;
+			UINT8 bytes[MCAST_DATAGRAM_MAX];
+		} m_datagram;
+};
+
+// receives the snapshots of any number of publishers
+class mcast_subscriber {
+	public:
+		struct stats_t {
+			unsigned long long datagrams;	// accepted
+			unsigned long long records;
+			unsigned long long rejected;	// bad magic, version or size
+			unsigned long long lost;		// gaps in the sequence of a sender
+		};
+
+		mcast_subscriber(void);
+		~mcast_subscriber(void);
+		// interface - address of the interface to join on, "" - any
+		bool open(const std::string &group, int port=MCAST_DEFAULT_PORT,
+				const std::string &interface="");
+		void close(void);
+		int get_fd(void);					// to poll with other descriptors
+		// records of the next datagram, in place until the next call,
+		// 0 - none within timeout_ms (-1 waits), -1 - error
+		int receive(const mcast_timing_t *&records, int timeout_ms);
+		const mcast_header_t *get_header(void);	// of the datagram last received
+		void get_stats(stats_t &stats);
+
+	private:
+		struct sender_t {
+			in_addr_t address;
+			UINT32 sender;
+			UINT32 next;					// sequence expected
+		};
+
+		int m_fd;
+		sender_t m_senders[MCAST_SENDERS_MAX];
+		size_t m_sender_count;
+		stats_t m_stats;
+		union {
+			mcast_header_t header;
+			UINT8 bytes[MCAST_DATAGRAM_MAX + 1];	// one more, to see a datagram too long
+		} m_datagram;
+
+		bool accept(const struct sockaddr_in &from, ssize_t len);
+};
+
+#endif
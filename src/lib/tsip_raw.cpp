@@ -0,0 +1,296 @@
+/**
+ *	@file tsip_raw.cpp
+ * 	@brief streaming of the 0x5A raw measurements to disk
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	raw_measurement_ring ring;
+ * 	raw_measurement_writer writer(ring);
+ *
+ * 	if (writer.open(path) && writer.start()) {
+ * 		gps.stream_raw(&ring);
+ * 		...
+ * 		gps.stream_raw(NULL);
+ * 		writer.stop();
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "tsip_raw.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+/** Constructor.
+*
+*   All the records are allocated here, the decoder never allocates.
+*
+* 	@param size_t   records, rounded up to a power of two
+*/
+raw_measurement_ring::raw_measurement_ring(size_t capacity) : m_tail(0), m_head(0), m_dropped(0) {
+	size_t n = 1;
+
+	while (n < capacity) {
+		n <<= 1;
+	}
+	m_records.resize(n);
+	m_mask = n - 1;
+}
+
+/** capacity
+*
+*   @return size_t  records the ring holds
+*/
+size_t raw_measurement_ring::capacity() const {
+	return m_records.size();
+}
+
+/** reserve
+*
+*   The record the producer fills next.  It is not seen by the
+*   consumer until commit().
+*
+*   @return raw_record_t*  NULL - the ring is full, counted as dropped
+*/
+raw_record_t *raw_measurement_ring::reserve() {
+	size_t tail = m_tail.load(std::memory_order_relaxed);
+
+	if (tail - m_head.load(std::memory_order_acquire) >= m_records.size()) {
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+	return &m_records[tail & m_mask];
+}
+
+/** commit
+*
+*   Hand the record reserved to the consumer.
+*
+*   @return void
+*/
+void raw_measurement_ring::commit() {
+	m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/** peek
+*
+*   Records committed and not yet released.  The run is split in two
+*   where the ring wraps.
+*
+*   @param span_t[]  filled with up to two runs of records
+*   @return int      runs filled
+*/
+int raw_measurement_ring::peek(span_t span[2]) {
+	size_t head = m_head.load(std::memory_order_relaxed);
+	size_t count = m_tail.load(std::memory_order_acquire) - head;
+	size_t begin = head & m_mask;
+
+	if (count == 0) {
+		return 0;
+	}
+	span[0].begin = &m_records[begin];
+	if (begin + count <= m_records.size()) {
+		span[0].count = count;
+		return 1;
+	}
+	span[0].count = m_records.size() - begin;
+	span[1].begin = &m_records[0];
+	span[1].count = count - span[0].count;
+	return 2;
+}
+
+/** release
+*
+*   @param size_t  records written, taken from the front of peek()
+*   @return void
+*/
+void raw_measurement_ring::release(size_t count) {
+	m_head.store(m_head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
+
+/** get committed
+*
+*   @return unsigned long long  records committed so far
+*/
+unsigned long long raw_measurement_ring::get_committed() const {
+	return m_tail.load(std::memory_order_acquire);
+}
+
+/** get dropped
+*
+*   @return unsigned long long  records lost to a full ring
+*/
+unsigned long long raw_measurement_ring::get_dropped() const {
+	return m_dropped.load(std::memory_order_relaxed);
+}
+
+/** Constructor.
+*
+* 	@param raw_measurement_ring&  ring to write, must outlive the writer
+*/
+raw_measurement_writer::raw_measurement_writer(raw_measurement_ring &ring)
+	: m_ring(ring), m_fd(-1), m_running(false), m_records(0), m_writes(0), m_errors(0) {
+}
+
+/** Destructor.
+*
+*	Stop the thread, the records left are written.
+*/
+raw_measurement_writer::~raw_measurement_writer() {
+	stop();
+	close();
+}
+
+/** open
+*
+*   @param string  file, created or appended to
+*   @return bool   false - not opened
+*/
+bool raw_measurement_writer::open(const std::string &path) {
+	close();
+	m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (m_fd < 0) {
+		perror(path.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** close
+*
+*   @return void
+*/
+void raw_measurement_writer::close() {
+	if (m_fd >= 0) {
+		::close(m_fd);
+		m_fd = -1;
+	}
+}
+
+/** start
+*
+*   @return bool  false - no file open
+*/
+bool raw_measurement_writer::start() {
+	if (m_fd < 0 || m_running) {
+		return m_fd >= 0;
+	}
+	m_running = true;
+	m_thread = std::thread(&raw_measurement_writer::run, this);
+	return true;
+}
+
+/** stop
+*
+*   Wake the thread, let it write the records left and join it.  Stop
+*   the decoder feeding the ring first, see tsip::stream_raw.
+*
+*   @return void
+*/
+void raw_measurement_writer::stop() {
+	if (m_thread.joinable()) {
+		m_running = false;
+		m_thread.join();
+	}
+}
+
+/** drain
+*
+*   Write the records ready, up to RAW_WRITE_BATCH, with one writev
+*   from the ring memory.  A short write is completed so the file only
+*   holds whole records.
+*
+*   @return size_t  records written
+*/
+size_t raw_measurement_writer::drain() {
+	raw_measurement_ring::span_t span[2];
+	struct iovec iov[2];
+	size_t records = 0;
+	int runs;
+
+	if (m_fd < 0 || (runs = m_ring.peek(span)) == 0) {
+		return 0;
+	}
+	for (int i=0; i<runs; i++) {
+		size_t n = std::min(span[i].count, (size_t)RAW_WRITE_BATCH - records);
+		iov[i].iov_base = (void *)span[i].begin;
+		iov[i].iov_len = n * sizeof(raw_record_t);
+		records += n;
+		if (records == RAW_WRITE_BATCH) {
+			runs = i + 1;
+		}
+	}
+
+	ssize_t done;
+	do {
+		done = writev(m_fd, iov, runs);
+	} while (done < 0 && errno == EINTR);
+	if (done < 0) {
+		m_errors++;
+		return 0;
+	}
+	m_writes++;
+
+	// finish the record cut by a short write
+	size_t rest = done % sizeof(raw_record_t);
+	if (rest != 0) {
+		size_t whole = done / sizeof(raw_record_t);
+		const UINT8 *p = (whole < span[0].count)
+				? (const UINT8 *)(span[0].begin + whole)
+				: (const UINT8 *)(span[1].begin + (whole - span[0].count));
+		size_t left = sizeof(raw_record_t) - rest;
+		p += rest;
+		while (left > 0) {
+			ssize_t n = ::write(m_fd, p, left);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				m_errors++;
+				break;
+			}
+			p += n;
+			left -= n;
+			done += n;
+		}
+	}
+
+	records = done / sizeof(raw_record_t);
+	m_ring.release(records);
+	m_records += records;
+	return records;
+}
+
+/** run
+*
+*   Writer thread, a batch every RAW_WRITE_INTERVAL_MS or sooner while
+*   a full batch is waiting.
+*
+*   @return void
+*/
+void raw_measurement_writer::run() {
+	while (m_running) {
+		if (drain() < RAW_WRITE_BATCH) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(RAW_WRITE_INTERVAL_MS));
+		}
+	}
+	while (drain() > 0) {
+	}
+}
+
+/** get stats
+*
+*   @param stats_t&  records and writes so far
+*   @return void
+*/
+void raw_measurement_writer::get_stats(stats_t &stats) {
+	stats.records = m_records;
+	stats.writes = m_writes;
+	stats.errors = m_errors;
+}
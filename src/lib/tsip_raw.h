@@ -0,0 +1,113 @@
+/*
+  tsip_raw.h - streaming of the 0x5A raw measurements to disk.
+
+  With 0x35 auxiliary packet_5A set the receiver sends an 0x5A for
+  every satellite each measurement epoch, far more packets than the
+  timing reports.  The decoder writes each one as a 32 byte record
+  straight into a ring allocated once; a writer thread takes the
+  records out in batches and writes them from the ring to the file,
+  no other copy is made.  The timing reports are decoded on the same
+  port as before:
+
+    raw_measurement_ring ring;
+    raw_measurement_writer writer(ring);
+
+    writer.open("/var/lib/gps/raw.bin");
+    writer.start();
+    gps.stream_raw(&ring);
+    gps.subscribe(REPORT_RAW_MEASUREMENT);   // sets packet_5A, with
+    gps.apply_subscriptions();                // the reports needed
+    ...                                       // reactor or encode loop
+    gps.stream_raw(NULL);
+    writer.stop();
+
+  The file is a sequence of struct _raw_measurement::_0x5A records in
+  host byte order.  The ring has one producer, the thread that decodes
+  the port, and one consumer, the writer.  It is sized to ride out
+  disk stalls: the default holds about three minutes of a 115200 baud
+  link carrying nothing but 0x5A.  A record that finds the ring full
+  is counted as dropped.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _tsip_raw_h
+#define _tsip_raw_h
+
+#include <tsip.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define RAW_RING_DEFAULT_CAPACITY	65536	// records, rounded up to a power of two
+#define RAW_WRITE_INTERVAL_MS		100		// writer wakes up to write a batch
+#define RAW_WRITE_BATCH				4096	// records written at most by one write
+
+typedef struct _raw_measurement::_0x5A raw_record_t;
+
+// single producer, single consumer ring of 0x5A records
+class raw_measurement_ring {
+	public:
+		// run of consecutive records
+		struct span_t {
+			const raw_record_t *begin;
+			size_t count;
+		};
+
+		raw_measurement_ring(size_t capacity=RAW_RING_DEFAULT_CAPACITY);
+		size_t capacity(void) const;
+
+		// producer
+		raw_record_t *reserve(void);		// record to fill, NULL - full
+		void commit(void);					// publish the record reserved
+
+		// consumer
+		int peek(span_t span[2]);			// records ready, up to two runs
+		void release(size_t count);			// records written
+
+		unsigned long long get_committed(void) const;
+		unsigned long long get_dropped(void) const;
+
+	private:
+		std::vector<raw_record_t> m_records;
+		size_t m_mask;
+		alignas(64) std::atomic<size_t> m_tail;	// next record to commit, producer
+		alignas(64) std::atomic<size_t> m_head;	// next record to write, consumer
+		std::atomic<unsigned long long> m_dropped;
+};
+
+// thread writing the records of a ring to a file
+class raw_measurement_writer {
+	public:
+		struct stats_t {
+			unsigned long long records;	// written
+			unsigned long long writes;	// write calls
+			unsigned long long errors;	// failed writes, the records are kept
+		};
+
+		raw_measurement_writer(raw_measurement_ring &ring);
+		~raw_measurement_writer(void);
+		bool open(const std::string &path);	// append to the file
+		void close(void);
+		bool start(void);				// start the writer thread
+		void stop(void);				// write what is left and stop
+		size_t drain(void);				// write the records ready, without the thread
+		void get_stats(stats_t &stats);
+
+	private:
+		raw_measurement_ring &m_ring;
+		int m_fd;
+		std::thread m_thread;
+		std::atomic<bool> m_running;
+		std::atomic<unsigned long long> m_records;
+		std::atomic<unsigned long long> m_writes;
+		std::atomic<unsigned long long> m_errors;
+
+		void run(void);
+};
+
+#endif
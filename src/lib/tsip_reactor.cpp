@@ -0,0 +1,351 @@
+/**
+ *	@file tsip_reactor.cpp
+ * 	@brief epoll reactor reading many receivers on one thread
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	tsip_reactor reactor;
+ * 	std::vector<tsip *> gps;
+ *
+ * 	for (size_t i=0; i<ports.size(); i++) {
+ * 		gps.push_back(new tsip(ports[i], false));
+ * 		reactor.add(*gps[i], on_report, gps[i]);
+ * 	}
+ * 	reactor.run();
+ * @endcode
+ *
+ */
+
+#include "tsip_reactor.h"
+#ifdef GPS_HAVE_IO_URING
+#include "tsip_uring.h"
+#endif
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/** Constructor.
+*
+*	Set up the io_uring backend, or create the epoll instance and the
+*	stop eventfd when io_uring is not available.
+*
+*	@param bool  try io_uring first
+*/
+tsip_reactor::tsip_reactor(bool use_uring) {
+	m_stop = false;
+	m_epfd = -1;
+	m_wakeup = -1;
+	m_uring = NULL;
+
+#ifdef GPS_HAVE_IO_URING
+	if (use_uring) {
+		m_uring = new tsip_uring();
+		if (m_uring->is_ready()) {
+			return;
+		}
+		delete m_uring;
+		m_uring = NULL;
+	}
+#else
+	(void)use_uring;
+#endif
+
+	m_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (m_epfd < 0) {
+		perror("tsip_reactor epoll_create1");
+	}
+	m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_wakeup < 0) {
+		perror("tsip_reactor eventfd");
+	} else if (m_epfd >= 0) {
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wakeup, &ev);
+	}
+}
+
+/** Destructor.
+*
+*	The receivers are not closed, they belong to the caller.
+*/
+tsip_reactor::~tsip_reactor() {
+#ifdef GPS_HAVE_IO_URING
+	delete m_uring;
+#endif
+	for (size_t i=0; i<m_entries.size(); i++) {
+		delete m_entries[i];
+	}
+	for (size_t i=0; i<m_removed.size(); i++) {
+		delete m_removed[i];
+	}
+	if (m_wakeup >= 0) {
+		close(m_wakeup);
+	}
+	if (m_epfd >= 0) {
+		close(m_epfd);
+	}
+}
+
+/** add receiver
+*
+*   Register an open receiver of any protocol.  Its port is switched
+*   to non-blocking reads, so a tsip must not be used with
+*   get_report_msg() afterwards.
+*
+*   @param frame_decoder&  receiver, must outlive the registration
+*   @param frame_handler   called for each report or sentence
+*   @param void*           passed to the handler
+*   @return bool  true - registered
+*/
+bool tsip_reactor::add(frame_decoder &decoder, frame_handler handler, void *ctx) {
+	return add_entry(decoder, handler, NULL, ctx);
+}
+
+/** add receiver
+*
+*   Register an open TSIP receiver, its handler is given the tsip.
+*
+*   @param tsip&                receiver, must outlive the registration
+*   @param tsip_report_handler  called for each report
+*   @param void*                passed to the handler
+*   @return bool  true - registered
+*/
+bool tsip_reactor::add(tsip &gps, tsip_report_handler handler, void *ctx) {
+	return add_entry(gps, NULL, handler, ctx);
+}
+
+/** add entry
+*
+*   @param frame_decoder&       receiver
+*   @param frame_handler        handler, NULL - report_handler is used
+*   @param tsip_report_handler  handler of a tsip
+*   @param void*                passed to the handler
+*   @return bool  true - registered
+*/
+bool tsip_reactor::add_entry(frame_decoder &decoder, frame_handler handler,
+		tsip_report_handler report_handler, void *ctx) {
+#ifdef GPS_HAVE_IO_URING
+	if (m_uring != NULL) {
+		return m_uring->add(decoder, handler, report_handler, ctx);
+	}
+#endif
+	int fd = decoder.get_port_fd();
+
+	if (fd < 0 || m_epfd < 0) {
+		printf("%s is not open\n", decoder.get_gps_port().c_str());
+		return false;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	entry_t *entry = new entry_t;
+	entry->decoder = &decoder;
+	entry->fd = fd;
+	entry->handler = handler;
+	entry->report_handler = report_handler;
+	entry->ctx = ctx;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = entry;
+	if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		perror(decoder.get_gps_port().c_str());
+		delete entry;
+		return false;
+	}
+	m_entries.push_back(entry);
+	return true;
+}
+
+/** remove receiver
+*
+*   May be called from a handler, also for another receiver.
+*
+*   @param frame_decoder&  receiver
+*   @return bool  true - was registered
+*/
+bool tsip_reactor::remove(frame_decoder &decoder) {
+#ifdef GPS_HAVE_IO_URING
+	if (m_uring != NULL) {
+		return m_uring->remove(decoder);
+	}
+#endif
+	for (size_t i=0; i<m_entries.size(); i++) {
+		if (m_entries[i]->decoder == &decoder) {
+			drop(m_entries[i]);
+			return true;
+		}
+	}
+	return false;
+}
+
+/** size
+*
+*   @return size_t  registered receivers
+*/
+size_t tsip_reactor::size() {
+#ifdef GPS_HAVE_IO_URING
+	if (m_uring != NULL) {
+		return m_uring->size();
+	}
+#endif
+	return m_entries.size();
+}
+
+/** poll
+*
+*   Wait up to timeout_ms (-1 for no limit) for ports to become ready,
+*   then read each ready port once and decode the bytes.  A port that
+*   is closed or fails is removed.
+*
+*   @param int  timeout in milliseconds
+*   @return int reports decoded, -1 on error
+*/
+int tsip_reactor::poll(int timeout_ms) {
+	struct epoll_event events[TSIP_REACTOR_EVENTS];
+	counter_t counter;
+
+#ifdef GPS_HAVE_IO_URING
+	if (m_uring != NULL) {
+		return m_uring->poll(timeout_ms);
+	}
+#endif
+	int n = epoll_wait(m_epfd, events, TSIP_REACTOR_EVENTS, timeout_ms);
+	if (n < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		perror("tsip_reactor epoll_wait");
+		return -1;
+	}
+
+	counter.reports = 0;
+	for (int i=0; i<n; i++) {
+		entry_t *entry = (entry_t *)events[i].data.ptr;
+
+		if (entry == NULL) {
+			uint64_t value;
+			if (read(m_wakeup, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+				perror("tsip_reactor eventfd");
+			}
+			continue;
+		}
+		if (entry->decoder == NULL) {
+			// removed by a handler earlier in this pass
+			continue;
+		}
+
+		ssize_t len = read(entry->fd, m_buffer, sizeof(m_buffer));
+		if (len > 0) {
+			counter.handler = entry->handler;
+			counter.report_handler = entry->report_handler;
+			counter.ctx = entry->ctx;
+			counter.keep = true;
+			entry->decoder->decode(m_buffer, len, count_report, &counter);
+			if (!counter.keep) {
+				drop(entry);
+			}
+		} else if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+			if (len < 0) {
+				perror(entry->decoder->get_gps_port().c_str());
+			} else {
+				printf("%s closed\n", entry->decoder->get_gps_port().c_str());
+			}
+			drop(entry);
+		}
+	}
+
+	for (size_t i=0; i<m_removed.size(); i++) {
+		delete m_removed[i];
+	}
+	m_removed.clear();
+	return counter.reports;
+}
+
+/** run
+*
+*   Collect reports until stop() is called or no receiver is left.
+*
+*   @return void
+*/
+void tsip_reactor::run() {
+	m_stop = false;
+	while (!m_stop && size() > 0) {
+		if (poll(-1) < 0) {
+			break;
+		}
+	}
+}
+
+/** stop
+*
+*   Make run() return.  Safe from any thread and from a handler.
+*
+*   @return void
+*/
+void tsip_reactor::stop() {
+	uint64_t one = 1;
+
+	m_stop = true;
+#ifdef GPS_HAVE_IO_URING
+	if (m_uring != NULL) {
+		m_uring->wakeup();
+		return;
+	}
+#endif
+	if (m_wakeup >= 0 && write(m_wakeup, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		perror("tsip_reactor eventfd");
+	}
+}
+
+/** get backend
+*
+*   @return const char*  "io_uring" or "epoll"
+*/
+const char *tsip_reactor::get_backend() {
+	return (m_uring != NULL) ? "io_uring" : "epoll";
+}
+
+/** count report
+*
+*   Decoder callback, counts the report and passes it to the handler
+*   of the receiver.
+*
+*   @return bool false - the handler asked to remove the receiver
+*/
+bool tsip_reactor::count_report(frame_decoder &decoder, void *ctx) {
+	counter_t *counter = (counter_t *)ctx;
+
+	counter->reports++;
+	if (counter->handler != NULL) {
+		counter->keep = counter->handler(decoder, counter->ctx);
+	} else if (counter->report_handler != NULL) {
+		// registered by add(tsip &, ...)
+		counter->keep = counter->report_handler((tsip &)decoder, counter->ctx);
+	}
+	return counter->keep;
+}
+
+/** drop entry
+*
+*   Unregister the port.  The entry is freed after the current pass,
+*   the events already returned may still point to it.
+*
+*   @return void
+*/
+void tsip_reactor::drop(entry_t *entry) {
+	if (entry->decoder == NULL) {
+		return;
+	}
+	epoll_ctl(m_epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+	entry->decoder = NULL;
+	m_entries.erase(std::remove(m_entries.begin(), m_entries.end(), entry), m_entries.end());
+	m_removed.push_back(entry);
+}
@@ -0,0 +1,98 @@
+/*
+  tsip_reactor.h - collect reports from many receivers on one thread.
+
+  Each receiver is a frame_decoder, a tsip or an nmea object, with its
+  own decoder state.  The reactor registers the port descriptors with
+  epoll, reads whatever is ready and feeds each block of bytes through
+  the receiver's decoder, calling the receiver's handler for every
+  report or sentence decoded.  There is no thread per receiver and no
+  wakeup per byte.  A handler returns false to remove its receiver
+  from the reactor.
+
+    bool on_report(tsip &gps, void *ctx) {
+        if (gps.m_updated.report.secondary_time) ...
+        return true;
+    }
+
+    tsip_reactor reactor;
+    for (i...) reactor.add(*gps[i], on_report, &state[i]);
+    reactor.run();
+
+  A port of unknown protocol is opened with open_decoder() and added
+  with a frame_handler, which is given either decoder, see gps_frame.h.
+
+  When the kernel supports it, the ports are read through io_uring
+  (tsip_uring) instead: one read stays in flight per port and a pass
+  over all ready ports is one system call.  Otherwise, or when the
+  reactor is constructed with use_uring false, epoll is used.
+  get_backend() tells which.
+
+  The reactor only reads.  Commands may be sent with the tsip methods
+  that do not wait for a reply (save_to_eeprom, set_survey_params ...)
+  from the reactor thread, e.g. from a handler.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _tsip_reactor_h
+#define _tsip_reactor_h
+
+#include <tsip.h>
+#include <atomic>
+#include <vector>
+
+#define TSIP_REACTOR_EVENTS		64		// events taken per epoll_wait
+#define TSIP_REACTOR_BUFFER		4096	// bytes read per ready port
+
+class tsip_uring;
+
+class tsip_reactor {
+	friend class tsip_uring;
+
+	public:
+		tsip_reactor(bool use_uring = true);
+		~tsip_reactor(void);
+		bool add(frame_decoder &decoder, frame_handler handler, void *ctx);
+		bool add(tsip &gps, tsip_report_handler handler, void *ctx);
+		bool remove(frame_decoder &decoder);
+		size_t size(void);
+		int poll(int timeout_ms);		// one pass, returns reports decoded
+		void run(void);					// until stop()
+		void stop(void);				// from any thread or a handler
+		const char *get_backend(void);	// "io_uring" or "epoll"
+
+	private:
+		struct entry_t {
+			frame_decoder *decoder;		// NULL once removed
+			int fd;
+			frame_handler handler;
+			tsip_report_handler report_handler;	// added as a tsip, handler is NULL
+			void *ctx;
+		};
+
+		int m_epfd;
+		int m_wakeup;					// eventfd, wakes epoll_wait on stop
+		std::atomic<bool> m_stop;
+		std::vector<entry_t *> m_entries;
+		std::vector<entry_t *> m_removed;	// freed after the current pass
+		UINT8 m_buffer[TSIP_REACTOR_BUFFER];
+		tsip_uring *m_uring;			// NULL when epoll is used
+
+		struct counter_t {
+			frame_handler handler;
+			tsip_report_handler report_handler;
+			void *ctx;
+			int reports;
+			bool keep;
+		};
+		bool add_entry(frame_decoder &decoder, frame_handler handler,
+				tsip_report_handler report_handler, void *ctx);
+		static bool count_report(frame_decoder &decoder, void *ctx);
+		void drop(entry_t *entry);
+};
+
+#endif
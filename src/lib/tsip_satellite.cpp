@@ -0,0 +1,341 @@
+/**
+ *	@file tsip_satellite.cpp
+ * 	@brief satellite tracking table of a receiver
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	const satellite_table *sats = gps.get_satellites();
+ * 	unsigned long long since = gps.get_generation();
+ *
+ * 	// one second later
+ * 	if (sats->count(since) > 0 && sats->mean_snr(since) < 35) {
+ * 		printf("%d satellites, mean C/N0 %.1f dB-Hz\n",
+ * 				sats->count(since), sats->mean_snr(since));
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "tsip_satellite.h"
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/** Constructor.
+*/
+satellite_table::satellite_table() {
+	clear();
+}
+
+/** clear
+*
+*   Forget every satellite.
+*
+*   @return void
+*/
+void satellite_table::clear() {
+	for (int s=0; s<SATELLITE_MAX_PRN; s++) {
+		m_columns.snr[s] = NAN;
+		m_columns.elevation[s] = NAN;
+		m_columns.azimuth[s] = NAN;
+		m_columns.residual[s] = NAN;
+		m_columns.seen[s] = 0;
+		m_almanac_seen[s] = 0;
+	}
+	memset(m_almanac, 0, sizeof(m_almanac));
+	memset(&stamp, 0, sizeof(stamp));
+}
+
+/** slot
+*
+*   @param int   PRN
+*   @return int  slot in every column, -1 - PRN not kept
+*/
+int satellite_table::slot(int prn) {
+	return (prn >= 1 && prn <= SATELLITE_MAX_PRN) ? prn - 1 : -1;
+}
+
+/** update level  0x47
+*
+*   @param int                 PRN
+*   @param SINGLE              signal level
+*   @param unsigned long long  generation of the report
+*   @return bool  false - PRN not kept
+*/
+bool satellite_table::update_level(int prn, SINGLE snr, unsigned long long generation) {
+	int s = slot(prn);
+
+	if (s < 0) {
+		return false;
+	}
+	m_columns.snr[s] = snr;
+	m_columns.seen[s] = generation;
+	return true;
+}
+
+/** update status  0x5C
+*
+*   @param int                 PRN
+*   @param SINGLE              signal level
+*   @param SINGLE              elevation, radians
+*   @param SINGLE              azimuth, radians
+*   @param unsigned long long  generation of the report
+*   @return bool  false - PRN not kept
+*/
+bool satellite_table::update_status(int prn, SINGLE snr, SINGLE elevation, SINGLE azimuth,
+		unsigned long long generation) {
+	int s = slot(prn);
+
+	if (s < 0) {
+		return false;
+	}
+	m_columns.snr[s] = snr;
+	m_columns.elevation[s] = elevation;
+	m_columns.azimuth[s] = azimuth;
+	m_columns.seen[s] = generation;
+	return true;
+}
+
+/** start solution  8F-A7
+*
+*   An 8F-A7 lists every satellite of the timing solution, the ones it
+*   leaves out have no residual any more.
+*
+*   @return void
+*/
+void satellite_table::start_solution() {
+	for (int s=0; s<SATELLITE_MAX_PRN; s++) {
+		m_columns.residual[s] = NAN;
+	}
+}
+
+/** update residual  8F-A7
+*
+*   @param int                 PRN
+*   @param SINGLE              satellite bias, ns
+*   @param unsigned long long  generation of the report
+*   @return bool  false - PRN not kept
+*/
+bool satellite_table::update_residual(int prn, SINGLE residual, unsigned long long generation) {
+	int s = slot(prn);
+
+	if (s < 0) {
+		return false;
+	}
+	m_columns.residual[s] = residual;
+	m_columns.seen[s] = generation;
+	return true;
+}
+
+/** update almanac  0x58
+*
+*   The almanac does not mark the satellite as seen, it is known
+*   whether or not the satellite is tracked.
+*
+*   @param int                 PRN
+*   @param almanac_t&          almanac of the satellite
+*   @param unsigned long long  generation of the report
+*   @return bool  false - PRN not kept
+*/
+bool satellite_table::update_almanac(int prn, const almanac_t &almanac, unsigned long long generation) {
+	int s = slot(prn);
+
+	if (s < 0) {
+		return false;
+	}
+	m_almanac[s] = almanac;
+	m_almanac_seen[s] = generation;
+	return true;
+}
+
+/** almanac
+*
+*   @param int          PRN
+*   @return almanac_t*  almanac of the satellite, NULL - none received
+*/
+const almanac_t *satellite_table::almanac(int prn) const {
+	int s = slot(prn);
+
+	return (s >= 0 && m_almanac_seen[s] != 0) ? &m_almanac[s] : NULL;
+}
+
+/** almanac generation
+*
+*   @param int                  PRN
+*   @return unsigned long long  generation of its almanac, 0 - none received
+*/
+unsigned long long satellite_table::almanac_generation(int prn) const {
+	int s = slot(prn);
+
+	return (s >= 0) ? m_almanac_seen[s] : 0;
+}
+
+/** almanacs
+*
+*   @return UINT32  bit PRN - 1 set for each almanac received
+*/
+UINT32 satellite_table::almanacs() const {
+	UINT32 sats = 0;
+
+	for (int s=0; s<SATELLITE_MAX_PRN; s++) {
+		sats |= (UINT32)(m_almanac_seen[s] != 0) << s;
+	}
+	return sats;
+}
+
+/** columns
+*
+*   @return columns_t&  one array per field, indexed by PRN - 1
+*/
+const satellite_table::columns_t &satellite_table::columns() const {
+	return m_columns;
+}
+
+/** tracked
+*
+*   @param unsigned long long  generation taken earlier
+*   @return UINT32  bit PRN - 1 set for each satellite named after it
+*/
+UINT32 satellite_table::tracked(unsigned long long since) const {
+	UINT32 sats = 0;
+
+	for (int s=0; s<SATELLITE_MAX_PRN; s++) {
+		sats |= (UINT32)(m_columns.seen[s] > since) << s;
+	}
+	return sats;
+}
+
+/** count
+*
+*   @param unsigned long long  generation taken earlier
+*   @return int  satellites named after it
+*/
+int satellite_table::count(unsigned long long since) const {
+	return __builtin_popcount(tracked(since));
+}
+
+#if defined(__SSE2__)
+/** lanes
+*
+*   @param UINT32  satellite bits, the low four are used
+*   @return __m128 all ones in the lanes of the bits set
+*/
+static inline __m128 lanes(UINT32 bits) {
+	const __m128i lane_bit = _mm_setr_epi32(1, 2, 4, 8);
+	__m128i b = _mm_and_si128(_mm_set1_epi32(bits), lane_bit);
+	return _mm_castsi128_ps(_mm_cmpeq_epi32(b, lane_bit));
+}
+#endif
+
+/** masked sum
+*
+*   Sum of a column, or of its squares, over the satellites given, the
+*   NAN values left out.
+*
+*   @param SINGLE*  column
+*   @param UINT32   satellite bits
+*   @param bool     true - sum the squares
+*   @param double&  returned sum
+*   @param int&     returned number of values summed
+*   @return void
+*/
+void satellite_table::masked_sum(const SINGLE *x, UINT32 sats, bool square, double &sum, int &n) {
+#if defined(__SSE2__)
+	__m128 acc = _mm_setzero_ps();
+	int used = 0;
+
+	for (int s=0; s<SATELLITE_MAX_PRN; s+=4, sats>>=4) {
+		if ((sats & 0xf) == 0) {
+			continue;
+		}
+		__m128 v = _mm_load_ps(x + s);
+		__m128 m = _mm_and_ps(lanes(sats), _mm_cmpord_ps(v, v));
+		if (square) {
+			v = _mm_mul_ps(v, v);
+		}
+		acc = _mm_add_ps(acc, _mm_and_ps(v, m));
+		used += __builtin_popcount(_mm_movemask_ps(m));
+	}
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	sum = _mm_cvtss_f32(acc);
+	n = used;
+#else
+	sum = 0;
+	n = 0;
+	for (int s=0; s<SATELLITE_MAX_PRN; s++) {
+		if ((sats >> s) & 1 && !std::isnan(x[s])) {
+			sum += square ? (double)x[s] * x[s] : x[s];
+			n++;
+		}
+	}
+#endif
+}
+
+/** mean snr
+*
+*   Mean signal level, C/N0 when the receiver reports dB-Hz.
+*
+*   @param unsigned long long  generation taken earlier
+*   @return double  NAN - no satellite with a level
+*/
+double satellite_table::mean_snr(unsigned long long since) const {
+	double sum;
+	int n;
+
+	masked_sum(m_columns.snr, tracked(since), false, sum, n);
+	return (n > 0) ? sum / n : NAN;
+}
+
+/** above mask
+*
+*   @param SINGLE              mask angle, radians
+*   @param unsigned long long  generation taken earlier
+*   @return int  satellites higher than the mask angle
+*/
+int satellite_table::above_mask(SINGLE mask_angle, unsigned long long since) const {
+	UINT32 sats = tracked(since);
+	int n = 0;
+
+#if defined(__SSE2__)
+	__m128 angle = _mm_set1_ps(mask_angle);
+
+	for (int s=0; s<SATELLITE_MAX_PRN; s+=4, sats>>=4) {
+		if ((sats & 0xf) == 0) {
+			continue;
+		}
+		// NAN compares false, satellites without an elevation are left out
+		__m128 high = _mm_cmpgt_ps(_mm_load_ps(m_columns.elevation + s), angle);
+		n += __builtin_popcount(_mm_movemask_ps(_mm_and_ps(high, lanes(sats))));
+	}
+#else
+	for (int s=0; s<SATELLITE_MAX_PRN; s++) {
+		if ((sats >> s) & 1 && m_columns.elevation[s] > mask_angle) {
+			n++;
+		}
+	}
+#endif
+	return n;
+}
+
+/** residual rms
+*
+*   RMS of the satellite residuals of the last timing solution.
+*
+*   @param unsigned long long  generation taken earlier
+*   @return double  ns, NAN - no satellite with a residual
+*/
+double satellite_table::residual_rms(unsigned long long since) const {
+	double sum;
+	int n;
+
+	masked_sum(m_columns.residual, tracked(since), true, sum, n);
+	return (n > 0) ? sqrt(sum / n) : NAN;
+}
@@ -0,0 +1,105 @@
+/*
+  tsip_satellite.h - satellite tracking table of a receiver.
+
+  The table is filled in place from the satellite reports, nothing is
+  allocated per packet:
+
+    0x47   signal levels of all the satellites tracked
+    0x5C   tracking status of one satellite, level, elevation, azimuth
+    8F-A7  individual satellite solutions, the timing residual of each
+           satellite in the solution
+    0x58   almanac of one satellite, requested by tsip::request_almanac,
+           see sky_geometry.h for the look angles it predicts
+
+  The fields are kept as a structure of arrays (columns()), one array
+  per field indexed by slot = PRN - 1, so the aggregate queries run
+  over one field with SSE:
+
+    const satellite_table *sats = gps.get_satellites();
+    unsigned long long since = gps.get_generation();
+    ...
+    double cn0 = sats->mean_snr(since);
+    int high = sats->above_mask(15 / gps._rad, since);
+    double rms = sats->residual_rms(since);
+
+  A satellite counts for a query when a report named it after the
+  generation since, see tsip::get_generation().  A value the reports
+  have not given yet is NAN and left out.
+
+  The table belongs to the tsip object and follows its threading rule:
+  read it from the thread that decodes the reports.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _tsip_satellite_h
+#define _tsip_satellite_h
+
+#include <tsip.h>
+
+#define SATELLITE_MAX_PRN			32		// GPS PRNs 1..32, slot PRN - 1
+
+// 0x58 almanac of one satellite, the orbit fields of IS-GPS-200
+struct almanac_t {
+	UINT8  health;				// SV_HEALTH, 0 - healthy
+	SINGLE e;					// eccentricity
+	SINGLE t_oa;				// reference time, seconds of week wn_oa
+	SINGLE i_o;					// inclination, radians
+	SINGLE omegadot;			// rate of right ascension, radians/second
+	SINGLE sqrt_a;				// square root of the semi-major axis, meters^1/2
+	SINGLE omega_0;				// longitude of the ascending node, radians
+	SINGLE omega;				// argument of perigee, radians
+	SINGLE m_0;					// mean anomaly, radians
+	SINGLE af0;					// clock bias, seconds
+	SINGLE af1;					// clock drift, seconds/second
+	UINT16 wn_oa;				// week of t_oa
+};
+
+class satellite_table {
+	public:
+		struct columns_t {
+			// signal level, AMU or dB-Hz as set by 0x35 auxiliary dbhz
+			alignas(16) SINGLE snr[SATELLITE_MAX_PRN];
+			alignas(16) SINGLE elevation[SATELLITE_MAX_PRN];	// radians
+			alignas(16) SINGLE azimuth[SATELLITE_MAX_PRN];		// radians
+			// satellite bias in the last 8F-A7, ns, NAN - not in the solution
+			alignas(16) SINGLE residual[SATELLITE_MAX_PRN];
+			// generation of the last report naming the satellite, 0 - never
+			unsigned long long seen[SATELLITE_MAX_PRN];
+		};
+
+		struct _report_stamp stamp;			// last satellite report decoded
+
+		satellite_table(void);
+		void clear(void);
+		bool update_level(int prn, SINGLE snr, unsigned long long generation);
+		bool update_status(int prn, SINGLE snr, SINGLE elevation, SINGLE azimuth,
+				unsigned long long generation);
+		void start_solution(void);			// a new 8F-A7, clear the residuals
+		bool update_residual(int prn, SINGLE residual, unsigned long long generation);
+		bool update_almanac(int prn, const almanac_t &almanac, unsigned long long generation);
+		const columns_t &columns(void) const;
+		const almanac_t *almanac(int prn) const;	// NULL - none received
+		unsigned long long almanac_generation(int prn) const;	// 0 - none received
+		UINT32 almanacs(void) const;		// bit PRN - 1 per almanac received
+
+		UINT32 tracked(unsigned long long since) const;	// bit PRN - 1 per satellite
+		int count(unsigned long long since) const;
+		double mean_snr(unsigned long long since) const;
+		int above_mask(SINGLE mask_angle, unsigned long long since) const;
+		double residual_rms(unsigned long long since) const;
+
+	private:
+		columns_t m_columns;
+		almanac_t m_almanac[SATELLITE_MAX_PRN];
+		unsigned long long m_almanac_seen[SATELLITE_MAX_PRN];	// generation, 0 - none
+
+		static int slot(int prn);
+		static void masked_sum(const SINGLE *x, UINT32 sats, bool square, double &sum, int &n);
+};
+
+#endif
@@ -0,0 +1,471 @@
+/**
+ *	@file tsip_shm.cpp
+ * 	@brief decoded reports shared with other processes
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	shm_packet_reader reader;
+ *
+ * 	if (reader.open("/tsip-ttyS0")) {
+ * 		while (!reader.is_closed()) {
+ * 			const shm_packet_t *p = reader.peek();
+ * 			if (p == NULL) {
+ * 				usleep(10000);
+ * 				continue;
+ * 			}
+ * 			bool primary = p->decoded && p->bit == tsip::report_bit(0x8f, 0xab);
+ * 			UINT32 tow = primary ? p->report.primary_time.seconds_of_week : 0;
+ * 			if (reader.consume() && primary) {
+ * 				printf("%u\n", tow);
+ * 			}
+ * 		}
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "tsip_shm.h"
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static_assert(std::atomic<unsigned long long>::is_always_lock_free,
+		"the ring needs lock-free 64 bit atomics to be shared between processes");
+
+/** Constructor.
+*/
+shm_packet_writer::shm_packet_writer() {
+	m_map = NULL;
+	m_map_size = 0;
+	m_header = NULL;
+	m_slots = NULL;
+	m_mask = 0;
+	m_next = 0;
+}
+
+/** Destructor.
+*
+*	Close the ring, stop the decoder publishing first, see tsip::publish.
+*/
+shm_packet_writer::~shm_packet_writer() {
+	close();
+}
+
+/** ring in use
+*
+*   Whether name holds a ring that is still published: not closed and
+*   its writer alive, as seen by shm_packet_reader::is_closed.  Anything
+*   else under the name, a ring left by a writer that died or not a ring
+*   at all, may be replaced.
+*
+*   @param string  shared memory name
+*   @return bool   true - a live writer owns the name
+*/
+static bool ring_in_use(const std::string &name) {
+	struct stat st;
+	bool live = false;
+
+	int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		return false;
+	}
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(shm_header_t)) {
+		void *map = mmap(NULL, sizeof(shm_header_t), PROT_READ, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED) {
+			const shm_header_t *header = (const shm_header_t *)map;
+			live = header->magic == SHM_MAGIC
+					&& header->closed.load(std::memory_order_acquire) == 0
+					&& (kill(header->writer, 0) == 0 || errno != ESRCH);
+			munmap(map, sizeof(shm_header_t));
+		}
+	}
+	::close(fd);
+	return live;
+}
+
+/** create
+*
+*   Create the ring under name, replacing a ring left by a writer that
+*   died.  A ring whose writer is still running is left alone.  The
+*   slots are touched here so publishing takes no page fault.
+*
+*   @param string  shared memory name, "/tsip-ttyS0"
+*   @param size_t  packets, rounded up to a power of two
+*   @return bool   false - not created, or in use by another writer
+*/
+bool shm_packet_writer::create(const std::string &name, size_t slots) {
+	size_t n = 1;
+
+	close();
+	while (n < slots) {
+		n <<= 1;
+	}
+	if (ring_in_use(name)) {
+		printf("%s is published by a running writer\n", name.c_str());
+		return false;
+	}
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		perror(name.c_str());
+		return false;
+	}
+	m_map_size = sizeof(shm_header_t) + n * sizeof(shm_slot_t);
+	if (ftruncate(fd, m_map_size) != 0) {
+		perror(name.c_str());
+		::close(fd);
+		shm_unlink(name.c_str());
+		return false;
+	}
+	m_map = mmap(NULL, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (m_map == MAP_FAILED) {
+		perror(name.c_str());
+		m_map = NULL;
+		shm_unlink(name.c_str());
+		return false;
+	}
+	memset(m_map, 0, m_map_size);
+
+	m_name = name;
+	m_header = new (m_map) shm_header_t;
+	m_slots = (shm_slot_t *)((UINT8 *)m_map + sizeof(shm_header_t));
+	m_mask = n - 1;
+	m_next = 0;
+	m_header->version = SHM_VERSION;
+	m_header->slot_size = sizeof(shm_slot_t);
+	m_header->slots = n;
+	m_header->writer = getpid();
+	m_header->closed.store(0, std::memory_order_relaxed);
+	m_header->head.store(0, std::memory_order_relaxed);
+	// readers only trust the layout once the magic is there
+	std::atomic_thread_fence(std::memory_order_release);
+	m_header->magic = SHM_MAGIC;
+	return true;
+}
+
+/** close
+*
+*   Mark the ring closed and remove its name.  Readers keep their
+*   mapping until they close it.
+*
+*   @return void
+*/
+void shm_packet_writer::close() {
+	if (m_map == NULL) {
+		return;
+	}
+	m_header->closed.store(1, std::memory_order_release);
+	munmap(m_map, m_map_size);
+	shm_unlink(m_name.c_str());
+	m_map = NULL;
+	m_header = NULL;
+	m_slots = NULL;
+}
+
+/** reserve
+*
+*   The slot of the next packet, marked as being written.  Readers
+*   still on the packet it held see it change.
+*
+*   @return shm_packet_t*  slot to fill, NULL - no ring
+*/
+shm_packet_t *shm_packet_writer::reserve() {
+	if (m_header == NULL) {
+		return NULL;
+	}
+	shm_slot_t &slot = m_slots[m_next & m_mask];
+
+	slot.sequence.store(2 * m_next + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	return &slot.packet;
+}
+
+/** commit
+*
+*   Publish the packet reserved.
+*
+*   @return void
+*/
+void shm_packet_writer::commit() {
+	if (m_header == NULL) {
+		return;
+	}
+	m_slots[m_next & m_mask].sequence.store(2 * m_next + 2, std::memory_order_release);
+	m_next++;
+	m_header->head.store(m_next, std::memory_order_release);
+}
+
+/** copy report
+*
+*   @param tsip&          decoder
+*   @param int            m_updated bit of the report
+*   @param shm_report_t&  returned report structure
+*   @return bool          false - the report has no structure of its own
+*/
+static bool copy_report(tsip &gps, int bit, union shm_report_t &report) {
+	union tsip::_update_report b;
+
+	b.value = bit;
+	if (b.report.ecef_position_s)			report.ecef_position_s = gps.m_ecef_position_s.report;
+	else if (b.report.ecef_position_d)		report.ecef_position_d = gps.m_ecef_position_d.report;
+	else if (b.report.ecef_velocity)		report.ecef_velocity = gps.m_ecef_velocity.report;
+	else if (b.report.sw_version)			report.sw_version = gps.m_sw_version.report;
+	else if (b.report.single_position)		report.single_position = gps.m_single_position.report;
+	else if (b.report.double_position)		report.double_position = gps.m_double_position.report;
+	else if (b.report.io_options)			report.io_options = gps.m_io_options.report;
+	else if (b.report.enu_velocity)			report.enu_velocity = gps.m_enu_velocity.report;
+	else if (b.report.primary_time)			report.primary_time = gps.m_primary_time.report;
+	else if (b.report.secondary_time)		report.secondary_time = gps.m_secondary_time.report;
+	else if (b.report.utc_gps_time)			report.utc_gps_time = gps.m_utc_gps_time.report;
+	else if (b.report.manufacturing_params)	report.manufacturing_params = gps.m_manufacturing_params.report;
+	else if (b.report.broadcast_mask)		report.broadcast_mask = gps.m_broadcast_mask.report;
+	else if (b.report.port_config)			report.port_config = gps.m_port_config.report;
+	else if (b.report.raw_measurement)		report.raw_measurement = gps.m_raw_measurement.report;
+	else return false;
+	return true;
+}
+
+/** publish
+*
+*   Write the report just decoded by gps into the next slot: its
+*   stamp, its structure and the packet bytes.
+*
+*   @param tsip&  decoder, called from its update of the report
+*   @return bool  false - no ring
+*/
+bool shm_packet_writer::publish(tsip &gps) {
+	shm_packet_t *p = reserve();
+
+	if (p == NULL) {
+		return false;
+	}
+	int bit = tsip::report_bit(gps.m_report.report.code, gps.m_report.extended.subcode);
+	const struct _report_stamp *stamp = gps.get_stamp(bit);
+	if (stamp == NULL || stamp->generation != gps.get_generation()) {
+		// not stored as its type, e.g. a 0x58 other than an almanac
+		union tsip::_update_report unknown;
+		unknown.value = 0;
+		unknown.report.unknown = 1;
+		bit = unknown.value;
+		stamp = gps.get_stamp(bit);
+	}
+	if (stamp != NULL && stamp->generation == gps.get_generation()) {
+		p->stamp = *stamp;
+	} else {
+		// a reply that stamps no report, generation 0
+		memset(&p->stamp, 0, sizeof(p->stamp));
+	}
+	p->bit = bit;
+	p->length = gps.m_report_length;
+	memcpy(p->raw, gps.m_report.raw.data, std::min(gps.m_report_length, SHM_PACKET_MAX));
+	p->decoded = copy_report(gps, bit, p->report);
+	commit();
+	return true;
+}
+
+/** get published
+*
+*   @return unsigned long long  packets published so far
+*/
+unsigned long long shm_packet_writer::get_published() {
+	return m_next;
+}
+
+/** Constructor.
+*/
+shm_packet_reader::shm_packet_reader() {
+	m_map = NULL;
+	m_map_size = 0;
+	m_header = NULL;
+	m_slots = NULL;
+	m_mask = 0;
+	m_cursor = 0;
+	m_peeked = NULL;
+	m_sequence = 0;
+	m_read = 0;
+	m_lost = 0;
+}
+
+/** Destructor.
+*/
+shm_packet_reader::~shm_packet_reader() {
+	close();
+}
+
+/** open
+*
+*   Map a ring read only.  Reading starts with the next packet
+*   published, or with the oldest one still in the ring.
+*
+*   @param string  shared memory name
+*   @param bool    start with the oldest packet kept
+*   @return bool   false - no ring under that name, or of another build
+*/
+bool shm_packet_reader::open(const std::string &name, bool from_oldest) {
+	struct stat st;
+
+	close();
+	int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		perror(name.c_str());
+		return false;
+	}
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(shm_header_t)) {
+		printf("%s is not a packet ring\n", name.c_str());
+		::close(fd);
+		return false;
+	}
+	m_map_size = st.st_size;
+	m_map = mmap(NULL, m_map_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (m_map == MAP_FAILED) {
+		perror(name.c_str());
+		m_map = NULL;
+		return false;
+	}
+
+	const shm_header_t *header = (const shm_header_t *)m_map;
+	bool ok = header->magic == SHM_MAGIC;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	ok = ok && header->version == SHM_VERSION
+			&& header->slot_size == sizeof(shm_slot_t)
+			&& header->slots != 0 && (header->slots & (header->slots - 1)) == 0
+			&& m_map_size >= sizeof(shm_header_t) + (size_t)header->slots * sizeof(shm_slot_t);
+	if (!ok) {
+		printf("%s is not a packet ring of this version\n", name.c_str());
+		munmap(m_map, m_map_size);
+		m_map = NULL;
+		return false;
+	}
+
+	m_header = header;
+	m_slots = (const shm_slot_t *)((const UINT8 *)m_map + sizeof(shm_header_t));
+	m_mask = header->slots - 1;
+	m_cursor = header->head.load(std::memory_order_acquire);
+	if (from_oldest) {
+		m_cursor = (m_cursor > header->slots) ? m_cursor - header->slots : 0;
+	}
+	m_peeked = NULL;
+	m_read = 0;
+	m_lost = 0;
+	return true;
+}
+
+/** close
+*
+*   Leave the ring, the writer is not affected.
+*
+*   @return void
+*/
+void shm_packet_reader::close() {
+	if (m_map != NULL) {
+		munmap(m_map, m_map_size);
+		m_map = NULL;
+	}
+	m_header = NULL;
+	m_slots = NULL;
+	m_peeked = NULL;
+}
+
+/** peek
+*
+*   The next packet, in the ring.  It may be overwritten while it is
+*   used: consume() tells, whatever was taken from it is only good if
+*   consume() returns true.  Packets the writer has lapped are skipped
+*   and counted as lost.
+*
+*   @return shm_packet_t*  next packet, NULL - none published yet
+*/
+const shm_packet_t *shm_packet_reader::peek() {
+	if (m_header == NULL) {
+		return NULL;
+	}
+	for (;;) {
+		unsigned long long head = m_header->head.load(std::memory_order_acquire);
+		if (m_cursor >= head) {
+			m_peeked = NULL;
+			return NULL;
+		}
+		if (head - m_cursor > m_mask + 1) {
+			// more than a ring behind, the oldest packets are gone
+			m_lost += head - (m_mask + 1) - m_cursor;
+			m_cursor = head - (m_mask + 1);
+		}
+
+		const shm_slot_t *slot = &m_slots[m_cursor & m_mask];
+		unsigned long long sequence = slot->sequence.load(std::memory_order_acquire);
+		if (sequence == 2 * m_cursor + 2) {
+			m_peeked = slot;
+			m_sequence = sequence;
+			return &slot->packet;
+		}
+		// being written with a later packet
+		m_lost++;
+		m_cursor++;
+	}
+}
+
+/** consume
+*
+*   Move past the packet peeked.
+*
+*   @return bool  true - the packet was intact all the time it was used
+*/
+bool shm_packet_reader::consume() {
+	if (m_peeked == NULL) {
+		return false;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	bool intact = m_peeked->sequence.load(std::memory_order_relaxed) == m_sequence;
+
+	m_peeked = NULL;
+	m_cursor++;
+	if (intact) {
+		m_read++;
+	} else {
+		m_lost++;
+	}
+	return intact;
+}
+
+/** is closed
+*
+*   The writer closed the ring or its process is gone.  Costs a system
+*   call, call it when peek() keeps returning NULL.
+*
+*   @return bool  true - nothing more will be published, reopen the name
+*/
+bool shm_packet_reader::is_closed() {
+	if (m_header == NULL) {
+		return true;
+	}
+	if (m_header->closed.load(std::memory_order_acquire) != 0) {
+		return true;
+	}
+	return kill(m_header->writer, 0) != 0 && errno == ESRCH;
+}
+
+/** get read
+*
+*   @return unsigned long long  packets consumed intact
+*/
+unsigned long long shm_packet_reader::get_read() {
+	return m_read;
+}
+
+/** get lost
+*
+*   @return unsigned long long  packets overrun by the writer or torn
+*/
+unsigned long long shm_packet_reader::get_lost() {
+	return m_lost;
+}
@@ -0,0 +1,151 @@
+/*
+  tsip_shm.h - decoded reports shared with other processes.
+
+  Only one process can own a receiver's port, yet the archiver, the
+  monitor and the time exporter all want every report.  The owner
+  publishes each report it decodes into a ring of fixed size slots in
+  POSIX shared memory: the packet bytes, the decoded report structure
+  and its stamp.  Any number of readers map the ring read only and
+  follow it with their own cursor, so they join, fall behind and leave
+  without the writer knowing:
+
+    // owner of the port
+    shm_packet_writer writer;
+    writer.create("/tsip-ttyS0");
+    gps.publish(&writer);
+    ...                                   // reactor or encode loop
+
+    // any other process
+    shm_packet_reader reader;
+    reader.open("/tsip-ttyS0");
+    for (;;) {
+        const shm_packet_t *p = reader.peek();
+        if (p == NULL) { sleep a little; continue; }
+        ...                               // use *p in place
+        if (!reader.consume()) ...        // overwritten meanwhile, discard
+    }
+
+  Each slot is a sequence lock: the writer marks it odd, fills it in
+  place and marks it even with the packet number, then moves the head.
+  A reader checks the mark before and after using the slot, nothing is
+  copied and no system call is made on either side once the ring is
+  mapped.  A reader that falls more than a ring behind loses the
+  oldest packets, counted by get_lost(); the writer never waits.
+
+  A report longer than SHM_PACKET_MAX bytes keeps its full length in
+  length and only the first SHM_PACKET_MAX bytes.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _tsip_shm_h
+#define _tsip_shm_h
+
+#include <tsip.h>
+#include <atomic>
+#include <sys/types.h>
+
+#define SHM_DEFAULT_SLOTS		4096	// packets, rounded up to a power of two
+#define SHM_PACKET_MAX			256		// packet bytes kept per slot
+#define SHM_MAGIC				0x54534d52	// "TSMR"
+#define SHM_VERSION				1
+
+// decoded report structure, the member of the report's m_updated bit
+union shm_report_t {
+	struct _ecef_position_s::_0x42		ecef_position_s;
+	struct _ecef_position_d::_0x83		ecef_position_d;
+	struct _ecef_velocity::_0x43		ecef_velocity;
+	struct _sw_version::_0x45			sw_version;
+	struct _single_position::_0x4A		single_position;
+	struct _double_position::_0x84		double_position;
+	struct _io_options::_report			io_options;
+	struct _enu_velocity::_0x56			enu_velocity;
+	struct _primary_time::_0x8FAB		primary_time;
+	struct _secondary_time::_0x8FAC		secondary_time;
+	struct _utc_gps_time::_0x8FA2		utc_gps_time;
+	struct _manufacturing_params::_0x8F41	manufacturing_params;
+	struct _broadcast_mask::_0x8FA5		broadcast_mask;
+	struct _port_config::_0xBC			port_config;
+	struct _raw_measurement::_0x5A		raw_measurement;
+};
+
+// one report, as published
+struct shm_packet_t {
+	struct _report_stamp stamp;		// generation and host time of the report
+	int   bit;						// m_updated bit, tsip::report_bit
+	bool  decoded;					// report holds the structure, else see raw
+	int   length;					// packet bytes, code first, no DLE stuffing
+	union shm_report_t report;
+	UINT8 raw[SHM_PACKET_MAX];
+};
+
+// layout of the shared memory
+struct shm_slot_t {
+	// 2n + 1 while packet n is written, 2n + 2 once it is complete
+	alignas(64) std::atomic<unsigned long long> sequence;
+	shm_packet_t packet;
+};
+
+struct shm_header_t {
+	UINT32 magic;					// SHM_MAGIC once the ring is set up
+	UINT32 version;
+	UINT32 slot_size;				// sizeof(shm_slot_t), readers of another build refuse
+	UINT32 slots;
+	pid_t  writer;
+	std::atomic<UINT32> closed;		// the writer closed the ring
+	alignas(64) std::atomic<unsigned long long> head;	// packets published
+};
+
+// owner of the port, creates the ring and publishes into it
+class shm_packet_writer {
+	public:
+		shm_packet_writer(void);
+		~shm_packet_writer(void);
+		bool create(const std::string &name, size_t slots=SHM_DEFAULT_SLOTS);
+		void close(void);				// readers see is_closed(), the name is removed
+		shm_packet_t *reserve(void);	// slot of the next packet, NULL - no ring
+		void commit(void);				// publish the packet reserved
+		bool publish(tsip &gps);		// the report just decoded, see tsip::publish
+		unsigned long long get_published(void);
+
+	private:
+		std::string m_name;
+		void *m_map;
+		size_t m_map_size;
+		shm_header_t *m_header;
+		shm_slot_t *m_slots;
+		size_t m_mask;
+		unsigned long long m_next;		// packet reserved or to reserve
+};
+
+// follows a ring with its own cursor, read only
+class shm_packet_reader {
+	public:
+		shm_packet_reader(void);
+		~shm_packet_reader(void);
+		bool open(const std::string &name, bool from_oldest=false);
+		void close(void);
+		const shm_packet_t *peek(void);	// next packet in place, NULL - none yet
+		bool consume(void);				// false - overwritten while it was used
+		bool is_closed(void);			// the writer is gone
+		unsigned long long get_read(void);	// packets consumed intact
+		unsigned long long get_lost(void);	// overrun or torn
+
+	private:
+		void *m_map;
+		size_t m_map_size;
+		const shm_header_t *m_header;
+		const shm_slot_t *m_slots;
+		size_t m_mask;
+		unsigned long long m_cursor;	// next packet to read
+		const shm_slot_t *m_peeked;		// slot returned by peek, NULL - none
+		unsigned long long m_sequence;	// its mark when peeked
+		unsigned long long m_read;
+		unsigned long long m_lost;
+};
+
+#endif
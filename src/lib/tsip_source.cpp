@@ -0,0 +1,232 @@
+/**
+ *	@file tsip_source.cpp
+ * 	@brief byte sources and fault injection for the packet decoder
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ * Usage:
+ * @code
+ * 	fd_source port(gps.get_port_fd());
+ * 	fault_source::profile_t profile = { 1e-4, 0, 0, 0, 64 };
+ * 	fault_source noisy(port, profile, 1);
+ * 	UINT8 buffer[256];
+ * 	int n;
+ *
+ * 	while ((n = noisy.read(buffer, sizeof(buffer))) > 0) {
+ * 		gps.encode(buffer, n, on_report, NULL);
+ * 	}
+ * @endcode
+ *
+ */
+
+#include "tsip_source.h"
+#include <cerrno>
+
+#define FAULT_READ_SIZE	4096		// bytes read from the wrapped source at once
+
+/** Constructor.
+*
+* 	@param int  open file descriptor, not closed
+*/
+fd_source::fd_source(int fd) {
+	m_fd = fd;
+}
+
+/** read
+*
+*   Blocks as read(2) does on the descriptor.
+*
+*   @return int  bytes, 0 - end of file, -1 - error
+*/
+int fd_source::read(UINT8 *buffer, int len) {
+	for (;;) {
+		ssize_t n = ::read(m_fd, buffer, len);
+		if (n >= 0) {
+			return n;
+		}
+		if (errno != EINTR) {
+			return -1;
+		}
+	}
+}
+
+/** Constructor.
+*
+* 	@param UINT8*  bytes, must outlive the source
+* 	@param size_t  number of bytes
+*/
+memory_source::memory_source(const UINT8 *data, size_t len) {
+	m_data = data;
+	m_len = len;
+	m_pos = 0;
+}
+
+/** read
+*
+*   @return int  bytes, 0 - all the bytes were read
+*/
+int memory_source::read(UINT8 *buffer, int len) {
+	size_t n = std::min((size_t)len, m_len - m_pos);
+
+	memcpy(buffer, m_data + m_pos, n);
+	m_pos += n;
+	return n;
+}
+
+/** rewind
+*
+*   Start again at the first byte.
+*
+*   @return void
+*/
+void memory_source::rewind() {
+	m_pos = 0;
+}
+
+/** Constructor.
+*
+* 	@param byte_source&  source to damage, must outlive this one
+* 	@param profile_t&    fault rates
+* 	@param unsigned long seed, the same seed gives the same faults
+*/
+fault_source::fault_source(byte_source &source, const profile_t &profile, unsigned long seed)
+	: m_source(source), m_profile(profile), m_random(seed) {
+	m_bit_flip = threshold(profile.bit_flip);
+	m_drop = threshold(profile.drop);
+	m_dup_dle = threshold(profile.dup_dle);
+	m_truncate = threshold(profile.truncate);
+	m_input_pos = 0;
+	m_truncating = false;
+	m_last_dle = false;
+	m_end = false;
+	m_failed = false;
+	m_pending_len = 0;
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+/** threshold
+*
+*   @param double              probability 0..1
+*   @return unsigned long long m_random() values below it are a fault
+*/
+unsigned long long fault_source::threshold(double probability) {
+	if (probability <= 0) {
+		return 0;
+	}
+	if (probability >= 1) {
+		return ~0ULL;
+	}
+	return (unsigned long long)(probability * 18446744073709551616.0);
+}
+
+/** happens
+*
+*   @return bool  true - inject the fault
+*/
+bool fault_source::happens(unsigned long long threshold) {
+	return threshold != 0 && m_random() < threshold;
+}
+
+/** fill
+*
+*   Read the next block of the wrapped source.
+*
+*   @return bool  false - the source is at its end
+*/
+bool fault_source::fill() {
+	if (m_end) {
+		return false;
+	}
+	m_input.resize(FAULT_READ_SIZE);
+	int n = m_source.read(&m_input[0], FAULT_READ_SIZE);
+	if (n <= 0) {
+		m_input.clear();
+		m_end = true;
+		m_failed = (n < 0);
+		return false;
+	}
+	m_input.resize(n);
+	m_input_pos = 0;
+	m_stats.bytes += n;
+	return true;
+}
+
+/** read
+*
+*   Pass the bytes of the wrapped source on, damaged by the profile.
+*   With burst_max set the size of each read is random, as the bytes
+*   of a USB serial adapter arrive.
+*
+*   @return int  bytes, 0 - end of the stream, -1 - error
+*/
+int fault_source::read(UINT8 *buffer, int len) {
+	int want = len;
+	int n = 0;
+
+	if (m_profile.burst_max > 0) {
+		want = std::min(len, 1 + (int)(m_random() % m_profile.burst_max));
+	}
+
+	while (n < want) {
+		if (m_pending_len > 0) {
+			buffer[n++] = m_pending[--m_pending_len];
+			continue;
+		}
+		if (m_input_pos >= m_input.size() && !fill()) {
+			break;
+		}
+		UINT8 c = m_input[m_input_pos++];
+
+		if (m_truncating) {
+			// keep the DLE ETX so the next packet is intact
+			if (m_last_dle && c == ETX) {
+				m_truncating = false;
+				m_stats.truncated--;
+				m_pending[1] = DLE;
+				m_pending[0] = ETX;
+				m_pending_len = 2;
+			} else {
+				m_stats.truncated++;
+				m_last_dle = (c == DLE && !m_last_dle);
+			}
+			continue;
+		}
+		if (happens(m_truncate)) {
+			m_stats.truncations++;
+			m_stats.truncated++;
+			m_truncating = true;
+			m_last_dle = (c == DLE);
+			continue;
+		}
+		if (happens(m_drop)) {
+			m_stats.drops++;
+			continue;
+		}
+		if (happens(m_bit_flip)) {
+			m_stats.bit_flips++;
+			c ^= (UINT8)(1 << (m_random() % 8));
+		}
+		buffer[n++] = c;
+		if (c == DLE && happens(m_dup_dle)) {
+			m_stats.dup_dles++;
+			m_pending[0] = DLE;
+			m_pending_len = 1;
+		}
+	}
+	if (n == 0 && m_failed) {
+		return -1;
+	}
+	return n;
+}
+
+/** get stats
+*
+*   @param stats_t&  faults injected so far
+*   @return void
+*/
+void fault_source::get_stats(stats_t &stats) {
+	stats = m_stats;
+}
@@ -0,0 +1,114 @@
+/*
+  tsip_source.h - byte sources for the TSIP packet decoder.
+
+  A byte_source hands out the bytes the decoder is fed, from a port, a
+  buffer or another source.  fault_source wraps any source and damages
+  the stream the way a noisy serial link does: flipped bits, dropped
+  bytes, duplicated DLEs, truncated packets and reads of random size.
+  The faults come from a seeded generator, so a run is repeated exactly
+  with the same seed.
+
+    memory_source clean(stream.data(), stream.size());
+    fault_source::profile_t profile = { 1e-4, 1e-4, 0, 0, 0 };
+    fault_source noisy(clean, profile, 42);
+    UINT8 buffer[4096];
+    int n;
+
+    while ((n = noisy.read(buffer, sizeof(buffer))) > 0) {
+        gps.encode(buffer, n, handler, ctx);
+    }
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _tsip_source_h
+#define _tsip_source_h
+
+#include <tsip.h>
+#include <random>
+#include <vector>
+
+class byte_source {
+	public:
+		virtual ~byte_source(void) {}
+		// up to len bytes, 0 - end of the stream, -1 - error
+		virtual int read(UINT8 *buffer, int len) = 0;
+};
+
+// open file descriptor, tsip::get_port_fd() or a capture file
+class fd_source : public byte_source {
+	public:
+		fd_source(int fd);
+		int read(UINT8 *buffer, int len);
+
+	private:
+		int m_fd;
+};
+
+// bytes in memory, not copied
+class memory_source : public byte_source {
+	public:
+		memory_source(const UINT8 *data, size_t len);
+		int read(UINT8 *buffer, int len);
+		void rewind(void);
+
+	private:
+		const UINT8 *m_data;
+		size_t m_len;
+		size_t m_pos;
+};
+
+class fault_source : public byte_source {
+	public:
+		// probabilities per byte read from the wrapped source
+		struct profile_t {
+			double bit_flip;		// one bit of the byte inverted
+			double drop;			// byte lost
+			double dup_dle;			// a DLE sent twice, per DLE
+			double truncate;		// rest of the packet lost, up to its DLE ETX
+			int    burst_max;		// reads return 1..burst_max bytes, 0 - as many as asked
+		};
+
+		// faults injected so far
+		struct stats_t {
+			unsigned long bytes;	// read from the wrapped source
+			unsigned long bit_flips;
+			unsigned long drops;
+			unsigned long dup_dles;
+			unsigned long truncations;
+			unsigned long truncated;	// bytes lost to truncations
+		};
+
+		fault_source(byte_source &source, const profile_t &profile, unsigned long seed);
+		int read(UINT8 *buffer, int len);
+		void get_stats(stats_t &stats);
+
+	private:
+		byte_source &m_source;
+		profile_t m_profile;
+		std::mt19937_64 m_random;
+		// thresholds of m_random() for each fault
+		unsigned long long m_bit_flip;
+		unsigned long long m_drop;
+		unsigned long long m_dup_dle;
+		unsigned long long m_truncate;
+		std::vector<UINT8> m_input;		// read from the source, not yet passed on
+		size_t m_input_pos;
+		UINT8 m_pending[2];				// bytes to pass on first, last one first
+		int m_pending_len;
+		bool m_truncating;				// dropping up to the next DLE ETX
+		bool m_last_dle;				// previous byte dropped is an unpaired DLE
+		bool m_end;						// the source is at its end
+		bool m_failed;					// the source returned an error
+		stats_t m_stats;
+
+		bool fill(void);
+		bool happens(unsigned long long threshold);
+		static unsigned long long threshold(double probability);
+};
+
+#endif
@@ -0,0 +1,475 @@
+/**
+ *	@file tsip_uring.cpp
+ * 	@brief io_uring backend of tsip_reactor, raw system calls
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  Used through tsip_reactor, which picks this backend when the kernel
+ *  supports it.
+ *
+ */
+
+#include "tsip_uring.h"
+#include "tsip_reactor.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+typedef unsigned long long UINT64;
+
+#define URING_ENTRIES	(2*TSIP_URING_MAX_PORTS)
+
+// user_data: kind in the top byte, generation, slot in the low 16 bits
+#define URING_READ		0ULL
+#define URING_WAKEUP	1ULL
+#define URING_CANCEL	2ULL
+#define URING_TAG(kind, gen, slot)	(((kind) << 56) | ((UINT64)(gen) << 16) | (UINT64)(slot))
+#define URING_KIND(tag)				((tag) >> 56)
+#define URING_GEN(tag)				((UINT32)(((tag) >> 16) & 0xffffffffULL))
+#define URING_SLOT(tag)				((int)((tag) & 0xffff))
+
+/** Constructor.
+*
+*	Set up the ring and register the read buffers.  Check is_ready().
+*/
+tsip_uring::tsip_uring() {
+	m_ring = -1;
+	m_wakeup = -1;
+	m_sq_ptr = MAP_FAILED;
+	m_cq_ptr = MAP_FAILED;
+	m_sqes = (struct io_uring_sqe *)MAP_FAILED;
+	m_buffers = NULL;
+	m_slots.resize(TSIP_URING_MAX_PORTS);
+	for (size_t i=0; i<m_slots.size(); i++) {
+		m_slots[i].decoder = NULL;
+		m_slots[i].generation = 0;
+		m_slots[i].armed = false;
+		m_slots[i].removed = false;
+	}
+
+	if (!setup()) {
+		release();
+	}
+}
+
+/** Destructor.
+*
+*	Closing the ring cancels the reads in flight.  The receivers belong
+*	to the caller.
+*/
+tsip_uring::~tsip_uring() {
+	release();
+}
+
+/** is ready
+*
+*   @return bool true - the ring is usable
+*/
+bool tsip_uring::is_ready() {
+	return (m_ring >= 0);
+}
+
+/** set up ring
+*
+*   Create the ring, map the queues, register the buffers and arm the
+*   wakeup read.  Failures are silent, the caller falls back to epoll.
+*
+*   @return bool true - success
+*/
+bool tsip_uring::setup() {
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	m_ring = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (m_ring < 0) {
+		return false;
+	}
+	// the timed wait needs IORING_ENTER_EXT_ARG
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		return false;
+	}
+
+	m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+	}
+	m_sq_ptr = mmap(NULL, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			m_ring, IORING_OFF_SQ_RING);
+	if (m_sq_ptr == MAP_FAILED) {
+		return false;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		m_cq_ptr = m_sq_ptr;
+	} else {
+		m_cq_ptr = mmap(NULL, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				m_ring, IORING_OFF_CQ_RING);
+		if (m_cq_ptr == MAP_FAILED) {
+			return false;
+		}
+	}
+	m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	m_sqes = (struct io_uring_sqe *)mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+	if (m_sqes == MAP_FAILED) {
+		return false;
+	}
+
+	char *sq = (char *)m_sq_ptr;
+	m_sq_head = (unsigned *)(sq + p.sq_off.head);
+	m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	m_sq_array = (unsigned *)(sq + p.sq_off.array);
+	char *cq = (char *)m_cq_ptr;
+	m_cq_head = (unsigned *)(cq + p.cq_off.head);
+	m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	// one buffer per slot, registered once
+	void *mem = mmap(NULL, TSIP_URING_MAX_PORTS * TSIP_URING_BUFFER, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		return false;
+	}
+	m_buffers = (UINT8 *)mem;
+
+	std::vector<struct iovec> iov(TSIP_URING_MAX_PORTS);
+	for (int i=0; i<TSIP_URING_MAX_PORTS; i++) {
+		iov[i].iov_base = m_buffers + i * TSIP_URING_BUFFER;
+		iov[i].iov_len = TSIP_URING_BUFFER;
+	}
+	if (syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_BUFFERS,
+			iov.data(), TSIP_URING_MAX_PORTS) != 0) {
+		return false;
+	}
+
+	m_wakeup = eventfd(0, EFD_CLOEXEC);
+	if (m_wakeup < 0) {
+		return false;
+	}
+	arm_wakeup();
+	return true;
+}
+
+/** release ring
+*
+*   @return void
+*/
+void tsip_uring::release() {
+	if (m_ring >= 0) {
+		close(m_ring);
+		m_ring = -1;
+	}
+	if (m_wakeup >= 0) {
+		close(m_wakeup);
+		m_wakeup = -1;
+	}
+	if (m_sqes != MAP_FAILED) {
+		munmap(m_sqes, m_sqes_size);
+		m_sqes = (struct io_uring_sqe *)MAP_FAILED;
+	}
+	if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr) {
+		munmap(m_cq_ptr, m_cq_size);
+	}
+	m_cq_ptr = MAP_FAILED;
+	if (m_sq_ptr != MAP_FAILED) {
+		munmap(m_sq_ptr, m_sq_size);
+		m_sq_ptr = MAP_FAILED;
+	}
+	if (m_buffers != NULL) {
+		munmap(m_buffers, TSIP_URING_MAX_PORTS * TSIP_URING_BUFFER);
+		m_buffers = NULL;
+	}
+}
+
+/** add receiver
+*
+*   Register an open receiver in a free slot and arm its first read.
+*   The port is switched back to blocking mode: io_uring waits for a
+*   blocking tty by polling it internally, a non-blocking one would
+*   complete every read with EAGAIN.
+*
+*   @param frame_decoder&       receiver, must outlive the registration
+*   @param frame_handler        called for each report, NULL - report_handler
+*   @param tsip_report_handler  called for each report of a tsip
+*   @param void*                passed to the handler
+*   @return bool  true - registered
+*/
+bool tsip_uring::add(frame_decoder &decoder, frame_handler handler,
+		tsip_report_handler report_handler, void *ctx) {
+	int fd = decoder.get_port_fd();
+
+	if (fd < 0 || m_ring < 0) {
+		printf("%s is not open\n", decoder.get_gps_port().c_str());
+		return false;
+	}
+	for (size_t i=0; i<m_slots.size(); i++) {
+		entry_t &e = m_slots[i];
+		if (e.decoder != NULL || e.armed) {
+			continue;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+		e.decoder = &decoder;
+		e.fd = fd;
+		e.handler = handler;
+		e.report_handler = report_handler;
+		e.ctx = ctx;
+		e.generation++;
+		e.removed = false;
+		arm_read(i);
+		return true;
+	}
+	printf("%s: more than %d receivers\n", decoder.get_gps_port().c_str(), TSIP_URING_MAX_PORTS);
+	return false;
+}
+
+/** remove receiver
+*
+*   The read in flight is cancelled; its buffer slot is reused once the
+*   cancellation completes.
+*
+*   @param frame_decoder&  receiver
+*   @return bool  true - was registered
+*/
+bool tsip_uring::remove(frame_decoder &decoder) {
+	for (size_t i=0; i<m_slots.size(); i++) {
+		if (m_slots[i].decoder == &decoder && !m_slots[i].removed) {
+			drop(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+/** size
+*
+*   @return size_t  registered receivers
+*/
+size_t tsip_uring::size() {
+	size_t n = 0;
+
+	for (size_t i=0; i<m_slots.size(); i++) {
+		if (m_slots[i].decoder != NULL && !m_slots[i].removed) {
+			n++;
+		}
+	}
+	return n;
+}
+
+/** poll
+*
+*   Submit the queued reads and wait up to timeout_ms (-1 for no
+*   limit) for completions, then decode every completed read and
+*   queue its re-arm for the next pass.
+*
+*   @param int  timeout in milliseconds
+*   @return int reports decoded, -1 on error
+*/
+int tsip_uring::poll(int timeout_ms) {
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	tsip_reactor::counter_t counter;
+
+	memset(&arg, 0, sizeof(arg));
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+		arg.ts = (UINT64)&ts;
+	}
+	if (enter(IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) < 0
+			&& errno != ETIME && errno != EINTR && errno != EBUSY) {
+		perror("tsip_uring io_uring_enter");
+		return -1;
+	}
+
+	counter.reports = 0;
+	unsigned head = *m_cq_head;
+	unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &m_cqes[head & *m_cq_mask];
+		UINT64 tag = cqe->user_data;
+		int res = cqe->res;
+
+		if (URING_KIND(tag) == URING_WAKEUP) {
+			arm_wakeup();
+			continue;
+		}
+		if (URING_KIND(tag) != URING_READ) {
+			continue;
+		}
+
+		int slot = URING_SLOT(tag);
+		entry_t &e = m_slots[slot];
+		if (URING_GEN(tag) != e.generation) {
+			continue;
+		}
+		e.armed = false;
+		if (e.removed) {
+			// cancelled read completed, the slot is free
+			e.decoder = NULL;
+			e.removed = false;
+			continue;
+		}
+
+		if (res > 0) {
+			counter.handler = e.handler;
+			counter.report_handler = e.report_handler;
+			counter.ctx = e.ctx;
+			counter.keep = true;
+			e.decoder->decode(m_buffers + slot * TSIP_URING_BUFFER, res,
+					tsip_reactor::count_report, &counter);
+			if (e.decoder == NULL || e.removed) {
+				// removed by the handler
+				continue;
+			}
+			if (!counter.keep) {
+				drop(slot);
+			} else {
+				arm_read(slot);
+			}
+		} else if (res == -EINTR || res == -EAGAIN) {
+			arm_read(slot);
+		} else {
+			if (res == 0) {
+				printf("%s closed\n", e.decoder->get_gps_port().c_str());
+			} else {
+				printf("%s: %s\n", e.decoder->get_gps_port().c_str(), strerror(-res));
+			}
+			drop(slot);
+		}
+	}
+	__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+	return counter.reports;
+}
+
+/** wakeup
+*
+*   Make a waiting poll() return.  Safe from any thread.
+*
+*   @return void
+*/
+void tsip_uring::wakeup() {
+	UINT64 one = 1;
+
+	if (m_wakeup >= 0 && write(m_wakeup, &one, sizeof(one)) < 0) {
+		perror("tsip_uring eventfd");
+	}
+}
+
+/** get submission entry
+*
+*   Reserve the next submission queue entry, submitting the queue first
+*   when it is full.
+*
+*   @return io_uring_sqe*  cleared entry
+*/
+struct io_uring_sqe *tsip_uring::get_sqe() {
+	unsigned tail = *m_sq_tail;
+
+	while (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) > *m_sq_mask) {
+		if (enter(0, NULL, 0) < 0 && errno != EINTR && errno != EBUSY) {
+			perror("tsip_uring io_uring_enter");
+			break;
+		}
+	}
+
+	unsigned index = tail & *m_sq_mask;
+	struct io_uring_sqe *sqe = &m_sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	m_sq_array[index] = index;
+	// the kernel reads the entry on the next io_uring_enter
+	__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+/** enter ring
+*
+*   Submit every queued entry, optionally waiting for completions.
+*
+*   @return int io_uring_enter result
+*/
+int tsip_uring::enter(unsigned flags, void *arg, size_t arg_size) {
+	unsigned pending = *m_sq_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+	unsigned wait = (flags & IORING_ENTER_GETEVENTS) ? 1 : 0;
+
+	return syscall(__NR_io_uring_enter, m_ring, pending, wait, flags, arg, arg_size);
+}
+
+/** arm read
+*
+*   Queue a fixed buffer read on the receiver's port.
+*
+*   @return void
+*/
+void tsip_uring::arm_read(int slot) {
+	entry_t &e = m_slots[slot];
+	struct io_uring_sqe *sqe = get_sqe();
+
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->fd = e.fd;
+	sqe->off = (UINT64)-1;					// current position, ttys ignore it
+	sqe->addr = (UINT64)(m_buffers + slot * TSIP_URING_BUFFER);
+	sqe->len = TSIP_URING_BUFFER;
+	sqe->buf_index = slot;
+	sqe->user_data = URING_TAG(URING_READ, e.generation, slot);
+	e.armed = true;
+}
+
+/** arm wakeup
+*
+*   Queue a read of the wakeup eventfd.
+*
+*   @return void
+*/
+void tsip_uring::arm_wakeup() {
+	struct io_uring_sqe *sqe = get_sqe();
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = m_wakeup;
+	sqe->off = (UINT64)-1;
+	sqe->addr = (UINT64)&m_wakeup_value;
+	sqe->len = sizeof(m_wakeup_value);
+	sqe->user_data = URING_TAG(URING_WAKEUP, 0, 0);
+}
+
+/** cancel read
+*
+*   @return void
+*/
+void tsip_uring::cancel(int slot) {
+	struct io_uring_sqe *sqe = get_sqe();
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = URING_TAG(URING_READ, m_slots[slot].generation, slot);
+	sqe->user_data = URING_TAG(URING_CANCEL, 0, slot);
+}
+
+/** drop slot
+*
+*   Unregister the receiver.  A slot with a read in flight is freed
+*   when the cancelled read completes.
+*
+*   @return void
+*/
+void tsip_uring::drop(int slot) {
+	entry_t &e = m_slots[slot];
+
+	if (e.armed) {
+		e.removed = true;
+		cancel(slot);
+	} else {
+		e.decoder = NULL;
+		e.removed = false;
+	}
+}
@@ -0,0 +1,94 @@
+/*
+  tsip_uring.h - io_uring backend of tsip_reactor.
+
+  One read is kept in flight per receiver, into a buffer registered
+  with the ring once (IORING_OP_READ_FIXED), so the kernel does not map
+  the buffer per read.  Completions are fed straight to the receiver's
+  block decoder, tsip or nmea, and the read is re-armed.  Re-arms are
+  submitted in the same io_uring_enter call that waits for the next
+  completions, so a pass over any number of ready ports costs one
+  system call.
+
+  Uses the raw system calls, liburing is not needed.  Kernels without
+  io_uring, or without IORING_FEAT_EXT_ARG (5.11), are reported by
+  is_ready() and tsip_reactor falls back to epoll.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+*/
+
+#ifndef _tsip_uring_h
+#define _tsip_uring_h
+
+#include <tsip.h>
+#include <vector>
+
+#define TSIP_URING_MAX_PORTS	256		// registered buffers
+#define TSIP_URING_BUFFER		4096	// bytes per registered buffer
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+class tsip_uring {
+	public:
+		tsip_uring(void);
+		~tsip_uring(void);
+		bool is_ready(void);
+		bool add(frame_decoder &decoder, frame_handler handler,
+				tsip_report_handler report_handler, void *ctx);
+		bool remove(frame_decoder &decoder);
+		size_t size(void);
+		int poll(int timeout_ms);		// one pass, returns reports decoded
+		void wakeup(void);				// make a waiting poll() return
+
+	private:
+		struct entry_t {
+			frame_decoder *decoder;		// NULL when the slot is free
+			int fd;
+			frame_handler handler;
+			tsip_report_handler report_handler;	// added as a tsip, handler is NULL
+			void *ctx;
+			UINT32 generation;			// tags the reads of this use of the slot
+			bool armed;					// a read is in flight
+			bool removed;				// cancelled, slot freed on completion
+		};
+
+		int m_ring;						// io_uring fd, -1 when not usable
+		int m_wakeup;					// eventfd read through the ring
+		unsigned long long m_wakeup_value;
+
+		// submission queue
+		void *m_sq_ptr;
+		size_t m_sq_size;
+		unsigned *m_sq_head;
+		unsigned *m_sq_tail;
+		unsigned *m_sq_mask;
+		unsigned *m_sq_array;
+		struct io_uring_sqe *m_sqes;
+		size_t m_sqes_size;
+
+		// completion queue
+		void *m_cq_ptr;
+		size_t m_cq_size;
+		unsigned *m_cq_head;
+		unsigned *m_cq_tail;
+		unsigned *m_cq_mask;
+		struct io_uring_cqe *m_cqes;
+
+		UINT8 *m_buffers;				// TSIP_URING_MAX_PORTS registered buffers
+		std::vector<entry_t> m_slots;
+
+		bool setup(void);
+		void release(void);
+		struct io_uring_sqe *get_sqe(void);
+		int enter(unsigned flags, void *arg, size_t arg_size);
+		void arm_read(int slot);
+		void arm_wakeup(void);
+		void cancel(int slot);
+		void drop(int slot);
+};
+
+#endif